@@ -9,19 +9,44 @@
 #include "drivers/clock.hh"
 #include "exceptions.hh"
 #include "apic.hh"
+#include "msr.hh"
+#include "cpuid.hh"
+#include <osv/percpu.hh>
+#include <atomic>
 
 using namespace processor;
 
+// In tsc-deadline mode the timer fires when the tsc reaches the value
+// written to IA32_TSC_DEADLINE, so there is no counter to overflow and
+// no divide register to calibrate.  We need the tsc rate to convert
+// nanoseconds to tsc cycles, which we measure against the clock over the
+// first few hundred milliseconds of uptime; until then (and on processors
+// without tsc-deadline support) the one-shot counter is used.
 class apic_clock_events : public clock_event_driver {
 public:
     explicit apic_clock_events();
     ~apic_clock_events();
     virtual void setup_on_cpu();
     virtual void set(u64 time);
+private:
+    void set_oneshot(u64 delta);
+    void set_deadline(u64 delta);
+    void calibrate();
 private:
     unsigned _vector;
+    // tsc cycles per nanosecond, as a 32.32 fixed-point number; 0 until
+    // calibrated
+    std::atomic<u64> _tsc_per_ns = { 0 };
+    u64 _calibration_tsc = 0;
+    s64 _calibration_ns = 0;
+    static PERCPU(bool, _deadline_mode);
 };
 
+PERCPU(bool, apic_clock_events::_deadline_mode);
+
+constexpr s64 calibration_period = 200000000; // 200ms
+constexpr unsigned lvtt_tsc_deadline = 2 << 17;
+
 apic_clock_events::apic_clock_events()
     : _vector(idt.register_handler([this] { _callback->fired(); }))
 {
@@ -43,10 +68,64 @@ void apic_clock_events::set(u64 time)
     u64 now = clock::get()->time();
     if (time <= now) {
         _callback->fired();
+        return;
+    }
+    if (!*_deadline_mode && features().tsc_deadline) {
+        if (!_tsc_per_ns.load(std::memory_order_acquire)) {
+            calibrate();
+        }
+        if (_tsc_per_ns.load(std::memory_order_acquire)) {
+            // Switching modes disarms the one-shot counter, so this must
+            // only be done when we are about to set a deadline.
+            processor::apic->write(apicreg::LVTT, _vector | lvtt_tsc_deadline);
+            *_deadline_mode = true;
+        }
+    }
+    if (*_deadline_mode) {
+        set_deadline(time - now);
     } else {
-        // FIXME: handle overflow
-        apic->write(apicreg::TMICT, time - now);
+        set_oneshot(time - now);
+    }
+}
+
+void apic_clock_events::set_oneshot(u64 delta)
+{
+    // The initial count register is 32 bits wide; if the delta is too
+    // large, fire early and let the timer list reprogram us.
+    apic->write(apicreg::TMICT, std::min<u64>(delta, 0xffffffff));
+}
+
+void apic_clock_events::set_deadline(u64 delta)
+{
+    auto cycles = (__uint128_t(delta) * _tsc_per_ns.load(std::memory_order_relaxed)) >> 32;
+    // A deadline of 0 disarms the timer, so make sure we never write it.
+    wrmsr(msr::IA32_TSC_DEADLINE, rdtsc() + cycles + 1);
+}
+
+// Called on every set() until calibration completes; only cpu 0 samples,
+// so no locking is needed.  Requires a running clock, and uptime() is 0
+// until the clock is fully initialized.
+void apic_clock_events::calibrate()
+{
+    if (sched::cpu::current()->id != 0) {
+        return;
+    }
+    auto ns = clock::get()->uptime();
+    auto tsc = rdtsc();
+    if (!ns) {
+        return;
+    }
+    if (!_calibration_ns) {
+        _calibration_ns = ns;
+        _calibration_tsc = tsc;
+        return;
+    }
+    auto elapsed = ns - _calibration_ns;
+    if (elapsed < calibration_period) {
+        return;
     }
+    auto rate = (__uint128_t(tsc - _calibration_tsc) << 32) / elapsed;
+    _tsc_per_ns.store(rate, std::memory_order_release);
 }
 
 void __attribute__((constructor)) init_apic_clock()
@@ -28,6 +28,91 @@ inline void arch_cpu::exit_exception()
     in_exception = false;
 }
 
+u64 xsave_components()
+{
+    static u64 components = [] {
+        using namespace processor;
+        if (!features().xsave) {
+            return u64(0);
+        }
+        auto supported = cpuid(0xd, 0).a;
+        u64 c = xcr0_x87 | xcr0_sse;
+        if (features().avx && (supported & xcr0_avx)) {
+            c |= xcr0_avx;
+            auto avx512 = xcr0_opmask | xcr0_zmm_hi256 | xcr0_hi16_zmm;
+            if (features().avx512f && (supported & avx512) == avx512) {
+                c |= avx512;
+            }
+        }
+        return c;
+    }();
+    return components;
+}
+
+void fpu_save_fxsave(processor::fpu_state* s)
+{
+    processor::fxsave(s);
+}
+
+void fpu_restore_fxrstor(processor::fpu_state* s)
+{
+    processor::fxrstor(s);
+}
+
+void fpu_save_xsave(processor::fpu_state* s)
+{
+    processor::xsave(s, xsave_components());
+}
+
+void fpu_save_xsaveopt(processor::fpu_state* s)
+{
+    processor::xsaveopt(s, xsave_components());
+}
+
+void fpu_restore_xrstor(processor::fpu_state* s)
+{
+    processor::xrstor(s, xsave_components());
+}
+
+extern "C"
+void (*resolve_fpu_save(void))(processor::fpu_state* s)
+{
+    if (processor::features().xsaveopt) {
+        return fpu_save_xsaveopt;
+    } else if (processor::features().xsave) {
+        return fpu_save_xsave;
+    } else {
+        return fpu_save_fxsave;
+    }
+}
+
+extern "C"
+void (*resolve_fpu_save_full(void))(processor::fpu_state* s)
+{
+    if (processor::features().xsave) {
+        return fpu_save_xsave;
+    } else {
+        return fpu_save_fxsave;
+    }
+}
+
+extern "C"
+void (*resolve_fpu_restore(void))(processor::fpu_state* s)
+{
+    if (processor::features().xsave) {
+        return fpu_restore_xrstor;
+    } else {
+        return fpu_restore_fxrstor;
+    }
+}
+
+void fpu_save(processor::fpu_state* s)
+    __attribute__((ifunc("resolve_fpu_save")));
+void fpu_save_full(processor::fpu_state* s)
+    __attribute__((ifunc("resolve_fpu_save_full")));
+void fpu_restore(processor::fpu_state* s)
+    __attribute__((ifunc("resolve_fpu_restore")));
+
 exception_guard::exception_guard()
 {
     sched::cpu::current()->arch.enter_exception();
@@ -58,26 +58,58 @@ struct arch_thread {
 };
 
 
+// Extended state components (XCR0 bits) enabled on every cpu and saved
+// across preemption.  Zero if the processor lacks xsave.
+u64 xsave_components();
+
+// Resolved at boot to fxsave/fxrstor, xsave/xrstor or xsaveopt/xrstor.
+// xsaveopt skips components that are in their initial state or were not
+// modified since the last xrstor from the same area, so a thread that
+// never touched the AVX registers pays only for the legacy SSE state.
+// That leaves whatever the area held before in place of the skipped
+// components, so fpu_save_full() (xsave or fxsave) is for areas that
+// don't hold the previous save of the same state, such as signal frames.
+void fpu_save(processor::fpu_state* s);
+void fpu_save_full(processor::fpu_state* s);
+void fpu_restore(processor::fpu_state* s);
+
 template <class T>
 struct save_fpu {
     T state;
-    // FIXME: xsave and friends
     typedef processor::fpu_state fpu_state;
-    void save() { processor::fxsave(state.addr()); }
-    void restore() { processor::fxrstor(state.addr()); }
+    void save() {
+        if (T::long_lived) {
+            fpu_save(state.addr());
+        } else {
+            fpu_save_full(state.addr());
+        }
+    }
+    void restore() { fpu_restore(state.addr()); }
 };
 
+// A page is large enough for the biggest xsave area we enable (and its
+// alignment satisfies xsave's 64-byte requirement).
+// A thread's own save area, which every save overwrites with the same
+// thread's state, so xsaveopt can be used
 struct fpu_state_alloc_page {
+    static constexpr bool long_lived = true;
     processor::fpu_state* s =
             static_cast<processor::fpu_state*>(memory::alloc_page());
+    fpu_state_alloc_page() { processor::xsave_header_init(s); }
     processor::fpu_state *addr(){ return s; }
     ~fpu_state_alloc_page(){ memory::free_page(s); }
 };
 
+// A save area on the stack, such as in a signal frame, which may hold
+// stale bytes of an earlier frame
 struct fpu_state_inplace {
-    processor::fpu_state s;
-    processor::fpu_state *addr() { return &s; }
-} __attribute__((aligned(16)));
+    static constexpr bool long_lived = false;
+    char s[processor::xsave_area_max_size];
+    fpu_state_inplace() { processor::xsave_header_init(addr()); }
+    processor::fpu_state *addr() {
+        return reinterpret_cast<processor::fpu_state*>(s);
+    }
+} __attribute__((aligned(64)));
 
 typedef save_fpu<fpu_state_alloc_page> arch_fpu;
 typedef save_fpu<fpu_state_inplace> inplace_arch_fpu;
@@ -126,6 +158,9 @@ inline void arch_cpu::init_on_cpu()
         cr4 |= cr4_osxsave;
     }
     write_cr4(cr4);
+    if (features().xsave) {
+        write_xcr(0, xsave_components());
+    }
 
     // We can't trust the FPU and the MXCSR to be always initialized to default values.
     // In at least one particular version of Xen it is not, leading to SIMD exceptions.
@@ -31,5 +31,24 @@ int backtrace_safe(void** pc, int nr)
     return i;
 }
 
+int backtrace_safe(void** pc, int nr, void* pc0, void* fp)
+{
+    if (nr <= 0) {
+        return 0;
+    }
+    pc[0] = pc0;
+    auto rbp = static_cast<frame*>(fp);
+    frame* next;
+    int i = 1;
+    while (i < nr
+            && safe_load(&rbp->next, next)
+            && safe_load(&rbp->pc, pc[i])
+            && pc[i]) {
+        rbp = next;
+        ++i;
+    }
+    return i;
+}
+
 
 
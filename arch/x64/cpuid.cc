@@ -53,7 +53,11 @@ cpuid_bit cpuid_bits[] = {
     { 1, 'c', 28, &f::avx },
     { 1, 'c', 30, &f::rdrand },
     { 7, 'b', 0, &f::fsgsbase, 0 },
+    { 7, 'b', 5, &f::avx2, 0 },
     { 7, 'b', 9, &f::repmovsb, 0 },
+    { 7, 'b', 16, &f::avx512f, 0 },
+    { 7, 'b', 29, &f::sha, 0 },
+    { 0xd, 'a', 0, &f::xsaveopt, 1 },
     { 0x80000001, 'd', 26, &f::gbpage },
     { 0x80000007, 'd', 8, &f::invariant_tsc },
     { 0x40000001, 'a', 0, &f::kvm_clocksource, 0, &kvm_signature },
@@ -20,10 +20,14 @@ struct features_type {
     bool x2apic;
     bool tsc_deadline;
     bool xsave;
+    bool xsaveopt;
     bool avx;
+    bool avx2;
+    bool avx512f;
     bool rdrand;
     bool fsgsbase;
     bool repmovsb;
+    bool sha;
     bool gbpage;
     bool invariant_tsc;
     bool kvm_clocksource;
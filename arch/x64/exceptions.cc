@@ -15,6 +15,7 @@
 #include <libc/signal.hh>
 #include <apic.hh>
 #include "prio.hh"
+#include "drivers/clock.hh"
 
 typedef boost::format fmt;
 
@@ -148,7 +149,15 @@ void interrupt(exception_frame* frame)
     // don't nest.
     current_interrupt_frame = frame;
     unsigned vector = frame->error_code;
-    idt.invoke_interrupt(vector);
+    auto c = sched::cpu::current();
+    if (sched::irq_accounting) {
+        auto start = clock::get()->time();
+        idt.invoke_interrupt(vector);
+        c->irq_time += clock::get()->time() - start;
+    } else {
+        idt.invoke_interrupt(vector);
+    }
+    ++c->irqs;
     // must call scheduler after EOI, or it may switch contexts and miss the EOI
     current_interrupt_frame = nullptr;
     // FIXME: layering violation
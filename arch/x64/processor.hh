@@ -42,6 +42,13 @@ constexpr ulong cr4_pcide = 1u << 17;
 constexpr ulong cr4_osxsave = 1u << 18;
 constexpr ulong cr4_smep = 1u << 20;
 
+constexpr u64 xcr0_x87 = 1u << 0;
+constexpr u64 xcr0_sse = 1u << 1;
+constexpr u64 xcr0_avx = 1u << 2;
+constexpr u64 xcr0_opmask = 1u << 5;
+constexpr u64 xcr0_zmm_hi256 = 1u << 6;
+constexpr u64 xcr0_hi16_zmm = 1u << 7;
+
 struct cpuid_result {
     u32 a, b, c, d;
 };
@@ -110,6 +117,17 @@ inline void write_cr8(ulong r) {
     asm volatile ("mov %0, %%cr8" : : "r"(r));
 }
 
+inline u64 read_xcr(u32 index) {
+    u32 lo, hi;
+    asm volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+    return lo | ((u64)hi << 32);
+}
+
+inline void write_xcr(u32 index, u64 data) {
+    u32 lo = data, hi = data >> 32;
+    asm volatile ("xsetbv" : : "c"(index), "a"(lo), "d"(hi));
+}
+
 struct desc_ptr {
     desc_ptr(u16 limit, ulong addr) : limit(limit), addr(addr) {}
     u16 limit;
@@ -312,6 +330,17 @@ struct fpu_state {
     char extra[];
 };
 
+// Size of the standard-format XSAVE area covering x87, SSE, AVX and the
+// three AVX-512 components; these are the only ones we ever enable in XCR0.
+constexpr ulong xsave_area_max_size = 2688;
+
+// xrstor faults unless the reserved part of the xsave header is zero, and
+// xsave never writes it, so do this once for every new save area.
+inline void xsave_header_init(fpu_state* s)
+{
+    __builtin_memset(s->extra, 0, 64);
+}
+
 inline void fxsave(fpu_state* s)
 {
     asm volatile("fxsaveq %0" : "=m"(*s));
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <arch-cpu.hh>
 #include <debug.hh>
+#include <new>
 
 namespace arch {
 
@@ -38,9 +39,10 @@ void build_signal_frame(exception_frame* ef,
     rsp -= 128;                 // skip red zone
     rsp -= sizeof(signal_frame);
     // the Linux x86_64 calling conventions want 16-byte aligned rsp, and
-    // signal_frame also needs to be 16-byte aligned (for the fpu state):
-    rsp = align_down(rsp, 16);
+    // signal_frame also needs to be 64-byte aligned (for the xsave state):
+    rsp = align_down(rsp, alignof(signal_frame));
     signal_frame* frame = static_cast<signal_frame*>(rsp);
+    new (&frame->fpu) sched::inplace_arch_fpu;
     frame->state = *ef;
     frame->si = si;
     frame->sa = sa;
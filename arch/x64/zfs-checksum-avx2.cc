@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// The AVX2 fletcher4 loop.  This file is built with -mavx2, so it must only
+// be entered after checking processor::features().avx2 (see zfs-checksum.cc).
+
+#include <immintrin.h>
+#include "zfs-checksum.hh"
+
+// See fletcher_4_fini_2lane() in zfs-checksum.cc
+static void fletcher_4_fini_4lane(const uint64_t a[4], const uint64_t b[4],
+        const uint64_t c[4], const uint64_t d[4], zio_cksum_t *zcp)
+{
+    zcp->zc_word[0] = a[0] + a[1] + a[2] + a[3];
+    zcp->zc_word[1] = 4 * (b[0] + b[1] + b[2] + b[3])
+                      - a[1] - 2 * a[2] - 3 * a[3];
+    zcp->zc_word[2] = 16 * (c[0] + c[1] + c[2] + c[3])
+                      - 6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3]
+                      + a[2] + 3 * a[3];
+    zcp->zc_word[3] = 64 * (d[0] + d[1] + d[2] + d[3])
+                      - 48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3]
+                      + 4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3]
+                      - a[3];
+}
+
+template <bool bswap>
+static void fletcher_4_avx2(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    auto ip = static_cast<const __m128i*>(buf);
+    auto ipend = ip + size / sizeof(__m128i);
+    const __m128i swap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                      4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i a = _mm256_setzero_si256(), b = a, c = a, d = a;
+
+    for (; ip < ipend; ip++) {
+        __m128i v = _mm_loadu_si128(ip);
+        if (bswap) {
+            v = _mm_shuffle_epi8(v, swap);
+        }
+        a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(v));
+        b = _mm256_add_epi64(b, a);
+        c = _mm256_add_epi64(c, b);
+        d = _mm256_add_epi64(d, c);
+    }
+
+    uint64_t va[4], vb[4], vc[4], vd[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(va), a);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(vb), b);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(vc), c);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(vd), d);
+    fletcher_4_fini_4lane(va, vb, vc, vd, zcp);
+    fletcher_4_tail(reinterpret_cast<const uint32_t*>(ipend),
+                    static_cast<const uint32_t*>(buf) + size / sizeof(uint32_t),
+                    bswap, zcp);
+}
+
+void fletcher_4_avx2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    fletcher_4_avx2<false>(buf, size, zcp);
+}
+
+void fletcher_4_avx2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    fletcher_4_avx2<true>(buf, size, zcp);
+}
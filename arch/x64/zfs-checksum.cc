@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Vectorized fletcher4 and SHA-256 for the ZFS checksum table.  The
+// scalar implementations stay in the ZFS sources, renamed with a _scalar
+// suffix, and the names the ZFS code calls are bound to the best variant
+// for this cpu with ifunc, as with memcpy() in string.cc.
+
+#include <stdint.h>
+#include <string.h>
+#include <smmintrin.h>
+#include "cpuid.hh"
+#include "zfs-checksum.hh"
+
+// Every lane of the vector loop runs fletcher4 over the words whose index
+// is its lane number modulo the lane count.  fletcher_4_fini_2lane()
+// weighs the lane sums so they add up to the sums of one sequential pass
+// over all the words; the arithmetic is modulo 2^64, like the scalar code.
+static void fletcher_4_fini_2lane(const uint64_t a[2], const uint64_t b[2],
+        const uint64_t c[2], const uint64_t d[2], zio_cksum_t *zcp)
+{
+    zcp->zc_word[0] = a[0] + a[1];
+    zcp->zc_word[1] = 2 * b[0] + 2 * b[1] - a[1];
+    zcp->zc_word[2] = 4 * c[0] - b[0] + 4 * c[1] - 3 * b[1];
+    zcp->zc_word[3] = 8 * d[0] - 4 * c[0] + 8 * d[1] - 8 * c[1] + b[1];
+}
+
+// Words which do not fill a whole vector are summed one by one, starting
+// from the combined lane sums.
+void fletcher_4_tail(const uint32_t *ip, const uint32_t *ipend, bool bswap,
+        zio_cksum_t *zcp)
+{
+    uint64_t a = zcp->zc_word[0], b = zcp->zc_word[1];
+    uint64_t c = zcp->zc_word[2], d = zcp->zc_word[3];
+    for (; ip < ipend; ip++) {
+        a += bswap ? __builtin_bswap32(*ip) : *ip;
+        b += a;
+        c += b;
+        d += c;
+    }
+    zcp->zc_word[0] = a;
+    zcp->zc_word[1] = b;
+    zcp->zc_word[2] = c;
+    zcp->zc_word[3] = d;
+}
+
+template <bool bswap>
+static void fletcher_4_sse(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    auto ip = static_cast<const __m128i*>(buf);
+    auto ipend = ip + size / sizeof(__m128i);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i swap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                      4, 5, 6, 7, 0, 1, 2, 3);
+    __m128i a = zero, b = zero, c = zero, d = zero;
+
+    for (; ip < ipend; ip++) {
+        __m128i v = _mm_loadu_si128(ip);
+        if (bswap) {
+            v = _mm_shuffle_epi8(v, swap);
+        }
+        a = _mm_add_epi64(a, _mm_unpacklo_epi32(v, zero));
+        b = _mm_add_epi64(b, a);
+        c = _mm_add_epi64(c, b);
+        d = _mm_add_epi64(d, c);
+        a = _mm_add_epi64(a, _mm_unpackhi_epi32(v, zero));
+        b = _mm_add_epi64(b, a);
+        c = _mm_add_epi64(c, b);
+        d = _mm_add_epi64(d, c);
+    }
+
+    uint64_t va[2], vb[2], vc[2], vd[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(va), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vb), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vc), c);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(vd), d);
+    fletcher_4_fini_2lane(va, vb, vc, vd, zcp);
+    fletcher_4_tail(reinterpret_cast<const uint32_t*>(ipend),
+                    static_cast<const uint32_t*>(buf) + size / sizeof(uint32_t),
+                    bswap, zcp);
+}
+
+void fletcher_4_sse_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    fletcher_4_sse<false>(buf, size, zcp);
+}
+
+void fletcher_4_sse_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    fletcher_4_sse<true>(buf, size, zcp);
+}
+
+// SHA-NI has no intrinsics in our compiler, so wrap the instructions.
+// sha256rnds2 implicitly takes the round constants + message in %xmm0.
+static inline __m128i sha256rnds2(__m128i cdgh, __m128i abef, __m128i wk)
+{
+    asm("sha256rnds2 %2, %1, %0" : "+x"(cdgh) : "x"(abef), "Yz"(wk));
+    return cdgh;
+}
+
+static inline __m128i sha256msg1(__m128i a, __m128i b)
+{
+    asm("sha256msg1 %1, %0" : "+x"(a) : "x"(b));
+    return a;
+}
+
+static inline __m128i sha256msg2(__m128i a, __m128i b)
+{
+    asm("sha256msg2 %1, %0" : "+x"(a) : "x"(b));
+    return a;
+}
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_ni_blocks(uint32_t state[8], const uint8_t *p, size_t n)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL);
+    auto k = reinterpret_cast<const __m128i*>(sha256_k);
+
+    // The instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<__m128i*>(&state[0]));
+    __m128i cdgh = _mm_loadu_si128(reinterpret_cast<__m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    cdgh = _mm_shuffle_epi32(cdgh, 0x1b);
+    __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+    for (; n; n--, p += 64) {
+        __m128i abef_save = abef, cdgh_save = cdgh;
+        auto in = reinterpret_cast<const __m128i*>(p);
+        __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), bswap);
+        __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), bswap);
+        __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), bswap);
+        __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), bswap);
+        // Four rounds per step, each step also computing the message
+        // schedule for the step after the next three.  Unrolled by four so
+        // the schedule stays in registers.
+        auto step = [&] (int i, __m128i& w0, __m128i w1, __m128i w2,
+                         __m128i w3) {
+            __m128i wk = _mm_add_epi32(w0, _mm_load_si128(k + i));
+            cdgh = sha256rnds2(cdgh, abef, wk);
+            abef = sha256rnds2(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+            if (i < 12) {
+                w0 = sha256msg2(_mm_add_epi32(sha256msg1(w0, w1),
+                                              _mm_alignr_epi8(w3, w2, 4)),
+                                w3);
+            }
+        };
+        for (int i = 0; i < 16; i += 4) {
+            step(i, w0, w1, w2, w3);
+            step(i + 1, w1, w2, w3, w0);
+            step(i + 2, w2, w3, w0, w1);
+            step(i + 3, w3, w0, w1, w2);
+        }
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1b);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]),
+                     _mm_blend_epi16(tmp, cdgh, 0xf0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]),
+                     _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+void zio_checksum_SHA256_ni(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    auto p = static_cast<const uint8_t*>(buf);
+    sha256_ni_blocks(state, p, size / 64);
+
+    // ZFS blocks are a multiple of 512 bytes, so this is normally just
+    // the padding block.
+    uint8_t last[128] = {};
+    size_t tail = size % 64;
+    memcpy(last, p + size - tail, tail);
+    last[tail] = 0x80;
+    size_t nlast = tail < 56 ? 1 : 2;
+    uint64_t bits = size * 8;
+    for (int i = 0; i < 8; i++) {
+        last[nlast * 64 - 1 - i] = bits >> (8 * i);
+    }
+    sha256_ni_blocks(state, last, nlast);
+
+    // Same word layout as zio_checksum_SHA256_scalar(): the big-endian
+    // digest, read as four big-endian 64-bit words.
+    for (int i = 0; i < 4; i++) {
+        zcp->zc_word[i] = uint64_t(state[2 * i]) << 32 | state[2 * i + 1];
+    }
+}
+
+typedef void (*zio_checksum_func)(const void *, uint64_t, zio_cksum_t *);
+
+extern "C" zio_checksum_func resolve_fletcher_4_native()
+{
+    if (processor::features().avx2) {
+        return fletcher_4_avx2_native;
+    }
+    return fletcher_4_sse_native;
+}
+
+extern "C" zio_checksum_func resolve_fletcher_4_byteswap()
+{
+    if (processor::features().avx2) {
+        return fletcher_4_avx2_byteswap;
+    }
+    return fletcher_4_sse_byteswap;
+}
+
+extern "C" zio_checksum_func resolve_zio_checksum_SHA256()
+{
+    if (processor::features().sha) {
+        return zio_checksum_SHA256_ni;
+    }
+    return zio_checksum_SHA256_scalar;
+}
+
+// C linkage, as declared in zfs-checksum.hh: the ZFS code and
+// tests/tst-zfs-checksum.c call these by their unmangled names
+extern "C" {
+void fletcher_4_native(const void *, uint64_t, zio_cksum_t *)
+    __attribute__((ifunc("resolve_fletcher_4_native")));
+void fletcher_4_byteswap(const void *, uint64_t, zio_cksum_t *)
+    __attribute__((ifunc("resolve_fletcher_4_byteswap")));
+void zio_checksum_SHA256(const void *, uint64_t, zio_cksum_t *)
+    __attribute__((ifunc("resolve_zio_checksum_SHA256")));
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef ARCH_X64_ZFS_CHECKSUM_HH_
+#define ARCH_X64_ZFS_CHECKSUM_HH_
+
+#include <stdint.h>
+
+// The ZFS checksum variants, with C linkage so tests/tst-zfs-checksum.c
+// can compare them against each other.  zio_cksum_t matches the one in
+// the ZFS headers (sys/spa.h), which can't be included from C++ code.
+
+extern "C" {
+
+typedef struct zio_cksum {
+    uint64_t zc_word[4];
+} zio_cksum_t;
+
+void fletcher_4_scalar_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_scalar_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_sse_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_sse_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_avx2_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_avx2_byteswap(const void *, uint64_t, zio_cksum_t *);
+void zio_checksum_SHA256_scalar(const void *, uint64_t, zio_cksum_t *);
+void zio_checksum_SHA256_ni(const void *, uint64_t, zio_cksum_t *);
+
+// The names the ZFS code calls, bound to one of the above by ifunc
+void fletcher_4_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_byteswap(const void *, uint64_t, zio_cksum_t *);
+void zio_checksum_SHA256(const void *, uint64_t, zio_cksum_t *);
+
+}
+
+// Shared by the SSE and AVX2 fletcher4 loops
+void fletcher_4_tail(const uint32_t *ip, const uint32_t *ipend, bool bswap,
+        zio_cksum_t *zcp);
+
+#endif
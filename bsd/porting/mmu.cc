@@ -21,3 +21,8 @@ uint64_t virt_to_phys(void *virt)
     return mmu::virt_to_phys(virt);
 }
 
+
+int virt_is_translatable(void *virt)
+{
+    return virt >= mmu::phys_mem;
+}
@@ -39,6 +39,8 @@ typedef uint64_t vm_offset_t;
 __BEGIN_DECLS
 void *pmap_mapdev(uint64_t addr, size_t size);
 uint64_t virt_to_phys(void *virt);
+/* Whether virt_to_phys() can translate virt */
+int virt_is_translatable(void *virt);
 static inline vm_paddr_t pmap_kextract(vm_offset_t va)
 {
     // In BSD this depends on the type of the address, but maybe
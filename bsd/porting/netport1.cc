@@ -63,3 +63,17 @@ int cv_timedwait(kcondvar_t *cv, mutex_t *mutex, clock_t tmo)
     auto ret = condvar_wait(cv, mutex, clock::get()->time() + ticks2ns(tmo));
     return ret == ETIMEDOUT ? -1 : 0;
 }
+
+int cv_timedwait_hires(kcondvar_t *cv, mutex_t *mutex, int64_t tim,
+                       int64_t res, int flag)
+{
+    auto now = clock::get()->time();
+    if (!(flag & CALLOUT_FLAG_ABSOLUTE)) {
+        tim += now;
+    }
+    if (tim <= now) {
+        return -1;
+    }
+    auto ret = condvar_wait(cv, mutex, tim);
+    return ret == ETIMEDOUT ? -1 : 0;
+}
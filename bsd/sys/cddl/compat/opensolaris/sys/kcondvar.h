@@ -29,6 +29,7 @@
 #ifndef _OPENSOLARIS_SYS_CONDVAR_H_
 #define	_OPENSOLARIS_SYS_CONDVAR_H_
 
+#include <stdint.h>
 #include <osv/condvar.h>
 
 #ifdef __cplusplus
@@ -49,6 +50,12 @@ typedef enum {
 #define cv_wait(cv, mutex)		condvar_wait(cv, mutex, 0)
 int cv_timedwait(kcondvar_t *cv, mutex_t *mutex, clock_t tmo);
 
+#define	CALLOUT_FLAG_ABSOLUTE	0x2
+
+/* tim is in nanoseconds; absolute (on the gethrtime() clock) with the flag */
+int cv_timedwait_hires(kcondvar_t *cv, mutex_t *mutex, int64_t tim,
+    int64_t res, int flag);
+
 #ifdef __cplusplus
 }
 #endif
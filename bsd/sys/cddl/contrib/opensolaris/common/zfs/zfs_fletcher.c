@@ -165,8 +165,13 @@ fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
 }
 
+/*
+ * On x86_64 fletcher_4_native() and fletcher_4_byteswap() are bound at
+ * boot to a vectorized variant (arch/x64/zfs-checksum.cc), and these are
+ * kept as the reference implementation.
+ */
 void
-fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -183,7 +188,7 @@ fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
 }
 
 void
-fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
@@ -41,6 +41,14 @@ void fletcher_2_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_2_byteswap(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_native(const void *, uint64_t, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_scalar_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_scalar_byteswap(const void *, uint64_t, zio_cksum_t *);
+#ifdef __x86_64__
+void fletcher_4_sse_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_sse_byteswap(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_avx2_native(const void *, uint64_t, zio_cksum_t *);
+void fletcher_4_avx2_byteswap(const void *, uint64_t, zio_cksum_t *);
+#endif
 void fletcher_4_incremental_native(const void *, uint64_t,
     zio_cksum_t *);
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
@@ -332,6 +332,7 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_write_buffer_bytes_scanned;
 	kstat_named_t arcstat_l2_write_buffer_list_iter;
 	kstat_named_t arcstat_l2_write_buffer_list_null_iter;
+	kstat_named_t arcstat_lent_size;
 } arc_stats_t;
 
 static arc_stats_t arc_stats = {
@@ -401,7 +402,8 @@ static arc_stats_t arc_stats = {
 	{ "l2_write_pios",		KSTAT_DATA_UINT64 },
 	{ "l2_write_buffer_bytes_scanned", KSTAT_DATA_UINT64 },
 	{ "l2_write_buffer_list_iter",	KSTAT_DATA_UINT64 },
-	{ "l2_write_buffer_list_null_iter", KSTAT_DATA_UINT64 }
+	{ "l2_write_buffer_list_null_iter", KSTAT_DATA_UINT64 },
+	{ "lent_size",			KSTAT_DATA_UINT64 }
 };
 
 #define	ARCSTAT(stat)	(arc_stats.stat.value.ui64)
@@ -1482,6 +1484,16 @@ arc_return_buf(arc_buf_t *buf, void *tag)
 	atomic_add_64(&arc_loaned_bytes, -hdr->b_size);
 }
 
+/*
+ * Account for cached data lent by reference (see zfs_loan()).  It stays
+ * in the ARC, and can't be evicted, until it is given back.
+ */
+void
+arc_lent_space(int64_t space)
+{
+	ARCSTAT_INCR(arcstat_lent_size, space);
+}
+
 /* Detach an arc_buf from a dbuf (tag) */
 void
 arc_loan_inuse_buf(arc_buf_t *buf, void *tag)
@@ -0,0 +1,600 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ * Header File
+ * Copyright (C) 2011-2013, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ */
+
+/*
+ * The block format is the one of the reference implementation, so pools
+ * written here can be read by any other ZFS implementation supporting the
+ * org.illumos:lz4_compress feature, and vice versa.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/byteorder.h>
+
+static int real_LZ4_compress(const char *source, char *dest, int isize,
+    int osize);
+static int LZ4_uncompress_unknownOutputSize(const char *source, char *dest,
+    int isize, int maxOutputSize);
+static int LZ4_compressCtx(void *ctx, const char *source, char *dest,
+    int isize, int osize);
+static int LZ4_compress64kCtx(void *ctx, const char *source, char *dest,
+    int isize, int osize);
+
+static kmem_cache_t *lz4_ctx_cache;
+
+/*ARGSUSED*/
+size_t
+lz4_compress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
+{
+	uint32_t bufsiz;
+	char *dest = d_start;
+
+	ASSERT(d_len >= sizeof (bufsiz));
+
+	bufsiz = real_LZ4_compress(s_start, &dest[sizeof (bufsiz)], s_len,
+	    d_len - sizeof (bufsiz));
+
+	/* Signal an error if the compression routine returned zero. */
+	if (bufsiz == 0)
+		return (s_len);
+
+	/*
+	 * Encode the compresed buffer size at the start. We'll need this in
+	 * decompression to counter the effects of padding which might be
+	 * added to the compressed buffer and which, if unhandled, would
+	 * confuse the decompression function.
+	 */
+	*(uint32_t *)dest = BE_32(bufsiz);
+
+	return (bufsiz + sizeof (bufsiz));
+}
+
+/*ARGSUSED*/
+int
+lz4_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
+{
+	const char *src = s_start;
+	uint32_t bufsiz = BE_IN32(src);
+
+	/* invalid compressed buffer size encoded at start */
+	if (bufsiz + sizeof (bufsiz) > s_len)
+		return (1);
+
+	/*
+	 * Returns 0 on success (decompression function returned non-negative)
+	 * and non-zero on failure (decompression function returned negative).
+	 */
+	return (LZ4_uncompress_unknownOutputSize(&src[sizeof (bufsiz)],
+	    d_start, bufsiz, d_len) < 0);
+}
+
+/*
+ * Tuning parameters
+ */
+
+/*
+ * COMPRESSIONLEVEL: Increasing this value improves compression ratio
+ *	 Lowering this value reduces memory usage. Reduced memory usage
+ *	typically improves speed, due to cache effect (ex: L1 32KB for Intel,
+ *	L1 64KB for AMD). Memory usage formula : N->2^(N+2) Bytes
+ *	(examples : 12 -> 16KB ; 17 -> 512KB)
+ */
+#define	COMPRESSIONLEVEL 12
+
+/*
+ * NOTCOMPRESSIBLE_CONFIRMATION: Decreasing this value will make the
+ *	algorithm skip faster data segments considered "incompressible".
+ *	This may decrease compression ratio dramatically, but will be
+ *	faster on incompressible data. Increasing this value will make
+ *	the algorithm search more before declaring a segment "incompressible".
+ *	This could improve compression a bit, but will be slower on
+ *	incompressible data. The default value (6) is recommended.
+ */
+#define	NOTCOMPRESSIBLE_CONFIRMATION 6
+
+/*
+ * Basic types and unaligned access
+ */
+#define	BYTE	uint8_t
+#define	U16	uint16_t
+#define	U32	uint32_t
+#define	U64	uint64_t
+
+typedef struct _U16_S {
+	U16 v;
+} __attribute__((packed)) U16_S;
+typedef struct _U32_S {
+	U32 v;
+} __attribute__((packed)) U32_S;
+typedef struct _U64_S {
+	U64 v;
+} __attribute__((packed)) U64_S;
+
+#define	A16(x)	(((U16_S *)(x))->v)
+#define	A32(x)	(((U32_S *)(x))->v)
+#define	A64(x)	(((U64_S *)(x))->v)
+
+#define	likely(expr)	__builtin_expect((expr) != 0, 1)
+#define	unlikely(expr)	__builtin_expect((expr) != 0, 0)
+
+/*
+ * Constants
+ */
+#define	MINMATCH 4
+
+#define	HASH_LOG COMPRESSIONLEVEL
+#define	HASHTABLESIZE (1 << HASH_LOG)
+#define	HASH_MASK (HASHTABLESIZE - 1)
+
+#define	SKIPSTRENGTH (NOTCOMPRESSIBLE_CONFIRMATION > 2 ? \
+	NOTCOMPRESSIBLE_CONFIRMATION : 2)
+
+#define	COPYLENGTH 8
+#define	LASTLITERALS 5
+#define	MFLIMIT (COPYLENGTH + MINMATCH)
+#define	MINLENGTH (MFLIMIT + 1)
+
+#define	MAXD_LOG 16
+#define	MAX_DISTANCE ((1 << MAXD_LOG) - 1)
+
+#define	ML_BITS 4
+#define	ML_MASK ((1U<<ML_BITS)-1)
+#define	RUN_BITS (8-ML_BITS)
+#define	RUN_MASK ((1U<<RUN_BITS)-1)
+
+#define	STEPSIZE 8
+#define	UARCH U64
+#define	AARCH A64
+
+/*
+ * Hash tables, 16KB each: the general one holds 32-bit offsets from the
+ * start of the input, while inputs under 64KB use 16-bit offsets and so
+ * can afford twice the entries.
+ */
+#define	LZ4_64KLIMIT ((1 << 16) + (MFLIMIT - 1))
+#define	HASHLOG64K (HASH_LOG + 1)
+#define	HASH64KTABLESIZE (1U << HASHLOG64K)
+
+struct refTables {
+	union {
+		U32 hashTable[HASHTABLESIZE];
+		U16 hashTable64k[HASH64KTABLESIZE];
+	};
+};
+
+#define	LZ4_HASH_FUNCTION(i)	(((i) * 2654435761U) >> ((MINMATCH * 8) - \
+	HASH_LOG))
+#define	LZ4_HASH_VALUE(p)	LZ4_HASH_FUNCTION(A32(p))
+#define	LZ4_HASH64K_FUNCTION(i)	(((i) * 2654435761U) >> ((MINMATCH*8) - \
+	HASHLOG64K))
+#define	LZ4_HASH64K_VALUE(p)	LZ4_HASH64K_FUNCTION(A32(p))
+
+/*
+ * Copy in 8-byte steps, possibly overrunning e by up to 7 bytes; callers
+ * make sure there is room for that.
+ */
+#define	LZ4_COPYSTEP(s, d)	A64(d) = A64(s); d += 8; s += 8;
+#define	LZ4_WILDCOPY(s, d, e)	do { LZ4_COPYSTEP(s, d) } while (d < e);
+
+static inline int
+LZ4_NbCommonBytes(U64 val)
+{
+	return (__builtin_ctzll(val) >> 3);
+}
+
+/*
+ * Encode a literal run and its token; returns the advanced output pointer.
+ */
+static inline BYTE *
+LZ4_encodeLiterals(BYTE *op, BYTE *token, const BYTE *anchor, int length)
+{
+	int len;
+
+	if (length >= (int)RUN_MASK) {
+		*token = (RUN_MASK << ML_BITS);
+		len = length - RUN_MASK;
+		for (; len > 254; len -= 255)
+			*op++ = 255;
+		*op++ = (BYTE)len;
+	} else {
+		*token = (length << ML_BITS);
+	}
+	(void) memcpy(op, anchor, length);
+	return (op + length);
+}
+
+/*
+ * Count the bytes at ip matching those at ref, stopping at matchlimit.
+ */
+static inline const BYTE *
+LZ4_countMatch(const BYTE *ip, const BYTE *ref, const BYTE *matchlimit)
+{
+	while (likely(ip < matchlimit - (STEPSIZE - 1))) {
+		UARCH diff = AARCH(ref) ^ AARCH(ip);
+		if (!diff) {
+			ip += STEPSIZE;
+			ref += STEPSIZE;
+			continue;
+		}
+		return (ip + LZ4_NbCommonBytes(diff));
+	}
+	if ((ip < (matchlimit - 3)) && (A32(ref) == A32(ip))) {
+		ip += 4;
+		ref += 4;
+	}
+	if ((ip < (matchlimit - 1)) && (A16(ref) == A16(ip))) {
+		ip += 2;
+		ref += 2;
+	}
+	if ((ip < matchlimit) && (*ref == *ip))
+		ip++;
+	return (ip);
+}
+
+/*
+ * Encode the match length (beyond MINMATCH) into the token and output.
+ */
+static inline BYTE *
+LZ4_encodeMatchLength(BYTE *op, BYTE *token, int len)
+{
+	if (len >= (int)ML_MASK) {
+		*token += ML_MASK;
+		len -= ML_MASK;
+		for (; len > 509; len -= 510) {
+			*op++ = 255;
+			*op++ = 255;
+		}
+		if (len > 254) {
+			len -= 255;
+			*op++ = 255;
+		}
+		*op++ = (BYTE)len;
+	} else {
+		*token += len;
+	}
+	return (op);
+}
+
+static inline BYTE *
+LZ4_encodeLastLiterals(BYTE *op, const BYTE *anchor, const BYTE *iend,
+    const BYTE *oend)
+{
+	int lastRun = iend - anchor;
+
+	if (op + lastRun + 1 + ((lastRun + 255 - RUN_MASK) / 255) > oend)
+		return (NULL);
+	if (lastRun >= (int)RUN_MASK) {
+		*op++ = (RUN_MASK << ML_BITS);
+		lastRun -= RUN_MASK;
+		for (; lastRun > 254; lastRun -= 255)
+			*op++ = 255;
+		*op++ = (BYTE)lastRun;
+	} else {
+		*op++ = (lastRun << ML_BITS);
+	}
+	(void) memcpy(op, anchor, iend - anchor);
+	return (op + (iend - anchor));
+}
+
+/*
+ * The compressors. The two only differ in the width of the hash table
+ * entries, so they are generated from one body.
+ */
+#define	LZ4_COMPRESS_BODY(HTYPE, TABLE, HASH_VALUE, DISTANCE_OK)	\
+	HTYPE *HashTable = (HTYPE *)(srt->TABLE);			\
+	const BYTE *ip = (const BYTE *) source;				\
+	const BYTE *const base = ip;					\
+	const BYTE *anchor = ip;					\
+	const BYTE *const iend = ip + isize;				\
+	const BYTE *const oend = (BYTE *) dest + osize;			\
+	const BYTE *const mflimit = iend - MFLIMIT;			\
+	const BYTE *const matchlimit = iend - LASTLITERALS;		\
+	BYTE *op = (BYTE *) dest;					\
+	const int skipStrength = SKIPSTRENGTH;				\
+	U32 forwardH;							\
+									\
+	if (isize < MINLENGTH)						\
+		goto _last_literals;					\
+									\
+	/* First Byte */						\
+	HashTable[HASH_VALUE(ip)] = ip - base;				\
+	ip++;								\
+	forwardH = HASH_VALUE(ip);					\
+									\
+	/* Main Loop */							\
+	for (;;) {							\
+		int findMatchAttempts = (1U << skipStrength) + 3;	\
+		const BYTE *forwardIp = ip;				\
+		const BYTE *ref;					\
+		BYTE *token;						\
+		int length;						\
+									\
+		/* Find a match */					\
+		do {							\
+			U32 h = forwardH;				\
+			int step = findMatchAttempts++ >> skipStrength;	\
+			ip = forwardIp;					\
+			forwardIp = ip + step;				\
+									\
+			if (unlikely(forwardIp > mflimit))		\
+				goto _last_literals;			\
+									\
+			forwardH = HASH_VALUE(forwardIp);		\
+			ref = base + HashTable[h];			\
+			HashTable[h] = ip - base;			\
+		} while (!(DISTANCE_OK) || (A32(ref) != A32(ip)));	\
+									\
+		/* Catch up */						\
+		while ((ip > anchor) && (ref > (const BYTE *) source) &&	\
+		    unlikely(ip[-1] == ref[-1])) {			\
+			ip--;						\
+			ref--;						\
+		}							\
+									\
+		/* Encode Literal length, and check output limit */	\
+		length = ip - anchor;					\
+		token = op++;						\
+		if (unlikely(op + length + (2 + 1 + LASTLITERALS) +	\
+		    (length >> 8) > oend))				\
+			return (0);					\
+		op = LZ4_encodeLiterals(op, token, anchor, length);	\
+									\
+		for (;;) {						\
+			const BYTE *mend;				\
+									\
+			/* Encode Offset */				\
+			A16(op) = LE_16(ip - ref);			\
+			op += 2;					\
+									\
+			/* Count the match, MINMATCH verified */	\
+			mend = LZ4_countMatch(ip + MINMATCH,		\
+			    ref + MINMATCH, matchlimit);		\
+			length = mend - (ip + MINMATCH);		\
+			ip = mend;					\
+			if (unlikely(op + (1 + LASTLITERALS) +		\
+			    (length >> 8) > oend))			\
+				return (0);				\
+			op = LZ4_encodeMatchLength(op, token, length);	\
+			anchor = ip;					\
+									\
+			/* Test end of chunk */				\
+			if (ip > mflimit)				\
+				goto _last_literals;			\
+									\
+			/* Fill table */				\
+			HashTable[HASH_VALUE(ip - 2)] = ip - 2 - base;	\
+									\
+			/* Test next position */			\
+			ref = base + HashTable[HASH_VALUE(ip)];		\
+			HashTable[HASH_VALUE(ip)] = ip - base;		\
+			if (!(DISTANCE_OK) || A32(ref) != A32(ip))	\
+				break;					\
+			/* Immediate match: no literals */		\
+			token = op++;					\
+			*token = 0;					\
+		}							\
+									\
+		/* Prepare next loop */					\
+		anchor = ip++;						\
+		forwardH = HASH_VALUE(ip);				\
+	}								\
+									\
+_last_literals:								\
+	op = LZ4_encodeLastLiterals(op, anchor, iend, oend);		\
+	if (op == NULL)							\
+		return (0);						\
+	return (int)(((char *)op) - dest);
+
+static int
+LZ4_compressCtx(void *ctx, const char *source, char *dest, int isize,
+    int osize)
+{
+	struct refTables *srt = (struct refTables *)ctx;
+
+	LZ4_COMPRESS_BODY(U32, hashTable, LZ4_HASH_VALUE,
+	    ref >= ip - MAX_DISTANCE)
+}
+
+/*
+ * Inputs under LZ4_64KLIMIT never have a match further than MAX_DISTANCE
+ * away, so skip that check.
+ */
+static int
+LZ4_compress64kCtx(void *ctx, const char *source, char *dest, int isize,
+    int osize)
+{
+	struct refTables *srt = (struct refTables *)ctx;
+
+	LZ4_COMPRESS_BODY(U16, hashTable64k, LZ4_HASH64K_VALUE, 1)
+}
+
+static int
+real_LZ4_compress(const char *source, char *dest, int isize, int osize)
+{
+	void *ctx;
+	int result;
+
+	/*
+	 * out of kernel memory, gently fall through - this will disable
+	 * compression in zio_compress_data
+	 */
+	ctx = kmem_cache_alloc(lz4_ctx_cache, KM_NOSLEEP);
+	if (ctx == NULL)
+		return (0);
+	bzero(ctx, sizeof (struct refTables));
+
+	if (isize < LZ4_64KLIMIT)
+		result = LZ4_compress64kCtx(ctx, source, dest, isize, osize);
+	else
+		result = LZ4_compressCtx(ctx, source, dest, isize, osize);
+
+	kmem_cache_free(lz4_ctx_cache, ctx);
+	return (result);
+}
+
+/*
+ * Decompression: every read of the input and write of the output is
+ * bounds checked, as the compressed data comes from disk. The fast paths
+ * copy 8 bytes at a time while at least COPYLENGTH bytes remain on both
+ * sides; close to the ends we fall back to exact copies.
+ *
+ * Returns the number of bytes written to dest, or a negative value (the
+ * position of the error in the input) for malformed input.
+ */
+static int
+LZ4_uncompress_unknownOutputSize(const char *source, char *dest, int isize,
+    int maxOutputSize)
+{
+	const BYTE *ip = (const BYTE *) source;
+	const BYTE *const iend = ip + isize;
+	const BYTE *ref;
+
+	BYTE *op = (BYTE *) dest;
+	BYTE *const oend = op + maxOutputSize;
+	BYTE *cpy;
+
+	static const size_t dec32table[] = {0, 3, 2, 3, 0, 0, 0, 0};
+	static const size_t dec64table[] = {0, 0, 0, (size_t)-1, 0, 1, 2, 3};
+
+	while (ip < iend) {
+		unsigned token;
+		size_t length;
+
+		/* get runlength */
+		token = *ip++;
+		if ((length = (token >> ML_BITS)) == RUN_MASK) {
+			unsigned s = 255;
+			while ((ip < iend) && (s == 255)) {
+				s = *ip++;
+				length += s;
+			}
+		}
+		/* copy literals */
+		if (length > (size_t)(iend - ip) ||
+		    length > (size_t)(oend - op))
+			goto _output_error;
+		cpy = op + length;
+		if ((cpy > oend - COPYLENGTH) ||
+		    (ip + length > iend - COPYLENGTH)) {
+			/*
+			 * The last sequence has only literals, so this must
+			 * consume all the input.
+			 */
+			if (ip + length != iend)
+				goto _output_error;
+			(void) memcpy(op, ip, length);
+			op += length;
+			break;
+		}
+		LZ4_WILDCOPY(ip, op, cpy);
+		ip -= (op - cpy);
+		op = cpy;
+
+		/* get offset */
+		if (iend - ip < 2)
+			goto _output_error;
+		ref = cpy - LE_16(A16(ip));
+		ip += 2;
+		if (ref < (BYTE *) dest || ref == op)
+			goto _output_error;
+
+		/* get matchlength */
+		if ((length = (token & ML_MASK)) == ML_MASK) {
+			while (ip < iend) {
+				unsigned s = *ip++;
+				length += s;
+				if (s != 255)
+					break;
+			}
+		}
+		length += MINMATCH;
+		if (length > (size_t)(oend - op))
+			goto _output_error;
+		cpy = op + length;
+
+		if (unlikely(cpy > oend - COPYLENGTH)) {
+			/* close to the end of the output: exact copy */
+			while (op < cpy)
+				*op++ = *ref++;
+			continue;
+		}
+
+		/* copy repeated sequence */
+		if (unlikely(op - ref < STEPSIZE)) {
+			/*
+			 * Overlapping copy: replicate the first bytes until
+			 * the distance is at least STEPSIZE.
+			 */
+			size_t dec64 = dec64table[op - ref];
+			op[0] = ref[0];
+			op[1] = ref[1];
+			op[2] = ref[2];
+			op[3] = ref[3];
+			op += 4;
+			ref += 4;
+			ref -= dec32table[op - ref];
+			A32(op) = A32(ref);
+			op += STEPSIZE - 4;
+			ref -= dec64;
+		} else {
+			LZ4_COPYSTEP(ref, op);
+		}
+		if (op < cpy) {
+			LZ4_WILDCOPY(ref, op, cpy);
+		}
+		op = cpy;	/* correction */
+	}
+
+	/* end of decoding */
+	return (int)(((char *)op) - dest);
+
+	/* write overflow error detected */
+_output_error:
+	return (int)(-(((const char *)ip) - source));
+}
+
+void
+lz4_init(void)
+{
+	lz4_ctx_cache = kmem_cache_create("lz4_ctx", sizeof (struct refTables),
+	    0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+lz4_fini(void)
+{
+	if (lz4_ctx_cache) {
+		kmem_cache_destroy(lz4_ctx_cache);
+		lz4_ctx_cache = NULL;
+	}
+}
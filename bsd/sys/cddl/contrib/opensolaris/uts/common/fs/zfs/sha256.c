@@ -30,8 +30,12 @@
 #include <sha256.h>
 #endif
 
+/*
+ * zio_checksum_SHA256() itself is bound at boot to the SHA-NI variant
+ * (arch/x64/zfs-checksum.cc) when the cpu has it, or to this one.
+ */
 void
-zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
+zio_checksum_SHA256_scalar(const void *buf, uint64_t size, zio_cksum_t *zcp)
 {
 	SHA256_CTX ctx;
 	zio_cksum_t tmp;
@@ -105,6 +105,11 @@ struct vdev_queue {
 	avl_tree_t	vq_write_tree;
 	avl_tree_t	vq_pending_tree;
 	kmutex_t	vq_lock;
+	uint64_t	vq_pending_limit; /* current queue depth limit */
+	hrtime_t	vq_lat_avg;	/* moving average of i/o latency */
+	hrtime_t	vq_lat_base;	/* lowest recent vq_lat_avg */
+	uint64_t	vq_round_ios;	/* completions this round */
+	boolean_t	vq_saturated;	/* limit was reached this round */
 };
 
 /*
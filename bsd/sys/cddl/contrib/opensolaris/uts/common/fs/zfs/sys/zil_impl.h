@@ -72,6 +72,24 @@ typedef struct itx_async_node {
 	avl_node_t	ia_node;	/* AVL tree linkage */
 } itx_async_node_t;
 
+/*
+ * itxs are first queued on the assigning cpu, so threads logging at the
+ * same time don't all contend for the itxg_lock.  Whoever next needs an
+ * itxg's lists (zil_commit(), zil_clean(), ...) moves the queued itxs over,
+ * in the order they were assigned; see zil_itxg_merge().
+ *
+ * That order comes from gethrtime(), read under zc_lock and bumped past
+ * the last itx queued on this cpu, rather than from a shared counter
+ * every logging cpu would have to bounce between them.
+ */
+typedef struct zil_cpu {
+	kmutex_t	zc_lock;
+	uint64_t	zc_txg[TXG_SIZE];	/* txg of the itxs in zc_itxs */
+	list_t		zc_itxs[TXG_SIZE];	/* itxs not yet in zl_itxg */
+	uint64_t	zc_dirty_txg;		/* txg we last dirtied */
+	uint64_t	zc_seq;			/* itx_seq of the last itx */
+} __aligned(CACHE_LINE_SIZE) zil_cpu_t;
+
 /*
  * Vdev flushing: during a zil_commit(), we build up an AVL tree of the vdevs
  * we've touched so we know which ones need a write cache flush at the end.
@@ -117,6 +135,13 @@ struct zilog {
 	uint64_t	zl_next_batch;	/* next batch number */
 	uint64_t	zl_com_batch;	/* committed batch number */
 	kcondvar_t	zl_cv_batch[2];	/* batch condition variables */
+	uint64_t	zl_batch_cnt;	/* committers in the forming batch */
+	uint64_t	zl_batch_avg;	/* committers per batch, times 16 */
+	hrtime_t	zl_commit_avg;	/* time a commit takes */
+	boolean_t	zl_batch_window; /* writer waits for the batch */
+	kcondvar_t	zl_cv_window;	/* batch filled up */
+	zil_cpu_t	*zl_cpu;	/* per-cpu itx queues */
+	void		*zl_cpu_buf;	/* allocation zl_cpu is aligned in */
 	itxg_t		zl_itxg[TXG_SIZE]; /* intent log txg chains */
 	list_t		zl_itx_commit_list; /* itx list to be committed */
 	uint64_t	zl_itx_list_sz;	/* total size of records on list */
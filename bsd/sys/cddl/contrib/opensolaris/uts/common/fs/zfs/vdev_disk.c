@@ -141,7 +141,7 @@ vdev_disk_start_bio(zio_t *zio)
 	bio->bio_caller1 = zio;
 	bio->bio_done = vdev_disk_bio_done;
 
-	bio->bio_dev->driver->devops->strategy(bio);
+	submit_bio(bio);
 	return ZIO_PIPELINE_STOP;
 }
 
@@ -159,7 +159,7 @@ vdev_disk_start_flush(zio_t *zio)
 	bio->bio_caller1 = zio;
 	bio->bio_done = vdev_disk_bio_done;
 
-	bio->bio_dev->driver->devops->strategy(bio);
+	submit_bio(bio);
 	return ZIO_PIPELINE_STOP;
 }
 
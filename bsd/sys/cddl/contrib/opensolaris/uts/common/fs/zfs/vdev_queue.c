@@ -27,6 +27,7 @@
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
 #include <sys/avl.h>
+#include <osv/bio.h>
 
 /*
  * These tunables are for performance analysis.
@@ -36,9 +37,16 @@
  * pending to each device.  zfs_vdev_min_pending is the initial number
  * of i/os pending to each device (before it starts ramping up to
  * max_pending).
+ *
+ * Between the two, each device's queue depth adapts to its latency (see
+ * vdev_queue_adapt()): it grows while deeper queues do not make i/os
+ * take longer than zfs_vdev_latency_ratio times the best recent average,
+ * and shrinks when they do.  A fast virtual disk thus gets enough i/os
+ * to keep it busy, while a slow one is not flooded.
  */
-int zfs_vdev_max_pending = 10;
+int zfs_vdev_max_pending = 64;
 int zfs_vdev_min_pending = 4;
+int zfs_vdev_latency_ratio = 2;
 
 /* deadline = pri + ddi_get_lbolt64() >> time_shift) */
 int zfs_vdev_time_shift = 6;
@@ -64,6 +72,10 @@ TUNABLE_INT("vfs.zfs.vdev.min_pending", &zfs_vdev_min_pending);
 SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, min_pending, CTLFLAG_RW,
     &zfs_vdev_min_pending, 0,
     "Initial number of I/O requests pending to each device");
+TUNABLE_INT("vfs.zfs.vdev.latency_ratio", &zfs_vdev_latency_ratio);
+SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, latency_ratio, CTLFLAG_RW,
+    &zfs_vdev_latency_ratio, 0,
+    "Latency increase tolerated when growing the queue depth");
 TUNABLE_INT("vfs.zfs.vdev.time_shift", &zfs_vdev_time_shift);
 SYSCTL_INT(_vfs_zfs_vdev, OID_AUTO, time_shift, CTLFLAG_RW,
     &zfs_vdev_time_shift, 0, "Used for calculating I/O request deadline");
@@ -147,6 +159,8 @@ vdev_queue_init(vdev_t *vd)
 
 	avl_create(&vq->vq_pending_tree, vdev_queue_offset_compare,
 	    sizeof (zio_t), offsetof(struct zio, io_offset_node));
+
+	vq->vq_pending_limit = zfs_vdev_min_pending;
 }
 
 void
@@ -211,9 +225,13 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit)
 again:
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
-	if (avl_numnodes(&vq->vq_pending_tree) >= pending_limit ||
-	    avl_numnodes(&vq->vq_deadline_tree) == 0)
+	if (avl_numnodes(&vq->vq_deadline_tree) == 0)
+		return (NULL);
+
+	if (avl_numnodes(&vq->vq_pending_tree) >= pending_limit) {
+		vq->vq_saturated = B_TRUE;
 		return (NULL);
+	}
 
 	fio = lio = avl_first(&vq->vq_deadline_tree);
 
@@ -339,6 +357,7 @@ again:
 			zio_execute(dio);
 		} while (dio != lio);
 
+		aio->io_timestamp = gethrtime();
 		avl_add(&vq->vq_pending_tree, aio);
 
 		return (aio);
@@ -361,6 +380,7 @@ again:
 		goto again;
 	}
 
+	fio->io_timestamp = gethrtime();
 	avl_add(&vq->vq_pending_tree, fio);
 
 	return (fio);
@@ -406,17 +426,69 @@ vdev_queue_io(zio_t *zio)
 	return (nio);
 }
 
+/*
+ * Adjust the queue depth once per round, that is, every time as many i/os
+ * have completed as the queue may hold.  If the average latency stayed
+ * close to the best recently seen, the device is keeping up, and if the
+ * queue was also full at some point, one more i/o may help.  If latency
+ * went up, i/os are just waiting in the device's queue instead of ours,
+ * so back off.  The baseline slowly ages, so a device that got slower
+ * (or a one-off fast round) doesn't pin the queue depth to the minimum.
+ */
+static void
+vdev_queue_adapt(vdev_queue_t *vq, zio_t *zio)
+{
+	hrtime_t lat = gethrtime() - zio->io_timestamp;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (vq->vq_lat_avg == 0)
+		vq->vq_lat_avg = lat;
+	else
+		vq->vq_lat_avg += (lat - vq->vq_lat_avg) / 8;
+
+	if (++vq->vq_round_ios < vq->vq_pending_limit)
+		return;
+
+	if (vq->vq_lat_base == 0 || vq->vq_lat_avg < vq->vq_lat_base)
+		vq->vq_lat_base = vq->vq_lat_avg;
+	else
+		vq->vq_lat_base += vq->vq_lat_base / 64 + 1;
+
+	if (vq->vq_lat_avg <= vq->vq_lat_base * zfs_vdev_latency_ratio) {
+		if (vq->vq_saturated &&
+		    vq->vq_pending_limit < zfs_vdev_max_pending)
+			vq->vq_pending_limit++;
+	} else {
+		vq->vq_pending_limit -= vq->vq_pending_limit / 4;
+	}
+	vq->vq_pending_limit = MAX(vq->vq_pending_limit, zfs_vdev_min_pending);
+	vq->vq_pending_limit = MIN(vq->vq_pending_limit, zfs_vdev_max_pending);
+
+	vq->vq_round_ios = 0;
+	vq->vq_saturated = B_FALSE;
+}
+
 void
 vdev_queue_io_done(zio_t *zio)
 {
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
+	struct bio_plug plug;
 
 	mutex_enter(&vq->vq_lock);
 
 	avl_remove(&vq->vq_pending_tree, zio);
+	vdev_queue_adapt(vq, zio);
+
+	/*
+	 * Hold back the bios of the i/os issued here, so the device sees
+	 * them as one batch.  Should we block, on vq_lock or in
+	 * zio_execute(), the bios held so far are submitted first.
+	 */
+	bio_start_plug(&plug);
 
 	for (int i = 0; i < zfs_vdev_ramp_rate; i++) {
-		zio_t *nio = vdev_queue_io_to_issue(vq, zfs_vdev_max_pending);
+		zio_t *nio = vdev_queue_io_to_issue(vq, vq->vq_pending_limit);
 		if (nio == NULL)
 			break;
 		mutex_exit(&vq->vq_lock);
@@ -430,4 +502,6 @@ vdev_queue_io_done(zio_t *zio)
 	}
 
 	mutex_exit(&vq->vq_lock);
+
+	bio_finish_plug(&plug);
 }
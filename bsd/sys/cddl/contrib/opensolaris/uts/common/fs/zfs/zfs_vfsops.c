@@ -960,6 +960,81 @@ zfs_set_fuid_feature(zfsvfs_t *zfsvfs)
 	zfsvfs->z_use_sa = USE_SA(zfsvfs->z_version, zfsvfs->z_os);
 }
 
+/*
+ * Boot set prefetching.  An image built with "mkzfs.py -b" has a .bootset
+ * file in the root of the file system, listing the objects the application
+ * opens while booting, one "<object> <d|f> <path>" line each.  The image
+ * builder copies those files first and in that order, so their dnodes sit
+ * together in the first few blocks of the meta-dnode and their directories'
+ * ZAP blocks follow each other on disk.  We issue all of the reads for that
+ * metadata up front, asynchronously, and the vdev queue aggregates them
+ * into a few large sequential reads, instead of the first lookups faulting
+ * in the metadata one small synchronous read at a time.
+ */
+int zfs_prewarm_enable = 1;
+TUNABLE_INT("vfs.zfs.prewarm_enable", &zfs_prewarm_enable);
+SYSCTL_INT(_vfs_zfs, OID_AUTO, prewarm_enable, CTLFLAG_RW,
+    &zfs_prewarm_enable, 0, "Prefetch the boot set metadata at mount");
+
+#define	ZFS_BOOTSET_NAME	".bootset"
+#define	ZFS_BOOTSET_MAX		(1 << 20)
+
+static void
+zfs_prewarm(zfsvfs_t *zfsvfs)
+{
+	objset_t *os = zfsvfs->z_os;
+	dmu_object_info_t doi;
+	uint64_t obj, size;
+	char *buf, *p;
+	int pass, nobjs = 0;
+
+	if (!zfs_prewarm_enable)
+		return;
+	if (zap_lookup(os, zfsvfs->z_root, ZFS_BOOTSET_NAME, 8, 1, &obj) != 0)
+		return;
+	obj = ZFS_DIRENT_OBJ(obj);
+	if (dmu_object_info(os, obj, &doi) != 0)
+		return;
+	size = MIN(doi.doi_max_offset, ZFS_BOOTSET_MAX);
+	buf = kmem_zalloc(size + 1, KM_SLEEP);
+	if (dmu_read(os, obj, 0, size, buf, DMU_READ_PREFETCH) != 0) {
+		kmem_free(buf, size + 1);
+		return;
+	}
+
+	/*
+	 * The first pass prefetches the dnodes, and the second the
+	 * directories' ZAP blocks, which needs their dnodes.  By then the
+	 * dnode reads are all in flight, so waiting for the first one
+	 * doesn't serialize the rest.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (p = buf; *p != '\0'; ) {
+			uint64_t o = 0;
+			char type;
+
+			while (*p >= '0' && *p <= '9')
+				o = o * 10 + *p++ - '0';
+			while (*p == ' ')
+				p++;
+			type = *p;
+			while (*p != '\0' && *p++ != '\n')
+				;
+			if (o == 0)
+				continue;
+			if (pass == 0) {
+				dmu_prefetch(os, o, 0, 0);
+				nobjs++;
+			} else if (type == 'd' &&
+			    dmu_object_info(os, o, &doi) == 0) {
+				dmu_prefetch(os, o, 0, doi.doi_max_offset);
+			}
+		}
+	}
+	dprintf("zfs: prefetching %d boot set objects\n", nobjs);
+	kmem_free(buf, size + 1);
+}
+
 static int
 zfs_domount(vfs_t *vfsp, char *osname)
 {
@@ -1017,8 +1092,10 @@ zfs_domount(vfs_t *vfsp, char *osname)
 	}
 
 	error = zfs_zget(zfsvfs, zfsvfs->z_root, &rootzp);
-	if (error == 0)
+	if (error == 0) {
 		vfsp->m_root->d_vnode->v_data = rootzp;
+		zfs_prewarm(zfsvfs);
+	}
 
 
 #ifdef notyet
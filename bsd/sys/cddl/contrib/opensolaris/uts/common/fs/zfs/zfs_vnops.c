@@ -631,6 +631,89 @@ out:
 	return (error);
 }
 
+/*
+ * Lend out the cached data of the file at a page-aligned offset by
+ * reference, instead of copying it, so it can be mapped into an address
+ * space or sent from directly.  The dbuf stays held, so its buffer can
+ * neither be evicted nor replaced, until zfs_unloan() drops the hold.
+ * Writes to the file still go to the same buffer, so a borrower sees them.
+ *
+ *	IN:	vp	- vnode of file to lend from.
+ *		off	- page-aligned file offset.
+ *
+ *	OUT:	addrp	- page-aligned address of the data at off.
+ *		lenp	- bytes available at addrp, a multiple of PAGESIZE.
+ *		cookiep	- to hand back to zfs_unloan().
+ *
+ *	RETURN:	0 on success, EOPNOTSUPP if the block can't be lent (the
+ *		caller should read() instead), or an error code.
+ */
+static int
+zfs_loan(vnode_t *vp, off_t off, void **addrp, size_t *lenp, void **cookiep)
+{
+	znode_t		*zp = VTOZ(vp);
+	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
+	dmu_buf_t	*db;
+	rl_t		*rl;
+	int		error;
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	if (off < 0 || (off & PAGEOFFSET) != 0) {
+		ZFS_EXIT(zfsvfs);
+		return (EINVAL);
+	}
+
+	rl = zfs_range_lock(zp, off, PAGESIZE, RL_READER);
+	if (off >= zp->z_size) {
+		error = EINVAL;
+		goto out;
+	}
+
+	/*
+	 * Only blocks made of whole pages can be mapped.  A file's only block
+	 * may still be grown by zfs_grow_blocksize(), which would replace its
+	 * buffer, so lend from it only once it has the maximum size.
+	 */
+	if ((zp->z_blksz & PAGEOFFSET) != 0 ||
+	    (zp->z_size <= zp->z_blksz && zp->z_blksz != SPA_MAXBLOCKSIZE)) {
+		error = EOPNOTSUPP;
+		goto out;
+	}
+
+	error = dmu_buf_hold(zfsvfs->z_os, zp->z_id, off, zfs_loan,
+	    &db, DMU_READ_PREFETCH);
+	if (error) {
+		if (error == ECKSUM)
+			error = EIO;
+		goto out;
+	}
+	if (((uintptr_t)db->db_data & PAGEOFFSET) != 0) {
+		dmu_buf_rele(db, zfs_loan);
+		error = EOPNOTSUPP;
+		goto out;
+	}
+
+	*addrp = (char *)db->db_data + (off - db->db_offset);
+	*lenp = db->db_size - (off - db->db_offset);
+	*cookiep = db;
+	arc_lent_space(db->db_size);
+out:
+	zfs_range_unlock(rl);
+	ZFS_EXIT(zfsvfs);
+	return (error);
+}
+
+static void
+zfs_unloan(vnode_t *vp, void *cookie)
+{
+	dmu_buf_t *db = cookie;
+
+	arc_lent_space(-(int64_t)db->db_size);
+	dmu_buf_rele(db, zfs_loan);
+}
+
 /*
  * Write the bytes to a file.
  *
@@ -5384,4 +5467,6 @@ struct vnops zfs_vnops = {
 	NULL,				/* setattr */
 	zfs_inactive,			/* inactive */
 	zfs_truncate,			/* truncate */
+	zfs_loan,			/* loan */
+	zfs_unloan,			/* unloan */
 };
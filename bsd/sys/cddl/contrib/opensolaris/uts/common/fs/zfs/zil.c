@@ -1188,6 +1188,129 @@ zil_aitx_compare(const void *x1, const void *x2)
 	return (0);
 }
 
+static void
+zil_itx_free_list(zilog_t *zilog, list_t *list)
+{
+	itx_t *itx;
+
+	while ((itx = list_remove_head(list)) != NULL) {
+		if (itx->itx_sync)
+			atomic_add_64(&zilog->zl_itx_list_sz, -itx->itx_sod);
+		zil_itx_destroy(itx);
+	}
+}
+
+/*
+ * Merge src into dst.  Both are in itx_seq order.
+ */
+static void
+zil_itx_list_merge(list_t *dst, list_t *src)
+{
+	itx_t *itx, *next = list_head(dst);
+
+	while ((itx = list_remove_head(src)) != NULL) {
+		while (next != NULL && next->itx_seq < itx->itx_seq)
+			next = list_next(dst, next);
+		if (next != NULL)
+			list_insert_before(dst, next, itx);
+		else
+			list_insert_tail(dst, itx);
+	}
+}
+
+/*
+ * Move the itxs the cpus queued for txg into itxg, in the order they were
+ * assigned, and free the ones left from a txg that has synced since.
+ * Called with the itxg_lock held, before looking at the itxg's lists.
+ *
+ * An itx which is still being queued (on another cpu) while we merge
+ * will just be picked up by the next merge.  That is fine: it cannot be
+ * for an operation which the ones we merge now depend on, as those only
+ * start once the itxs they depend on are queued.
+ */
+static void
+zil_itxg_merge(zilog_t *zilog, itxg_t *itxg, uint64_t txg)
+{
+	int t = txg & TXG_MASK;
+	list_t merge, stale;
+	itxs_t *itxs, *clean = NULL;
+	itx_t *itx;
+
+	ASSERT(MUTEX_HELD(&itxg->itxg_lock));
+
+	list_create(&merge, sizeof (itx_t), offsetof(itx_t, itx_node));
+	list_create(&stale, sizeof (itx_t), offsetof(itx_t, itx_node));
+	for (int c = 0; c < max_ncpus; c++) {
+		zil_cpu_t *zc = &zilog->zl_cpu[c];
+
+		if (list_is_empty(&zc->zc_itxs[t]))
+			continue;
+		mutex_enter(&zc->zc_lock);
+		if (zc->zc_txg[t] == txg)
+			zil_itx_list_merge(&merge, &zc->zc_itxs[t]);
+		else if (zc->zc_txg[t] < txg)
+			list_move_tail(&stale, &zc->zc_itxs[t]);
+		mutex_exit(&zc->zc_lock);
+	}
+	zil_itx_free_list(zilog, &stale);
+	list_destroy(&stale);
+
+	if (list_is_empty(&merge)) {
+		list_destroy(&merge);
+		return;
+	}
+
+	itxs = itxg->itxg_itxs;
+	if (itxg->itxg_txg != txg) {
+		if (itxs != NULL) {
+			/*
+			 * The zil_clean callback hasn't got around to cleaning
+			 * this itxg. Save the itxs for release below.
+			 * This should be rare.
+			 */
+			atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
+			itxg->itxg_sod = 0;
+			clean = itxg->itxg_itxs;
+		}
+		ASSERT(itxg->itxg_sod == 0);
+		itxg->itxg_txg = txg;
+		itxs = itxg->itxg_itxs = kmem_zalloc(sizeof (itxs_t), KM_SLEEP);
+
+		list_create(&itxs->i_sync_list, sizeof (itx_t),
+		    offsetof(itx_t, itx_node));
+		avl_create(&itxs->i_async_tree, zil_aitx_compare,
+		    sizeof (itx_async_node_t),
+		    offsetof(itx_async_node_t, ia_node));
+	}
+
+	while ((itx = list_remove_head(&merge)) != NULL) {
+		if (itx->itx_sync) {
+			list_insert_tail(&itxs->i_sync_list, itx);
+			itxg->itxg_sod += itx->itx_sod;
+		} else {
+			avl_tree_t *t = &itxs->i_async_tree;
+			uint64_t foid = ((lr_ooo_t *)&itx->itx_lr)->lr_foid;
+			itx_async_node_t *ian;
+			avl_index_t where;
+
+			ian = avl_find(t, &foid, &where);
+			if (ian == NULL) {
+				ian = kmem_alloc(sizeof (itx_async_node_t),
+				    KM_SLEEP);
+				list_create(&ian->ia_list, sizeof (itx_t),
+				    offsetof(itx_t, itx_node));
+				ian->ia_foid = foid;
+				avl_insert(t, ian, where);
+			}
+			list_insert_tail(&ian->ia_list, itx);
+		}
+	}
+	list_destroy(&merge);
+
+	if (clean != NULL)
+		zil_itxg_clean(clean);
+}
+
 /*
  * Remove all async itx with the given oid.
  */
@@ -1213,6 +1336,7 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
 
 		mutex_enter(&itxg->itxg_lock);
+		zil_itxg_merge(zilog, itxg, txg);
 		if (itxg->itxg_txg != txg) {
 			mutex_exit(&itxg->itxg_lock);
 			continue;
@@ -1239,8 +1363,9 @@ void
 zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 {
 	uint64_t txg;
-	itxg_t *itxg;
-	itxs_t *itxs, *clean = NULL;
+	zil_cpu_t *zc;
+	list_t stale;
+	int t;
 
 	/*
 	 * Object ids can be re-instantiated in the next txg so
@@ -1263,58 +1388,33 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 	else
 		txg = dmu_tx_get_txg(tx);
 
-	itxg = &zilog->zl_itxg[txg & TXG_MASK];
-	mutex_enter(&itxg->itxg_lock);
-	itxs = itxg->itxg_itxs;
-	if (itxg->itxg_txg != txg) {
-		if (itxs != NULL) {
-			/*
-			 * The zil_clean callback hasn't got around to cleaning
-			 * this itxg. Save the itxs for release below.
-			 * This should be rare.
-			 */
-			atomic_add_64(&zilog->zl_itx_list_sz, -itxg->itxg_sod);
-			itxg->itxg_sod = 0;
-			clean = itxg->itxg_itxs;
-		}
-		ASSERT(itxg->itxg_sod == 0);
-		itxg->itxg_txg = txg;
-		itxs = itxg->itxg_itxs = kmem_zalloc(sizeof (itxs_t), KM_SLEEP);
+	itx->itx_lr.lrc_txg = dmu_tx_get_txg(tx);
+	if (itx->itx_sync)
+		atomic_add_64(&zilog->zl_itx_list_sz, itx->itx_sod);
 
-		list_create(&itxs->i_sync_list, sizeof (itx_t),
-		    offsetof(itx_t, itx_node));
-		avl_create(&itxs->i_async_tree, zil_aitx_compare,
-		    sizeof (itx_async_node_t),
-		    offsetof(itx_async_node_t, ia_node));
+	list_create(&stale, sizeof (itx_t), offsetof(itx_t, itx_node));
+	zc = &zilog->zl_cpu[CPU_SEQID];
+	t = txg & TXG_MASK;
+	mutex_enter(&zc->zc_lock);
+	if (zc->zc_txg[t] != txg) {
+		/*
+		 * Left over from a txg that has synced since, without
+		 * anybody merging them.  Release them below.
+		 */
+		list_move_tail(&stale, &zc->zc_itxs[t]);
+		zc->zc_txg[t] = txg;
 	}
-	if (itx->itx_sync) {
-		list_insert_tail(&itxs->i_sync_list, itx);
-		atomic_add_64(&zilog->zl_itx_list_sz, itx->itx_sod);
-		itxg->itxg_sod += itx->itx_sod;
-	} else {
-		avl_tree_t *t = &itxs->i_async_tree;
-		uint64_t foid = ((lr_ooo_t *)&itx->itx_lr)->lr_foid;
-		itx_async_node_t *ian;
-		avl_index_t where;
-
-		ian = avl_find(t, &foid, &where);
-		if (ian == NULL) {
-			ian = kmem_alloc(sizeof (itx_async_node_t), KM_SLEEP);
-			list_create(&ian->ia_list, sizeof (itx_t),
-			    offsetof(itx_t, itx_node));
-			ian->ia_foid = foid;
-			avl_insert(t, ian, where);
-		}
-		list_insert_tail(&ian->ia_list, itx);
+	itx->itx_seq = MAX(gethrtime(), zc->zc_seq + 1);
+	zc->zc_seq = itx->itx_seq;
+	list_insert_tail(&zc->zc_itxs[t], itx);
+	if (zc->zc_dirty_txg != txg || txg == ZILTEST_TXG) {
+		zilog_dirty(zilog, txg);
+		zc->zc_dirty_txg = txg;
 	}
+	mutex_exit(&zc->zc_lock);
 
-	itx->itx_lr.lrc_txg = dmu_tx_get_txg(tx);
-	zilog_dirty(zilog, txg);
-	mutex_exit(&itxg->itxg_lock);
-
-	/* Release the old itxs now we've dropped the lock */
-	if (clean != NULL)
-		zil_itxg_clean(clean);
+	zil_itx_free_list(zilog, &stale);
+	list_destroy(&stale);
 }
 
 /*
@@ -1331,6 +1431,7 @@ zil_clean(zilog_t *zilog, uint64_t synced_txg)
 	itxs_t *clean_me;
 
 	mutex_enter(&itxg->itxg_lock);
+	zil_itxg_merge(zilog, itxg, synced_txg);
 	if (itxg->itxg_itxs == NULL || itxg->itxg_txg == ZILTEST_TXG) {
 		mutex_exit(&itxg->itxg_lock);
 		return;
@@ -1374,6 +1475,7 @@ zil_get_commit_list(zilog_t *zilog)
 		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
 
 		mutex_enter(&itxg->itxg_lock);
+		zil_itxg_merge(zilog, itxg, txg);
 		if (itxg->itxg_txg != txg) {
 			mutex_exit(&itxg->itxg_lock);
 			continue;
@@ -1408,6 +1510,7 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
 
 		mutex_enter(&itxg->itxg_lock);
+		zil_itxg_merge(zilog, itxg, txg);
 		if (itxg->itxg_txg != txg) {
 			mutex_exit(&itxg->itxg_lock);
 			continue;
@@ -1514,6 +1617,66 @@ zil_commit_writer(zilog_t *zilog)
 		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
 }
 
+/*
+ * Group commit windows.  When recent batches had several committers, a
+ * new writer waits a little before collecting the itxs, so the committers
+ * arriving right behind it join its batch rather than waiting for it to
+ * finish and then paying for another round of log writes and cache
+ * flushes.  The wait is bounded by a share (zil_batch_window_pct) of the
+ * average commit time and by zil_batch_window_max, and ends as soon as
+ * an average batch worth of committers has arrived.  A single thread
+ * calling fsync() never waits.
+ */
+int zil_batch_window_pct = 25;
+int zil_batch_window_max = 1000;	/* microseconds */
+TUNABLE_INT("vfs.zfs.zil_batch_window_pct", &zil_batch_window_pct);
+SYSCTL_INT(_vfs_zfs, OID_AUTO, zil_batch_window_pct, CTLFLAG_RW,
+    &zil_batch_window_pct, 0,
+    "Max wait for a commit batch to fill, in percent of the commit time");
+TUNABLE_INT("vfs.zfs.zil_batch_window_max", &zil_batch_window_max);
+SYSCTL_INT(_vfs_zfs, OID_AUTO, zil_batch_window_max, CTLFLAG_RW,
+    &zil_batch_window_max, 0,
+    "Max wait for a commit batch to fill, in microseconds");
+
+static void
+zil_commit_window(zilog_t *zilog)
+{
+	hrtime_t window, deadline;
+
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+
+	if (zilog->zl_batch_avg < 2 * 16)
+		return;
+
+	window = MIN(zilog->zl_commit_avg * zil_batch_window_pct / 100,
+	    (hrtime_t)zil_batch_window_max * 1000);
+	deadline = gethrtime() + window;
+
+	zilog->zl_batch_window = B_TRUE;
+	while (zilog->zl_batch_cnt * 16 < zilog->zl_batch_avg) {
+		if (cv_timedwait_hires(&zilog->zl_cv_window, &zilog->zl_lock,
+		    deadline, 0, CALLOUT_FLAG_ABSOLUTE) == -1)
+			break;
+	}
+	zilog->zl_batch_window = B_FALSE;
+}
+
+/*
+ * Moving averages of batch size and commit time, which size the window.
+ */
+static void
+zil_commit_stats(zilog_t *zilog, uint64_t ncommitters, hrtime_t time)
+{
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+
+	zilog->zl_batch_avg += (int64_t)(ncommitters * 16 -
+	    zilog->zl_batch_avg) / 8;
+	if (zilog->zl_commit_avg == 0)
+		zilog->zl_commit_avg = time;
+	else
+		zilog->zl_commit_avg += (time - zilog->zl_commit_avg) / 8;
+}
+
 /*
  * Commit zfs transactions to stable storage.
  * If foid is 0 push out all transactions, otherwise push only those
@@ -1540,7 +1703,8 @@ zil_commit_writer(zilog_t *zilog)
 void
 zil_commit(zilog_t *zilog, uint64_t foid)
 {
-	uint64_t mybatch;
+	uint64_t mybatch, ncommitters;
+	hrtime_t start;
 
 	if (zilog->zl_sync == ZFS_SYNC_DISABLED)
 		return;
@@ -1550,6 +1714,10 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 
 	mutex_enter(&zilog->zl_lock);
 	mybatch = zilog->zl_next_batch;
+	zilog->zl_batch_cnt++;
+	if (zilog->zl_batch_window &&
+	    zilog->zl_batch_cnt * 16 >= zilog->zl_batch_avg)
+		cv_signal(&zilog->zl_cv_window);
 	while (zilog->zl_writer) {
 		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
 		if (mybatch <= zilog->zl_com_batch) {
@@ -1558,9 +1726,16 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 		}
 	}
 
-	zilog->zl_next_batch++;
 	zilog->zl_writer = B_TRUE;
+	zil_commit_window(zilog);
+	zilog->zl_next_batch++;
+	ncommitters = zilog->zl_batch_cnt;
+	zilog->zl_batch_cnt = 0;
+
+	start = gethrtime();
 	zil_commit_writer(zilog);
+	zil_commit_stats(zilog, ncommitters, gethrtime() - start);
+
 	zilog->zl_com_batch = mybatch;
 	zilog->zl_writer = B_FALSE;
 	mutex_exit(&zilog->zl_lock);
@@ -1691,6 +1866,21 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 		    MUTEX_DEFAULT, NULL);
 	}
 
+	/* kmem_zalloc() doesn't align to a cache line, as zil_cpu_t wants */
+	zilog->zl_cpu_buf = kmem_zalloc(max_ncpus * sizeof (zil_cpu_t) +
+	    CACHE_LINE_SIZE, KM_SLEEP);
+	zilog->zl_cpu = (zil_cpu_t *)P2ROUNDUP((uintptr_t)zilog->zl_cpu_buf,
+	    CACHE_LINE_SIZE);
+	for (int c = 0; c < max_ncpus; c++) {
+		zil_cpu_t *zc = &zilog->zl_cpu[c];
+
+		mutex_init(&zc->zc_lock, NULL, MUTEX_DEFAULT, NULL);
+		for (int i = 0; i < TXG_SIZE; i++) {
+			list_create(&zc->zc_itxs[i], sizeof (itx_t),
+			    offsetof(itx_t, itx_node));
+		}
+	}
+
 	list_create(&zilog->zl_lwb_list, sizeof (lwb_t),
 	    offsetof(lwb_t, lwb_node));
 
@@ -1706,6 +1896,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	cv_init(&zilog->zl_cv_suspend, NULL, CV_DEFAULT, NULL);
 	cv_init(&zilog->zl_cv_batch[0], NULL, CV_DEFAULT, NULL);
 	cv_init(&zilog->zl_cv_batch[1], NULL, CV_DEFAULT, NULL);
+	cv_init(&zilog->zl_cv_window, NULL, CV_DEFAULT, NULL);
 
 	return (zilog);
 }
@@ -1737,12 +1928,25 @@ zil_free(zilog_t *zilog)
 		mutex_destroy(&zilog->zl_itxg[i].itxg_lock);
 	}
 
+	for (int c = 0; c < max_ncpus; c++) {
+		zil_cpu_t *zc = &zilog->zl_cpu[c];
+
+		for (int i = 0; i < TXG_SIZE; i++) {
+			zil_itx_free_list(zilog, &zc->zc_itxs[i]);
+			list_destroy(&zc->zc_itxs[i]);
+		}
+		mutex_destroy(&zc->zc_lock);
+	}
+	kmem_free(zilog->zl_cpu_buf, max_ncpus * sizeof (zil_cpu_t) +
+	    CACHE_LINE_SIZE);
+
 	mutex_destroy(&zilog->zl_lock);
 
 	cv_destroy(&zilog->zl_cv_writer);
 	cv_destroy(&zilog->zl_cv_suspend);
 	cv_destroy(&zilog->zl_cv_batch[0]);
 	cv_destroy(&zilog->zl_cv_batch[1]);
+	cv_destroy(&zilog->zl_cv_window);
 
 	kmem_free(zilog, sizeof (zilog_t));
 }
@@ -209,6 +209,8 @@ zio_init(void)
 		zfs_mg_alloc_failures = 8;
 
 	zio_inject_init();
+
+	lz4_init();
 }
 
 void
@@ -236,6 +238,8 @@ zio_fini(void)
 	kmem_cache_destroy(zio_cache);
 
 	zio_inject_fini();
+
+	lz4_fini();
 }
 
 /*
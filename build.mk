@@ -51,6 +51,9 @@ ASFLAGS = -g $(autodepend) -DASSEMBLY
 
 fs/vfs/main.o: CXXFLAGS += -Wno-sign-compare -Wno-write-strings
 
+# only entered after checking the cpu supports AVX2
+arch/x64/zfs-checksum-avx2.o: CXXFLAGS += -mavx2
+
 bsd/%.o: INCLUDES += -isystem $(src)/bsd/sys
 # for machine/
 bsd/%.o: INCLUDES += -isystem $(src)/bsd/ 
@@ -128,6 +131,7 @@ tests += tests/tst-tracepoint.so
 tests += tests/tst-hub.so
 tests += tests/tst-leak.so tests/tst-mmap.so tests/tst-vfs.so
 tests += tests/tst-mmap-file.so
+tests += tests/tst-bio-plug.so
 tests += tests/tst-mutex.so
 tests += tests/tst-sockets.so
 tests += tests/tst-bsd-tcp1.so
@@ -135,11 +139,23 @@ tests += tests/tst-condvar.so
 tests += tests/tst-queue-mpsc.so
 tests += tests/tst-af-local.so
 tests += tests/tst-pipe.so
+tests += tests/tst-pipe-bench.so
+tests += tests/tst-dladdr.so
+tests += tests/tst-sampler.so
+tests += tests/tst-schedstat.so
+tests += tests/tst-lockstat.so
+tests += tests/tst-heapprof.so
+tests += tests/tst-fpu-preempt.so
+tests += tests/tst-dcache.so
+tests += tests/tst-prelink.so
 tests += tests/tst-yield.so
 tests += tests/tst-ctxsw.so
 tests += tests/tst-readdir.so
 tests += tests/tst-wake.so
 tests += tests/tst-epoll.so
+tests += tests/tst-eventfd.so
+tests += tests/tst-fds.so
+tests += tests/tst-aio.so
 tests += tests/tst-lfring.so
 tests += tests/tst-fsx.so
 tests += tests/tst-resolve.so
@@ -156,6 +172,11 @@ tools/%.o: COMMON += -fPIC
 tools := tools/ifconfig/ifconfig.so
 tools += tools/route/lsroute.so
 
+# Benchmarks: they only measure, so they are not in the tests list, and
+# are installed in usr.img rather than in bootfs
+misc/%.o: COMMON += -fPIC
+bench := misc/dlopen-bench.so
+
 all: loader.img loader.bin usr.img
 
 boot.bin: arch/x64/boot16.ld arch/x64/boot16.o
@@ -354,6 +375,7 @@ zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/dsl_scan.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/dsl_synctask.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/gzip.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/lzjb.o
+zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/lz4.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/metaslab.o
 zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/refcount.o
 #zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/rrwlock.o
@@ -411,8 +433,11 @@ zfs += bsd/sys/cddl/contrib/opensolaris/uts/common/fs/zfs/zrlock.o
 
 zfs-tests += tests/tst-zfs-simple.so
 zfs-tests += tests/tst-zfs-disk.so
+zfs-tests += tests/tst-zfs-compress.so
+zfs-tests += tests/tst-zfs-checksum.so
 
 tests += tests/tst-zfs-mount.so
+tests += tests/tst-zfs-mmap.so
 
 solaris += $(zfs)
 solaris-tests += $(zfs-tests)
@@ -454,6 +479,7 @@ drivers += drivers/virtio-net.o
 drivers += drivers/virtio-blk.o
 drivers += drivers/clock.o drivers/kvmclock.o drivers/xenclock.o
 drivers += drivers/clockevent.o
+drivers += drivers/report-device.o
 drivers += drivers/acpi.o
 drivers += drivers/hpet.o
 drivers += drivers/xenfront.o drivers/xenfront-xenbus.o drivers/xenfront-blk.o
@@ -470,6 +496,8 @@ objects += arch/x64/smp.o
 objects += arch/x64/signal.o
 objects += arch/x64/cpuid.o
 objects += arch/x64/string.o
+objects += arch/x64/zfs-checksum.o
+objects += arch/x64/zfs-checksum-avx2.o
 objects += arch/x64/arch-cpu.o
 objects += arch/x64/entry-xen.o
 objects += arch/x64/xen.o
@@ -494,6 +522,8 @@ objects += core/mmio.o
 objects += core/kprintf.o
 objects += core/trace.o
 objects += core/callstack.o
+objects += core/sampler.o
+objects += core/lockstat.o
 objects += core/poll.o
 objects += core/select.o
 objects += core/epoll.o
@@ -502,6 +532,7 @@ objects += core/percpu.o
 objects += core/per-cpu-counter.o
 objects += core/percpu-worker.o
 objects += core/dhcp.o
+objects += core/init-graph.o
 
 include $(src)/fs/build.mk
 include $(src)/libc/build.mk
@@ -551,10 +582,45 @@ bsd/%.o: COMMON += -D_KERNEL -DSMP -D'__FBSDID(__str__)=extern int __bogus__' -D
 jni = java/jni/balloon.so java/jni/elf-loader.so java/jni/networking.so \
 	java/jni/stty.so java/jni/tracepoint.so java/jni/power.so
 
-usr.img: loader.img scripts/mkzfs.py usr.manifest $(jni)
+# "make slog=1" also builds slog.img, a separate intent log device for the
+# pool; pass --slog to scripts/run.py to attach it.
+ifeq ($(slog),1)
+slog-opt = -l slog.img
+endif
+
+# "make compression=lz4" (or any other algorithm ZFS has) compresses /usr.
+ifneq ($(compression),)
+compression-opt = -c $(compression)
+endif
+
+# "make bootset=/abs/FILE" lays out the files listed in FILE first and has them
+# prefetched when /usr is mounted.  FILE is the console output of running
+# the application with --bootset.
+ifneq ($(bootset),)
+bootset-opt = -b $(bootset)
+endif
+
+# "make prelink=1" relocates java.so and the JVM at build time; the kernel
+# maps the relocated data from /usr/.prelink instead of relocating them.
+ifeq ($(prelink),1)
+prelink-file = prelink.snap
+prelink-opt = -p prelink.snap
+endif
+
+prelink.snap: loader.elf scripts/mkprelink.py usr.manifest bootfs.manifest \
+		java/java.so
+	$(call quiet, $(src)/scripts/mkprelink.py -o $@ -d $@.d -k loader.elf \
+		-m $(src)/bootfs.manifest -m $(src)/usr.manifest \
+		-D jdkbase=$(jdkbase) -D gccbase=$(gccbase) -D \
+		glibcbase=$(glibcbase) -D miscbase=$(miscbase) \
+		-r java.so -r /usr/lib/jvm/jre/lib/amd64/server/libjvm.so, PRELINK $@)
+
+usr.img: loader.img scripts/mkzfs.py usr.manifest $(jni) $(bench) \
+		$(bootset) $(prelink-file)
 	$(src)/scripts/mkzfs.py -o $@ -d $@.d -m $(src)/usr.manifest \
 		-D jdkbase=$(jdkbase) -D gccbase=$(gccbase) -D \
-		glibcbase=$(glibcbase) -D miscbase=$(miscbase) -s $(zfs-start)
+		glibcbase=$(glibcbase) -D miscbase=$(miscbase) -s $(zfs-start) \
+		$(slog-opt) $(compression-opt) $(bootset-opt) $(prelink-opt)
 	$(call quiet, dd if=loader.img of=$@ conv=notrunc > /dev/null 2>&1)
 	$(call quiet, $(src)/scripts/imgedit.py setpartition $@ 2 $(zfs-start) $(zfs-size), IMGEDIT $@)
 	$(call quiet, rm loader.img)
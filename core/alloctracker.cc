@@ -8,8 +8,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <execinfo.h>
+#include <algorithm>
 
 #include "alloctracker.hh"
+#include <osv/execinfo.hh>
+#include "drivers/clock.hh"
+#include "drivers/report-device.hh"
+#include "elf.hh"
 
 namespace memory {
 
@@ -114,4 +119,322 @@ void alloc_tracker::forget(void *addr)
     }
 }
 
+heap_sampler heap_profiler;
+
+__thread s64 heap_sampler::bytes_until_sample;
+__thread bool heap_sampler::thread_seeded;
+__thread u64 heap_sampler::random_state;
+
+// marks a freed slot of the live object table, which lookups must skip
+static void* const tombstone = reinterpret_cast<void*>(1);
+
+static size_t table_size(size_t entries)
+{
+    // a power of two, at most 3/4 full
+    size_t size = 1;
+    while (size < entries * 4 / 3) {
+        size *= 2;
+    }
+    return size;
+}
+
+static size_t addr_hash(void* addr)
+{
+    return (reinterpret_cast<uintptr_t>(addr) >> 4) * 0x9e3779b97f4a7c15UL >> 20;
+}
+
+// the number of objects a sample of @weight bytes stands for
+static s64 sample_objects(size_t weight, size_t size)
+{
+    return size ? std::max<size_t>(1, weight / size) : 1;
+}
+
+void heap_sampler::start(size_t interval, size_t nr_sites, size_t nr_live)
+{
+    if (!_sites) {
+        _nr_sites = table_size(nr_sites);
+        _sites.reset(new site[_nr_sites]());
+        auto size = table_size(nr_live);
+        _live[0].reset(new live_object[size]());
+        _live[1].reset(new live_object[size]());
+        _live_mask = size - 1;
+        _live_table.store(_live[0].get());
+    }
+    WITH_LOCK(_lock) {
+        // concurrent frees can't tell a sampled object from its cleared
+        // slot, so make them retry like during a rehash
+        _rehash_seq.fetch_add(1);
+        std::fill(_sites.get(), _sites.get() + _nr_sites, site());
+        _used_sites = 0;
+        for (auto& table : _live) {
+            for (size_t i = 0; i <= _live_mask; ++i) {
+                table[i].addr.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        _used_live = 0;
+        _nr_live.store(0);
+        _dropped.store(0);
+        _interval = interval;
+        _rehash_seq.fetch_add(1);
+    }
+    _sampling.store(true);
+}
+
+void heap_sampler::stop()
+{
+    _sampling.store(false);
+}
+
+// uniform over [1, 2 * interval], so the average interval is right
+s64 heap_sampler::next_interval()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return 1 + random_state % (2 * _interval);
+}
+
+void heap_sampler::sample(void* addr, size_t size)
+{
+    if (!thread_seeded) {
+        // start a new thread somewhere in the interval, rather than sample
+        // its first allocation
+        thread_seeded = true;
+        random_state = (reinterpret_cast<uintptr_t>(&random_state)
+                        ^ clock::get()->time()) | 1;
+        bytes_until_sample += next_interval();
+        if (bytes_until_sample >= 0) {
+            return;
+        }
+    }
+    // each sample point this allocation spans stands for the interval bytes
+    // before it
+    size_t points = 0;
+    while (bytes_until_sample < 0) {
+        bytes_until_sample += next_interval();
+        ++points;
+    }
+    auto weight = points * _interval;
+
+    void* pc[max_frames];
+    unsigned len = backtrace_safe(pc, max_frames);
+    if (!len) {
+        pc[0] = nullptr;
+        len = 1;
+    }
+    WITH_LOCK(_lock) {
+        auto i = find_site(pc, len);
+        if (i == _nr_sites || !insert_live(addr, i, size, weight)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto& s = _sites[i];
+        auto objects = sample_objects(weight, size);
+        s.live_bytes += weight;
+        s.live_objects += objects;
+        s.total_bytes += weight;
+        s.total_objects += objects;
+    }
+}
+
+// Returns _nr_sites if the table is full
+unsigned heap_sampler::find_site(void** pc, unsigned len)
+{
+    size_t h = 0;
+    for (unsigned i = 0; i < len; ++i) {
+        h = (h ^ reinterpret_cast<uintptr_t>(pc[i])) * 0x100000001b3UL;
+    }
+    for (auto i = h; ; ++i) {
+        auto& s = _sites[i & (_nr_sites - 1)];
+        if (!s.len) {
+            if (_used_sites >= _nr_sites - _nr_sites / 4) {
+                return _nr_sites;
+            }
+            ++_used_sites;
+            s.len = len;
+            std::copy(pc, pc + len, s.pc);
+            return &s - _sites.get();
+        }
+        if (s.len == len && std::equal(pc, pc + len, s.pc)) {
+            return &s - _sites.get();
+        }
+    }
+}
+
+auto heap_sampler::find_live(live_object* table, void* addr) -> live_object*
+{
+    for (auto i = addr_hash(addr); ; ++i) {
+        auto& e = table[i & _live_mask];
+        auto a = e.addr.load(std::memory_order_relaxed);
+        if (a == addr) {
+            return &e;
+        }
+        if (!a) {
+            return nullptr;
+        }
+    }
+}
+
+bool heap_sampler::insert_live(void* addr, unsigned site, size_t size, size_t weight)
+{
+    if (_used_live >= _live_mask - _live_mask / 4) {
+        if (_nr_live.load() > _live_mask / 2) {
+            return false;
+        }
+        rehash_live();
+    }
+    auto table = _live_table.load(std::memory_order_relaxed);
+    for (auto i = addr_hash(addr); ; ++i) {
+        auto& e = table[i & _live_mask];
+        auto a = e.addr.load(std::memory_order_relaxed);
+        if (!a || a == tombstone) {
+            _used_live += !a;
+            e.site = site;
+            e.size = size;
+            e.weight = weight;
+            e.addr.store(addr, std::memory_order_release);
+            _nr_live.fetch_add(1);
+            return true;
+        }
+    }
+}
+
+// Move the live objects to the other table, dropping the tombstones
+void heap_sampler::rehash_live()
+{
+    _rehash_seq.fetch_add(1);
+    auto from = _live_table.load(std::memory_order_relaxed);
+    auto to = from == _live[0].get() ? _live[1].get() : _live[0].get();
+    for (size_t i = 0; i <= _live_mask; ++i) {
+        auto addr = from[i].addr.load(std::memory_order_relaxed);
+        if (!addr || addr == tombstone) {
+            continue;
+        }
+        for (auto j = addr_hash(addr); ; ++j) {
+            auto& e = to[j & _live_mask];
+            if (!e.addr.load(std::memory_order_relaxed)) {
+                e.site = from[i].site;
+                e.size = from[i].size;
+                e.weight = from[i].weight;
+                e.addr.store(addr, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    _live_table.store(to);
+    for (size_t i = 0; i <= _live_mask; ++i) {
+        from[i].addr.store(nullptr, std::memory_order_relaxed);
+    }
+    _used_live = _nr_live.load();
+    _rehash_seq.fetch_add(1);
+}
+
+void heap_sampler::forget(void* addr)
+{
+    // Almost all frees are of objects that weren't sampled; find that out
+    // without the lock, retrying if the table was rehashed meanwhile.
+    for (;;) {
+        auto seq = _rehash_seq.load(std::memory_order_acquire);
+        bool found = find_live(_live_table.load(std::memory_order_acquire), addr);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && _rehash_seq.load(std::memory_order_relaxed) == seq) {
+            if (!found) {
+                return;
+            }
+            break;
+        }
+    }
+    WITH_LOCK(_lock) {
+        auto e = find_live(_live_table.load(std::memory_order_relaxed), addr);
+        if (!e) {
+            return;
+        }
+        auto& s = _sites[e->site];
+        s.live_bytes -= e->weight;
+        s.live_objects -= sample_objects(e->weight, e->size);
+        e->addr.store(tombstone, std::memory_order_relaxed);
+        _nr_live.fetch_sub(1);
+    }
+}
+
+std::vector<heap_sampler::site> heap_sampler::sites()
+{
+    std::vector<site> ret;
+    if (!_sites) {
+        return ret;
+    }
+    // don't allocate under the spinlock
+    ret.reserve(_nr_sites);
+    WITH_LOCK(_lock) {
+        for (size_t i = 0; i < _nr_sites; ++i) {
+            if (_sites[i].len) {
+                ret.push_back(_sites[i]);
+            }
+        }
+    }
+    std::sort(ret.begin(), ret.end(), [] (const site& a, const site& b) {
+        return a.live_bytes > b.live_bytes
+            || (a.live_bytes == b.live_bytes && a.total_bytes > b.total_bytes);
+    });
+    return ret;
+}
+
+std::string heap_sampler::report(size_t n)
+{
+    std::string ret;
+    auto all = sites();
+    s64 live = 0;
+    for (auto& s : all) {
+        live += s.live_bytes;
+    }
+    report_printf(ret, "%s, sampling every %lu bytes, %lu samples dropped (tables full)\n",
+                  sampling() ? "running" : "stopped", _interval, _dropped.load());
+    report_printf(ret, "%ld live bytes (estimated) in %lu sites\n", live, all.size());
+    if (all.size() > n) {
+        all.resize(n);
+    }
+    for (auto& s : all) {
+        report_printf(ret, "\n%12ld live bytes %10ld live objects %14lu bytes %10lu objects allocated\n",
+                      s.live_bytes, s.live_objects, s.total_bytes, s.total_objects);
+        for (unsigned i = 0; i < s.len; ++i) {
+            report_printf(ret, "    %p ", s.pc[i]);
+            ret += elf::get_program()->symbol_name(s.pc[i]) + "\n";
+        }
+    }
+    return ret;
+}
+
+void heap_sampler::write_pprof(FILE* f)
+{
+    auto all = sites();
+    s64 live_objects = 0, live_bytes = 0;
+    u64 total_objects = 0, total_bytes = 0;
+    for (auto& s : all) {
+        live_objects += s.live_objects;
+        live_bytes += s.live_bytes;
+        total_objects += s.total_objects;
+        total_bytes += s.total_bytes;
+    }
+    // the counts are already scaled up from the samples, so the profile is
+    // marked as unsampled
+    fprintf(f, "heap profile: %6ld: %8ld [%6lu: %8lu] @ heap\n",
+            live_objects, live_bytes, total_objects, total_bytes);
+    for (auto& s : all) {
+        fprintf(f, "%6ld: %8ld [%6lu: %8lu] @", s.live_objects,
+                s.live_bytes, s.total_objects, s.total_bytes);
+        for (unsigned i = 0; i < s.len; ++i) {
+            fprintf(f, " %p", s.pc[i]);
+        }
+        fprintf(f, "\n");
+    }
+    // the address space, so pprof can find the object each address is in
+    fprintf(f, "\nMAPPED_LIBRARIES:\n");
+    fputs(elf::get_program()->maps().c_str(), f);
+}
+
+void heap_profiler_device_init()
+{
+    create_report_device("heapprof", [] { return heap_profiler.report(); });
+}
+
 }
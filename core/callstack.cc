@@ -98,11 +98,6 @@ inline bool operator==(const callstack_collector::trace& a,
     return a.len == b.len && std::equal(a.pc, a.pc + a.len, b.pc);
 }
 
-inline bool bt_trace_compare(void** bt, const callstack_collector::trace& b)
-{
-    return std::equal(bt, bt + b.len, b.pc);
-}
-
 struct backtrace_hash {
     backtrace_hash(unsigned nr) : nr(nr) {}
     size_t operator()(void* const * bt) const {
@@ -126,6 +121,9 @@ size_t hash_value(const callstack_collector::trace& a)
 callstack_collector::trace* callstack_collector::alloc_trace(void** pc, unsigned len)
 {
     auto t = _free_traces.fetch_add(trace_object_size(), std::memory_order_relaxed);
+    if (t >= _buffer + _nr_traces * trace_object_size()) {
+        return nullptr;
+    }
     return new (t) trace(pc, len);
 }
 
@@ -144,9 +142,19 @@ void callstack_collector::hit()
     int nr = backtrace_safe(bt, std::min(100u, _skip_frames + _nr_frames));
     bt += _skip_frames;
     nr -= _skip_frames;
+    if (nr > 0) {
+        add(bt, nr);
+    }
+}
+
+void callstack_collector::add(void** bt, unsigned nr)
+{
+    nr = std::min(nr, _nr_frames);
     auto table = _table->get();
     backtrace_hash hash(nr);
-    auto i = table->find(bt, hash, bt_trace_compare);
+    auto i = table->find(bt, hash, [nr] (void** bt, const trace& b) {
+        return b.len == nr && std::equal(bt, bt + nr, b.pc);
+    });
     if (i == table->end()) {
         // new unique trace, copy and store it
         auto t = alloc_trace(bt, nr);
@@ -20,6 +20,9 @@
 #include <cxxabi.h>
 #include <iterator>
 #include <sched.hh>
+#include <osv/trace.hh>
+
+TRACEPOINT(trace_elf_snapshot_stale, "%s", const char*);
 
 namespace {
     typedef boost::format fmt;
@@ -82,6 +85,9 @@ object::object(program& prog, std::string pathname)
     , _tls_init_size()
     , _tls_uninit_size()
     , _dynamic_table(nullptr)
+    , _snapshot(nullptr)
+    , _identity(0)
+    , _addr_index_ready(false)
     , _visibility(nullptr)
 {
 }
@@ -102,6 +108,11 @@ void object::setprivate(bool priv)
              std::memory_order_release);
 }
 
+bool object::isprivate(void) const
+{
+    return _visibility.load(std::memory_order_acquire) != nullptr;
+}
+
 
 template <>
 void* object::lookup(const char* symbol)
@@ -213,6 +224,8 @@ void file::load_program_headers()
 namespace {
 
 ulong page_size = 4096;
+// Elf64_Phdr::p_flags of a writable segment
+const Elf64_Word pf_w = 2;
 
 }
 
@@ -222,8 +235,18 @@ void file::load_segment(const Elf64_Phdr& phdr)
     ulong filesz_unaligned = phdr.p_vaddr + phdr.p_filesz - vstart;
     ulong filesz = align_up(filesz_unaligned, page_size);
     ulong memsz = align_up(phdr.p_vaddr + phdr.p_memsz, page_size) - vstart;
+    auto f = _f;
+    auto offset = align_down(phdr.p_offset, page_size);
+    if (_snapshot) {
+        for (auto& seg : _snapshot->segments) {
+            if (seg.vaddr == vstart && seg.size == filesz) {
+                f = _snapshot->file;
+                offset = seg.offset;
+            }
+        }
+    }
     mmu::map_file(_base + vstart, filesz, false, mmu::perm_rwx,
-                  _f, align_down(phdr.p_offset, page_size), false);
+                  f, offset, false);
     memset(_base + vstart + filesz_unaligned, 0, filesz - filesz_unaligned);
     mmu::map_anon(_base + vstart + filesz, memsz - filesz, false, mmu::perm_rwx);
 }
@@ -258,6 +281,12 @@ void object::load_segments()
             throw std::runtime_error("bad p_type");
         }
     }
+    // Now, while loading may read the file anyway, rather than in the first
+    // lookup_addr(), which may come from a backtrace or a profiler
+    if (!_addr_index_ready.load(std::memory_order_relaxed)) {
+        build_addr_index();
+        _addr_index_ready.store(true, std::memory_order_release);
+    }
 }
 
 void file::unload_segment(const Elf64_Phdr& phdr)
@@ -376,12 +405,22 @@ Elf64_Xword object::symbol_tls_module(unsigned idx)
     return 0;
 }
 
-void object::relocate_rela()
+void object::relocate_rela(const std::vector<u32>* which)
 {
     auto rela = dynamic_ptr<Elf64_Rela>(DT_RELA);
     assert(dynamic_val(DT_RELAENT) == sizeof(Elf64_Rela));
     unsigned nb = dynamic_val(DT_RELASZ) / sizeof(Elf64_Rela);
-    for (auto p = rela; p < rela + nb; ++p) {
+    // A large object refers to the same symbol from many places (vtables,
+    // GOT entries), so look each one up only once.
+    std::unordered_map<u32, symbol_module> resolved;
+    auto resolve = [&] (u32 sym) -> const symbol_module& {
+        auto i = resolved.find(sym);
+        if (i == resolved.end()) {
+            i = resolved.emplace(sym, symbol(sym)).first;
+        }
+        return i->second;
+    };
+    auto apply = [&] (const Elf64_Rela* p) {
         auto info = p->r_info;
         u32 sym = info >> 32;
         u32 type = info & 0xffffffff;
@@ -391,28 +430,38 @@ void object::relocate_rela()
         case R_X86_64_NONE:
             break;
         case R_X86_64_64:
-            *static_cast<void**>(addr) = symbol(sym).relocated_addr() + addend;
+            *static_cast<void**>(addr) = resolve(sym).relocated_addr() + addend;
             break;
         case R_X86_64_RELATIVE:
             *static_cast<void**>(addr) = _base + addend;
             break;
         case R_X86_64_JUMP_SLOT:
         case R_X86_64_GLOB_DAT:
-            *static_cast<void**>(addr) = symbol(sym).relocated_addr();
+            *static_cast<void**>(addr) = resolve(sym).relocated_addr();
             break;
         case R_X86_64_DPTMOD64:
             *static_cast<u64*>(addr) = symbol_tls_module(sym);
             break;
         case R_X86_64_DTPOFF64:
-            *static_cast<u64*>(addr) = symbol(sym).symbol->st_value;
+            *static_cast<u64*>(addr) = resolve(sym).symbol->st_value;
             break;
         case R_X86_64_TPOFF64:
-            *static_cast<u64*>(addr) = symbol(sym).symbol->st_value - tls_data().size;
+            *static_cast<u64*>(addr) = resolve(sym).symbol->st_value - tls_data().size;
             break;
         default:
             debug("unknown relocation type %d\n", type);
             abort();
         }
+    };
+    if (which) {
+        for (auto i : *which) {
+            assert(i < nb);
+            apply(rela + i);
+        }
+    } else {
+        for (auto p = rela; p < rela + nb; ++p) {
+            apply(p);
+        }
     }
 }
 
@@ -435,7 +484,7 @@ void object::relocate_pltgot()
     for (auto p = rel; p < rel + nrel; ++p) {
         auto info = p->r_info;
           u32 type = info & 0xffffffff;
-          assert(type = R_X86_64_JUMP_SLOT);
+          assert(type == R_X86_64_JUMP_SLOT);
           void *addr = _base + p->r_offset;
           if (original_plt) {
               // Restore the link to the original plt.
@@ -448,11 +497,31 @@ void object::relocate_pltgot()
               *static_cast<u64*>(addr) += reinterpret_cast<u64>(_base);
           }
     }
+    bind_pltgot();
+}
+
+void object::bind_pltgot()
+{
+    auto pltgot = dynamic_ptr<void*>(DT_PLTGOT);
     // PLTGOT resolution has a special calling convention, with the symbol
     // index and some word pushed on the stack, so we need an assembly
     // stub to convert it back to the standard calling convention.
     pltgot[1] = this;
     pltgot[2] = reinterpret_cast<void*>(__elf_resolve_pltgot);
+    // Otherwise each slot is bound by resolve_pltgot() on its first call
+    if (bind_now()) {
+        auto nrel = dynamic_val(DT_PLTRELSZ) / sizeof(Elf64_Rela);
+        for (unsigned i = 0; i < nrel; ++i) {
+            resolve_pltgot(i);
+        }
+    }
+}
+
+bool object::bind_now()
+{
+    return dynamic_exists(DT_BIND_NOW)
+        || (dynamic_exists(DT_FLAGS) && (dynamic_val(DT_FLAGS) & DF_BIND_NOW))
+        || (dynamic_exists(DT_FLAGS_1) && (dynamic_val(DT_FLAGS_1) & DF_1_NOW));
 }
 
 void* object::resolve_pltgot(unsigned index)
@@ -468,9 +537,146 @@ void* object::resolve_pltgot(unsigned index)
     return ret;
 }
 
+void object::set_snapshot(const snapshot_object* snapshot)
+{
+    _snapshot = snapshot;
+}
+
+namespace {
+
+const u64 fnv_basis = 0xcbf29ce484222325ULL;
+
+u64 fnv1a(u64 h, const void* data, size_t len)
+{
+    auto p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+}
+
+// What symbol lookups in this object depend on: its program headers and
+// its dynamic symbol and string tables, which are read-only; and what
+// relocating it depends on, see hash_contents().
+u64 object::identity()
+{
+    if (!_identity) {
+        unsigned nsyms = symtab_len();
+        auto h = fnv1a(fnv_basis, _phdrs.data(),
+                       _phdrs.size() * sizeof(Elf64_Phdr));
+        h = fnv1a(h, dynamic_ptr<void>(DT_SYMTAB), nsyms * sizeof(Elf64_Sym));
+        h = fnv1a(h, dynamic_ptr<void>(DT_STRTAB), dynamic_val(DT_STRSZ));
+        _identity = hash_contents(h);
+    }
+    return _identity;
+}
+
+// The kernel is never relocated by us, and its writable segments have been
+// written to since it was loaded, so only its symbols identify it.
+u64 object::hash_contents(u64 h)
+{
+    return h;
+}
+
+// A snapshot replaces the contents of the writable segments, so it must
+// have been made from this very file.  Hashing the relocation tables and
+// segments on every boot would cost more than relocating, so trust the
+// build-id the linker computed over the whole file, if it left one in a
+// loaded note, and the file's size.
+u64 file::hash_contents(u64 h)
+{
+    struct note_header {
+        Elf64_Word n_namesz;
+        Elf64_Word n_descsz;
+        Elf64_Word n_type;
+    };
+    const Elf64_Word nt_gnu_build_id = 3;
+    auto loaded = [&] (const Elf64_Phdr& note) {
+        for (auto& phdr : _phdrs) {
+            if (phdr.p_type == PT_LOAD && phdr.p_vaddr <= note.p_vaddr &&
+                note.p_vaddr + note.p_filesz <= phdr.p_vaddr + phdr.p_filesz) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (auto& phdr : _phdrs) {
+        if (phdr.p_type != PT_NOTE || !loaded(phdr)) {
+            continue;
+        }
+        auto notes = static_cast<const char*>(_base + phdr.p_vaddr);
+        ulong off = 0;
+        while (off + sizeof(note_header) <= phdr.p_filesz) {
+            auto n = reinterpret_cast<const note_header*>(notes + off);
+            auto name = off + sizeof(*n);
+            auto desc = name + align_up(u64(n->n_namesz), u64(4));
+            auto next = desc + align_up(u64(n->n_descsz), u64(4));
+            if (next > phdr.p_filesz) {
+                break;
+            }
+            if (n->n_type == nt_gnu_build_id && n->n_namesz == 4 &&
+                memcmp(notes + name, "GNU", 4) == 0) {
+                h = fnv1a(h, notes + desc, n->n_descsz);
+            }
+            off = next;
+        }
+    }
+    u64 file_size = size(_f);
+    return fnv1a(h, &file_size, sizeof(file_size));
+}
+
+// Relocating the object gives the same result as it did offline if the
+// object, its base and every module it can look symbols up in, at their
+// bases, are the same.
+u64 object::snapshot_hash()
+{
+    u64 h = fnv_basis;
+    auto add = [&] (object* obj) {
+        u64 v[2] = { obj->identity(), reinterpret_cast<u64>(obj->base()) };
+        h = fnv1a(h, v, sizeof(v));
+    };
+    add(this);
+    _prog.with_modules([&] (const std::vector<object*>& modules, int, int) {
+        for (auto module : modules) {
+            if (module->visible()) {
+                add(module);
+            }
+        }
+    });
+    return h;
+}
+
 void object::relocate()
 {
     assert(!dynamic_exists(DT_REL));
+    if (_snapshot) {
+        auto nrela = dynamic_exists(DT_RELA) ?
+                dynamic_val(DT_RELASZ) / sizeof(Elf64_Rela) : 0;
+        auto valid = [&] {
+            for (auto i : _snapshot->deferred) {
+                if (i >= nrela) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        if (snapshot_hash() == _snapshot->hash && valid()) {
+            if (!_snapshot->deferred.empty()) {
+                relocate_rela(&_snapshot->deferred);
+            }
+            if (dynamic_exists(DT_JMPREL)) {
+                bind_pltgot();
+            }
+            return;
+        }
+        trace_elf_snapshot_stale(_pathname.c_str());
+        debug(fmt("%s: stale prelink snapshot, relocating\n") % _pathname);
+        _snapshot = nullptr;
+        unload_segments();
+        load_segments();
+    }
     if (dynamic_exists(DT_RELA)) {
         relocate_rela();
     }
@@ -522,7 +728,7 @@ dl_new_hash(const char *s)
     return h & 0xffffffff;
 }
 
-Elf64_Sym* object::lookup_symbol_gnu(const char* name)
+Elf64_Sym* object::lookup_symbol_gnu(const char* name, u32 hashval)
 {
     auto symtab = dynamic_ptr<Elf64_Sym>(DT_SYMTAB);
     auto strtab = dynamic_ptr<char>(DT_STRTAB);
@@ -533,7 +739,6 @@ Elf64_Sym* object::lookup_symbol_gnu(const char* name)
     auto shift2 = hashtab[3];
     auto bloom = reinterpret_cast<const Elf64_Xword*>(hashtab + 4);
     auto C = sizeof(*bloom) * 8;
-    auto hashval = dl_new_hash(name);
     auto bword = bloom[(hashval / C) % maskwords];
     auto hashbit1 = hashval % C;
     auto hashbit2 = (hashval >> shift2) % C;
@@ -558,13 +763,18 @@ Elf64_Sym* object::lookup_symbol_gnu(const char* name)
 }
 
 Elf64_Sym* object::lookup_symbol(const char* name)
+{
+    return lookup_symbol(name, dl_new_hash(name));
+}
+
+Elf64_Sym* object::lookup_symbol(const char* name, u32 gnu_hash)
 {
     if (!visible()) {
         return nullptr;
     }
     Elf64_Sym* sym;
     if (dynamic_exists(DT_GNU_HASH)) {
-        sym = lookup_symbol_gnu(name);
+        sym = lookup_symbol_gnu(name, gnu_hash);
     } else {
         sym = lookup_symbol_old(name);
     }
@@ -574,6 +784,11 @@ Elf64_Sym* object::lookup_symbol(const char* name)
     return sym;
 }
 
+const char* object::symbol_name(const Elf64_Sym* sym)
+{
+    return dynamic_ptr<const char>(DT_STRTAB) + sym->st_name;
+}
+
 unsigned object::symtab_len()
 {
     if (dynamic_exists(DT_HASH)) {
@@ -587,7 +802,8 @@ unsigned object::symtab_len()
     auto bloom = reinterpret_cast<const Elf64_Xword*>(hashtab + 4);
     auto buckets = reinterpret_cast<const Elf64_Word*>(bloom + maskwords);
     auto chains = buckets + nbucket - symndx;
-    unsigned len = 0;
+    // The symbols before symndx aren't hashed
+    unsigned len = symndx;
     for (unsigned b = 0; b < nbucket; ++b) {
         auto idx = buckets[b];
         if (idx == 0) {
@@ -600,42 +816,98 @@ unsigned object::symtab_len()
     return len;
 }
 
-dladdr_info object::lookup_addr(const void* addr)
+void object::load_symtab(std::vector<Elf64_Sym>& symtab,
+                         std::unique_ptr<char[]>& strtab)
 {
-    dladdr_info ret;
-    if (addr < _base || addr >= _end) {
-        return ret;
+}
+
+void file::load_symtab(std::vector<Elf64_Sym>& symtab,
+                       std::unique_ptr<char[]>& strtab)
+{
+    if (!_ehdr.e_shoff || _ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+        return;
     }
-    auto strtab = dynamic_ptr<char>(DT_STRTAB);
-    auto symtab = dynamic_ptr<Elf64_Sym>(DT_SYMTAB);
-    auto len = symtab_len();
-    symbol_module best;
-    for (unsigned i = 1; i < len; ++i) {
-        auto& sym = symtab[i];
-        auto type = sym.st_info & 15;
-        if (type != STT_OBJECT && type != STT_FUNC) {
+    std::vector<Elf64_Shdr> shdrs(_ehdr.e_shnum);
+    read(_f, shdrs.data(), _ehdr.e_shoff, shdrs.size() * sizeof(Elf64_Shdr));
+    for (auto& sh : shdrs) {
+        if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= shdrs.size()) {
             continue;
         }
-        auto bind = (sym.st_info >> 4) & 15;
-        if (bind != STB_GLOBAL && bind != STB_WEAK) {
-            continue;
-        }
-        symbol_module sm{&sym, this};
-        auto s_addr = sm.relocated_addr();
-        if (s_addr < addr) {
-            continue;
+        auto& str = shdrs[sh.sh_link];
+        symtab.resize(sh.sh_size / sizeof(Elf64_Sym));
+        read(_f, symtab.data(), sh.sh_offset, symtab.size() * sizeof(Elf64_Sym));
+        strtab.reset(new char[str.sh_size + 1]);
+        read(_f, strtab.get(), str.sh_offset, str.sh_size);
+        strtab[str.sh_size] = '\0';
+        // make sure every name is terminated
+        for (auto& sym : symtab) {
+            if (sym.st_name > str.sh_size) {
+                sym.st_name = str.sh_size;
+            }
         }
-        if (!best.symbol || sm.relocated_addr() < best.relocated_addr()) {
-            best = sm;
+        return;
+    }
+}
+
+void object::build_addr_index()
+{
+    auto add = [&] (const Elf64_Sym& sym, const char* name) {
+        auto type = sym.st_info & 15;
+        if ((type != STT_OBJECT && type != STT_FUNC)
+                || sym.st_shndx == SHN_UNDEF) {
+            return;
         }
+        void* base = sym.st_shndx == SHN_ABS ? nullptr : _base;
+        _addr_index.push_back({base + sym.st_value, sym.st_size, name});
+    };
+    auto strtab = dynamic_ptr<const char>(DT_STRTAB);
+    auto symtab = dynamic_ptr<Elf64_Sym>(DT_SYMTAB);
+    auto len = symtab_len();
+    for (unsigned i = 1; i < len; ++i) {
+        add(symtab[i], strtab + symtab[i].st_name);
+    }
+    // The static symbol table adds the local symbols; where both name a
+    // symbol, the stable sort keeps the dynamic one first.
+    std::vector<Elf64_Sym> static_symtab;
+    load_symtab(static_symtab, _symtab_strings);
+    for (auto& sym : static_symtab) {
+        add(sym, _symtab_strings.get() + sym.st_name);
+    }
+    std::stable_sort(_addr_index.begin(), _addr_index.end(),
+            [] (const addr_symbol& a, const addr_symbol& b) {
+                return a.addr < b.addr;
+            });
+    _addr_index.shrink_to_fit();
+}
+
+dladdr_info object::lookup_addr(const void* addr)
+{
+    dladdr_info ret;
+    if (addr < _base || addr >= _end) {
+        return ret;
     }
-    if (!best.symbol) {
+    // not loaded yet
+    if (!_addr_index_ready.load(std::memory_order_acquire)) {
         return ret;
     }
     ret.fname = _pathname.c_str();
     ret.base = _base;
-    ret.sym = strtab + best.symbol->st_name;
-    ret.addr = best.relocated_addr();
+    // The last symbol starting at or below addr, and the first of those
+    // starting at the same address
+    auto i = std::upper_bound(_addr_index.begin(), _addr_index.end(), addr,
+            [] (const void* a, const addr_symbol& s) { return a < s.addr; });
+    if (i == _addr_index.begin()) {
+        return ret;
+    }
+    --i;
+    while (i != _addr_index.begin() && std::prev(i)->addr == i->addr) {
+        --i;
+    }
+    if (i->size && addr >= i->addr + i->size) {
+        return ret;
+    }
+    ret.sym = i->name;
+    ret.addr = const_cast<void*>(i->addr);
     return ret;
 }
 
@@ -725,12 +997,94 @@ tls_data program::tls()
     return _core->tls();
 }
 
+bool program::load_snapshot(std::string path)
+{
+    auto f = fileref_from_fname(path);
+    if (!f) {
+        return false;
+    }
+    auto file_size = size(f);
+    struct {
+        char magic[8];
+        u64 nobjs;
+        u64 meta_size;
+    } hdr;
+    if (try_read(f, &hdr, 0, sizeof(hdr)) != 0 ||
+        memcmp(hdr.magic, "OSVPRLK1", sizeof(hdr.magic)) != 0) {
+        debug(fmt("%s: not a prelink snapshot\n") % path);
+        return false;
+    }
+    auto corrupt = [&] {
+        debug(fmt("%s: corrupt prelink snapshot, ignored\n") % path);
+        return false;
+    };
+    if (hdr.meta_size > file_size - sizeof(hdr)) {
+        return corrupt();
+    }
+    std::vector<char> meta(hdr.meta_size);
+    if (try_read(f, meta.data(), sizeof(hdr), meta.size()) != 0) {
+        return corrupt();
+    }
+    struct object_header {
+        char path[232];
+        u64 base;
+        u64 hash;
+        u32 nsegs;
+        u32 ndeferred;
+    };
+    // Take nothing from the file unless all of it makes sense
+    std::map<std::string, snapshot_object> snapshots;
+    auto p = meta.data();
+    auto end = p + meta.size();
+    for (u64 i = 0; i < hdr.nobjs; ++i) {
+        if (size_t(end - p) < sizeof(object_header)) {
+            return corrupt();
+        }
+        auto oh = reinterpret_cast<object_header*>(p);
+        p += sizeof(*oh);
+        auto segs_size = u64(oh->nsegs) * sizeof(snapshot_segment);
+        auto deferred_size = align_up(u64(oh->ndeferred) * sizeof(u32),
+                                      sizeof(u64));
+        if (segs_size + deferred_size > u64(end - p)) {
+            return corrupt();
+        }
+        auto& snap = snapshots[std::string(oh->path,
+                                           strnlen(oh->path, sizeof(oh->path)))];
+        snap.base = reinterpret_cast<void*>(oh->base);
+        snap.hash = oh->hash;
+        auto segs = reinterpret_cast<snapshot_segment*>(p);
+        snap.segments.assign(segs, segs + oh->nsegs);
+        for (auto& seg : snap.segments) {
+            if (seg.offset % page_size || seg.size % page_size ||
+                seg.offset > file_size || seg.size > file_size - seg.offset) {
+                return corrupt();
+            }
+        }
+        p += segs_size;
+        auto deferred = reinterpret_cast<u32*>(p);
+        snap.deferred.assign(deferred, deferred + oh->ndeferred);
+        p += deferred_size;
+        snap.file = f;
+    }
+    // Objects already loaded may point to the snapshots we have, so keep them
+    _snapshots.insert(snapshots.begin(), snapshots.end());
+    return true;
+}
+
 void program::set_object(std::string name, object* obj)
 {
     _files[name] = obj;
     if (std::find(_modules.begin(), _modules.end(), obj) == _modules.end()) {
         _modules.push_back(obj);
         _modules_adds++;
+        modules_changed();
+    }
+}
+
+void program::modules_changed()
+{
+    WITH_LOCK(_symbol_cache_mutex) {
+        _symbol_cache.clear();
     }
 }
 
@@ -785,6 +1139,10 @@ object* program::add_object(std::string name, std::vector<std::string> extra_pat
     if (!_files.count(name) && f) {
         auto ef = new file(*this, f, name);
         ef->set_base(_next_alloc);
+        auto snap = _snapshots.find(name);
+        if (snap != _snapshots.end() && snap->second.base == ef->base()) {
+            ef->set_snapshot(&snap->second);
+        }
         _files[name] = ef;
         ef->setprivate(true);
         // We need to push the object at the end of the list (so that the main
@@ -793,6 +1151,7 @@ object* program::add_object(std::string name, std::vector<std::string> extra_pat
         // list - We want it to behave like a library, not the main program.
         _modules.insert(std::prev(_modules.end()), ef);
         _modules_adds++;
+        modules_changed();
         ef->load_segments();
         _next_alloc = ef->end();
         add_debugger_obj(ef);
@@ -820,6 +1179,7 @@ void program::remove_object(std::string name)
     _files.erase(name);
     _modules.erase(std::find(_modules.begin(), _modules.end(), ef));
     _modules_subs++;
+    modules_changed();
     ef->unload_segments();
     delete ef;
 }
@@ -851,9 +1211,33 @@ void program::del_debugger_obj(object* obj)
 
 symbol_module program::lookup(const char* name)
 {
+    u32 hash = dl_new_hash(name);
+    int generation;
+    WITH_LOCK(_symbol_cache_mutex) {
+        auto range = _symbol_cache.equal_range(hash);
+        for (auto i = range.first; i != range.second; ++i) {
+            auto& sm = i->second;
+            if (strcmp(sm.obj->symbol_name(sm.symbol), name) == 0) {
+                return sm;
+            }
+        }
+        generation = _modules_adds + _modules_subs;
+    }
+    // A private object is only searched by the thread loading it, so
+    // another thread may get a different answer past it.
+    bool shared = true;
     for (auto module : _modules) {
-        if (auto sym = module->lookup_symbol(name)) {
-            return symbol_module(sym, module);
+        shared &= !module->isprivate();
+        if (auto sym = module->lookup_symbol(name, hash)) {
+            symbol_module ret(sym, module);
+            if (shared) {
+                WITH_LOCK(_symbol_cache_mutex) {
+                    if (generation == _modules_adds + _modules_subs) {
+                        _symbol_cache.emplace(hash, ret);
+                    }
+                }
+            }
+            return ret;
         }
     }
     return symbol_module(nullptr, nullptr);
@@ -882,6 +1266,47 @@ dladdr_info program::lookup_addr(const void* addr)
     return {};
 }
 
+std::string program::symbol_name(const void* addr, bool with_offset)
+{
+    char buf[100];
+    auto ei = lookup_addr(addr);
+    if (!ei.sym) {
+        snprintf(buf, sizeof(buf), "%p", addr);
+        return buf;
+    }
+    int status;
+    std::string name = ei.sym;
+    char* demangled = abi::__cxa_demangle(ei.sym, nullptr, 0, &status);
+    if (demangled) {
+        name = demangled;
+        free(demangled);
+    }
+    auto offset = static_cast<const char*>(addr) - static_cast<const char*>(ei.addr);
+    if (with_offset && offset) {
+        snprintf(buf, sizeof(buf), "+%#lx", offset);
+        name += buf;
+    }
+    return name;
+}
+
+std::string program::maps()
+{
+    std::string ret;
+    char buf[100];
+    with_modules([&] (const std::vector<object*>& modules, int, int) {
+        for (auto obj : modules) {
+            auto name = obj->pathname();
+            snprintf(buf, sizeof(buf), "%lx-%lx r-xp 00000000 00:00 0 ",
+                     reinterpret_cast<uintptr_t>(obj->base()),
+                     reinterpret_cast<uintptr_t>(obj->end()));
+            ret += buf;
+            ret += name.empty() ? "loader.elf" : name;
+            ret += "\n";
+        }
+    });
+    return ret;
+}
+
 program* get_program()
 {
     return s_program;
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/init-graph.hh>
+#include <osv/trace.hh>
+#include <string.h>
+#include <algorithm>
+#include "sched.hh"
+#include "debug.hh"
+#include "drivers/clock.hh"
+
+TRACEPOINT(trace_init_stage_start, "%s", const char*);
+TRACEPOINT(trace_init_stage_done, "%s %d us", const char*, u64);
+
+namespace osv {
+
+void init_graph::add(const char* name, std::function<void ()> func,
+                     std::initializer_list<const char*> after)
+{
+    std::unique_ptr<stage> s(new stage{name, func, {}, false});
+    for (auto dep : after) {
+        auto i = std::find_if(_stages.begin(), _stages.end(),
+                [=] (const std::unique_ptr<stage>& p) {
+                    return strcmp(p->name, dep) == 0;
+                });
+        if (i == _stages.end()) {
+            debug("init stage %s: unknown stage %s\n", name, dep);
+            abort();
+        }
+        s->after.push_back(i->get());
+    }
+    _stages.push_back(std::move(s));
+}
+
+void init_graph::run()
+{
+    std::vector<std::unique_ptr<sched::thread>> threads;
+    for (auto& sp : _stages) {
+        auto s = sp.get();
+        sched::thread::attr attr;
+        // Stages run what used to run on the boot thread or on the main
+        // pthread, so give them a pthread-sized stack
+        attr.stack.size = 1 << 20;
+        threads.emplace_back(new sched::thread([=] {
+            WITH_LOCK(_mtx) {
+                while (!std::all_of(s->after.begin(), s->after.end(),
+                                    [] (stage* d) { return d->done; })) {
+                    _done.wait(&_mtx);
+                }
+            }
+            trace_init_stage_start(s->name);
+            auto start = clock::get()->time();
+            s->func();
+            trace_init_stage_done(s->name, (clock::get()->time() - start) / 1000);
+            WITH_LOCK(_mtx) {
+                s->done = true;
+                _done.wake_all();
+            }
+        }, attr));
+        threads.back()->start();
+    }
+    for (auto& t : threads) {
+        t->join();
+    }
+}
+
+}
@@ -9,6 +9,8 @@
 #include <osv/trace.hh>
 #include <sched.hh>
 #include <osv/wait_record.hh>
+#include <osv/lockstat.hh>
+#include "drivers/clock.hh"
 
 namespace lockfree {
 
@@ -33,6 +35,9 @@ void mutex::lock()
         // just for implementing a recursive mutex.
         owner.store(current, std::memory_order_relaxed);
         depth = 1;
+        if (lockstat::enabled.load(std::memory_order_relaxed)) {
+            lockstat::acquired(this, __builtin_return_address(0), 0);
+        }
         return;
     }
 
@@ -53,6 +58,12 @@ void mutex::lock()
     wait_record waiter(current);
     waitqueue.push(&waiter);
 
+    // A contended lock: if lock contention is being profiled, time the wait
+    s64 wait_start = 0;
+    if (lockstat::enabled.load(std::memory_order_relaxed)) {
+        wait_start = clock::get()->time();
+    }
+
     // The "Responsibility Hand-Off" protocol where a lock() picks from
     // a concurrent unlock() the responsibility of waking somebody up:
     auto old_handoff = handoff.load();
@@ -77,6 +88,10 @@ void mutex::lock()
                     assert(other == &waiter);
                     owner.store(current, std::memory_order_relaxed);
                     depth = 1;
+                    if (wait_start) {
+                        lockstat::acquired(this, __builtin_return_address(0),
+                                           wait_start);
+                    }
                     return;
                 }
             }
@@ -90,6 +105,9 @@ void mutex::lock()
     trace_mutex_lock_wake(this);
     owner.store(current, std::memory_order_relaxed);
     depth = 1;
+    if (wait_start) {
+        lockstat::acquired(this, __builtin_return_address(0), wait_start);
+    }
 }
 
 // send_lock() is used for implementing a "wait morphing" technique, where
@@ -146,6 +164,9 @@ void mutex::receive_lock()
     trace_mutex_receive_lock(this);
     owner.store(sched::thread::current(), std::memory_order_relaxed);
     depth = 1;
+    if (lockstat::enabled.load(std::memory_order_relaxed)) {
+        lockstat::acquired(this, __builtin_return_address(0), 0);
+    }
 }
 
 bool mutex::try_lock()
@@ -156,6 +177,9 @@ bool mutex::try_lock()
         // Uncontended case. We got the lock.
         owner.store(current, std::memory_order_relaxed);
         depth = 1;
+        if (lockstat::enabled.load(std::memory_order_relaxed)) {
+            lockstat::acquired(this, __builtin_return_address(0), 0);
+        }
         trace_mutex_try_lock(this, true);
         return true;
     }
@@ -176,6 +200,9 @@ bool mutex::try_lock()
         count.fetch_add(1, std::memory_order_relaxed);
         owner.store(current, std::memory_order_relaxed);
         depth = 1;
+        if (lockstat::enabled.load(std::memory_order_relaxed)) {
+            lockstat::acquired(this, __builtin_return_address(0), 0);
+        }
         trace_mutex_try_lock(this, true);
         return true;
     }
@@ -196,6 +223,10 @@ void mutex::unlock()
     if (--depth)
         return; // recursive mutex still locked.
 
+    if (lockstat::enabled.load(std::memory_order_relaxed)) {
+        lockstat::released(this);
+    }
+
     // When we return from unlock(), we will no longer be holding the lock.
     // We can't leave owner==current, otherwise a later lock() in the same
     // thread will think it's a recursive lock, while actually another thread
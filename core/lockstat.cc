@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/lockstat.hh>
+#include <sched.hh>
+#include "irqlock.hh"
+#include "drivers/clock.hh"
+#include "drivers/report-device.hh"
+#include "elf.hh"
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
+
+namespace lockstat {
+
+std::atomic<bool> enabled;
+
+namespace {
+
+// A non-allocating hash table of (lock, caller) pairs, one per cpu,
+// updated with interrupts disabled
+struct table {
+    explicit table(size_t size) : entries(new lock_stats[size]()), mask(size - 1) {}
+    lock_stats* find(const void* lock, void* caller);
+    std::unique_ptr<lock_stats[]> entries;
+    size_t mask;
+    size_t used = 0;
+};
+
+lock_stats* table::find(const void* lock, void* caller)
+{
+    auto h = (reinterpret_cast<uintptr_t>(lock) * 31
+              + reinterpret_cast<uintptr_t>(caller)) * 0x9e3779b97f4a7c15UL;
+    for (auto i = h >> 32; ; ++i) {
+        auto& e = entries[i & mask];
+        if (e.lock == lock && e.caller == caller) {
+            return &e;
+        }
+        if (!e.lock) {
+            // keep the table at most 3/4 full, so misses end quickly
+            if (used >= mask - mask / 4) {
+                return nullptr;
+            }
+            ++used;
+            e.lock = lock;
+            e.caller = caller;
+            return &e;
+        }
+    }
+}
+
+// The locks the current thread holds, and when it took them.  Locks are
+// mostly released in the reverse order, so this is searched from the top.
+// The stack belongs to the run of start() it was filled in: locks taken
+// before stop() may be released while we aren't recording.
+struct held_lock {
+    const void* lock;
+    void* caller;
+    s64 since;
+};
+constexpr unsigned max_held = 16;
+__thread held_lock held[max_held];
+__thread unsigned nr_held;
+__thread unsigned held_generation;
+
+std::atomic<unsigned> generation;
+
+void check_generation()
+{
+    auto gen = generation.load(std::memory_order_relaxed);
+    if (held_generation != gen) {
+        held_generation = gen;
+        nr_held = 0;
+    }
+}
+
+}
+
+// Indexed by cpu id.  A lock may still be updating them right after
+// stop(), so once allocated, they are only ever cleared.
+static std::vector<std::unique_ptr<table>> tables;
+static std::atomic<u64> overflows;
+
+void start(size_t entries_per_cpu)
+{
+    // a power of two, for table::mask
+    size_t size = 1;
+    while (size < entries_per_cpu * 4 / 3) {
+        size *= 2;
+    }
+    if (tables.empty()) {
+        for (auto c : sched::cpus) {
+            tables.resize(std::max(tables.size(), size_t(c->id + 1)));
+            tables[c->id].reset(new table(size));
+        }
+    } else {
+        for (auto& t : tables) {
+            if (t) {
+                std::fill(t->entries.get(), t->entries.get() + t->mask + 1,
+                          lock_stats());
+                t->used = 0;
+            }
+        }
+    }
+    overflows.store(0);
+    generation.fetch_add(1);
+    enabled.store(true);
+}
+
+void stop()
+{
+    enabled.store(false);
+}
+
+// Called with interrupts disabled, which also keeps spin locks taken by
+// interrupt handlers from changing the held-lock stack under us
+template <typename Func>
+static void update(const void* lock, void* caller, Func func)
+{
+    auto c = sched::cpu::current();
+    if (!c || c->id >= tables.size()) {
+        return;
+    }
+    auto e = tables[c->id]->find(lock, caller);
+    if (!e) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    func(*e);
+}
+
+void acquired(const void* lock, void* caller, s64 wait_start)
+{
+    irq_save_lock_type irq_lock;
+    WITH_LOCK(irq_lock) {
+        auto now = clock::get()->time();
+        update(lock, caller, [&] (lock_stats& e) {
+            ++e.acquisitions;
+            if (wait_start) {
+                auto wait = now - wait_start;
+                ++e.contended;
+                e.wait_time += wait;
+                e.max_wait = std::max(e.max_wait, wait);
+            }
+        });
+        check_generation();
+        // A full stack most likely holds a lock whose release we missed at
+        // the bottom, so make room by dropping that one
+        if (nr_held == max_held) {
+            std::copy(held + 1, held + nr_held, held);
+            --nr_held;
+        }
+        held[nr_held++] = { lock, caller, now };
+    }
+}
+
+void released(const void* lock)
+{
+    irq_save_lock_type irq_lock;
+    WITH_LOCK(irq_lock) {
+        check_generation();
+        for (unsigned i = nr_held; i-- > 0; ) {
+            if (held[i].lock == lock) {
+                auto h = held[i];
+                std::copy(held + i + 1, held + nr_held, held + i);
+                --nr_held;
+                auto hold = clock::get()->time() - h.since;
+                update(lock, h.caller, [&] (lock_stats& e) {
+                    e.hold_time += hold;
+                    e.max_hold = std::max(e.max_hold, hold);
+                });
+                return;
+            }
+        }
+    }
+}
+
+std::vector<lock_stats> collect()
+{
+    std::unordered_map<std::pair<const void*, void*>, lock_stats,
+                       boost::hash<std::pair<const void*, void*>>> merged;
+    for (auto& t : tables) {
+        if (!t) {
+            continue;
+        }
+        for (size_t i = 0; i <= t->mask; ++i) {
+            auto e = t->entries[i];
+            if (!e.lock) {
+                continue;
+            }
+            auto& m = merged[std::make_pair(e.lock, e.caller)];
+            m.lock = e.lock;
+            m.caller = e.caller;
+            m.acquisitions += e.acquisitions;
+            m.contended += e.contended;
+            m.wait_time += e.wait_time;
+            m.max_wait = std::max(m.max_wait, e.max_wait);
+            m.hold_time += e.hold_time;
+            m.max_hold = std::max(m.max_hold, e.max_hold);
+        }
+    }
+    std::vector<lock_stats> ret;
+    for (auto& m : merged) {
+        ret.push_back(m.second);
+    }
+    std::sort(ret.begin(), ret.end(), [] (const lock_stats& a, const lock_stats& b) {
+        return a.wait_time > b.wait_time
+            || (a.wait_time == b.wait_time && a.hold_time > b.hold_time);
+    });
+    return ret;
+}
+
+std::string report(size_t n)
+{
+    std::string ret;
+    auto stats = collect();
+    if (stats.size() > n) {
+        stats.resize(n);
+    }
+    report_printf(ret, "%s, %lu acquisitions not recorded (table full)\n",
+                  enabled.load() ? "running" : "stopped", overflows.load());
+    report_printf(ret, "%12s %10s %12s %10s %12s %10s  lock / caller\n",
+                  "acquired", "contended", "wait(us)", "max", "hold(us)", "max");
+    for (auto& s : stats) {
+        report_printf(ret, "%12lu %10lu %12ld %10ld %12ld %10ld  ", s.acquisitions,
+                      s.contended, s.wait_time / 1000, s.max_wait / 1000,
+                      s.hold_time / 1000, s.max_hold / 1000);
+        ret += elf::get_program()->symbol_name(s.lock) + "\n";
+        report_printf(ret, "%*s", 74, "");
+        ret += elf::get_program()->symbol_name(s.caller) + "\n";
+    }
+    return ret;
+}
+
+void device_init()
+{
+    create_report_device("lockstat", [] { return report(); });
+}
+
+}
@@ -25,6 +25,9 @@
 #include <preempt-lock.hh>
 #include <sched.hh>
 #include "prio.hh"
+#include <osv/condvar.h>
+#include <osv/shrinker.h>
+#include "drivers/clock.hh"
 
 TRACEPOINT(trace_memory_malloc, "buf=%p, len=%d", void *, size_t);
 TRACEPOINT(trace_memory_malloc_large, "buf=%p, len=%d", void *, size_t);
@@ -33,6 +36,7 @@ TRACEPOINT(trace_memory_free_large, "buf=%p", void *);
 TRACEPOINT(trace_memory_realloc, "in=%p, newlen=%d, out=%p", void *, size_t, void *);
 TRACEPOINT(trace_memory_page_alloc, "%p", void*);
 TRACEPOINT(trace_memory_page_free, "%p", void*);
+TRACEPOINT(trace_memory_shrink, "%s target=%d freed=%d", const char*, size_t, size_t);
 
 bool smp_allocator = false;
 
@@ -42,6 +46,7 @@ size_t phys_mem_size;
 
 // Optionally track living allocations, and the call chain which led to each
 // allocation. Don't set tracker_enabled before tracker is fully constructed.
+// The heap profiler (see heap_sampler) hooks in here too.
 alloc_tracker tracker;
 bool tracker_enabled = false;
 static inline void tracker_remember(void *addr, size_t size)
@@ -51,12 +56,16 @@ static inline void tracker_remember(void *addr, size_t size)
     if (__builtin_expect(tracker_enabled, false)) {
         tracker.remember(addr, size);
     }
+    if (__builtin_expect(heap_profiler.sampling(), false)) {
+        heap_profiler.allocated(addr, size);
+    }
 }
 static inline void tracker_forget(void *addr)
 {
     if (__builtin_expect(tracker_enabled, false)) {
         tracker.forget(addr);
     }
+    heap_profiler.freed(addr);
 }
 
 //
@@ -383,30 +392,102 @@ bi::set<page_range,
                        &page_range::member_hook>
        > free_page_ranges __attribute__((init_priority(FPRANGES_INIT_PRIO)));
 
+// Shrinkers (see <osv/shrinker.h>) run on their own thread.  A thread which
+// runs out of memory asks them for memory and waits for them, but only for
+// a bounded time: it may hold a lock one of them needs.
+const unsigned max_shrinkers = 16;
+const int max_reclaim_tries = 3;
+const u64 reclaim_timeout = 1000000000;
+
+static struct {
+    const char* name;
+    shrinker_func func;
+} shrinkers[max_shrinkers];
+static std::atomic<unsigned> nr_shrinkers;
+static sched::thread* reclaimer_thread;
+static mutex reclaim_lock;
+static condvar reclaim_cond;
+static condvar reclaim_done;
+static bool reclaim_requested;
+static size_t reclaim_target;
+static unsigned long reclaim_generation;
+
+static void reclaimer()
+{
+    for (;;) {
+        size_t target;
+        WITH_LOCK(reclaim_lock) {
+            while (!reclaim_requested) {
+                reclaim_cond.wait(reclaim_lock);
+            }
+            reclaim_requested = false;
+            target = reclaim_target;
+            reclaim_target = 0;
+        }
+        auto n = nr_shrinkers.load(std::memory_order_acquire);
+        for (unsigned i = 0; i < n; i++) {
+            auto freed = shrinkers[i].func(target);
+            trace_memory_shrink(shrinkers[i].name, target, freed);
+        }
+        WITH_LOCK(reclaim_lock) {
+            reclaim_generation++;
+            reclaim_done.wake_all();
+        }
+    }
+}
+
+// Ask the shrinkers to free @size bytes and wait until they had a go.
+// Returns false if there are none, or we cannot or should not wait.
+static bool reclaim(size_t size)
+{
+    if (!reclaimer_thread || sched::thread::current() == reclaimer_thread ||
+            !sched::preemptable() || !arch::irq_enabled()) {
+        return false;
+    }
+    auto deadline = clock::get()->time() + reclaim_timeout;
+    WITH_LOCK(reclaim_lock) {
+        auto generation = reclaim_generation;
+        reclaim_requested = true;
+        reclaim_target = std::max(reclaim_target, size);
+        reclaim_cond.wake_one();
+        while (reclaim_generation == generation) {
+            if (condvar_wait(&reclaim_done, &reclaim_lock, deadline) == ETIMEDOUT) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 static void* malloc_large(size_t size)
 {
     size = (size + page_size - 1) & ~(page_size - 1);
     size += page_size;
 
-    WITH_LOCK(free_page_ranges_lock) {
-        for (auto i = free_page_ranges.begin(); i != free_page_ranges.end(); ++i) {
-            auto header = &*i;
-            page_range* ret_header;
-            if (header->size >= size) {
-                if (header->size == size) {
-                    free_page_ranges.erase(i);
-                    ret_header = header;
-                } else {
-                    void *v = header;
-                    header->size -= size;
-                    ret_header = new (v + header->size) page_range(size);
+    for (int tries = 0; ; tries++) {
+        WITH_LOCK(free_page_ranges_lock) {
+            for (auto i = free_page_ranges.begin(); i != free_page_ranges.end(); ++i) {
+                auto header = &*i;
+                page_range* ret_header;
+                if (header->size >= size) {
+                    if (header->size == size) {
+                        free_page_ranges.erase(i);
+                        ret_header = header;
+                    } else {
+                        void *v = header;
+                        header->size -= size;
+                        ret_header = new (v + header->size) page_range(size);
+                    }
+                    void* obj = ret_header;
+                    obj += page_size;
+                    trace_memory_malloc_large(obj, size);
+                    return obj;
                 }
-                void* obj = ret_header;
-                obj += page_size;
-                trace_memory_malloc_large(obj, size);
-                return obj;
             }
         }
+        if (tries == max_reclaim_tries || !reclaim(size)) {
+            break;
+        }
     }
     debug(fmt("malloc_large(): out of memory: can't find %d bytes. aborting.\n")
             % size);
@@ -477,13 +558,20 @@ PERCPU(page_buffer, percpu_page_buffer);
 
 static void refill_page_buffer()
 {
-    WITH_LOCK(free_page_ranges_lock) {
-        WITH_LOCK(preempt_lock) {
-            if (free_page_ranges.empty()) {
-                debug("alloc_page(): out of memory\n");
-                abort();
+    for (int tries = 0; ; tries++) {
+        WITH_LOCK(free_page_ranges_lock) {
+            if (!free_page_ranges.empty()) {
+                break;
             }
+        }
+        if (tries == max_reclaim_tries || !reclaim(page_size)) {
+            debug("alloc_page(): out of memory\n");
+            abort();
+        }
+    }
 
+    WITH_LOCK(free_page_ranges_lock) {
+        WITH_LOCK(preempt_lock) {
             auto& pbuf = *percpu_page_buffer;
             auto limit = (pbuf.max + 1) / 2;
 
@@ -604,8 +692,10 @@ static inline void untracked_free_page(void *v)
 
 void free_page(void* v)
 {
-    untracked_free_page(v);
+    // forget the page first, or it could be allocated (and remembered) again
+    // before we do
     tracker_forget(v);
+    untracked_free_page(v);
 }
 
 /* Allocate a huge page of a given size N (which must be a power of two)
@@ -687,6 +777,22 @@ void  __attribute__((constructor(MEMPOOL_INIT_PRIO))) setup()
     arch_setup_free_memory();
 }
 
+void add_shrinker(const char *name, shrinker_func func)
+{
+    WITH_LOCK(reclaim_lock) {
+        auto n = nr_shrinkers.load(std::memory_order_relaxed);
+        assert(n < max_shrinkers);
+        shrinkers[n].name = name;
+        shrinkers[n].func = func;
+        nr_shrinkers.store(n + 1, std::memory_order_release);
+    }
+    if (!reclaimer_thread) {
+        auto t = new sched::thread(reclaimer);
+        t->start();
+        reclaimer_thread = t;
+    }
+}
+
 void debug_memory_pool(size_t *total, size_t *contig)
 {
     *total = *contig = 0;
@@ -704,6 +810,11 @@ void debug_memory_pool(size_t *total, size_t *contig)
 
 }
 
+extern "C" void register_shrinker(const char *name, shrinker_func func)
+{
+    memory::add_shrinker(name, func);
+}
+
 extern "C" {
     void* malloc(size_t size);
     void free(void* object);
@@ -13,6 +13,7 @@
 #include <boost/format.hpp>
 #include <string.h>
 #include <iterator>
+#include <vector>
 #include "libc/signal.hh"
 #include "align.hh"
 #include "interrupt.hh"
@@ -533,6 +534,90 @@ protected:
     }
 };
 
+/*
+ * Map pages lent by a file system (see lent_pages below) instead of
+ * allocating and filling new ones.  Always uses small pages, as the lent
+ * pages are only physically contiguous within one file system block.
+ */
+class populate_lent : public page_range_operation {
+private:
+    lent_pages& pages;
+    f_offset file_offset;
+    unsigned int perm;
+public:
+    populate_lent(lent_pages& pages, f_offset file_offset, unsigned int perm)
+        : pages(pages), file_offset(file_offset), perm(perm) { }
+protected:
+    virtual void small_page(hw_ptep ptep, uintptr_t offset);
+    virtual void huge_page(hw_ptep ptep, uintptr_t offset){
+        if (ptep.read().empty()) {
+            allocate_intermediate_level(ptep);
+        }
+        assert(!ptep.read().large()); // don't populate an already populated page!
+        hw_ptep pt = follow(ptep.read());
+        for (int i=0; i<pte_per_page; ++i) {
+            small_page(pt.at(i), offset + i * page_size);
+        }
+    }
+    virtual bool should_allocate_intermediate(){
+        return true;
+    }
+};
+
+/*
+ * Undo populate_lent(): clear the page table entries, without freeing the
+ * pages, which still belong to the file system.
+ */
+class unpopulate_lent : public page_range_operation {
+protected:
+    virtual void small_page(hw_ptep ptep, uintptr_t offset){
+        ptep.write(make_empty_pte());
+    }
+    virtual void huge_page(hw_ptep ptep, uintptr_t offset){
+        pt_element pte = ptep.read();
+        ptep.write(make_empty_pte());
+        assert(!pte.empty() && !pte.large());
+        hw_ptep pt = follow(pte);
+        for (int i=0; i<pte_per_page; ++i) {
+            pt.at(i).write(make_empty_pte());
+        }
+        memory::free_page(pt.release());
+    }
+    virtual bool should_allocate_intermediate(){
+        return false;
+    }
+};
+
+/*
+ * Replace lent pages with private copies, so they can be made writable
+ * without scribbling over the file system's cache.
+ */
+class copy_lent : public page_range_operation {
+protected:
+    virtual void small_page(hw_ptep ptep, uintptr_t offset){
+        pt_element pte = ptep.read();
+        if (pte.empty()) {
+            return;
+        }
+        void *page = memory::alloc_page();
+        memcpy(page, phys_to_virt(pte.addr(false)), page_size);
+        pte.set_addr(virt_to_phys(page), false);
+        ptep.write(pte);
+    }
+    virtual void huge_page(hw_ptep ptep, uintptr_t offset){
+        if (ptep.read().empty()) {
+            return;
+        }
+        hw_ptep pt = follow(ptep.read());
+        for (int i=0; i<pte_per_page; ++i) {
+            small_page(pt.at(i), offset + i * page_size);
+        }
+    }
+    virtual bool should_allocate_intermediate(){
+        return false;
+    }
+};
+
 class protection : public page_range_operation {
 private:
     unsigned int perm;
@@ -573,6 +658,15 @@ protected:
 int protect(void *addr, size_t size, unsigned int perm)
 {
     std::lock_guard<mutex> guard(vma_list_mutex);
+    if (perm & perm_write) {
+        auto start = reinterpret_cast<uintptr_t>(addr);
+        auto end = start + size;
+        for (auto& v : vma_list) {
+            if (v.start() < end && v.end() > start) {
+                v.prepare_write();
+            }
+        }
+    }
     protection p(perm);
     p.operate(addr, size);
     return p.getsuccess();
@@ -612,7 +706,7 @@ void evacuate(uintptr_t start, uintptr_t end)
         i->split(start);
         if (contains(start, end, *i)) {
             auto& dead = *i--;
-            unpopulate().operate(dead);
+            dead.unmap_pages();
             vma_list.erase(dead);
             delete &dead;
         }
@@ -654,7 +748,7 @@ struct fill_anon_page : fill_page {
 };
 
 uintptr_t allocate(vma *v, uintptr_t start, size_t size, bool search,
-                    fill_page& fill, unsigned perm)
+                    page_range_operation& populator)
 {
     std::lock_guard<mutex> guard(vma_list_mutex);
     if (search) {
@@ -671,11 +765,18 @@ uintptr_t allocate(vma *v, uintptr_t start, size_t size, bool search,
 
     vma_list.insert(*v);
 
-    populate(&fill, perm).operate((void*)start, size);
+    populator.operate((void*)start, size);
 
     return start;
 }
 
+uintptr_t allocate(vma *v, uintptr_t start, size_t size, bool search,
+                    fill_page& fill, unsigned perm)
+{
+    populate populator(&fill, perm);
+    return allocate(v, start, size, search, populator);
+}
+
 void vpopulate(void* addr, size_t size)
 {
     fill_anon_page fill;
@@ -701,11 +802,80 @@ void* map_anon(void* addr, size_t size, bool search, unsigned perm)
     return (void*) allocate(vma, start, size, search, zfill, perm);
 }
 
+/*
+ * File pages lent to a read-only mapping by the file system, which then
+ * needs neither to allocate memory for the mapping nor to copy the data.
+ * The loans are returned when the last vma mapping them goes away.
+ */
+class lent_pages {
+public:
+    lent_pages(fileref f, f_offset offset) : _file(f), _offset(offset) { }
+    ~lent_pages();
+    lent_pages(const lent_pages&) = delete;
+    // Borrows the file pages in [_offset, _offset + size), all or none.
+    bool borrow(size_t size);
+    phys page(f_offset offset) const;
+private:
+    fileref _file;
+    f_offset _offset;
+    std::vector<file_loan> _loans;
+    std::vector<phys> _pages;
+};
+
+lent_pages::~lent_pages()
+{
+    for (auto& l : _loans) {
+        unloan(_file, l);
+    }
+}
+
+bool lent_pages::borrow(size_t size)
+{
+    if (_offset % page_size) {
+        return false;
+    }
+    auto end = _offset + size;
+    for (auto off = _offset; off < end;) {
+        file_loan l;
+        if (!loan(_file, off, l)) {
+            return false;
+        }
+        _loans.push_back(l);
+        for (size_t p = 0; p < l.len && off < end; p += page_size) {
+            _pages.push_back(virt_to_phys(static_cast<char*>(l.addr) + p));
+            off += page_size;
+        }
+    }
+    return true;
+}
+
+phys lent_pages::page(f_offset offset) const
+{
+    return _pages[(offset - _offset) / page_size];
+}
+
+void populate_lent::small_page(hw_ptep ptep, uintptr_t offset)
+{
+    assert(ptep.read().empty()); // don't populate an already populated page!
+    ptep.write(make_normal_pte(pages.page(file_offset + offset), perm));
+}
+
 void* map_file(void* addr, size_t size, bool search, unsigned perm,
               fileref f, f_offset offset, bool shared)
 {
     auto asize = align_up(size, mmu::page_size);
     auto start = reinterpret_cast<uintptr_t>(addr);
+    // A read-only mapping can share the file system's cached pages.  It
+    // gets private copies if it is made writable later (see prepare_write).
+    if (!(perm & perm_write)) {
+        auto lent = std::make_shared<lent_pages>(f, offset);
+        if (lent->borrow(asize)) {
+            auto *vma = new mmu::file_vma(start, start + size, f, offset,
+                                          shared, lent);
+            populate_lent fill(*lent, offset, perm);
+            return (void*) allocate(vma, start, asize, search, fill);
+        }
+    }
     fill_anon_page zfill;
     auto *vma = new mmu::file_vma(start, start + size, f, offset, shared);
     auto v = (void*) allocate(vma, start, asize, search, zfill, perm | perm_write);
@@ -839,11 +1009,22 @@ error vma::sync(uintptr_t start, uintptr_t end)
     return make_error(ENOMEM);
 }
 
-file_vma::file_vma(uintptr_t start, uintptr_t end, fileref file, f_offset offset, bool shared)
+void vma::unmap_pages()
+{
+    unpopulate().operate(*this);
+}
+
+void vma::prepare_write()
+{
+}
+
+file_vma::file_vma(uintptr_t start, uintptr_t end, fileref file, f_offset offset,
+                   bool shared, std::shared_ptr<lent_pages> lent)
     : vma(start, end)
     , _file(file)
     , _offset(offset)
     , _shared(shared)
+    , _lent(lent)
 {
 }
 
@@ -853,15 +1034,35 @@ void file_vma::split(uintptr_t edge)
         return;
     }
     auto off = offset(edge);
-    vma* n = new file_vma(edge, _end, _file, off, _shared);
+    vma* n = new file_vma(edge, _end, _file, off, _shared, _lent);
     _end = edge;
     vma_list.insert(*n);
 }
 
+void file_vma::unmap_pages()
+{
+    if (_lent) {
+        unpopulate_lent().operate(*this);
+    } else {
+        vma::unmap_pages();
+    }
+}
+
+void file_vma::prepare_write()
+{
+    if (_lent) {
+        copy_lent().operate(*this);
+        _lent.reset();
+    }
+}
+
 error file_vma::sync(uintptr_t start, uintptr_t end)
 {
     if (!_shared)
         return make_error(ENOMEM);
+    // Pages still lent to us were never writable, so they are clean
+    if (_lent)
+        return no_error();
     auto fsize = ::size(_file);
     uintptr_t size = end - start;
     auto off = offset(start);
@@ -11,6 +11,8 @@
 #include <pthread.h>
 #include <cassert>
 #include "osv/trace.hh"
+#include <osv/lockstat.hh>
+#include "drivers/clock.hh"
 
 #ifndef LOCKFREE_MUTEX
 static_assert(sizeof(mutex) <= sizeof(pthread_mutex_t), "mutex too big");
@@ -30,12 +32,25 @@ struct waiter {
 void spin_lock(spinlock_t *sl)
 {
     sched::preempt_disable();
-    while (__sync_lock_test_and_set(&sl->_lock, 1))
-        ;
+    if (!lockstat::enabled.load(std::memory_order_relaxed)) {
+        while (__sync_lock_test_and_set(&sl->_lock, 1))
+            ;
+        return;
+    }
+    s64 wait_start = 0;
+    if (__sync_lock_test_and_set(&sl->_lock, 1)) {
+        wait_start = clock::get()->time();
+        while (__sync_lock_test_and_set(&sl->_lock, 1))
+            ;
+    }
+    lockstat::acquired(sl, __builtin_return_address(0), wait_start);
 }
 
 void spin_unlock(spinlock_t *sl)
 {
+    if (lockstat::enabled.load(std::memory_order_relaxed)) {
+        lockstat::released(sl);
+    }
     __sync_lock_release(&sl->_lock, 0);
     sched::preempt_enable();
 }
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <osv/sampler.hh>
+#include <osv/execinfo.hh>
+#include <osv/mutex.h>
+#include "exceptions.hh"
+#include "interrupt.hh"
+#include "irqlock.hh"
+#include "drivers/clock.hh"
+#include "elf.hh"
+#include <algorithm>
+#include <unordered_map>
+#include <string>
+#include <limits>
+
+class cpu_sampler::cpu_timer : private sched::timer_base::client {
+public:
+    explicit cpu_timer(cpu_sampler& s) : _sampler(s), _timer(*this) {}
+    void arm() { _timer.set(clock::get()->time() + _sampler._period); }
+    void cancel() { _timer.cancel(); }
+private:
+    virtual void timer_fired() override;
+private:
+    cpu_sampler& _sampler;
+    sched::timer_base _timer;
+};
+
+// Runs in the timer interrupt, so current_interrupt_frame is the context
+// it interrupted
+void cpu_sampler::cpu_timer::timer_fired()
+{
+    auto ef = current_interrupt_frame;
+    if (ef) {
+        void* pc[_sampler._nr_frames];
+        auto nr = backtrace_safe(pc, _sampler._nr_frames,
+                                 reinterpret_cast<void*>(ef->rip),
+                                 reinterpret_cast<void*>(ef->rbp));
+        _sampler._collector.add(pc, nr);
+    }
+    arm();
+}
+
+// Timers can only be set and cancelled on their own cpu, so starting and
+// stopping the sampler runs on every cpu, much like tlb_flush().
+static mutex sampler_mutex;
+static cpu_sampler* sampler_switching;
+static sched::thread* sampler_waiter;
+static std::atomic<int> sampler_pendingconfirms;
+
+static inter_processor_interrupt sampler_ipi{[] {
+    sampler_switching->switch_local();
+    if (sampler_pendingconfirms.fetch_add(-1) == 1) {
+        sampler_waiter->wake();
+    }
+}};
+
+cpu_sampler::cpu_sampler(unsigned frequency, size_t nr_traces, unsigned nr_frames)
+    : _period(1000000000 / frequency)
+    , _nr_frames(nr_frames)
+    , _collector(nr_traces, 0, nr_frames)
+{
+    for (auto c : sched::cpus) {
+        _timers.resize(std::max(_timers.size(), size_t(c->id + 1)));
+        _timers[c->id].reset(new cpu_timer(*this));
+    }
+}
+
+cpu_sampler::~cpu_sampler()
+{
+    if (_running) {
+        stop();
+    }
+}
+
+void cpu_sampler::switch_local()
+{
+    auto& t = *_timers[sched::cpu::current()->id];
+    if (_running) {
+        t.arm();
+    } else {
+        t.cancel();
+    }
+}
+
+void cpu_sampler::switch_all()
+{
+    WITH_LOCK(sampler_mutex) {
+        sampler_switching = this;
+        sampler_waiter = sched::thread::current();
+        sampler_pendingconfirms.store(int(sched::cpus.size()) - 1);
+        // don't move to another cpu between the two
+        irq_save_lock_type irq_lock;
+        WITH_LOCK(irq_lock) {
+            switch_local();
+            if (sched::cpus.size() > 1) {
+                sampler_ipi.send_allbutself();
+            }
+        }
+        sched::thread::wait_until([] {
+            return sampler_pendingconfirms.load() == 0;
+        });
+    }
+}
+
+void cpu_sampler::start()
+{
+    _collector.start();
+    _running = true;
+    switch_all();
+}
+
+void cpu_sampler::stop()
+{
+    _running = false;
+    switch_all();
+    _collector.stop();
+}
+
+void cpu_sampler::write_pprof(FILE* f)
+{
+    auto put = [f] (uintptr_t word) { fwrite(&word, sizeof(word), 1, f); };
+    // header: header words, version, sampling period (us), padding
+    put(0);
+    put(3);
+    put(0);
+    put(_period / 1000);
+    put(0);
+    _collector.dump(std::numeric_limits<size_t>::max(),
+            [&] (const callstack_collector::trace& tr) {
+        put(tr.hits);
+        put(tr.len);
+        for (unsigned i = 0; i < tr.len; ++i) {
+            put(reinterpret_cast<uintptr_t>(tr.pc[i]));
+        }
+    });
+    // trailer
+    put(0);
+    put(1);
+    put(0);
+    // followed by the address space, as in /proc/self/maps, so pprof can
+    // find the object each address belongs to
+    fputs(elf::get_program()->maps().c_str(), f);
+}
+
+void cpu_sampler::write_folded(FILE* f)
+{
+    std::unordered_map<void*, std::string> names;
+    _collector.dump(std::numeric_limits<size_t>::max(),
+            [&] (const callstack_collector::trace& tr) {
+        std::string line;
+        for (unsigned i = tr.len; i-- > 0; ) {
+            // return addresses point after the call; look up the call itself
+            auto pc = tr.pc[i] - (i ? 1 : 0);
+            auto n = names.find(pc);
+            if (n == names.end()) {
+                auto name = elf::get_program()->symbol_name(pc, false);
+                n = names.emplace(pc, name).first;
+            }
+            line += n->second;
+            line += i ? ";" : "";
+        }
+        fprintf(f, "%s %u\n", line.c_str(), tr.hits);
+    });
+}
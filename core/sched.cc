@@ -20,9 +20,15 @@
 #include <osv/percpu.hh>
 #include "prio.hh"
 #include "elf.hh"
+#include "preempt-lock.hh"
+#include "ilog2.hh"
+#include "drivers/report-device.hh"
+#include <string>
 
 __thread void* percpu_base;
 
+__thread void (*sched_before_wait)(void);
+
 extern char _percpu_start[], _percpu_end[], _percpu_sec_end[];
 
 namespace sched {
@@ -138,6 +144,23 @@ void cpu::reschedule_from_interrupt(bool preempt)
     auto ni = runqueue.begin();
     auto n = &*ni;
     runqueue.erase(ni);
+    if (n != p) {
+        if (p->_status.load(std::memory_order_relaxed) == thread::status::queued) {
+            ++p->_stats.involuntary_switches;
+            p->_runnable_since = now;
+        } else {
+            ++p->_stats.voluntary_switches;
+        }
+        if (n != idle_thread) {
+            account_wait(*n, now);
+        }
+        ++context_switches;
+    }
+    auto ran = now - running_since;
+    p->_total_cpu_time += ran;
+    if (p != idle_thread) {
+        busy_time += ran;
+    }
     running_since = now;
     assert(n->_status.load() == thread::status::queued);
     n->_status.store(thread::status::running);
@@ -163,6 +186,18 @@ void cpu::reschedule_from_interrupt(bool preempt)
     }
 }
 
+void cpu::account_wait(thread& t, s64 now)
+{
+    auto wait = std::max(now - t._runnable_since, s64(0));
+    auto& s = t._stats;
+    s.wait_time += wait;
+    s.max_wait = std::max(s.max_wait, wait);
+    ++s.waits;
+    auto us = u64(wait) / 1000;
+    auto bucket = us ? 63 - count_leading_zeros(us) : 0;
+    ++wait_histogram[std::min(bucket, wait_histogram_size - 1)];
+}
+
 void cpu::update_preemption_timer(thread* current, s64 now, s64 run)
 {
     preemption_timer.cancel();
@@ -251,6 +286,7 @@ void cpu::handle_incoming_wakeups()
     if (!queues_with_wakes) {
         return;
     }
+    auto now = clock::get()->time();
     for (auto i : queues_with_wakes) {
         incoming_wakeup_queue q;
         incoming_wakeups[i].copy_and_clear(q);
@@ -259,6 +295,7 @@ void cpu::handle_incoming_wakeups()
             q.pop_front_nonatomic();
             irq_save_lock_type irq_lock;
             WITH_LOCK(irq_lock) {
+                t._runnable_since = now;
                 t._status.store(thread::status::queued);
                 enqueue(t, true);
                 t.resume_timers();
@@ -331,6 +368,7 @@ void cpu::load_balance()
             assert(mig._status.load() == thread::status::queued);
             mig._status.store(thread::status::waking);
             mig.suspend_timers();
+            ++mig._stats.migrations;
             mig._cpu = min;
             mig.remote_thread_local_var(::percpu_base) = min->percpu_base;
             mig.remote_thread_local_var(current_cpu) = min;
@@ -679,6 +717,70 @@ unsigned long thread::id()
     return _id;
 }
 
+s64 thread::thread_clock()
+{
+    if (this != current()) {
+        return _total_cpu_time;
+    }
+    WITH_LOCK(preempt_lock) {
+        return _total_cpu_time + (clock::get()->time() - _cpu->running_since);
+    }
+}
+
+s64 process_cputime()
+{
+    // Only the current thread's partial time slice is included; other
+    // cpus' running threads are accounted for when they switch out.
+    s64 total = 0;
+    for (auto c : cpus) {
+        total += c->busy_time;
+    }
+    WITH_LOCK(preempt_lock) {
+        auto c = cpu::current();
+        if (thread::current() != c->idle_thread) {
+            total += clock::get()->time() - c->running_since;
+        }
+    }
+    return total;
+}
+
+// The report /dev/schedstat reads as; times are in nanoseconds
+static std::string stats_report()
+{
+    std::string ret;
+    report_printf(ret, "# cpu busy idle irq irqs switches wait-histogram(us:count...)\n");
+    for (auto c : cpus) {
+        report_printf(ret, "cpu%u %ld %ld %ld %lu %lu", c->id, c->busy_time,
+                      c->idle_thread->thread_clock(), c->irq_time, c->irqs,
+                      c->context_switches);
+        for (unsigned i = 0; i < cpu::wait_histogram_size; ++i) {
+            if (c->wait_histogram[i]) {
+                report_printf(ret, " %lu:%lu", 1UL << i, c->wait_histogram[i]);
+            }
+        }
+        report_printf(ret, "\n");
+    }
+    report_printf(ret, "# thread cpu runtime wait-time max-wait waits voluntary involuntary migrations\n");
+    WITH_LOCK(thread_list_mutex) {
+        for (auto& t : thread_list) {
+            auto& s = t.get_stats();
+            auto c = t.tcpu();
+            report_printf(ret, "thread%lu %d %ld %ld %ld %lu %lu %lu %lu\n", t.id(),
+                          c ? int(c->id) : -1, t.thread_clock(), s.wait_time,
+                          s.max_wait, s.waits, s.voluntary_switches,
+                          s.involuntary_switches, s.migrations);
+        }
+    }
+    return ret;
+}
+
+bool irq_accounting = false;
+
+void schedstat_device_init()
+{
+    create_report_device("schedstat", stats_report);
+}
+
 void preempt_disable()
 {
     ++preempt_counter;
@@ -723,18 +825,34 @@ void timer_list::fired()
     auto i = _list.begin();
     _last = std::numeric_limits<s64>::max();
     while (i != _list.end() && i->_time <= now) {
-        auto j = i++;
-        j->expire();
-        _list.erase(j);
+        auto& t = *i++;
+        // unlink first, so the callback may set the timer again
+        _list.erase(_list.iterator_to(t));
+        t.expire();
     }
     if (!_list.empty()) {
         rearm();
     }
 }
 
+// The earliest time by which the clock event must fire: the smallest
+// expiration time plus slack.  The list is sorted by expiration time, so
+// only timers expiring before the best deadline so far need be examined.
+s64 timer_list::deadline()
+{
+    s64 ret = std::numeric_limits<s64>::max();
+    for (auto i = _list.begin(); i != _list.end() && i->_time <= ret; ++i) {
+        ret = std::min(ret, i->_time + i->_slack);
+    }
+    return ret;
+}
+
+// Reprogram the clock event only if it is currently set to fire too late;
+// a clock event already due within the slack of the new earliest timer
+// serves it as well, so timers with nearby deadlines share one interrupt.
 void timer_list::rearm()
 {
-    auto t = _list.begin()->_time;
+    auto t = deadline();
     if (t < _last) {
         _last = t;
         clock_event->set(t);
@@ -753,14 +871,14 @@ void timer_list::suspend(bi::list<timer_base>& timers)
 // call with irq disabled
 void timer_list::resume(bi::list<timer_base>& timers)
 {
-    bool rearm = false;
+    bool need_rearm = false;
     for (auto& t : timers) {
         assert(t._state == timer::state::armed);
         auto i = _list.insert(t).first;
-        rearm |= i == _list.begin();
+        need_rearm |= i == _list.begin();
     }
-    if (rearm) {
-        clock_event->set(_list.begin()->_time);
+    if (need_rearm) {
+        rearm();
     }
 }
 
@@ -799,7 +917,7 @@ void timer_base::set(s64 time)
         auto& timers = cpu::current()->timers;
         timers._list.insert(*this);
         _t._active_timers.push_back(*this);
-        if (timers._list.iterator_to(*this) == timers._list.begin()) {
+        if (_time + _slack < timers._last) {
             timers.rearm();
         }
     }
@@ -823,6 +941,11 @@ void timer_base::cancel()
     // reprogramming the timer
 }
 
+void timer_base::set_slack(s64 slack)
+{
+    _slack = slack;
+}
+
 bool timer_base::expired() const
 {
     return _state == state::expired;
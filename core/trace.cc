@@ -15,6 +15,8 @@
 #include <debug.hh>
 #include "prio.hh"
 #include <osv/execinfo.hh>
+#include "drivers/report-device.hh"
+#include <memory>
 
 tracepoint<1, void*, void*> trace_function_entry("function entry", "fn %p caller %p");
 tracepoint<2, void*, void*> trace_function_exit("function exit", "fn %p caller %p");
@@ -45,16 +47,64 @@ tracepoint_patch_sites_type tracepoint_patch_sites;
 constexpr size_t trace_page_size = 4096;  // need not match arch page size
 constexpr unsigned max_trace = trace_page_size * 1024;
 
+// Each cpu logs into its own ring, so tracing on one cpu doesn't bounce
+// the position of another's.  The rings are only allocated once tracing or
+// a tracepoint is first enabled (or when a cpu starts, if one already is),
+// so that an unused tracer costs no memory.  Until then, and before there
+// are cpus at all, records go to cpu 0's, which is static; that is why the
+// position is still atomic.
+struct trace_buf {
+    char* log;
+    size_t size;
+    std::atomic<size_t> last;
+} __attribute__((aligned(64)));
+
 char trace_log[max_trace] __attribute__((may_alias, aligned(sizeof(long))));
-std::atomic<size_t> trace_record_last;
+trace_buf trace_for_cpu[sched::max_cpus] = { { trace_log, max_trace } };
 bool trace_enabled;
 
+static std::atomic<bool> trace_bufs_wanted;
+
+static void alloc_trace_buf(unsigned cpu)
+{
+    auto& tb = trace_for_cpu[cpu];
+    if (__atomic_load_n(&tb.log, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    auto log = new char[max_trace];
+    tb.size = max_trace;
+    char* expected = nullptr;
+    // a starting cpu and an enabler may race to allocate the same ring
+    if (!__atomic_compare_exchange_n(&tb.log, &expected, log, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        delete[] log;
+    }
+}
+
+static void alloc_trace_bufs()
+{
+    if (trace_bufs_wanted.exchange(true)) {
+        return;
+    }
+    for (auto c : sched::cpus) {
+        alloc_trace_buf(c->id);
+    }
+}
+
+static sched::cpu::notifier trace_cpu_notifier([] {
+    if (trace_bufs_wanted.load()) {
+        alloc_trace_buf(sched::cpu::current()->id);
+    }
+});
+
 typeof(tracepoint_base::tp_list) tracepoint_base::tp_list __attribute__((init_priority(TRACEPOINT_BASE_INIT_PRIO)));
+mutex tracepoint_base::tp_list_mutex;
 
 std::vector<std::regex> enabled_tracepoint_regexs;
 
 void enable_trace()
 {
+    alloc_trace_bufs();
     trace_enabled = true;
 }
 
@@ -63,10 +113,12 @@ void enable_tracepoint(std::string wildcard)
     wildcard = boost::algorithm::replace_all_copy(wildcard, std::string("*"), std::string(".*"));
     wildcard = boost::algorithm::replace_all_copy(wildcard, std::string("?"), std::string("."));
     std::regex re{wildcard};
-    enabled_tracepoint_regexs.push_back(re);
-    for (auto& tp : tracepoint_base::tp_list) {
-        if (std::regex_match(std::string(tp.name), re)) {
-            tp.enable();
+    WITH_LOCK(tracepoint_base::tp_list_mutex) {
+        enabled_tracepoint_regexs.push_back(re);
+        for (auto& tp : tracepoint_base::tp_list) {
+            if (std::regex_match(std::string(tp.name), re)) {
+                tp.enable();
+            }
         }
     }
 }
@@ -94,19 +146,24 @@ tracepoint_base::tracepoint_base(unsigned _id, const std::type_info& tp_type,
         abort();
     }
     probes_ptr.assign(new std::vector<probe*>);
-    tp_list.push_back(*this);
-    try_enable();
+    WITH_LOCK(tp_list_mutex) {
+        tp_list.push_back(*this);
+        try_enable();
+    }
 }
 
 tracepoint_base::~tracepoint_base()
 {
-    tp_list.erase(tp_list.iterator_to(*this));
+    WITH_LOCK(tp_list_mutex) {
+        tp_list.erase(tp_list.iterator_to(*this));
+    }
     known_ids().erase(id);
     delete probes_ptr.read();
 }
 
 void tracepoint_base::enable()
 {
+    alloc_trace_bufs();
     logging = true;
     update();
 }
@@ -227,11 +284,24 @@ void tracepoint_base::do_log_backtrace(trace_record* tr, u8*& buffer)
     buffer += backtrace_len * sizeof(void*);
 }
 
+// Called with interrupts disabled, so we can't move to another cpu
+static trace_buf& current_trace_buf()
+{
+    if (arch::tls_available()) {
+        auto c = sched::cpu::current();
+        if (c && trace_for_cpu[c->id].log) {
+            return trace_for_cpu[c->id];
+        }
+    }
+    return trace_for_cpu[0];
+}
+
 trace_record* allocate_trace_record(size_t size)
 {
+    auto& tb = current_trace_buf();
     size += sizeof(trace_record);
     size = align_up(size, sizeof(long));
-    size_t p = trace_record_last.load(std::memory_order_relaxed);
+    size_t p = tb.last.load(std::memory_order_relaxed);
     size_t pn;
     do {
         pn = p + size;
@@ -239,12 +309,102 @@ trace_record* allocate_trace_record(size_t size)
             // crossed page boundary
             pn = align_up(p, trace_page_size) + size;
         }
-    } while (!trace_record_last.compare_exchange_weak(p, pn, std::memory_order_relaxed));
-    char* pp = &trace_log[p % max_trace];
+    } while (!tb.last.compare_exchange_weak(p, pn, std::memory_order_relaxed));
+    char* pp = &tb.log[p % tb.size];
     // clear the first word, do indicate an padding at the end of the page
     reinterpret_cast<trace_record*>(pp)->tp = nullptr;
     pn -= size;
-    return reinterpret_cast<trace_record*>(&trace_log[pn % max_trace]);
+    return reinterpret_cast<trace_record*>(&tb.log[pn % tb.size]);
+}
+
+// The binary trace format, all little-endian and 8-byte aligned:
+//
+//   "OSVTRACE", u64 version, u64 backtrace length, u64 page size
+//   u64 number of tracepoints, then for each:
+//       u64 key (the tp field of its records), u64 signature
+//       (signature_char codes packed lsb first), u64 name length,
+//       u64 format length, name, format, padding
+//   u64 number of cpus, then for each:
+//       u64 cpu id, u64 length, then the cpu's records, oldest first,
+//       exactly as they are laid out in the ring (records don't cross
+//       trace_page_size boundaries; a null tp skips to the next one)
+//
+// scripts/trace.py decodes it.
+constexpr u64 trace_export_version = 1;
+
+namespace {
+
+struct trace_writer {
+    std::function<void (const void*, size_t)>& out;
+    void put(const void* data, size_t len) {
+        static const char zeros[8] = {};
+        out(data, len);
+        if (len % 8) {
+            out(zeros, 8 - len % 8);
+        }
+    }
+    void put(u64 v) { put(&v, sizeof(v)); }
+    void put(const char* s) { put(s, strlen(s)); }
+};
+
+}
+
+void trace_export(std::function<void (const void* data, size_t len)> out)
+{
+    trace_writer w{out};
+    w.put("OSVTRACE");
+    w.put(trace_export_version);
+    w.put(tracepoint_base::backtrace_len);
+    w.put(trace_page_size);
+    WITH_LOCK(tracepoint_base::tp_list_mutex) {
+        w.put(tracepoint_base::tp_list.size());
+        for (auto& tp : tracepoint_base::tp_list) {
+            w.put(reinterpret_cast<u64>(&tp));
+            w.put(tp.sig);
+            w.put(strlen(tp.name));
+            w.put(strlen(tp.format));
+            w.put(tp.name);
+            w.put(tp.format);
+        }
+    }
+    std::vector<unsigned> cpus;
+    for (unsigned i = 0; i < sched::max_cpus; ++i) {
+        if (__atomic_load_n(&trace_for_cpu[i].log, __ATOMIC_ACQUIRE)) {
+            cpus.push_back(i);
+        }
+    }
+    w.put(cpus.size());
+    std::unique_ptr<char[]> copy(new char[max_trace]);
+    for (auto i : cpus) {
+        auto& tb = trace_for_cpu[i];
+        // Copy the ring while its cpu keeps logging, then drop the pages
+        // it may have overwritten in the meantime.
+        auto end = tb.last.load(std::memory_order_acquire);
+        memcpy(copy.get(), tb.log, tb.size);
+        auto now = tb.last.load(std::memory_order_acquire);
+        size_t begin = 0;
+        if (align_up(now, trace_page_size) > tb.size) {
+            begin = align_up(now, trace_page_size) - tb.size;
+        }
+        begin = std::min(begin, end);
+        w.put(i);
+        w.put(end - begin);
+        auto first = begin % tb.size;
+        auto len = std::min(end - begin, tb.size - first);
+        out(copy.get() + first, len);
+        out(copy.get(), end - begin - len);
+    }
+}
+
+void trace_device_init()
+{
+    create_report_device("trace", [] {
+        std::string ret;
+        trace_export([&] (const void* data, size_t len) {
+            ret.append(static_cast<const char*>(data), len);
+        });
+        return ret;
+    });
 }
 
 static __thread unsigned func_trace_nesting;
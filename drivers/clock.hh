@@ -13,7 +13,11 @@
 class clock {
 public:
     virtual ~clock();
+    // Wall-clock time, in nanoseconds since the epoch
     virtual s64 time() = 0;
+    // Monotonic time, in nanoseconds since boot; unaffected by changes to
+    // the wall clock
+    virtual s64 uptime() = 0;
     static void register_clock(clock* c);
     static clock* get() __attribute__((no_instrument_function));
 private:
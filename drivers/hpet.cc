@@ -25,6 +25,7 @@ class hpetclock : public clock {
 public:
     hpetclock(uint64_t hpet_address);
     virtual s64 time() __attribute__((no_instrument_function));
+    virtual s64 uptime() __attribute__((no_instrument_function));
 private:
     mmioaddr_t _addr;
     uint64_t _wall;
@@ -146,6 +147,12 @@ s64 hpetclock::time()
     return _wall + (mmio_getl(_addr + HPET_COUNTER) * _period);
 }
 
+s64 hpetclock::uptime()
+{
+    // The counter was reset to 0 when the clock was set up.
+    return mmio_getl(_addr + HPET_COUNTER) * _period;
+}
+
 void __attribute__((constructor(HPET_INIT_PRIO))) hpet_init()
 {
     XENPV_ALTERNATIVE(
@@ -20,12 +20,16 @@ class kvmclock : public clock {
 public:
     kvmclock();
     virtual s64 time() __attribute__((no_instrument_function));
+    virtual s64 uptime() __attribute__((no_instrument_function));
 private:
     u64 wall_clock_boot();
     u64 system_time();
     static void setup_cpu();
 private:
     static bool _smp_init;
+    // cpu 0's time info, if the host guarantees that all vcpus see a
+    // synchronized tsc; then any cpu may use it without pinning itself.
+    static pvclock_vcpu_time_info* _stable_sys;
     pvclock_wall_clock* _wall;
     u64  _wall_ns;
     static PERCPU(pvclock_vcpu_time_info, _sys);
@@ -33,6 +37,7 @@ private:
 };
 
 bool kvmclock::_smp_init = false;
+pvclock_vcpu_time_info* kvmclock::_stable_sys = nullptr;
 PERCPU(pvclock_vcpu_time_info, kvmclock::_sys);
 
 kvmclock::kvmclock()
@@ -48,6 +53,10 @@ void kvmclock::setup_cpu()
 {
     memset(&*_sys, 0, sizeof(*_sys));
     processor::wrmsr(msr::KVM_SYSTEM_TIME_NEW, mmu::virt_to_phys(&*_sys) | 1);
+    if (sched::cpu::current()->id == 0
+            && processor::features().kvm_clocksource_stable) {
+        _stable_sys = &*_sys;
+    }
     _smp_init = true;
 }
 
@@ -64,6 +73,15 @@ s64 kvmclock::time()
     return r;
 }
 
+s64 kvmclock::uptime()
+{
+    if (_smp_init) {
+        return system_time();
+    } else {
+        return 0;
+    }
+}
+
 u64 kvmclock::wall_clock_boot()
 {
     return pvclock::wall_clock_boot(_wall);
@@ -71,6 +89,13 @@ u64 kvmclock::wall_clock_boot()
 
 u64 kvmclock::system_time()
 {
+    auto stable = _stable_sys;
+    if (stable && (stable->flags & pvclock::tsc_stable_bit)) {
+        // The tsc is synchronized across cpus, so there is no need to
+        // disable preemption to keep the tsc read and the time info on
+        // the same cpu.
+        return pvclock::system_time(stable);
+    }
     sched::preempt_disable();
     auto sys = &*_sys;  // avoid recaclulating address each access
     auto r = pvclock::system_time(sys);
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include "drivers/report-device.hh"
+#include <osv/device.h>
+#include <osv/mutex.h>
+#include <osv/uio.h>
+#include <algorithm>
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace {
+
+struct report_device {
+    std::function<std::string ()> generate;
+    mutex mtx;
+    std::string snapshot;
+};
+
+}
+
+// A snapshot can be large (the trace buffers of all cpus), so it is only
+// kept until the read that reaches its end, or until the device is closed.
+static void free_snapshot(report_device* rd)
+{
+    std::string().swap(rd->snapshot);
+}
+
+static int report_read(struct device* dev, struct uio* uio, int ioflags)
+{
+    auto rd = static_cast<report_device*>(dev->private_data);
+    WITH_LOCK(rd->mtx) {
+        if (uio->uio_offset == 0) {
+            rd->snapshot = rd->generate();
+        }
+        if (uio->uio_offset >= off_t(rd->snapshot.size())) {
+            free_snapshot(rd);
+            return 0;
+        }
+        auto len = std::min(size_t(uio->uio_resid),
+                            rd->snapshot.size() - uio->uio_offset);
+        auto error = uiomove(&rd->snapshot[uio->uio_offset], len, uio);
+        if (uio->uio_offset >= off_t(rd->snapshot.size())) {
+            free_snapshot(rd);
+        }
+        return error;
+    }
+}
+
+static int report_close(struct device* dev)
+{
+    auto rd = static_cast<report_device*>(dev->private_data);
+    WITH_LOCK(rd->mtx) {
+        free_snapshot(rd);
+    }
+    return 0;
+}
+
+static struct devops report_devops = {
+    .open	= no_open,
+    .close	= report_close,
+    .read	= report_read,
+    .write	= no_write,
+    .ioctl	= no_ioctl,
+    .devctl	= no_devctl,
+};
+
+static struct driver report_driver = {
+    .name	= "report",
+    .devops	= &report_devops,
+};
+
+void create_report_device(const char* name,
+                          std::function<std::string ()> generate)
+{
+    auto dev = device_create(&report_driver, name, D_CHR);
+    dev->private_data = new report_device{generate};
+}
+
+void report_printf(std::string& report, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    auto len = vsnprintf(nullptr, 0, fmt, ap);
+    va_end(ap);
+    auto old = report.size();
+    report.resize(old + len + 1);
+    va_start(ap, fmt);
+    vsnprintf(&report[old], len + 1, fmt, ap);
+    va_end(ap);
+    report.resize(old + len);
+}
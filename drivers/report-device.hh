@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef REPORT_DEVICE_HH_
+#define REPORT_DEVICE_HH_
+
+#include <functional>
+#include <string>
+
+// Create /dev/@name, a read-only character device for reports and dumps.
+// Reading it from the start calls @generate for a new snapshot, which that
+// read and the following ones return.  The snapshot is freed once it has
+// been read to the end, or when the device is closed.
+void create_report_device(const char* name,
+                          std::function<std::string ()> generate);
+
+// Append printf-style formatted text to @report
+void report_printf(std::string& report, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif /* REPORT_DEVICE_HH_ */
@@ -51,6 +51,17 @@ virtio_blk_strategy(struct bio *bio)
     prv->drv->make_virtio_request(bio);
 }
 
+static void
+virtio_blk_strategy_batch(struct bio **bios, int nbios)
+{
+    struct virtio_blk_priv *prv = reinterpret_cast<struct virtio_blk_priv*>(bios[0]->bio_dev->private_data);
+
+    for (int i = 0; i < nbios; i++) {
+        bios[i]->bio_offset += bios[i]->bio_dev->offset;
+    }
+    prv->drv->make_virtio_requests(bios, nbios);
+}
+
 static int
 virtio_blk_read(struct device *dev, struct uio *uio, int ioflags)
 {
@@ -81,6 +92,7 @@ static struct devops virtio_blk_devops {
     no_ioctl,
     no_devctl,
     virtio_blk_strategy,
+    virtio_blk_strategy_batch,
 };
 
 struct driver virtio_blk_driver = {
@@ -118,6 +130,10 @@ virtio_blk::virtio_blk(pci::device& pci_dev)
     prv = reinterpret_cast<struct virtio_blk_priv*>(dev->private_data);
     prv->drv = this;
     dev->size = prv->drv->size();
+    // Larger bios would not fit in one request (see queue_request())
+    if (get_guest_feature_bit(VIRTIO_BLK_F_SEG_MAX)) {
+        dev->max_io_size = (_config.seg_max - 1) * page_size;
+    }
     read_partition_table(dev);
 }
 
@@ -170,24 +186,26 @@ void virtio_blk::response_worker() {
 
         u32 len;
         while((req = static_cast<virtio_blk_req*>(queue->get_buf_elem(&len))) != nullptr) {
-            if (req->bio) {
+            if (!req->bios.empty()) {
+                bool ok = false;
                 switch (req->res.status) {
                 case VIRTIO_BLK_S_OK:
-                    biodone(req->bio, true);
+                    ok = true;
                     break;
                 case VIRTIO_BLK_S_UNSUPP:
                     kprintf("unsupported I/O request\n");
-                    biodone(req->bio, false);
                     break;
                 default:
-                    kprintf("virtio-blk: I/O error, sector = %lu, len = %lu, type = %x\n",
-                            req->hdr.sector, req->bio->bio_bcount, req->hdr.type);
-                    biodone(req->bio, false);
+                    kprintf("virtio-blk: I/O error, sector = %lu, bios = %lu, type = %x\n",
+                            req->hdr.sector, req->bios.size(), req->hdr.type);
                     break;
                }
+               for (auto bio : req->bios) {
+                   biodone(bio, ok);
+               }
             }
 
-            req->bio = nullptr;
+            req->bios.clear();
             delete req;
             queue->get_buf_finalize();
         }
@@ -209,56 +227,76 @@ int64_t virtio_blk::size() {
 static const int page_size = 4096;
 static const int sector_size = 512;
 
-int virtio_blk::make_virtio_request(struct bio* bio)
+// Data segments a bio needs: its buffer is split at page boundaries
+int virtio_blk::request_segments(struct bio* bio)
 {
-    // The lock is here for parallel requests protection
-    WITH_LOCK(_lock) {
+    long offset = 0xfff & reinterpret_cast<long>(bio->bio_data);
+    return (offset + bio->bio_bcount + page_size - 1) / page_size;
+}
 
-        if (!bio) return EIO;
+// Whether next can go in the same request as prev, which has segs data
+// segments so far: a read or write of the sectors right after prev's.
+bool virtio_blk::can_merge(struct bio* prev, struct bio* next, int segs)
+{
+    return next->bio_cmd == prev->bio_cmd &&
+           (next->bio_cmd == BIO_READ || next->bio_cmd == BIO_WRITE) &&
+           next->bio_offset == prev->bio_offset + prev->bio_bcount &&
+           segs + request_segments(next) + 2 <= (int)_config.seg_max;
+}
 
-        if (bio->bio_bcount/page_size + 1 > _config.seg_max) {
-            virtio_w("%s:request of size %d needs more segment than the max %d",
-                    __FUNCTION__, bio->bio_bcount, (u32)_config.seg_max);
-            return EIO;
-        }
+// Queues one request for bios[0..nbios), which must be adjacent (see
+// can_merge()), without notifying the host.  Called with _lock held.
+int virtio_blk::queue_request(struct bio** bios, int nbios)
+{
+    struct bio* bio = bios[0];
+    if (!bio) return EIO;
 
-        vring* queue = get_virt_queue(0);
-        virtio_blk_request_type type;
-
-        switch (bio->bio_cmd) {
-        case BIO_READ:
-            type = VIRTIO_BLK_T_IN;
-            break;
-        case BIO_WRITE:
-            if (is_readonly()) {
-                virtio_e("Error: block device is read only");
-                biodone(bio, false);
-                return EROFS;
+    if (bio->bio_bcount/page_size + 1 > _config.seg_max) {
+        virtio_w("%s:request of size %d needs more segment than the max %d",
+                __FUNCTION__, bio->bio_bcount, (u32)_config.seg_max);
+        return EIO;
+    }
+
+    vring* queue = get_virt_queue(0);
+    virtio_blk_request_type type;
+
+    switch (bio->bio_cmd) {
+    case BIO_READ:
+        type = VIRTIO_BLK_T_IN;
+        break;
+    case BIO_WRITE:
+        if (is_readonly()) {
+            virtio_e("Error: block device is read only");
+            for (int i = 0; i < nbios; i++) {
+                biodone(bios[i], false);
             }
-            type = VIRTIO_BLK_T_OUT;
-            break;
-        case BIO_FLUSH:
-            type = VIRTIO_BLK_T_FLUSH;
-            break;
-        default:
-            return ENOTBLK;
+            return EROFS;
         }
+        type = VIRTIO_BLK_T_OUT;
+        break;
+    case BIO_FLUSH:
+        type = VIRTIO_BLK_T_FLUSH;
+        break;
+    default:
+        return ENOTBLK;
+    }
 
-        virtio_blk_req* req = new virtio_blk_req;
-        req->bio = bio;
-        virtio_blk_outhdr* hdr = &req->hdr;
-        hdr->type = type;
-        hdr->ioprio = 0;
-        hdr->sector = bio->bio_offset/ sector_size;
+    virtio_blk_req* req = new virtio_blk_req;
+    req->bios.assign(bios, bios + nbios);
+    virtio_blk_outhdr* hdr = &req->hdr;
+    hdr->type = type;
+    hdr->ioprio = 0;
+    hdr->sector = bio->bio_offset/ sector_size;
 
-        queue->_sg_vec.clear();
-        queue->_sg_vec.push_back(vring::sg_node(mmu::virt_to_phys(hdr), sizeof(struct virtio_blk_outhdr), vring_desc::VRING_DESC_F_READ));
+    queue->_sg_vec.clear();
+    queue->_sg_vec.push_back(vring::sg_node(mmu::virt_to_phys(hdr), sizeof(struct virtio_blk_outhdr), vring_desc::VRING_DESC_F_READ));
 
-        // need to break a contiguous buffers that > 4k into several physical page mapping
-        // even if the virtual space is contiguous.
+    // need to break a contiguous buffers that > 4k into several physical page mapping
+    // even if the virtual space is contiguous.
+    for (int i = 0; i < nbios; i++) {
+        bio = bios[i];
         long len = 0;
-        int offset = bio->bio_offset;
-        offset = 0xfff & reinterpret_cast<long>(bio->bio_data);
+        int offset = 0xfff & reinterpret_cast<long>(bio->bio_data);
         void *base = bio->bio_data;
         while (len != bio->bio_bcount) {
             long size = std::min(bio->bio_bcount - len, (long)page_size);
@@ -269,22 +307,59 @@ int virtio_blk::make_virtio_request(struct bio* bio)
             base += size;
             offset = 0;
         }
+    }
 
-        req->res.status = 0;
-        queue->_sg_vec.push_back(vring::sg_node(mmu::virt_to_phys(&req->res), sizeof (struct virtio_blk_res), vring_desc::VRING_DESC_F_WRITE));
-
-        while (!queue->add_buf(req)) {
-            _waiting_request_thread = sched::thread::current();
-            std::atomic_thread_fence(std::memory_order_seq_cst);
-            sched::thread::wait_until([queue] {queue->get_buf_gc(); return queue->avail_ring_has_room(queue->_sg_vec.size());});
-            _request_thread_lock.lock();
-            _waiting_request_thread = nullptr;
-            _request_thread_lock.unlock();
-        }
+    req->res.status = 0;
+    queue->_sg_vec.push_back(vring::sg_node(mmu::virt_to_phys(&req->res), sizeof (struct virtio_blk_res), vring_desc::VRING_DESC_F_WRITE));
 
+    while (!queue->add_buf(req)) {
+        // Let the host start on what we queued so far while we wait
         queue->kick();
+        _waiting_request_thread = sched::thread::current();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        sched::thread::wait_until([queue] {queue->get_buf_gc(); return queue->avail_ring_has_room(queue->_sg_vec.size());});
+        _request_thread_lock.lock();
+        _waiting_request_thread = nullptr;
+        _request_thread_lock.unlock();
+    }
 
-        return 0;
+    return 0;
+}
+
+int virtio_blk::make_virtio_request(struct bio* bio)
+{
+    // The lock is here for parallel requests protection
+    WITH_LOCK(_lock) {
+        int ret = queue_request(&bio, 1);
+        if (ret == 0) {
+            get_virt_queue(0)->kick();
+        }
+        return ret;
+    }
+}
+
+void virtio_blk::make_virtio_requests(struct bio** bios, int nbios)
+{
+    WITH_LOCK(_lock) {
+        bool queued = false;
+        for (int i = 0, j; i < nbios; i = j) {
+            int segs = request_segments(bios[i]);
+            for (j = i + 1; j < nbios && can_merge(bios[j - 1], bios[j], segs); j++) {
+                segs += request_segments(bios[j]);
+            }
+            int ret = queue_request(bios + i, j - i);
+            if (ret == 0) {
+                queued = true;
+            } else if (ret != EROFS) {
+                // queue_request() completed the bios itself for EROFS only
+                for (int k = i; k < j; k++) {
+                    biodone(bios[k], false);
+                }
+            }
+        }
+        if (queued) {
+            get_virt_queue(0)->kick();
+        }
     }
 }
 
@@ -10,6 +10,7 @@
 #include "drivers/virtio.hh"
 #include "drivers/pci-device.hh"
 #include <osv/bio.h>
+#include <vector>
 
 namespace virtio {
 
@@ -127,6 +128,8 @@ namespace virtio {
         virtual u32 get_driver_features(void);
 
         int make_virtio_request(struct bio*);
+        // Queues several bios, sorted by offset, and kicks the host once.
+        void make_virtio_requests(struct bio** bios, int nbios);
 
         void response_worker();
         int64_t size();
@@ -137,17 +140,21 @@ namespace virtio {
         static hw_driver* probe(hw_device* dev);
     private:
 
+        // One request may carry several bios for adjacent sectors
         struct virtio_blk_req {
-            virtio_blk_req(struct bio* b=nullptr) :bio(b) {};
             ~virtio_blk_req() {
-                if (bio) biodone(bio, false);
+                for (auto bio : bios) biodone(bio, false);
             };
 
             virtio_blk_outhdr hdr;
             virtio_blk_res res;
-            struct bio* bio;
+            std::vector<struct bio*> bios;
         };
 
+        int queue_request(struct bio** bios, int nbios);
+        bool can_merge(struct bio* prev, struct bio* next, int segs);
+        int request_segments(struct bio* bio);
+
         std::string _driver_name;
         virtio_blk_config _config;
 
@@ -22,6 +22,7 @@ class xenclock : public clock {
 public:
     xenclock();
     virtual s64 time() __attribute__((no_instrument_function));
+    virtual s64 uptime() __attribute__((no_instrument_function));
 private:
     pvclock_wall_clock* _wall;
     static void setup_cpu();
@@ -61,6 +62,19 @@ s64 xenclock::time()
     return r;
 }
 
+s64 xenclock::uptime()
+{
+    int cpu = 0;
+
+    sched::preempt_disable();
+    if (_smp_init) {
+        cpu = sched::cpu::current()->id;
+    }
+    auto r = pvclock::system_time(&xen::xen_shared_info.vcpu_info[cpu].time);
+    sched::preempt_enable();
+    return r;
+}
+
 static __attribute__((constructor(CLOCK_INIT_PRIO))) void setup_xenclock()
 {
     if (processor::features().xen_clocksource) {
@@ -185,7 +185,17 @@ devfs_init(void)
 	return 0;
 }
 
-#define devfs_mount	((vfsop_mount_t)vfs_nullop)
+/*
+ * Devices are registered without going through the vnode operations, so
+ * a failed lookup must not be remembered.
+ */
+static int
+devfs_mount(struct mount *mp, char *dev, int flags, void *data)
+{
+	mp->m_flags |= MNT_NONEGCACHE;
+	return 0;
+}
+
 #define devfs_unmount	((vfsop_umount_t)vfs_nullop)
 #define devfs_sync	((vfsop_sync_t)vfs_nullop)
 #define devfs_vget	((vfsop_vget_t)vfs_nullop)
@@ -202,6 +212,8 @@ devfs_init(void)
 #define devfs_setattr	((vnop_setattr_t)vop_nullop)
 #define devfs_inactive	((vnop_inactive_t)vop_nullop)
 #define devfs_truncate	((vnop_truncate_t)vop_nullop)
+#define devfs_loan	((vnop_loan_t)vop_einval)
+#define devfs_unloan	((vnop_unloan_t)vop_nullop)
 
 /*
  * vnode operations
@@ -225,6 +237,8 @@ struct vnops devfs_vnops = {
 	devfs_setattr,		/* setattr */
 	devfs_inactive,		/* inactive */
 	devfs_truncate,		/* truncate */
+	devfs_loan,		/* loan */
+	devfs_unloan,		/* unloan */
 };
 
 /*
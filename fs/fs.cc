@@ -8,6 +8,7 @@
 #include "fs.hh"
 #include <fcntl.h>
 #include <sys/stat.h>
+#include "vfs/vfs.h"
 
 uint64_t size(fileref f)
 {
@@ -27,6 +28,17 @@ void read(fileref f, void *buffer, uint64_t offset, uint64_t len)
     assert(data.uio_resid == 0);
 }
 
+int try_read(fileref f, void *buffer, uint64_t offset, uint64_t len)
+{
+    iovec iov{buffer, len};
+    uio data{&iov, 1, off_t(offset), ssize_t(len), UIO_READ};
+    int r = fo_read(f.get(), &data, FOF_OFFSET);
+    if (r == 0 && data.uio_resid != 0) {
+        r = EIO;
+    }
+    return r;
+}
+
 void write(fileref f, const void* buffer, uint64_t offset, uint64_t len)
 {
     iovec iov{const_cast<void*>(buffer), len};
@@ -37,6 +49,16 @@ void write(fileref f, const void* buffer, uint64_t offset, uint64_t len)
     assert(data.uio_resid == 0);
 }
 
+bool loan(fileref f, uint64_t offset, file_loan& l)
+{
+    return sys_loan(f.get(), offset, &l.addr, &l.len, &l.cookie) == 0;
+}
+
+void unloan(fileref f, const file_loan& l)
+{
+    sys_unloan(f.get(), l.cookie);
+}
+
 fileref fileref_from_fd(int fd)
 {
     file* fp;
@@ -30,8 +30,24 @@ fileref fileref_from_fd(int fd);
 fileref fileref_from_fname(std::string name);
 uint64_t size(fileref f);
 void read(fileref f, void *buffer, uint64_t offset, uint64_t len);
+// Like read(), but returns an errno (EIO for a short read) instead of
+// asserting, for files which may be truncated or corrupt
+int try_read(fileref f, void *buffer, uint64_t offset, uint64_t len);
 void write(fileref f, const void* buffer, uint64_t offset, uint64_t len);
 
+// File data borrowed from the file system's cache, at a page-aligned
+// address, instead of read into a buffer of our own.
+struct file_loan {
+    void* addr;
+    size_t len;
+    void* cookie;
+};
+
+// Returns false if the file system can't lend the data at the (page
+// aligned) offset, in which case the caller should read() it instead.
+bool loan(fileref f, uint64_t offset, file_loan& l);
+void unloan(fileref f, const file_loan& l);
+
 class filesystem {};
 
 fileref falloc_noinstall(); // throws error
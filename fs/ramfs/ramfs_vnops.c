@@ -452,6 +452,8 @@ ramfs_init(void)
 #define ramfs_getattr	((vnop_getattr_t)vop_nullop)
 #define ramfs_setattr	((vnop_setattr_t)vop_nullop)
 #define ramfs_inactive	((vnop_inactive_t)vop_nullop)
+#define ramfs_loan	((vnop_loan_t)vop_einval)
+#define ramfs_unloan	((vnop_unloan_t)vop_nullop)
 
 /*
  * vnode operations
@@ -475,5 +477,7 @@ struct vnops ramfs_vnops = {
 	ramfs_setattr,		/* setattr */
 	ramfs_inactive,		/* inactive */
 	ramfs_truncate,		/* truncate */
+	ramfs_loan,		/* loan */
+	ramfs_unloan,		/* unloan */
 };
 
@@ -14,6 +14,8 @@
 #include <osv/debug.h>
 #include <osv/mutex.h>
 #include <osv/rcu.hh>
+#include <algorithm>
+#include <memory>
 
 #include <bsd/sys/sys/queue.h>
 
@@ -22,10 +24,94 @@ using namespace osv;
 /*
  * Global file descriptors table - in OSv we have a single process so file
  * descriptors are maintained globally.
+ *
+ * The table starts small and doubles, up to FDMAX entries, when it fills
+ * up.  fget() only takes rcu_read_lock; changes are serialized by gfdt_lock,
+ * and a grown table is published with assign() while the old one is
+ * disposed of after the readers are done with it.  A bitmap of the used
+ * slots makes finding the lowest free descriptor a scan over words.
  */
-rcu_ptr<file> gfdt[FDMAX] = {};
+struct fdtable {
+    explicit fdtable(int size);
+    int size;
+    int next_fd;        // no free slot below this one
+    std::unique_ptr<rcu_ptr<file>[]> fds;
+    std::unique_ptr<unsigned long[]> used;
+};
+
+static constexpr int fdtable_min = 256;
+static constexpr int bits_per_word = sizeof(unsigned long) * 8;
+
+fdtable::fdtable(int size)
+    : size(size)
+    , next_fd(0)
+    , fds(new rcu_ptr<file>[size]())
+    , used(new unsigned long[size / bits_per_word]())
+{
+}
+
+rcu_ptr<fdtable> gfdt;
 mutex_t gfdt_lock = MUTEX_INITIALIZER;
 
+/* Find the lowest free slot at or above start, or t->size if there is none */
+static int fdtable_find_free(fdtable* t, int start)
+{
+    for (int w = start / bits_per_word; w < t->size / bits_per_word; w++) {
+        unsigned long avail = ~t->used[w];
+        if (w == start / bits_per_word) {
+            avail &= ~0UL << (start % bits_per_word);
+        }
+        if (avail) {
+            return w * bits_per_word + __builtin_ctzl(avail);
+        }
+    }
+    return t->size;
+}
+
+/*
+ * Returns a table with room for descriptor fd, replacing the current one
+ * if it is too small.  Called with gfdt_lock held.
+ */
+static fdtable* fdtable_expand(int fd)
+{
+    fdtable* old = gfdt.read_by_owner();
+    if (old && fd < old->size) {
+        return old;
+    }
+
+    int size = old ? old->size : fdtable_min;
+    while (size <= fd) {
+        size *= 2;
+    }
+    size = std::min(size, FDMAX);
+
+    fdtable* t = new fdtable(size);
+    if (old) {
+        for (int i = 0; i < old->size; i++) {
+            t->fds[i].assign(old->fds[i].read_by_owner());
+        }
+        std::copy(old->used.get(), old->used.get() + old->size / bits_per_word,
+                  t->used.get());
+        t->next_fd = old->next_fd;
+    }
+    gfdt.assign(t);
+    if (old) {
+        rcu_dispose(old);
+    }
+    return t;
+}
+
+static void fdtable_install(fdtable* t, int fd, file* fp)
+{
+    t->fds[fd].assign(fp);
+    if (fp) {
+        t->used[fd / bits_per_word] |= 1UL << (fd % bits_per_word);
+    } else {
+        t->used[fd / bits_per_word] &= ~(1UL << (fd % bits_per_word));
+        t->next_fd = std::min(t->next_fd, fd);
+    }
+}
+
 /*
  * Allocate a file descriptor and assign fd to it atomically.
  *
@@ -33,27 +119,29 @@ mutex_t gfdt_lock = MUTEX_INITIALIZER;
  */
 int _fdalloc(struct file *fp, int *newfd, int min_fd)
 {
-    int fd;
+    if (min_fd < 0 || min_fd >= FDMAX)
+        return EMFILE;
 
     fhold(fp);
 
-    for (fd = min_fd; fd < FDMAX; fd++) {
-        if (gfdt[fd])
-            continue;
-
-        WITH_LOCK(gfdt_lock) {
-            /* Now that we hold the lock,
-             * make sure the entry is still available */
-            if (gfdt[fd].read_by_owner()) {
-                continue;
+    WITH_LOCK(gfdt_lock) {
+        fdtable* t = gfdt.read_by_owner();
+        int fd = min_fd;
+        if (t) {
+            fd = fdtable_find_free(t, std::max(min_fd, t->next_fd));
+            if (fd == t->size) {
+                fd = std::max(fd, min_fd);
             }
-
-            /* Install */
-            gfdt[fd].assign(fp);
+        }
+        if (fd < FDMAX) {
+            if (t && min_fd <= t->next_fd) {
+                t->next_fd = fd + 1;
+            }
+            t = fdtable_expand(fd);
+            fdtable_install(t, fd, fp);
             *newfd = fd;
+            return 0;
         }
-
-        return 0;
     }
 
     fdrop(fp);
@@ -75,13 +163,17 @@ int fdclose(int fd)
     struct file* fp;
 
     WITH_LOCK(gfdt_lock) {
+        fdtable* t = gfdt.read_by_owner();
+        if (!t || fd < 0 || fd >= t->size) {
+            return EBADF;
+        }
 
-        fp = gfdt[fd].read_by_owner();
+        fp = t->fds[fd].read_by_owner();
         if (fp == NULL) {
             return EBADF;
         }
 
-        gfdt[fd].assign(nullptr);
+        fdtable_install(t, fd, nullptr);
     }
 
     fdrop(fp);
@@ -103,9 +195,10 @@ int fdset(int fd, struct file *fp)
     fhold(fp);
 
     WITH_LOCK(gfdt_lock) {
-        orig = gfdt[fd].read_by_owner();
+        fdtable* t = fdtable_expand(fd);
+        orig = t->fds[fd].read_by_owner();
         /* Install new file structure in place */
-        gfdt[fd].assign(fp);
+        fdtable_install(t, fd, fp);
     }
 
     if (orig)
@@ -133,20 +226,35 @@ static bool fhold_if_positive(file* f)
 int fget(int fd, struct file **out_fp)
 {
     struct file *fp;
+    bool stale;
 
     if (fd < 0 || fd >= FDMAX)
         return EBADF;
 
-    WITH_LOCK(rcu_read_lock) {
-        fp = gfdt[fd].read();
-        if (fp == NULL) {
-            return EBADF;
-        }
+    do {
+        WITH_LOCK(rcu_read_lock) {
+            fdtable* t = gfdt.read();
+            if (!t || fd >= t->size) {
+                return EBADF;
+            }
 
-        if (!fhold_if_positive(fp)) {
-            return EBADF;
+            fp = t->fds[fd].read();
+            if (fp == NULL) {
+                return EBADF;
+            }
+
+            if (!fhold_if_positive(fp)) {
+                return EBADF;
+            }
+
+            /* A table replaced by a grown copy is no longer updated by
+             * fdclose(), so the slot may have changed since.  Look again. */
+            stale = gfdt.read() != t;
         }
-    }
+        if (stale) {
+            fdrop(fp);
+        }
+    } while (stale);
 
     *out_fp = fp;
     return 0;
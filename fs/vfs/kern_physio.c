@@ -37,6 +37,11 @@ destroy_bio(struct bio *bio)
 	free(bio);
 }
 
+static __thread struct bio_plug *current_plug;
+
+/* see sched.hh */
+extern __thread void (*sched_before_wait)(void);
+
 int
 bio_wait(struct bio *bio)
 {
@@ -80,6 +85,113 @@ biofinish(struct bio *bp, struct devstat *stat, int error)
 	biodone(bp, error);
 }
 
+/*
+ * Order of the bios in a plug: by disk (devices sharing private_data are
+ * partitions of one disk), then by offset on the disk.
+ */
+static int
+bio_plug_before(const struct bio *a, const struct bio *b)
+{
+	const struct device *da = a->bio_dev, *db = b->bio_dev;
+
+	if (da->private_data != db->private_data)
+		return da->private_data < db->private_data;
+	return da->offset + a->bio_offset < db->offset + b->bio_offset;
+}
+
+static void
+bio_flush_plug(struct bio_plug *plug)
+{
+	struct bio *bios[BIO_PLUG_MAX];
+	int nbios = plug->nbios;
+	int i, j, start;
+
+	/*
+	 * Work on a copy: a driver may complete a bio right away, and its
+	 * bio_done may submit more.
+	 */
+	memcpy(bios, plug->bios, nbios * sizeof(bios[0]));
+	plug->nbios = 0;
+
+	/*
+	 * Insertion sort, which is fine for a handful of bios.  A flush is a
+	 * barrier: nothing moves across it.
+	 */
+	for (start = 0, i = 1; i < nbios; i++) {
+		struct bio *bio = bios[i];
+		if (bio->bio_cmd == BIO_FLUSH || bios[i - 1]->bio_cmd == BIO_FLUSH) {
+			start = i;
+			continue;
+		}
+		for (j = i; j > start && bio_plug_before(bio, bios[j - 1]); j--)
+			bios[j] = bios[j - 1];
+		bios[j] = bio;
+	}
+
+	for (i = 0; i < nbios; i = j) {
+		struct device *dev = bios[i]->bio_dev;
+		struct devops *ops = dev->driver->devops;
+
+		for (j = i + 1; j < nbios; j++) {
+			struct device *d = bios[j]->bio_dev;
+			if (d->driver != dev->driver ||
+			    d->private_data != dev->private_data)
+				break;
+		}
+		if (ops->strategy_batch) {
+			ops->strategy_batch(bios + i, j - i);
+		} else {
+			int k;
+			for (k = i; k < j; k++)
+				ops->strategy(bios[k]);
+		}
+	}
+}
+
+/*
+ * Called before the plugging thread waits for anything: what it waits for,
+ * a lock included, may depend on the bios it holds.
+ */
+static void
+bio_flush_current_plug(void)
+{
+	bio_flush_plug(current_plug);
+}
+
+void
+bio_start_plug(struct bio_plug *plug)
+{
+	plug->nbios = 0;
+	if (!current_plug) {
+		current_plug = plug;
+		sched_before_wait = bio_flush_current_plug;
+	}
+}
+
+void
+bio_finish_plug(struct bio_plug *plug)
+{
+	if (current_plug != plug)
+		return;
+	current_plug = NULL;
+	sched_before_wait = NULL;
+	bio_flush_plug(plug);
+}
+
+void
+submit_bio(struct bio *bio)
+{
+	struct bio_plug *plug = current_plug;
+
+	if (!plug) {
+		bio->bio_dev->driver->devops->strategy(bio);
+		return;
+	}
+	if (plug->nbios == BIO_PLUG_MAX)
+		bio_flush_plug(plug);
+	plug->bios[plug->nbios++] = bio;
+}
+
 static void multiplex_bio_done(struct bio *b)
 {
 	struct bio *bio = b->bio_caller1;
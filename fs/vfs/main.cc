@@ -57,11 +57,20 @@
 #include <osv/debug.h>
 #include <osv/ioctl.h>
 #include <osv/trace.hh>
+#include <osv/mutex.h>
 #include <drivers/console.hh>
+#include <drivers/clock.hh>
+#include <sys/sendfile.h>
+#include "mmu.hh"
+
+#include <string>
+#include <vector>
+#include <unordered_set>
 
 #include "vfs.h"
 
 #include "libc/internal/libc.h"
+#include "libc/pipe_buffer.hh"
 
 #ifdef DEBUG_VFS
 int	vfs_debug = VFSDB_FLAGS;
@@ -75,6 +84,37 @@ TRACEPOINT(trace_vfs_open_err, "%d", int);
 
 struct task *main_task;	/* we only have a single process */
 
+/*
+ * The boot set: the files opened while booting the application, in the
+ * order they were first opened.  Enabled with --bootset and printed when
+ * main() returns, for scripts/mkzfs.py -b to lay out and prefetch.
+ */
+static bool bootset_enabled;
+static mutex bootset_mutex;
+static std::vector<std::string> bootset;
+static std::unordered_set<std::string> bootset_seen;
+
+extern "C" void vfs_bootset_enable(void)
+{
+	bootset_enabled = true;
+}
+
+static void bootset_add(const char *path)
+{
+	WITH_LOCK(bootset_mutex) {
+		if (bootset_seen.insert(path).second)
+			bootset.push_back(path);
+	}
+}
+
+extern "C" void vfs_bootset_print(void)
+{
+	WITH_LOCK(bootset_mutex) {
+		for (auto& path : bootset)
+			kprintf("bootset: %s\n", path.c_str());
+	}
+}
+
 extern "C"
 int open(const char *pathname, int flags, mode_t mode)
 {
@@ -111,6 +151,8 @@ int open(const char *pathname, int flags, mode_t mode)
 	if (error)
 		goto out_fput;
 
+	if (bootset_enabled)
+		bootset_add(path);
 	fdrop(fp);
 	trace_vfs_open_ret(fd);
 	return fd;
@@ -352,6 +394,120 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 	return pwritev(fd, iov, iovcnt, -1);
 }
 
+TRACEPOINT(trace_vfs_sendfile, "%d %d %p 0x%x", int, int, off_t*, size_t);
+TRACEPOINT(trace_vfs_sendfile_ret, "0x%x", ssize_t);
+TRACEPOINT(trace_vfs_sendfile_err, "%d", int);
+
+/*
+ * Write out up to len bytes of in_fp at offset, straight from the file
+ * system's cache when it can lend us the data (see sys_loan()), and
+ * otherwise through *buf, which is allocated on first use.
+ */
+static int sendfile_chunk(struct file *out_fp, struct file *in_fp,
+			  off_t offset, size_t len, char **buf, size_t *count)
+{
+	const size_t bufsize = 65536;
+	off_t page = offset & ~off_t(mmu::page_size - 1);
+	void *addr, *cookie;
+	size_t lent, bytes;
+	struct iovec iov;
+	int error;
+
+	*count = 0;
+	if (sys_loan(in_fp, page, &addr, &lent, &cookie) == 0) {
+		iov.iov_base = static_cast<char *>(addr) + (offset - page);
+		iov.iov_len = std::min(len, lent - (offset - page));
+		error = sys_write(out_fp, &iov, 1, -1, count);
+		sys_unloan(in_fp, cookie);
+		return error;
+	}
+
+	if (!*buf) {
+		*buf = static_cast<char *>(malloc(bufsize));
+		if (!*buf)
+			return ENOMEM;
+	}
+	iov.iov_base = *buf;
+	iov.iov_len = std::min(len, bufsize);
+	error = sys_read(in_fp, &iov, 1, offset, &bytes);
+	if (error || !bytes)
+		return error;
+	iov.iov_len = bytes;
+	return sys_write(out_fp, &iov, 1, -1, count);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	struct file *in_fp, *out_fp;
+	struct stat st;
+	char *buf = nullptr;
+	off_t off;
+	size_t total = 0, bytes;
+	int error;
+
+	trace_vfs_sendfile(out_fd, in_fd, offset, count);
+	error = fget(in_fd, &in_fp);
+	if (error)
+		goto out_errno;
+	error = fget(out_fd, &out_fp);
+	if (error) {
+		fdrop(in_fp);
+		goto out_errno;
+	}
+
+	if (!in_fp->f_dentry || (in_fp->f_flags & FREAD) == 0) {
+		error = EBADF;
+		goto out;
+	}
+	error = fo_stat(in_fp, &st);
+	if (error)
+		goto out;
+	if (offset) {
+		off = *offset;
+	} else {
+		error = sys_lseek(in_fp, 0, SEEK_CUR, &off);
+		if (error)
+			goto out;
+	}
+	if (off < 0) {
+		error = EINVAL;
+		goto out;
+	}
+	count = off < st.st_size ? std::min(count, size_t(st.st_size - off)) : 0;
+
+	while (total < count) {
+		error = sendfile_chunk(out_fp, in_fp, off, count - total,
+				       &buf, &bytes);
+		total += bytes;
+		off += bytes;
+		if (error || !bytes)
+			break;
+	}
+	free(buf);
+	if (total)
+		error = 0;
+
+	if (offset)
+		*offset = off;
+	else
+		sys_lseek(in_fp, off, SEEK_SET, &off);
+
+out:
+	fdrop(out_fp);
+	fdrop(in_fp);
+	if (error)
+		goto out_errno;
+	trace_vfs_sendfile_ret(total);
+	return total;
+
+out_errno:
+	trace_vfs_sendfile_err(error);
+	errno = error;
+	return -1;
+}
+
+LFS64(sendfile);
+
 TRACEPOINT(trace_vfs_ioctl, "%d 0x%x", int, unsigned long);
 TRACEPOINT(trace_vfs_ioctl_ret, "");
 TRACEPOINT(trace_vfs_ioctl_err, "%d", int);
@@ -392,19 +548,31 @@ out_errno:
 TRACEPOINT(trace_vfs_fsync, "%d", int);
 TRACEPOINT(trace_vfs_fsync_ret, "");
 TRACEPOINT(trace_vfs_fsync_err, "%d", int);
+// Counting this per bucket gives a latency histogram: bucket n holds the
+// fsync()s which took [2^n, 2^(n+1)) microseconds.
+TRACEPOINT(trace_vfs_fsync_latency, "bucket=%d %d us", int, u64);
+
+static void fsync_latency(u64 start)
+{
+	u64 us = (clock::get()->time() - start) / 1000;
+	trace_vfs_fsync_latency(us ? 63 - __builtin_clzll(us) : 0, us);
+}
 
 int fsync(int fd)
 {
 	struct file *fp;
 	int error;
+	u64 start;
 
 	trace_vfs_fsync(fd);
 	error = fget(fd, &fp);
 	if (error)
 		goto out_errno;
 
+	start = clock::get()->time();
 	error = sys_fsync(fp);
 	fdrop(fp);
+	fsync_latency(start);
 
 	if (error)
 		goto out_errno;
@@ -1088,6 +1256,10 @@ int fcntl(int fd, int cmd, int arg)
 		tmp = fp->f_flags & FASYNC;
 		fo_ioctl(fp, FIOASYNC, &tmp);
 
+		break;
+	case F_GETPIPE_SZ:
+	case F_SETPIPE_SZ:
+		error = pipe_fcntl_size(fp, cmd, arg, &ret);
 		break;
 	default:
 		kprintf("unsupported fcntl cmd 0x%x\n", cmd);
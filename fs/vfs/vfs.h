@@ -90,6 +90,9 @@ int	 sys_fstat(struct file *fp, struct stat *st);
 int	 sys_fstatfs(struct file *fp, struct statfs *buf);
 int	 sys_fsync(struct file *fp);
 int	 sys_ftruncate(struct file *fp, off_t length);
+int	 sys_loan(struct file *fp, off_t off, void **addr, size_t *len,
+		void **cookie);
+void	 sys_unloan(struct file *fp, void *cookie);
 
 int	 sys_readdir(struct file *fp, struct dirent *dirent);
 int	 sys_rewinddir(struct file *fp);
@@ -129,7 +132,13 @@ int	 vfs_findroot(char *path, struct mount **mp, char **root);
 int	 fs_noop(void);
 
 struct dentry *dentry_alloc(struct vnode *vp, char *path);
+void	dref(struct dentry *dp);
 void	drele(struct dentry *dp);
+void	dentry_invalidate(struct dentry *ddp, char *name, int subtree);
+void	dentry_purge(struct mount *mp);
+
+u_int	vfs_hash(struct mount *mp, const char *path);
+u_int	vfs_hash_buckets(void);
 
 #ifdef DEBUG_VFS
 void	 vnode_dump(void);
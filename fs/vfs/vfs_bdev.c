@@ -16,6 +16,9 @@
 #include <osv/prex.h>
 #include <osv/buf.h>
 #include <osv/bio.h>
+#include <osv/vnode.h>
+#include <sys/param.h>
+#include <bsd/porting/mmu.h>
 
 int
 bdev_read(struct device *dev, struct uio *uio, int ioflags)
@@ -25,6 +28,9 @@ bdev_read(struct device *dev, struct uio *uio, int ioflags)
 
 	assert(uio->uio_rw == UIO_READ);
 
+	if (ioflags & IO_DIRECT)
+		return physio(dev, uio, ioflags);
+
 	/*
 	 * These should be handled gracefully, but this gives us the
 	 * best debugging for now.
@@ -65,6 +71,9 @@ bdev_write(struct device *dev, struct uio *uio, int ioflags)
 
 	assert(uio->uio_rw == UIO_WRITE);
 
+	if (ioflags & IO_DIRECT)
+		return physio(dev, uio, ioflags);
+
 	/*
 	 * These should be handled gracefully, but this gives us the
 	 * best debugging for now.
@@ -100,49 +109,119 @@ bdev_write(struct device *dev, struct uio *uio, int ioflags)
 }
 
 
+/*
+ * Consume len bytes of the uio, which the caller has transferred itself.
+ */
+static void
+uio_advance(struct uio *uio, size_t len)
+{
+	uio->uio_resid -= len;
+	uio->uio_offset += len;
+	while (len) {
+		struct iovec *iov = uio->uio_iov;
+		size_t n = MIN(len, iov->iov_len);
+
+		iov->iov_base = (char *)iov->iov_base + n;
+		iov->iov_len -= n;
+		len -= n;
+		if (!iov->iov_len) {
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+		}
+	}
+}
+
+/*
+ * Transfer between a device and the caller's buffers without going
+ * through the buffer cache (O_DIRECT).  Each iovec is sent to the driver
+ * as one or more bios of at most max_io_size bytes, all queued under one
+ * plug and waited for at the end, so the driver gets them as a batch and
+ * the device can work on them together.  Offsets and lengths must be
+ * multiples of the sector size.  Buffers the driver cannot translate to
+ * physical addresses (mmap()ed memory) are bounced through a copy.
+ */
 int
 physio(struct device *dev, struct uio *uio, int ioflags)
 {
-	struct bio *bio;
-	int ret;
+	struct bio_plug plug;
+	struct bio **bios;
+	size_t max = dev->max_io_size, done = 0;
+	off_t offset = uio->uio_offset;
+	int i, nbios = 0, n = 0, error = 0;
 
-	if (uio->uio_offset < 0)
+	if (uio->uio_offset < 0 || uio->uio_offset % BSIZE)
 		return EINVAL;
 	if (uio->uio_resid == 0)
 		return 0;
-    
-	while (uio->uio_resid > 0) {
-		struct iovec *iov = uio->uio_iov;
-
-		if (!iov->iov_len)
-			continue;
-
-		bio = alloc_bio();
-		if (!bio)
-			return ENOMEM;
-
-		if (uio->uio_rw == UIO_READ)
-			bio->bio_cmd = BIO_READ;
-		else
-			bio->bio_cmd = BIO_WRITE;
-
-		bio->bio_dev = dev;
-		bio->bio_data = iov->iov_base;
-		bio->bio_offset = uio->uio_offset;
-		bio->bio_bcount = uio->uio_resid;
-
-		dev->driver->devops->strategy(bio);
 
-		ret = bio_wait(bio);
+	for (i = 0; i < uio->uio_iovcnt; i++) {
+		if (uio->uio_iov[i].iov_len % BSIZE)
+			return EINVAL;
+		nbios += howmany(uio->uio_iov[i].iov_len, max);
+	}
+	bios = malloc(nbios * sizeof(*bios));
+	if (!bios)
+		return ENOMEM;
+
+	bio_start_plug(&plug);
+	for (i = 0; i < uio->uio_iovcnt; i++) {
+		struct iovec *iov = &uio->uio_iov[i];
+		size_t off, len;
+
+		for (off = 0; off < iov->iov_len; off += len) {
+			struct bio *bio = alloc_bio();
+			char *data = (char *)iov->iov_base + off;
+
+			if (!bio) {
+				error = ENOMEM;
+				goto submitted;
+			}
+			len = MIN(max, iov->iov_len - off);
+			bio->bio_cmd = (uio->uio_rw == UIO_READ) ? BIO_READ : BIO_WRITE;
+			bio->bio_dev = dev;
+			bio->bio_offset = offset;
+			bio->bio_bcount = len;
+			bio->bio_data = data;
+			if (!virt_is_translatable(data)) {
+				bio->bio_data = malloc(len);
+				if (!bio->bio_data) {
+					destroy_bio(bio);
+					error = ENOMEM;
+					goto submitted;
+				}
+				bio->bio_caller1 = data;
+				if (uio->uio_rw == UIO_WRITE)
+					memcpy(bio->bio_data, data, len);
+			}
+			submit_bio(bio);
+			bios[n++] = bio;
+			offset += len;
+		}
+	}
+submitted:
+	bio_finish_plug(&plug);
+
+	/* Report the bytes transferred before the first failure */
+	for (i = 0; i < n; i++) {
+		struct bio *bio = bios[i];
+		int ret = bio_wait(bio);
+
+		if (ret && !error)
+			error = ret;
+		if (!error)
+			done += bio->bio_bcount;
+		if (bio->bio_caller1) {
+			if (!ret && uio->uio_rw == UIO_READ)
+				memcpy(bio->bio_caller1, bio->bio_data,
+				    bio->bio_bcount);
+			free(bio->bio_data);
+		}
 		destroy_bio(bio);
-		if (ret)
-			return ret;
-
-	        uio->uio_iov++;
-        	uio->uio_iovcnt--;
-        	uio->uio_resid -= iov->iov_len;
-        	uio->uio_offset += iov->iov_len;
 	}
+	free(bios);
 
-	return 0;
+	if (uio->uio_rw == UIO_WRITE && done)
+		bpurge(dev, uio->uio_offset >> 9, done >> 9);
+	uio_advance(uio, done);
+	return error;
 }
@@ -351,6 +351,28 @@ binval(struct device *dev)
 	BIO_UNLOCK();
 }
 
+/*
+ * Invalidate the cached copies of blocks [blkno, blkno + nblks) of a
+ * device, which were just written around the cache (O_DIRECT).  Buffers
+ * in use, or holding a delayed write, are left alone.
+ */
+void
+bpurge(struct device *dev, int blkno, int nblks)
+{
+	struct buf *bp;
+	int i;
+
+	BIO_LOCK();
+	for (i = 0; i < NBUFS; i++) {
+		bp = &buf_table[i];
+		if (bp->b_dev == dev && bp->b_blkno >= blkno &&
+		    bp->b_blkno < blkno + nblks &&
+		    !ISSET(bp->b_flags, B_BUSY | B_DELWRI))
+			bp->b_flags = B_INVAL;
+	}
+	BIO_UNLOCK();
+}
+
 /*
  * Invalidate all buffers.
  * This is called when unmount.
@@ -33,20 +33,37 @@ static int vfs_close(struct file *fp)
 	return 0;
 }
 
+/*
+ * A positioned O_DIRECT transfer on a device uses no state of the vnode or
+ * the file, so it does not take the vnode lock, and a file may have many
+ * in flight at once.
+ */
+static int vfs_direct(struct file *fp, struct vnode *vp, int flags)
+{
+	return (fp->f_flags & O_DIRECT) && (flags & FOF_OFFSET) &&
+	    vp->v_type == VBLK;
+}
+
 static int vfs_read(struct file *fp, struct uio *uio, int flags)
 {
 	struct vnode *vp = fp->f_dentry->d_vnode;
+	int ioflags = 0;
 	int error;
 	size_t count;
 	ssize_t bytes;
 
+	if (fp->f_flags & O_DIRECT)
+		ioflags |= IO_DIRECT;
+	if (vfs_direct(fp, vp, flags))
+		return VOP_READ(vp, uio, ioflags);
+
 	bytes = uio->uio_resid;
 
 	vn_lock(vp);
 	if ((flags & FOF_OFFSET) == 0)
 		uio->uio_offset = fp->f_offset;
 
-	error = VOP_READ(vp, uio, 0);
+	error = VOP_READ(vp, uio, ioflags);
 	if (!error) {
 		count = bytes - uio->uio_resid;
 		if ((flags & FOF_OFFSET) == 0)
@@ -66,14 +83,18 @@ static int vfs_write(struct file *fp, struct uio *uio, int flags)
 	size_t count;
 	ssize_t bytes;
 
-	bytes = uio->uio_resid;
-
-	vn_lock(vp);
-
 	if (fp->f_flags & O_APPEND)
 		ioflags |= IO_APPEND;
 	if (fp->f_flags & (O_DSYNC|O_SYNC))
 		ioflags |= IO_SYNC;
+	if (fp->f_flags & O_DIRECT)
+		ioflags |= IO_DIRECT;
+	if (vfs_direct(fp, vp, flags))
+		return VOP_WRITE(vp, uio, ioflags);
+
+	bytes = uio->uio_resid;
+
+	vn_lock(vp);
 
 	if ((flags & FOF_OFFSET) == 0)
 	        uio->uio_offset = fp->f_offset;
@@ -34,68 +34,261 @@
 
 #include <osv/dentry.h>
 #include <osv/vnode.h>
+#include <osv/shrinker.h>
 #include "vfs.h"
 
-#define DENTRY_BUCKETS 32
+/*
+ * Dentry cache.
+ *
+ * Dentries are hashed by mount point and path.  Each hash bucket has its
+ * own lock, and the table is sized for the memory size at boot, so
+ * lookups of different paths rarely contend.  A dentry whose last
+ * reference is dropped stays hashed, together with its vnode, and goes
+ * on the unused list; failed lookups leave negative dentries there too.
+ * Unused dentries are evicted in LRU order (with a second chance for the
+ * ones used since they were last scanned) when there are more than
+ * dentry_max_unused of them, or when the memory allocator runs short.
+ *
+ * Lock order: bucket lock, then dentry_lru_lock.  The evictor holds
+ * dentry_lru_lock and only tries to take bucket locks.
+ */
+struct dentry_bucket {
+	mutex_t			db_lock;
+	LIST_HEAD(, dentry)	db_head;
+};
+
+static struct dentry_bucket *dentry_table;
+static u_int dentry_mask;
 
-static LIST_HEAD(dentry_hash_head, dentry) dentry_hash_table[DENTRY_BUCKETS];
-static struct mutex dentry_hash_lock;
+static TAILQ_HEAD(, dentry) dentry_lru = TAILQ_HEAD_INITIALIZER(dentry_lru);
+static mutex_t dentry_lru_lock = MUTEX_INITIALIZER;
+static u_int dentry_nr_unused;
+static u_int dentry_max_unused;
 
 /*
- * Get the hash value from the mount point and path name.
- * XXX: replace with a better hash for 64-bit pointers.
+ * Number of hash buckets for a cache of name-keyed objects: one per 32
+ * pages of memory, a power of two between 256 and 65536.
  */
-static u_int
-dentry_hash(struct mount *mp, char *path)
+u_int
+vfs_hash_buckets(void)
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	u_int n = 256;
+
+	while (n < 65536 && n < pages / 32)
+		n <<= 1;
+	return n;
+}
+
+/*
+ * FNV-1a of the path, mixed with the mount point.
+ */
+u_int
+vfs_hash(struct mount *mp, const char *path)
 {
-	u_int val = 0;
+	u_int val = 2166136261u;
+	uintptr_t m = (uintptr_t)mp;
 
 	if (path) {
-		while (*path)
-			val = ((val << 5) + val) + *path++;
+		while (*path) {
+			val ^= (unsigned char)*path++;
+			val *= 16777619;
+		}
 	}
-	return (val ^ (unsigned long)mp) & (DENTRY_BUCKETS - 1);
+	return val ^ (u_int)(m >> 4) ^ (u_int)(m >> 32);
 }
 
+static inline struct dentry_bucket *
+dentry_bucket(struct dentry *dp)
+{
+	return &dentry_table[dp->d_hash & dentry_mask];
+}
 
-struct dentry *
-dentry_alloc(struct vnode *vp, char *path)
+static void
+dentry_free(struct dentry *dp)
 {
-	struct mount *mp = vp->v_mount;
-	struct dentry *dp = calloc(sizeof(*dp), 1);
+	if (dp->d_vnode)
+		vrele(dp->d_vnode);
+	free(dp->d_path);
+	free(dp);
+}
 
-	if (!dp)
-		return NULL;
+/*
+ * Evict up to @count unused dentries, least recently used first.
+ * Returns the number evicted.
+ */
+static u_int
+dentry_evict(u_int count)
+{
+	TAILQ_HEAD(, dentry) victims = TAILQ_HEAD_INITIALIZER(victims);
+	struct dentry_bucket *b;
+	struct dentry *dp;
+	u_int scan, evicted = 0;
+
+	mutex_lock(&dentry_lru_lock);
+	for (scan = dentry_nr_unused; scan && evicted < count; scan--) {
+		dp = TAILQ_FIRST(&dentry_lru);
+		TAILQ_REMOVE(&dentry_lru, dp, d_lru);
+		dp->d_onlru = 0;
+		dentry_nr_unused--;
+		/* In use again; drele() puts it back when it isn't. */
+		if (dp->d_refcnt)
+			continue;
+		b = dentry_bucket(dp);
+		if (dp->d_referenced || !mutex_trylock(&b->db_lock)) {
+			dp->d_referenced = 0;
+			TAILQ_INSERT_TAIL(&dentry_lru, dp, d_lru);
+			dp->d_onlru = 1;
+			dentry_nr_unused++;
+			continue;
+		}
+		if (dp->d_refcnt == 0) {
+			LIST_REMOVE(dp, d_link);
+			dp->d_hashed = 0;
+			TAILQ_INSERT_TAIL(&victims, dp, d_lru);
+			evicted++;
+		}
+		mutex_unlock(&b->db_lock);
+	}
+	mutex_unlock(&dentry_lru_lock);
 
-	vp->v_refcnt++;
+	while ((dp = TAILQ_FIRST(&victims)) != NULL) {
+		TAILQ_REMOVE(&victims, dp, d_lru);
+		dentry_free(dp);
+	}
+	return evicted;
+}
+
+/*
+ * Shrinker: evict unused dentries worth @target bytes, counting each
+ * with its path and vnode.
+ */
+static size_t
+dentry_shrink(size_t target)
+{
+	const size_t size = sizeof(struct dentry) + sizeof(struct vnode) + 64;
+
+	return dentry_evict(target / size + 1) * size;
+}
+
+/*
+ * Find a hashed dentry.  Called with the bucket locked.
+ */
+static struct dentry *
+dentry_find(struct dentry_bucket *b, struct mount *mp, const char *path,
+	    u_int hash)
+{
+	struct dentry *dp;
 
+	LIST_FOREACH(dp, &b->db_head, d_link) {
+		if (dp->d_hash == hash && dp->d_mount == mp &&
+		    !strncmp(dp->d_path, path, PATH_MAX))
+			return dp;
+	}
+	return NULL;
+}
+
+/*
+ * Take a dentry off the hash list, so it can't be found anymore.  It is
+ * freed now if unused, or else when its last reference is dropped.
+ * Called with the bucket locked.
+ */
+static int
+dentry_unhash(struct dentry *dp)
+{
+	LIST_REMOVE(dp, d_link);
+	dp->d_hashed = 0;
+	mutex_lock(&dentry_lru_lock);
+	if (dp->d_onlru) {
+		TAILQ_REMOVE(&dentry_lru, dp, d_lru);
+		dp->d_onlru = 0;
+		dentry_nr_unused--;
+	}
+	mutex_unlock(&dentry_lru_lock);
+	return dp->d_refcnt == 0;
+}
+
+static struct dentry *
+dentry_insert(struct mount *mp, struct vnode *vp, const char *path)
+{
+	struct dentry_bucket *b;
+	struct dentry *dp, *old;
+	int free_old = 0;
+
+	dp = calloc(sizeof(*dp), 1);
+	if (!dp)
+		return NULL;
+	dp->d_path = strdup(path);
+	if (!dp->d_path) {
+		free(dp);
+		return NULL;
+	}
 	dp->d_refcnt = 1;
 	dp->d_vnode = vp;
 	dp->d_mount = mp;
-	dp->d_path = strdup(path);
-
-	mutex_lock(&dentry_hash_lock);
-	LIST_INSERT_HEAD(&dentry_hash_table[dentry_hash(mp, path)], dp, d_link);
-	mutex_unlock(&dentry_hash_lock);
+	dp->d_hash = vfs_hash(mp, path);
+
+	b = dentry_bucket(dp);
+	mutex_lock(&b->db_lock);
+	old = dentry_find(b, mp, path, dp->d_hash);
+	if (old && (old->d_vnode || !vp)) {
+		/* Somebody else looked it up first; use theirs. */
+		__sync_fetch_and_add(&old->d_refcnt, 1);
+		mutex_unlock(&b->db_lock);
+		free(dp->d_path);
+		free(dp);
+		return old;
+	}
+	if (old)
+		free_old = dentry_unhash(old);
+	if (vp)
+		vref(vp);
+	LIST_INSERT_HEAD(&b->db_head, dp, d_link);
+	dp->d_hashed = 1;
+	mutex_unlock(&b->db_lock);
+
+	if (free_old)
+		dentry_free(old);
 	return dp;
-};
+}
+
+struct dentry *
+dentry_alloc(struct vnode *vp, char *path)
+{
+	return dentry_insert(vp->v_mount, vp, path);
+}
+
+/*
+ * Record that @path does not exist in @mp.
+ */
+static void
+dentry_alloc_negative(struct mount *mp, char *path)
+{
+	struct dentry *dp;
+
+	if (mp->m_flags & MNT_NONEGCACHE)
+		return;
+	dp = dentry_insert(mp, NULL, path);
+	if (dp)
+		drele(dp);
+}
 
 static struct dentry *
 dentry_lookup(struct mount *mp, char *path)
 {
+	struct dentry_bucket *b;
 	struct dentry *dp;
+	u_int hash = vfs_hash(mp, path);
 
-	mutex_lock(&dentry_hash_lock);
-	LIST_FOREACH(dp, &dentry_hash_table[dentry_hash(mp, path)], d_link) {
-		if (dp->d_mount == mp &&
-		    !strncmp(dp->d_path, path, PATH_MAX)) {
-			dp->d_refcnt++;
-			mutex_unlock(&dentry_hash_lock);
-			return dp;
-		}
+	b = &dentry_table[hash & dentry_mask];
+	mutex_lock(&b->db_lock);
+	dp = dentry_find(b, mp, path, hash);
+	if (dp) {
+		__sync_fetch_and_add(&dp->d_refcnt, 1);
+		dp->d_referenced = 1;
 	}
-	mutex_unlock(&dentry_hash_lock);
-	return NULL;		/* not found */
+	mutex_unlock(&b->db_lock);
+	return dp;
 }
 
 void
@@ -104,29 +297,119 @@ dref(struct dentry *dp)
 	ASSERT(dp);
 	ASSERT(dp->d_refcnt > 0);
 
-	mutex_lock(&dentry_hash_lock);
-	dp->d_refcnt++;
-	mutex_unlock(&dentry_hash_lock);
+	__sync_fetch_and_add(&dp->d_refcnt, 1);
 }
 
 void
 drele(struct dentry *dp)
 {
+	struct dentry_bucket *b;
+	int ref, evict = 0;
+
 	ASSERT(dp);
 	ASSERT(dp->d_refcnt > 0);
 
-	mutex_lock(&dentry_hash_lock);
-	if (--dp->d_refcnt) {
-		mutex_unlock(&dentry_hash_lock);
+	/*
+	 * Only the last reference needs the bucket lock, which keeps
+	 * lookups from finding the dentry while it becomes unused.
+	 */
+	while ((ref = dp->d_refcnt) > 1) {
+		if (__sync_bool_compare_and_swap(&dp->d_refcnt, ref, ref - 1))
+			return;
+	}
+
+	b = dentry_bucket(dp);
+	mutex_lock(&b->db_lock);
+	if (__sync_sub_and_fetch(&dp->d_refcnt, 1)) {
+		mutex_unlock(&b->db_lock);
 		return;
 	}
-	LIST_REMOVE(dp, d_link);
-	mutex_unlock(&dentry_hash_lock);
+	if (!dp->d_hashed) {
+		mutex_unlock(&b->db_lock);
+		dentry_free(dp);
+		return;
+	}
+	mutex_lock(&dentry_lru_lock);
+	if (!dp->d_onlru) {
+		TAILQ_INSERT_TAIL(&dentry_lru, dp, d_lru);
+		dp->d_onlru = 1;
+		dentry_nr_unused++;
+	}
+	if (dentry_nr_unused > dentry_max_unused)
+		evict = dentry_nr_unused - dentry_max_unused;
+	mutex_unlock(&dentry_lru_lock);
+	mutex_unlock(&b->db_lock);
 
-	vrele(dp->d_vnode);
+	if (evict)
+		dentry_evict(evict + 32);
+}
 
-	free(dp->d_path);
-	free(dp);
+/*
+ * Drop the cached dentries for @path in @mp, and if @subtree, for the
+ * paths below it as well.
+ */
+static void
+dentry_remove(struct mount *mp, const char *path, int subtree)
+{
+	TAILQ_HEAD(, dentry) victims = TAILQ_HEAD_INITIALIZER(victims);
+	struct dentry_bucket *b;
+	struct dentry *dp, *next;
+	size_t len = path ? strlen(path) : 0;
+	u_int i, first, last;
+
+	if (subtree || !path) {
+		first = 0;
+		last = dentry_mask;
+	} else {
+		first = last = vfs_hash(mp, path) & dentry_mask;
+	}
+	for (i = first; i <= last; i++) {
+		b = &dentry_table[i];
+		mutex_lock(&b->db_lock);
+		LIST_FOREACH_SAFE(dp, &b->db_head, d_link, next) {
+			if (mp && dp->d_mount != mp)
+				continue;
+			if (path && strcmp(dp->d_path, path) &&
+			    !(subtree && !strncmp(dp->d_path, path, len) &&
+			      (dp->d_path[len] == '/' || path[len - 1] == '/')))
+				continue;
+			if (dentry_unhash(dp))
+				TAILQ_INSERT_TAIL(&victims, dp, d_lru);
+		}
+		mutex_unlock(&b->db_lock);
+	}
+
+	while ((dp = TAILQ_FIRST(&victims)) != NULL) {
+		TAILQ_REMOVE(&victims, dp, d_lru);
+		dentry_free(dp);
+	}
+}
+
+/*
+ * Called when @name in directory @ddp was created, removed or renamed, to
+ * drop what the cache remembers about it.  @subtree also drops the paths
+ * below it, for directories.  The caller holds the directory locked, as
+ * namei() does while it adds a dentry for a name in it.
+ */
+void
+dentry_invalidate(struct dentry *ddp, char *name, int subtree)
+{
+	char node[PATH_MAX];
+
+	strlcpy(node, ddp->d_path, sizeof(node));
+	if (strcmp(node, "/"))
+		strlcat(node, "/", sizeof(node));
+	strlcat(node, name, sizeof(node));
+	dentry_remove(ddp->d_mount, node, subtree);
+}
+
+/*
+ * Drop all cached dentries of a file system being unmounted.
+ */
+void
+dentry_purge(struct mount *mp)
+{
+	dentry_remove(mp, NULL, 1);
 }
 
 /*
@@ -158,6 +441,10 @@ namei(char *path, struct dentry **dpp)
 	strlcat(node, p, sizeof(node));
 	dp = dentry_lookup(mp, node);
 	if (dp) {
+		if (!dp->d_vnode) {
+			drele(dp);
+			return ENOENT;
+		}
 		/* vnode is already active. */
 		*dpp = dp;
 		return 0;
@@ -193,6 +480,11 @@ namei(char *path, struct dentry **dpp)
 		strlcat(node, "/", sizeof(node));
 		strlcat(node, name, sizeof(node));
 		dp = dentry_lookup(mp, node);
+		if (dp && !dp->d_vnode) {
+			drele(dp);
+			drele(ddp);
+			return ENOENT;
+		}
 		if (dp == NULL) {
 			vp = vget(mp, node);
 			if (vp == NULL) {
@@ -205,6 +497,8 @@ namei(char *path, struct dentry **dpp)
 
 			/* Find a vnode in this directory. */
 			error = VOP_LOOKUP(dvp, name, vp);
+			if (error == ENOENT)
+				dentry_alloc_negative(mp, node);
 			if (error || (*p == '/' && vp->v_type != VDIR)) {
 				vput(vp);
 				vn_unlock(dvp);
@@ -302,8 +596,16 @@ lookup(char *path, struct dentry **dpp, char **name)
 void
 lookup_init(void)
 {
-	int i;
-
-	for (i = 0; i < DENTRY_BUCKETS; i++)
-		LIST_INIT(&dentry_hash_table[i]);
+	u_int i, n = vfs_hash_buckets();
+
+	dentry_table = malloc(n * sizeof(*dentry_table));
+	if (!dentry_table)
+		sys_panic("lookup_init");
+	for (i = 0; i < n; i++) {
+		mutex_init(&dentry_table[i].db_lock);
+		LIST_INIT(&dentry_table[i].db_head);
+	}
+	dentry_mask = n - 1;
+	dentry_max_unused = 2 * n;
+	register_shrinker("dentry", dentry_shrink);
 }
@@ -222,6 +222,7 @@ found:
 		error = EINVAL;
 		goto out;
 	}
+	dentry_purge(mp);
 	if ((error = VFS_UNMOUNT(mp)) != 0)
 		goto out;
 	LIST_REMOVE(mp, m_link);
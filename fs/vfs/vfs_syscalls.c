@@ -84,6 +84,8 @@ sys_open(char *path, int flags, mode_t mode, struct file *fp)
 			mode &= ~S_IFMT;
 			mode |= S_IFREG;
 			error = VOP_CREATE(ddp->d_vnode, filename, mode);
+			if (!error)
+				dentry_invalidate(ddp, filename, 0);
 			vn_unlock(ddp->d_vnode);
 			drele(ddp);
 
@@ -473,6 +475,8 @@ sys_mkdir(char *path, mode_t mode)
 	mode |= S_IFDIR;
 
 	error = VOP_MKDIR(ddp->d_vnode, name, mode);
+	if (!error)
+		dentry_invalidate(ddp, name, 0);
  out:
 	vn_unlock(ddp->d_vnode);
 	drele(ddp);
@@ -512,6 +516,8 @@ sys_rmdir(char *path)
 
 	vn_lock(ddp->d_vnode);
 	error = VOP_RMDIR(ddp->d_vnode, vp, name);
+	if (!error)
+		dentry_invalidate(ddp, name, 1);
 	vn_unlock(ddp->d_vnode);
 
 	vn_unlock(vp);
@@ -561,6 +567,8 @@ sys_mknod(char *path, mode_t mode)
 		error = VOP_MKDIR(ddp->d_vnode, name, mode);
 	else
 		error = VOP_CREATE(ddp->d_vnode, name, mode);
+	if (!error)
+		dentry_invalidate(ddp, name, 0);
  out:
 	vn_unlock(ddp->d_vnode);
 	drele(ddp);
@@ -573,7 +581,7 @@ sys_rename(char *src, char *dest)
 	struct dentry *dp1, *dp2 = 0, *ddp1, *ddp2;
 	struct vnode *vp1, *vp2 = 0, *dvp1, *dvp2;
 	char *sname, *dname;
-	int error;
+	int error, subtree;
 	size_t len;
 	char root[] = "/";
 
@@ -660,6 +668,12 @@ sys_rename(char *src, char *dest)
 		goto err4;
 	}
 	error = VOP_RENAME(dvp1, vp1, sname, dvp2, vp2, dname);
+	if (!error) {
+		/* Only a directory has cached paths below it */
+		subtree = vp1->v_type == VDIR;
+		dentry_invalidate(ddp1, sname, subtree);
+		dentry_invalidate(ddp2, dname, subtree);
+	}
  err4:
 	vn_unlock(dvp2);
 	drele(ddp2);
@@ -708,6 +722,8 @@ sys_unlink(char *path)
 
 	vn_lock(ddp->d_vnode);
 	error = VOP_REMOVE(ddp->d_vnode, vp, name);
+	if (!error)
+		dentry_invalidate(ddp, name, 0);
 	vn_unlock(ddp->d_vnode);
 
 	vn_unlock(vp);
@@ -835,6 +851,39 @@ sys_ftruncate(struct file *fp, off_t length)
 	return error;
 }
 
+/*
+ * Borrow the file system's cached copy of the file data at the page-aligned
+ * offset, see vnop_loan_t.  The loan holds until sys_unloan(), which needs
+ * no vnode lock, so it can be called with the vma list locked.
+ */
+int
+sys_loan(struct file *fp, off_t off, void **addr, size_t *len, void **cookie)
+{
+	struct vnode *vp;
+	int error;
+
+	if (!fp->f_dentry)
+		return EBADF;
+
+	vp = fp->f_dentry->d_vnode;
+	if (vp->v_type != VREG)
+		return EINVAL;
+
+	vn_lock(vp);
+	error = VOP_LOAN(vp, off, addr, len, cookie);
+	vn_unlock(vp);
+
+	return error;
+}
+
+void
+sys_unloan(struct file *fp, void *cookie)
+{
+	struct vnode *vp = fp->f_dentry->d_vnode;
+
+	VOP_UNLOAN(vp, cookie);
+}
+
 int
 sys_fchdir(struct file *fp, char *cwd)
 {
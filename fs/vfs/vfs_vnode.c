@@ -65,38 +65,26 @@ int vttoif_tab[10] = {
  * vrele      -1        *
  */
 
-#define VNODE_BUCKETS 32		/* size of vnode hash table */
-
 /*
  * vnode table.
- * All active (opened) vnodes are stored on this hash table.
- * They can be accessed by its path name.
+ * All active vnodes are stored on this hash table, which is sized for the
+ * memory size at boot (see vfs_hash_buckets()).  They can be accessed by
+ * their path name.  Each bucket has its own lock, which also protects the
+ * reference count of its vnodes from dropping to zero while a lookup is
+ * taking a new reference; other reference count changes are atomic.
  */
-static LIST_HEAD(vnode_hash_head, vnode) vnode_table[VNODE_BUCKETS];
+struct vnode_bucket {
+	mutex_t			vb_lock;
+	LIST_HEAD(, vnode)	vb_head;
+};
 
-/*
- * Global lock to access all vnodes and vnode table.
- * If a vnode is already locked, there is no need to
- * lock this global lock to access internal data.
- */
-static mutex_t vnode_lock = MUTEX_INITIALIZER;
-#define VNODE_LOCK()	mutex_lock(&vnode_lock)
-#define VNODE_UNLOCK()	mutex_unlock(&vnode_lock)
+static struct vnode_bucket *vnode_table;
+static u_int vnode_mask;
 
-/*
- * Get the hash value from the mount point and path name.
- * XXX(hch): replace with a better hash for 64-bit pointers.
- */
-static u_int
-vn_hash(struct mount *mp, char *path)
+static inline struct vnode_bucket *
+vn_bucket(struct mount *mp, char *path)
 {
-	u_int val = 0;
-
-	if (path) {
-		while (*path)
-			val = ((val << 5) + val) + *path++;
-	}
-	return (val ^ (unsigned long)mp) & (VNODE_BUCKETS - 1);
+	return &vnode_table[vfs_hash(mp, path) & vnode_mask];
 }
 
 /*
@@ -106,23 +94,49 @@ vn_hash(struct mount *mp, char *path)
 struct vnode *
 vn_lookup(struct mount *mp, char *path)
 {
+	struct vnode_bucket *b = vn_bucket(mp, path);
 	struct vnode *vp;
 
-	VNODE_LOCK();
-	LIST_FOREACH(vp, &vnode_table[vn_hash(mp, path)], v_link) {
+	mutex_lock(&b->vb_lock);
+	LIST_FOREACH(vp, &b->vb_head, v_link) {
 		if (vp->v_mount == mp &&
 		    !strncmp(vp->v_path, path, PATH_MAX)) {
-			vp->v_refcnt++;
-			VNODE_UNLOCK();
+			__sync_fetch_and_add(&vp->v_refcnt, 1);
+			mutex_unlock(&b->vb_lock);
 			mutex_lock(&vp->v_lock);
 			vp->v_nrlocks++;
 			return vp;
 		}
 	}
-	VNODE_UNLOCK();
+	mutex_unlock(&b->vb_lock);
 	return NULL;		/* not found */
 }
 
+/*
+ * Drop a reference.  Returns true if it was the last one, in which case
+ * the vnode is off the hash table and the caller frees it.
+ */
+static int
+vn_drop(struct vnode *vp)
+{
+	struct vnode_bucket *b;
+	int ref;
+
+	while ((ref = vp->v_refcnt) > 1) {
+		if (__sync_bool_compare_and_swap(&vp->v_refcnt, ref, ref - 1))
+			return 0;
+	}
+	b = vn_bucket(vp->v_mount, vp->v_path);
+	mutex_lock(&b->vb_lock);
+	if (__sync_sub_and_fetch(&vp->v_refcnt, 1)) {
+		mutex_unlock(&b->vb_lock);
+		return 0;
+	}
+	LIST_REMOVE(vp, v_link);
+	mutex_unlock(&b->vb_lock);
+	return 1;
+}
+
 /*
  * Lock vnode
  */
@@ -159,6 +173,7 @@ vn_unlock(struct vnode *vp)
 struct vnode *
 vget(struct mount *mp, char *path)
 {
+	struct vnode_bucket *b;
 	struct vnode *vp;
 	int error;
 	size_t len;
@@ -194,9 +209,10 @@ vget(struct mount *mp, char *path)
 	mutex_lock(&vp->v_lock);
 	vp->v_nrlocks++;
 
-	VNODE_LOCK();
-	LIST_INSERT_HEAD(&vnode_table[vn_hash(mp, path)], vp, v_link);
-	VNODE_UNLOCK();
+	b = vn_bucket(mp, path);
+	mutex_lock(&b->vb_lock);
+	LIST_INSERT_HEAD(&b->vb_head, vp, v_link);
+	mutex_unlock(&b->vb_lock);
 	return vp;
 }
 
@@ -212,15 +228,10 @@ vput(struct vnode *vp)
 	DPRINTF(VFSDB_VNODE, ("vput: ref=%d %s\n", vp->v_refcnt,
 			      vp->v_path));
 
-	VNODE_LOCK();
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-	    VNODE_UNLOCK();
+	if (!vn_drop(vp)) {
 		vn_unlock(vp);
 		return;
 	}
-	LIST_REMOVE(vp, v_link);
-	VNODE_UNLOCK();
 
 	/*
 	 * Deallocate fs specific vnode data
@@ -245,11 +256,9 @@ vref(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);	/* Need vget */
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vref: ref=%d %s\n", vp->v_refcnt,
 			      vp->v_path));
-	vp->v_refcnt++;
-	VNODE_UNLOCK();
+	__sync_fetch_and_add(&vp->v_refcnt, 1);
 }
 
 /*
@@ -264,16 +273,10 @@ vrele(struct vnode *vp)
 	ASSERT(vp);
 	ASSERT(vp->v_refcnt > 0);
 
-	VNODE_LOCK();
 	DPRINTF(VFSDB_VNODE, ("vrele: ref=%d %s\n", vp->v_refcnt,
 			      vp->v_path));
-	vp->v_refcnt--;
-	if (vp->v_refcnt > 0) {
-		VNODE_UNLOCK();
+	if (!vn_drop(vp))
 		return;
-	}
-	LIST_REMOVE(vp, v_link);
-	VNODE_UNLOCK();
 
 	/*
 	 * Deallocate fs specific vnode data
@@ -305,18 +308,18 @@ vcount(struct vnode *vp)
 void
 vflush(struct mount *mp)
 {
-	int i;
+	u_int i;
 	struct vnode *vp;
 
-	VNODE_LOCK();
-	for (i = 0; i < VNODE_BUCKETS; i++) {
-	        LIST_FOREACH(vp, &vnode_table[i], v_link) {
+	for (i = 0; i <= vnode_mask; i++) {
+		mutex_lock(&vnode_table[i].vb_lock);
+		LIST_FOREACH(vp, &vnode_table[i].vb_head, v_link) {
 			if (vp->v_mount == mp) {
 				/* XXX: */
 			}
 		}
+		mutex_unlock(&vnode_table[i].vb_lock);
 	}
-	VNODE_UNLOCK();
 }
 
 int
@@ -417,19 +420,19 @@ vn_access(struct vnode *vp, int flags)
 void
 vnode_dump(void)
 {
-	int i;
+	u_int i;
 	struct vnode *vp;
 	struct mount *mp;
 	char type[][6] = { "VNON ", "VREG ", "VDIR ", "VBLK ", "VCHR ",
 			   "VLNK ", "VSOCK", "VFIFO" };
 
-	VNODE_LOCK();
 	dprintf("Dump vnode\n");
 	dprintf(" vnode    mount    type  refcnt blkno    path\n");
 	dprintf(" -------- -------- ----- ------ -------- ------------------------------\n");
 
-	for (i = 0; i < VNODE_BUCKETS; i++) {
-	        LIST_FOREACH(vp, &vnode_table[i], v_link) {
+	for (i = 0; i <= vnode_mask; i++) {
+		mutex_lock(&vnode_table[i].vb_lock);
+		LIST_FOREACH(vp, &vnode_table[i].vb_head, v_link) {
 			mp = vp->v_mount;
 
 			dprintf(" %08x %08x %s %6d %8d %s%s\n", (u_int)vp,
@@ -437,9 +440,9 @@ vnode_dump(void)
 				(strlen(mp->m_path) == 1) ? "\0" : mp->m_path,
 				vp->v_path);
 		}
+		mutex_unlock(&vnode_table[i].vb_lock);
 	}
 	dprintf("\n");
-	VNODE_UNLOCK();
 }
 #endif
 
@@ -464,8 +467,14 @@ vop_einval(void)
 void
 vnode_init(void)
 {
-	int i;
-
-	for (i = 0; i < VNODE_BUCKETS; i++)
-		LIST_INIT(&vnode_table[i]);
+	u_int i, n = vfs_hash_buckets();
+
+	vnode_table = malloc(n * sizeof(*vnode_table));
+	if (!vnode_table)
+		sys_panic("vnode_init");
+	for (i = 0; i < n; i++) {
+		mutex_init(&vnode_table[i].vb_lock);
+		LIST_INIT(&vnode_table[i].vb_head);
+	}
+	vnode_mask = n - 1;
 }
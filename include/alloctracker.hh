@@ -17,7 +17,13 @@
 #ifndef INCLUDED_ALLOCTRACKER_H
 #define INCLUDED_ALLOCTRACKER_H
 #include <osv/mutex.h>
+#include <osv/types.h>
 #include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
 
 namespace memory {
 
@@ -98,6 +104,96 @@ private:
     static __thread class in_tracker_t in_tracker;
 
 };
+
+// heap_sampler is a low-overhead heap profiler, for finding out which code
+// owns the memory of a running system.  Rather than recording every
+// allocation like alloc_tracker, it samples on average one allocation in
+// every "interval" bytes allocated, like tcmalloc's heap profiler, and
+// accounts the sampled allocations, and their eventual frees, to the
+// backtrace which allocated them.  Each sample stands for the "interval"
+// bytes before it, so the per-backtrace estimates are unbiased for large
+// and small allocations alike.
+//
+// Sampling can be started and stopped at any time; its tables are allocated
+// by the first start(), so recording a sample never allocates.
+class heap_sampler {
+public:
+    static constexpr unsigned max_frames = 32;
+    struct site {
+        unsigned len;
+        void* pc[max_frames];   // most recent first
+        // estimates, in bytes and objects
+        s64 live_bytes;
+        s64 live_objects;
+        u64 total_bytes;        // allocated since start()
+        u64 total_objects;
+    };
+    // Sample about once every @interval bytes, keeping up to @nr_sites
+    // distinct backtraces and @nr_live sampled live objects.  Only the first
+    // start() sizes the tables; later ones just clear them.
+    void start(size_t interval = 512 * 1024, size_t nr_sites = 4096,
+               size_t nr_live = 65536);
+    // Stop sampling allocations.  Frees of the objects already sampled are
+    // still accounted, so their sites' live bytes stay accurate.
+    void stop();
+    // The sites with samples, most live bytes first
+    std::vector<site> sites();
+    // A text report of the @n sites with the most live bytes
+    std::string report(size_t n = 30);
+    // Write the profile in gperftools' heap profile format, for pprof
+    void write_pprof(FILE* f);
+
+    // Called by the allocator
+    bool sampling() const { return _sampling.load(std::memory_order_relaxed); }
+    void allocated(void* addr, size_t size) {
+        if ((bytes_until_sample -= size) < 0) {
+            sample(addr, size);
+        }
+    }
+    void freed(void* addr) {
+        if (_nr_live.load(std::memory_order_relaxed)) {
+            forget(addr);
+        }
+    }
+private:
+    struct live_object {
+        std::atomic<void*> addr;    // nullptr if empty, or tombstone
+        unsigned site;
+        size_t size;
+        size_t weight;              // bytes this sample stands for
+    };
+    void sample(void* addr, size_t size);
+    void forget(void* addr);
+    s64 next_interval();
+    unsigned find_site(void** pc, unsigned len);
+    live_object* find_live(live_object* table, void* addr);
+    bool insert_live(void* addr, unsigned site, size_t size, size_t weight);
+    void rehash_live();
+private:
+    std::atomic<bool> _sampling = { false };
+    size_t _interval;
+    std::unique_ptr<site[]> _sites;
+    size_t _nr_sites = 0;
+    size_t _used_sites = 0;
+    // two tables, so rehashing to drop tombstones doesn't allocate; lookups
+    // in free() don't take the lock, but retry if a rehash ran meanwhile
+    std::unique_ptr<live_object[]> _live[2];
+    std::atomic<live_object*> _live_table = { nullptr };
+    size_t _live_mask;
+    size_t _used_live = 0;          // live objects and tombstones
+    std::atomic<size_t> _nr_live = { 0 };
+    std::atomic<unsigned> _rehash_seq = { 0 };
+    std::atomic<u64> _dropped = { 0 };
+    // a spinlock, as pages are allocated in places that can't sleep
+    spinlock_t _lock;
+    static __thread s64 bytes_until_sample;
+    static __thread bool thread_seeded;
+    static __thread u64 random_state;
+};
+
+extern heap_sampler heap_profiler;
+// Create /dev/heapprof, which reads as heap_profiler.report()
+void heap_profiler_device_init();
 #endif
 
 }
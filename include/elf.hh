@@ -12,7 +12,9 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <osv/types.h>
+#include <osv/mutex.h>
 #include <atomic>
 
 namespace elf {
@@ -143,6 +145,7 @@ enum {
     DT_FINI_ARRAY = 26, // d_ptr Pointer to an array of pointers to termination functions.
     DT_INIT_ARRAYSZ = 27, // d_val Size, in bytes, of the array of initialization functions.
     DT_FINI_ARRAYSZ = 28, // d_val Size, in bytes, of the array of termination functions.
+    DT_FLAGS = 30, // d_val Flags for the object being loaded (DF_*).
     DT_LOOS = 0x60000000, // Deﬁnes a range of dynamic table tags that are reserved for
       // environment-speciﬁc use.
     DT_HIOS = 0x6FFFFFFF, //
@@ -150,6 +153,15 @@ enum {
       // processor-speciﬁc use.
     DT_HIPROC = 0x7FFFFFFF, //
     DT_GNU_HASH = 0x6ffffef5,
+    DT_FLAGS_1 = 0x6ffffffb, // d_val More flags for the object (DF_1_*).
+};
+
+enum {
+    DF_BIND_NOW = 0x8, // Process all relocations before running the object
+};
+
+enum {
+    DF_1_NOW = 0x1, // Same as DF_BIND_NOW
 };
 
 enum {
@@ -246,8 +258,27 @@ struct Elf64_Sym {
     Elf64_Xword st_size; /* Size of object (e.g., common) */
 };
 
+struct Elf64_Shdr {
+    Elf64_Word sh_name; /* Section name */
+    Elf64_Word sh_type; /* Section type */
+    Elf64_Xword sh_flags; /* Section attributes */
+    Elf64_Addr sh_addr; /* Virtual address in memory */
+    Elf64_Off sh_offset; /* Offset in file */
+    Elf64_Xword sh_size; /* Size of section */
+    Elf64_Word sh_link; /* Link to other section */
+    Elf64_Word sh_info; /* Miscellaneous information */
+    Elf64_Xword sh_addralign; /* Address alignment boundary */
+    Elf64_Xword sh_entsize; /* Size of entries, if section has table */
+};
+
+enum {
+    SHT_SYMTAB = 2, // Linker symbol table
+    SHT_STRTAB = 3, // String table
+};
+
 class program;
 class symbol_module;
+struct snapshot_object;
 
 struct tls_data {
     void* start;
@@ -274,6 +305,9 @@ public:
     void* base() const;
     void* end() const;
     Elf64_Sym* lookup_symbol(const char* name);
+    // Same, with the GNU hash of the name already computed
+    Elf64_Sym* lookup_symbol(const char* name, u32 gnu_hash);
+    const char* symbol_name(const Elf64_Sym* sym);
     void load_segments();
     void unload_segments();
     void* resolve_pltgot(unsigned index);
@@ -285,24 +319,36 @@ public:
     template <typename T = void>
     T* lookup(const char* name);
     dladdr_info lookup_addr(const void* addr);
+    void set_snapshot(const snapshot_object* snapshot);
 protected:
     virtual void load_segment(const Elf64_Phdr& segment) = 0;
     virtual void unload_segment(const Elf64_Phdr& segment) = 0;
-private:
-    Elf64_Sym* lookup_symbol_old(const char* name);
-    Elf64_Sym* lookup_symbol_gnu(const char* name);
+    // Read the static symbol table (.symtab) and its string table, if the
+    // object has them
+    virtual void load_symtab(std::vector<Elf64_Sym>& symtab,
+                             std::unique_ptr<char[]>& strtab);
+    // Add to @h what, besides the symbols, relocating the object depends on
+    virtual u64 hash_contents(u64 h);
     template <typename T>
     T* dynamic_ptr(unsigned tag);
     Elf64_Xword dynamic_val(unsigned tag);
-    const char* dynamic_str(unsigned tag);
     bool dynamic_exists(unsigned tag);
+private:
+    Elf64_Sym* lookup_symbol_old(const char* name);
+    Elf64_Sym* lookup_symbol_gnu(const char* name, u32 hashval);
+    const char* dynamic_str(unsigned tag);
     std::vector<const char*> dynamic_str_array(unsigned tag);
     Elf64_Dyn& dynamic_tag(unsigned tag);
     Elf64_Dyn* _dynamic_tag(unsigned tag);
     symbol_module symbol(unsigned idx);
     Elf64_Xword symbol_tls_module(unsigned idx);
-    void relocate_rela();
+    void relocate_rela(const std::vector<u32>* which = nullptr);
     void relocate_pltgot();
+    void bind_pltgot();
+    bool bind_now();
+    u64 identity();
+    u64 snapshot_hash();
+    void build_addr_index();
     unsigned symtab_len();
 protected:
     program& _prog;
@@ -314,6 +360,18 @@ protected:
     void* _tls_segment;
     ulong _tls_init_size, _tls_uninit_size;
     Elf64_Dyn* _dynamic_table;
+    const snapshot_object* _snapshot;
+    u64 _identity;
+private:
+    // Symbols sorted by address, for lookup_addr(); built by load_segments()
+    struct addr_symbol {
+        const void* addr;
+        size_t size;
+        const char* name;
+    };
+    std::vector<addr_symbol> _addr_index;
+    std::unique_ptr<char[]> _symtab_strings;
+    std::atomic<bool> _addr_index_ready;
     // Allow objects on program->_modules to be usable for the threads
     // currently initializing them, but not yet visible for other threads.
     // This simplifies the code (the initializer can use the regular lookup
@@ -323,6 +381,7 @@ private:
     bool visible(void) const;
 public:
     void setprivate(bool);
+    bool isprivate(void) const;
 };
 
 class file : public object {
@@ -334,6 +393,9 @@ public:
 protected:
     virtual void load_segment(const Elf64_Phdr& phdr);
     virtual void unload_segment(const Elf64_Phdr& phdr);
+    virtual void load_symtab(std::vector<Elf64_Sym>& symtab,
+                             std::unique_ptr<char[]>& strtab);
+    virtual u64 hash_contents(u64 h);
 private:
     ::fileref _f;
 };
@@ -346,6 +408,23 @@ protected:
     virtual void unload_segment(const Elf64_Phdr& phdr);
 };
 
+// An object relocated by scripts/mkprelink.py.  The object's writable
+// segments are mapped from the snapshot file, and relocate() only has to
+// apply the deferred relocations, provided snapshot_hash() still matches.
+struct snapshot_segment {
+    u64 vaddr; // relative to the object's base
+    u64 size;
+    u64 offset; // in the snapshot file
+};
+
+struct snapshot_object {
+    void* base;
+    u64 hash;
+    std::vector<snapshot_segment> segments;
+    std::vector<u32> deferred; // indices of DT_RELA entries
+    ::fileref file;
+};
+
 struct symbol_module {
 public:
     symbol_module();
@@ -369,12 +448,22 @@ public:
     template <typename functor>
     void with_modules(functor f);
     dladdr_info lookup_addr(const void* addr);
+    // The demangled name of the symbol @addr is in, followed by @addr's
+    // offset in it if @with_offset and that isn't 0; @addr in hex if no
+    // object has a symbol for it
+    std::string symbol_name(const void* addr, bool with_offset = true);
+    // The address range of every object, in the format of /proc/self/maps
+    std::string maps();
     void set_search_path(std::initializer_list<std::string> path);
+    // Use the relocated objects in a snapshot made by scripts/mkprelink.py.
+    // Returns false, using none of it, if the file is not a valid snapshot.
+    bool load_snapshot(std::string path);
 private:
     void add_debugger_obj(object* obj);
     void del_debugger_obj(object* obj);
     void* do_lookup_function(const char* symbol);
     void set_object(std::string lib, object* obj);
+    void modules_changed();
 private:
     ::filesystem& _fs;
     void* _next_alloc;
@@ -385,6 +474,13 @@ private:
     // Count object additions and removals from _modules. dl_iterate_phdr()
     // callbacks can use this to know if the object list has not changed.
     int _modules_adds = 0, _modules_subs = 0;
+    // Symbols already resolved by lookup(), keyed by the GNU hash of their
+    // name.  An entry is only added when no private object precedes the
+    // defining one in _modules, so it holds for every thread; the cache
+    // is emptied whenever _modules changes.
+    mutex _symbol_cache_mutex;
+    std::unordered_multimap<u32, symbol_module> _symbol_cache;
+    std::map<std::string, snapshot_object> _snapshots;
     // debugger interface
     static object* s_objs[100];
 };
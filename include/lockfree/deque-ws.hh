@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef INCLUDED_LOCKFREE_DEQUE_WS
+#define INCLUDED_LOCKFREE_DEQUE_WS
+// A lock-free work-stealing deque of fixed size (the Chase-Lev deque, with
+// the memory ordering of Le, Pop, Cohen and Zappa Nardelli, "Correct and
+// Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+//
+// The deque has a single owner, which push()es and pop()s at the bottom end,
+// like a stack, without any atomic read-modify-write in the common case.
+// Any other thread may steal() from the top end, taking the oldest item.
+// Only when the owner and a thief race for the last item do they CAS.
+//
+// This is meant for per-cpu work lists: a cpu keeps running its newest
+// (cache-hot) work, and an idle cpu steals the oldest work from another.
+//
+// T must be trivially copyable, as a thief may copy out an item which the
+// owner is overwriting (it then fails its CAS, and drops the copy).  MaxSize
+// must be a power of two.
+
+#include <atomic>
+#include <arch.hh>
+
+namespace lockfree {
+
+template <class T, unsigned MaxSize>
+class deque_ws {
+    static_assert((MaxSize & (MaxSize - 1)) == 0,
+                  "deque_ws size must be a power of two");
+public:
+    deque_ws() : _top(0), _bottom(0) { }
+
+    // Owner only.  Returns false if the deque is full.
+    bool push(const T& element)
+    {
+        long b = _bottom.load(std::memory_order_relaxed);
+        long t = _top.load(std::memory_order_acquire);
+        if (b - t >= long(MaxSize)) {
+            return false;
+        }
+        _ring[b & (MaxSize - 1)].store(element, std::memory_order_relaxed);
+        // make the element visible to thieves before the new bottom
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only: take the newest element.  Returns false if the deque is
+    // empty (or a thief took its last element first).
+    bool pop(T& element)
+    {
+        long b = _bottom.load(std::memory_order_relaxed) - 1;
+        _bottom.store(b, std::memory_order_relaxed);
+        // thieves must see the reserved bottom before we look at top
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = _top.load(std::memory_order_relaxed);
+        if (t > b) {
+            // empty
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        element = _ring[b & (MaxSize - 1)].load(std::memory_order_relaxed);
+        if (t < b) {
+            // more than one element: no thief can reach this one
+            return true;
+        }
+        // the last element: race the thieves for it
+        bool won = _top.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    // Any thread: take the oldest element.  Returns false if the deque is
+    // empty, or if the owner or another thief took the element first;
+    // a thief typically moves on to another deque in both cases.
+    bool steal(T& element)
+    {
+        long t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = _bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        T e = _ring[t & (MaxSize - 1)].load(std::memory_order_relaxed);
+        if (!_top.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        element = e;
+        return true;
+    }
+
+    // A snapshot, which may be stale by the time it returns
+    unsigned size() const
+    {
+        long b = _bottom.load(std::memory_order_relaxed);
+        long t = _top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    // thieves take from the top; the owner pushes and pops at the bottom
+    std::atomic<long> _top CACHELINE_ALIGNED;
+    std::atomic<long> _bottom CACHELINE_ALIGNED;
+    std::atomic<T> _ring[MaxSize] CACHELINE_ALIGNED;
+};
+
+}
+#endif
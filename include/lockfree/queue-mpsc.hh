@@ -108,5 +108,53 @@ public:
     }
 };
 
+// A variant of queue_mpsc for consumers which handle all the queued items at
+// once, such as a worker thread draining its work list.  push() is the same,
+// but also tells the producer whether the queue was empty, so it only needs
+// to wake the consumer for the first item of a batch.  pop_all() takes all
+// the items pushed so far with a single atomic exchange, and returns them
+// oldest first.
+//
+// As pop_all() doesn't keep any state between calls, it is also safe to call
+// from several consumers concurrently.
+template <class LT>
+class queue_mpsc_batch {
+private:
+    std::atomic<LT*> pushlist;
+public:
+    constexpr queue_mpsc_batch<LT>() : pushlist(nullptr) { }
+
+    // Returns true if the queue was empty before this push
+    inline bool push(LT* item)
+    {
+        LT *old = pushlist.load(std::memory_order_relaxed);
+        do {
+            item->next = old;
+        } while (!pushlist.compare_exchange_weak(old, item, std::memory_order_release));
+        return !old;
+    }
+
+    // Returns the items pushed so far, oldest first, linked through their
+    // "next" fields, or nullptr if the queue was empty
+    inline LT* pop_all()
+    {
+        LT *r = pushlist.exchange(nullptr, std::memory_order_acquire);
+        // the pushlist is newest first; reverse it
+        LT *result = nullptr;
+        while (r) {
+            LT *next = r->next;
+            r->next = result;
+            result = r;
+            r = next;
+        }
+        return result;
+    }
+
+    inline bool empty(void) const
+    {
+        return !pushlist.load(std::memory_order_relaxed);
+    }
+};
+
 }
 #endif
@@ -6,7 +6,9 @@
  */
 
 //
-// single-producer / single-consumer lockless ring buffer of fixed size.
+// lockless ring buffers of fixed size: single-producer / single-consumer,
+// multiple-producer / single-consumer and multiple-producer /
+// multiple-consumer.
 //
 #ifndef __LF_RING_HH__
 #define __LF_RING_HH__
@@ -147,4 +149,94 @@ private:
 
 };
 
+//
+// mpmc ring of fixed size
+//
+// Any number of threads may push() and pop() concurrently.  Each slot has a
+// sequence number telling which lap around the ring it is ready for, and
+// whether for a push or a pop, so a pusher or popper claims a slot with one
+// CAS of its own index and doesn't wait for the other side (Dmitry Vyukov's
+// bounded MPMC queue).  MaxSize must be a power of two.
+//
+template<class T, unsigned MaxSize>
+class ring_mpmc {
+    static_assert((MaxSize & (MaxSize - 1)) == 0,
+                  "ring_mpmc size must be a power of two");
+public:
+    ring_mpmc(): _begin(0), _end(0) {
+        for (unsigned i = 0; i < MaxSize; i++) {
+            _ring[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const T& element)
+    {
+        unsigned end = _end.load(std::memory_order_relaxed);
+
+        for (;;) {
+            slot& s = _ring[end % MaxSize];
+            int diff = s.seq.load(std::memory_order_acquire) - end;
+
+            if (diff == 0) {
+                // the slot is free for this lap; claim it
+                if (_end.compare_exchange_weak(end, end + 1,
+                                               std::memory_order_relaxed)) {
+                    s.element = element;
+                    s.seq.store(end + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // the slot still holds the element of the previous lap
+                return false;
+            } else {
+                // another pusher claimed the slot
+                end = _end.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& element)
+    {
+        unsigned beg = _begin.load(std::memory_order_relaxed);
+
+        for (;;) {
+            slot& s = _ring[beg % MaxSize];
+            int diff = s.seq.load(std::memory_order_acquire) - (beg + 1);
+
+            if (diff == 0) {
+                if (_begin.compare_exchange_weak(beg, beg + 1,
+                                                 std::memory_order_relaxed)) {
+                    element = s.element;
+                    // free the slot for the next lap
+                    s.seq.store(beg + MaxSize, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // nothing was pushed to the slot yet
+                return false;
+            } else {
+                // another popper took the slot
+                beg = _begin.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    unsigned size() {
+        unsigned end = _end.load(std::memory_order_relaxed);
+        unsigned beg = _begin.load(std::memory_order_relaxed);
+
+        return (end - beg);
+    }
+
+private:
+    struct slot {
+        std::atomic<unsigned> seq;
+        T element;
+    };
+
+    std::atomic<unsigned> _begin CACHELINE_ALIGNED;
+    std::atomic<unsigned> _end CACHELINE_ALIGNED;
+    slot _ring[MaxSize] CACHELINE_ALIGNED;
+};
+
 #endif // !__LF_RING_HH__
@@ -13,6 +13,7 @@
 #include <boost/intrusive/set.hpp>
 #include <osv/types.h>
 #include <functional>
+#include <memory>
 #include <osv/error.h>
 
 namespace mmu {
@@ -51,6 +52,10 @@ public:
     uintptr_t size() const;
     virtual void split(uintptr_t edge);
     virtual error sync(uintptr_t start, uintptr_t end);
+    // Clears the vma's page table entries, freeing the pages behind them
+    virtual void unmap_pages();
+    // Called before write permission is given to (part of) the vma
+    virtual void prepare_write();
 protected:
     uintptr_t _start;
     uintptr_t _end;
@@ -58,16 +63,24 @@ public:
     boost::intrusive::set_member_hook<> _vma_list_hook;
 };
 
+class lent_pages;
+
 class file_vma : public vma {
 public:
-    file_vma(uintptr_t start, uintptr_t end, fileref file, f_offset offset, bool shared);
+    file_vma(uintptr_t start, uintptr_t end, fileref file, f_offset offset,
+             bool shared, std::shared_ptr<lent_pages> lent = nullptr);
     virtual void split(uintptr_t edge) override;
     virtual error sync(uintptr_t start, uintptr_t end) override;
+    virtual void unmap_pages() override;
+    virtual void prepare_write() override;
 private:
     f_offset offset(uintptr_t addr);
     fileref _file;
     f_offset _offset;
     bool _shared;
+    // When set, the vma maps the file system's cached pages rather than
+    // a copy of them.  Shared with the vmas split from this one.
+    std::shared_ptr<lent_pages> _lent;
 };
 
 void* map_file(void* addr, size_t size, bool search, unsigned perm,
@@ -116,6 +116,27 @@ struct bio *	alloc_bio(void);
 void		destroy_bio(struct bio *bio);
 
 int		bio_wait(struct bio *bio);
+
+/*
+ * Plugging: between bio_start_plug() and bio_finish_plug(), the bios a
+ * thread passes to submit_bio() are held back, and then handed to their
+ * drivers together, sorted by disk offset, so a driver with a
+ * strategy_batch operation can merge adjacent ones, queue them under one
+ * lock hold and notify the device once.  Plugs nest; only the outermost
+ * one has any effect.  A thread that waits for anything, be it one of its
+ * bios or a lock, submits the held bios first, so it cannot deadlock on
+ * them.
+ */
+#define BIO_PLUG_MAX	32
+
+struct bio_plug {
+	int		nbios;
+	struct bio	*bios[BIO_PLUG_MAX];
+};
+
+void		bio_start_plug(struct bio_plug *plug);
+void		bio_finish_plug(struct bio_plug *plug);
+void		submit_bio(struct bio *bio);
 void		biodone(struct bio *bio, bool ok);
 struct devstat;
 void    biofinish(struct bio *bp, struct devstat *stat, int error);
@@ -63,6 +63,7 @@ int	bread(struct device *, int, struct buf **);
 int	bwrite(struct buf *);
 void	bdwrite(struct buf *);
 void	binval(struct device *);
+void	bpurge(struct device *, int, int);
 void	brelse(struct buf *);
 void	bflush(struct buf *);
 void	bio_sync(void);
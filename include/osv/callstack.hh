@@ -37,6 +37,9 @@ public:
     void start();
     // stop collecting samples
     void stop();
+    // count a backtrace the caller collected itself (most recent first);
+    // may be called from interrupt context
+    void add(void** pc, unsigned len);
     // on a stopped collector, call @func(const trace& tr) for n most
     // common traces; must not take address of @tr.
     template <typename function>
@@ -88,7 +91,6 @@ private:
     // attached tracepoints
     std::vector<tracepoint_base*> _attached;
     friend bool operator==(const trace& a, const trace& b);
-    friend bool bt_trace_compare(void** bt, const trace& b);
     friend size_t hash_value(const callstack_collector::trace& a);
 };
 
@@ -8,16 +8,27 @@
 #ifndef _OSV_DENTRY_H
 #define _OSV_DENTRY_H 1
 
+#include <sys/types.h>
 #include <osv/mutex.h>
 #include <bsd/sys/sys/queue.h>
 
 struct vnode;
 
+/*
+ * Dentries stay cached after their last reference is dropped, on an LRU
+ * list, until they are evicted.  A dentry without a vnode is negative: it
+ * records that the path does not exist.
+ */
 struct dentry {
 	LIST_ENTRY(dentry) d_link;	/* link for hash list */
+	TAILQ_ENTRY(dentry) d_lru;	/* link for unused list */
 	int		d_refcnt;	/* reference count */
+	u_int		d_hash;		/* hash of mount and path */
+	char		d_hashed;	/* on the hash list */
+	char		d_onlru;	/* on the unused list */
+	char		d_referenced;	/* looked up since last scanned */
 	char		*d_path;	/* pointer to path in fs */
-	struct vnode	*d_vnode;
+	struct vnode	*d_vnode;	/* NULL if negative */
 	struct mount	*d_mount;
 };
 
@@ -68,6 +68,7 @@ typedef int (*devop_write_t)  (struct device *, struct uio *, int);
 typedef int (*devop_ioctl_t)  (struct device *, u_long, void *);
 typedef int (*devop_devctl_t) (struct device *, u_long, void *);
 typedef void (*devop_strategy_t)(struct bio *);
+typedef void (*devop_strategy_batch_t)(struct bio **, int);
 
 /*
  * Device operations
@@ -80,6 +81,12 @@ struct devops {
 	devop_ioctl_t	ioctl;
 	devop_devctl_t	devctl;
 	devop_strategy_t strategy;
+	/*
+	 * Optional: start several bios at once.  They are sorted by offset,
+	 * and all belong to devices sharing private_data (a disk and its
+	 * partitions).
+	 */
+	devop_strategy_batch_t strategy_batch;
 };
 
 
@@ -13,5 +13,9 @@
 // contexts, but requires -fno-omit-frame-pointer
 int backtrace_safe(void** pc, int nr);
 
+// Like backtrace_safe(), but for another context (for example, one that was
+// interrupted): @pc0 is its program counter, and @fp its frame pointer.
+int backtrace_safe(void** pc, int nr, void* pc0, void* fp);
+
 
 #endif /* EXECINFO_HH_ */
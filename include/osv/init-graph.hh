@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef INCLUDED_OSV_INIT_GRAPH_HH
+#define INCLUDED_OSV_INIT_GRAPH_HH
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+
+namespace osv {
+
+// Initialization stages and the stages each of them must run after.
+// run() starts every stage on a thread of its own once the stages it
+// depends on are done, so that independent stages run concurrently on
+// different cpus, and returns when all of them are done.
+//
+// A stage can only depend on stages added before it, so the graph can't
+// have cycles.
+class init_graph {
+public:
+    void add(const char* name, std::function<void ()> func,
+             std::initializer_list<const char*> after = {});
+    void run();
+private:
+    struct stage {
+        const char* name;
+        std::function<void ()> func;
+        std::vector<stage*> after;
+        bool done;
+    };
+    std::vector<std::unique_ptr<stage>> _stages;
+    mutex _mtx;
+    condvar _done;
+};
+
+}
+
+#endif /* INCLUDED_OSV_INIT_GRAPH_HH */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef LOCKSTAT_HH_
+#define LOCKSTAT_HH_
+
+// Lock contention profiling for lockfree::mutex and spin locks.
+//
+// While enabled, every acquisition is counted per lock and call site (the
+// return address of lock()), along with how long the caller waited if the
+// lock was contended, and how long it then held the lock.  The counts are
+// kept in per-cpu tables, preallocated by start(), so recording them never
+// allocates or takes a lock.
+//
+// Use:
+//   call start()/stop() around the interesting period
+//   call report() (or read /dev/lockstat) for the locks with the most
+//   waiting, and the most holding
+
+#include <osv/types.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace lockstat {
+
+struct lock_stats {
+    const void* lock;
+    void* caller;
+    u64 acquisitions;
+    u64 contended;
+    s64 wait_time;    // nanoseconds
+    s64 max_wait;
+    s64 hold_time;
+    s64 max_hold;
+};
+
+// Start counting afresh, keeping up to @entries_per_cpu distinct (lock,
+// caller) pairs on each cpu.  The tables are allocated by the first start(),
+// and keep that size.
+void start(size_t entries_per_cpu = 4096);
+void stop();
+// The statistics gathered so far (and kept after stop()), merged over cpus
+std::vector<lock_stats> collect();
+// A text report of collect(), most waited-for first, naming locks and
+// callers where they have symbols
+std::string report(size_t n = 50);
+// Create /dev/lockstat, which reads as report()
+void device_init();
+
+// Called by the locks
+extern std::atomic<bool> enabled;
+// @wait_start is when the caller started waiting for a contended lock, or
+// 0 if it got it right away
+void acquired(const void* lock, void* caller, s64 wait_start);
+void released(const void* lock);
+
+}
+
+#endif /* LOCKSTAT_HH_ */
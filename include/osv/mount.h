@@ -83,6 +83,7 @@ struct mount {
 #define	MNT_LOCAL	0x00001000	/* filesystem is stored locally */
 #define	MNT_QUOTA	0x00002000	/* quotas are enabled on filesystem */
 #define	MNT_ROOTFS	0x00004000	/* identifies the root filesystem */
+#define	MNT_NONEGCACHE	0x00008000	/* names appear without a vnode op */
 
 /*
  * Mask of flags that are visible to statfs()
@@ -27,6 +27,7 @@ struct pvclock_vcpu_time_info {
 } __attribute__((__packed__)); /* 32 bytes */
 
 namespace pvclock {
+constexpr u8 tsc_stable_bit = 1 << 0;
 u64 wall_clock_boot(pvclock_wall_clock *_wall);
 u64 system_time(pvclock_vcpu_time_info *sys);
 };
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef SAMPLER_HH_
+#define SAMPLER_HH_
+
+#include <osv/callstack.hh>
+#include <stdio.h>
+#include <memory>
+#include <vector>
+
+// A statistical cpu profiler.  While it runs, every cpu takes a timer
+// interrupt @frequency times a second, and the backtrace of the code it
+// interrupted is counted in a callstack_collector.  Only one sampler may
+// run at a time.
+//
+// Use:
+//   call start()/stop() around the code to profile
+//   call write_pprof() or write_folded() to save the profile
+class cpu_sampler {
+public:
+    // Keep up to @nr_traces distinct backtraces of up to @nr_frames frames
+    explicit cpu_sampler(unsigned frequency, size_t nr_traces = 16384,
+                         unsigned nr_frames = 64);
+    ~cpu_sampler();
+    void start();
+    void stop();
+    // on a stopped sampler, write the profile in gperftools' binary cpu
+    // profile format, which pprof reads along with the object files
+    void write_pprof(FILE* f);
+    // on a stopped sampler, write one "root;...;leaf count" line per
+    // backtrace, for flamegraph.pl
+    void write_folded(FILE* f);
+    // start or stop sampling on the current cpu, following start()/stop();
+    // called with interrupts disabled, on every cpu
+    void switch_local();
+private:
+    class cpu_timer;
+    void switch_all();
+private:
+    s64 _period;
+    unsigned _nr_frames;
+    bool _running = false;
+    callstack_collector _collector;
+    // indexed by cpu id
+    std::vector<std::unique_ptr<cpu_timer>> _timers;
+    friend class cpu_timer;
+};
+
+#endif /* SAMPLER_HH_ */
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef _OSV_SHRINKER_H
+#define _OSV_SHRINKER_H 1
+
+#include <stddef.h>
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+/*
+ * Caches which can give memory back register a shrinker.  When the page
+ * allocator runs out of memory, it asks every shrinker to free about
+ * @target bytes before giving up.  A shrinker returns roughly how much it
+ * freed.  Shrinkers are called from a dedicated thread, so they may sleep
+ * and take locks, but they must not wait for memory themselves.
+ */
+typedef size_t (*shrinker_func)(size_t target);
+
+void register_shrinker(const char *name, shrinker_func func);
+
+__END_DECLS
+
+#endif /* _OSV_SHRINKER_H */
@@ -21,9 +21,15 @@
 #include <cstring>
 #include <arch.hh>
 #include <osv/rcu.hh>
+#include <functional>
 
 void enable_trace();
 void enable_tracepoint(std::string wildcard);
+// Stream a snapshot of the trace buffers, and the tracepoints needed to
+// decode them, to out in a binary format (see core/trace.cc)
+void trace_export(std::function<void (const void* data, size_t len)> out);
+// Create /dev/trace, which reads as a trace_export() snapshot
+void trace_device_init();
 
 class tracepoint_base;
 
@@ -245,6 +251,9 @@ public:
                                       &tracepoint_base::tp_list_link>,
         boost::intrusive::constant_time_size<false>
         > tp_list;
+    // Protects tp_list, which modules add their tracepoints to when they
+    // are loaded
+    static mutex tp_list_mutex;
 protected:
     bool active = false; // logging || !probes.empty()
     bool logging = false;
@@ -267,6 +276,7 @@ private:
     static std::unordered_set<tracepoint_id>& known_ids();
     static bool _log_backtrace;
     static const size_t backtrace_len = 10;
+    friend void trace_export(std::function<void (const void*, size_t)>);
 };
 
 namespace {
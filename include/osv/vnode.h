@@ -113,6 +113,7 @@ struct vattr {
 
 #define IO_APPEND	0x0001
 #define IO_SYNC		0x0002
+#define IO_DIRECT	0x0004		/* bypass the buffer cache (O_DIRECT) */
 
 
 typedef	int (*vnop_open_t)	(struct file *);
@@ -134,6 +135,8 @@ typedef	int (*vnop_getattr_t)	(struct vnode *, struct vattr *);
 typedef	int (*vnop_setattr_t)	(struct vnode *, struct vattr *);
 typedef	int (*vnop_inactive_t)	(struct vnode *);
 typedef	int (*vnop_truncate_t)	(struct vnode *, off_t);
+typedef	int (*vnop_loan_t)	(struct vnode *, off_t, void **, size_t *, void **);
+typedef	void (*vnop_unloan_t)	(struct vnode *, void *);
 
 /*
  * vnode operations
@@ -157,6 +160,8 @@ struct vnops {
 	vnop_setattr_t		vop_setattr;
 	vnop_inactive_t		vop_inactive;
 	vnop_truncate_t		vop_truncate;
+	vnop_loan_t		vop_loan;
+	vnop_unloan_t		vop_unloan;
 };
 
 /*
@@ -181,6 +186,8 @@ struct vnops {
 #define VOP_SETATTR(VP, VAP)	   ((VP)->v_op->vop_setattr)(VP, VAP)
 #define VOP_INACTIVE(VP)	   ((VP)->v_op->vop_inactive)(VP)
 #define VOP_TRUNCATE(VP, N)	   ((VP)->v_op->vop_truncate)(VP, N)
+#define VOP_LOAN(VP, O, A, L, C)   ((VP)->v_op->vop_loan)(VP, O, A, L, C)
+#define VOP_UNLOAN(VP, C)	   ((VP)->v_op->vop_unloan)(VP, C)
 
 int	 vop_nullop(void);
 int	 vop_einval(void);
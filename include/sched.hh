@@ -22,6 +22,9 @@
 
 extern "C" {
 void smp_main();
+// If set, called before the current thread waits, to hand over work it is
+// holding back which others may be waiting for, e.g. the bios of a plug.
+extern __thread void (*sched_before_wait)(void);
 };
 void smp_launch();
 
@@ -153,6 +156,9 @@ public:
     explicit timer_base(client& t);
     ~timer_base();
     void set(s64 time);
+    // Allow the timer to fire up to @slack nanoseconds after its expiration
+    // time, so that it can share a clock interrupt with nearby timers.
+    void set_slack(s64 slack);
     bool expired() const;
     void cancel();
     friend bool operator<(const timer_base& t1, const timer_base& t2);
@@ -165,12 +171,16 @@ protected:
     };
     state _state = state::free;
     s64 _time;
+    s64 _slack = 0;
     friend class timer_list;
 };
 
 class timer : public timer_base {
 public:
     explicit timer(thread& t);
+    // thread timeouts (sleeps, condvar and semaphore waits) tolerate a
+    // little lateness by default
+    static constexpr s64 default_slack = 50000; // 50us
 };
 
 class thread : private timer_base::client {
@@ -213,6 +223,19 @@ public:
     void join();
     void set_cleanup(std::function<void ()> cleanup);
     unsigned long id() __attribute__((no_instrument_function)); // guaranteed unique over system lifetime
+    // cpu time consumed by this thread, in nanoseconds
+    s64 thread_clock();
+    // Scheduling statistics.  They are only updated by the thread's cpu,
+    // with interrupts disabled, and may be read without locking.
+    struct stats {
+        s64 wait_time = 0;  // time spent runnable, waiting for the cpu (ns)
+        s64 max_wait = 0;   // longest such wait (ns)
+        u64 waits = 0;      // number of times picked to run after waiting
+        u64 voluntary_switches = 0;   // switched out to wait for something
+        u64 involuntary_switches = 0; // switched out while runnable
+        u64 migrations = 0; // moved to another cpu by the load balancer
+    };
+    const stats& get_stats() const { return _stats; }
 private:
     void main();
     void switch_to();
@@ -255,6 +278,10 @@ private:
     arch_fpu _fpu;
     unsigned long _id;
     s64 _vruntime;
+    s64 _total_cpu_time = 0;
+    stats _stats;
+    // when the thread last became runnable
+    s64 _runnable_since = 0;
     static const s64 max_vruntime = std::numeric_limits<s64>::max();
     std::function<void ()> _cleanup;
     // When _ref_counter reaches 0, the thread can be deleted.
@@ -297,7 +324,9 @@ public:
     void resume(bi::list<timer_base>& t);
     void rearm();
 private:
+    s64 deadline();
     friend class timer_base;
+    // expiration time currently programmed into the clock event device
     s64 _last = std::numeric_limits<s64>::max();
     bi::set<timer_base, bi::base_hook<bi::set_base_hook<>>> _list;
     class callback_dispatch : private clock_event_callback {
@@ -340,6 +369,16 @@ struct cpu : private timer_base::client {
     incoming_wakeup_queue* incoming_wakeups;
     thread* terminating_thread;
     s64 running_since;
+    // time this cpu spent running threads other than the idle thread
+    s64 busy_time = 0;
+    // time spent in interrupt handlers (if irq_accounting), and their number
+    s64 irq_time = 0;
+    u64 irqs = 0;
+    u64 context_switches = 0;
+    // how long threads waited on this runqueue: bucket i counts waits of
+    // [2^i, 2^(i+1)) microseconds, bucket 0 also the shorter ones
+    static constexpr unsigned wait_histogram_size = 24;
+    u64 wait_histogram[wait_histogram_size] = {};
     void* percpu_base;
     static cpu* current();
     void init_on_cpu();
@@ -357,6 +396,7 @@ struct cpu : private timer_base::client {
     void enqueue(thread& t, bool waking = false);
     void init_idle_thread();
     void update_preemption_timer(thread* current, s64 now, s64 run);
+    void account_wait(thread& t, s64 now);
     virtual void timer_fired() override;
     class notifier;
 };
@@ -374,6 +414,17 @@ private:
     friend class cpu;
 };
 
+// cpu time consumed by all threads, in nanoseconds
+s64 process_cputime();
+
+// Create /dev/schedstat, which reads as a text report of the per-cpu and
+// per-thread scheduling statistics
+void schedstat_device_init();
+
+// Whether interrupts are timed for cpu::irq_time.  Off by default, as it
+// reads the clock twice per interrupt.
+extern bool irq_accounting;
+
 void preempt();
 void preempt_disable() __attribute__((no_instrument_function));
 void preempt_enable() __attribute__((no_instrument_function));
@@ -423,6 +474,9 @@ inline
 void thread::do_wait_until(Mutex& mtx, Pred pred)
 {
     thread* me = current();
+    if (sched_before_wait) {
+        sched_before_wait();
+    }
     while (true) {
         {
             wait_guard waiter(me);
@@ -514,6 +568,7 @@ inline
 timer::timer(thread& t)
     : timer_base(t)
 {
+    _slack = default_slack;
 }
 
 extern std::vector<cpu*> cpus;
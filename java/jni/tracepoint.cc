@@ -15,23 +15,27 @@ static std::string get_string(JNIEnv* jni, jstring s)
 JNIEXPORT jlongArray JNICALL Java_com_cloudius_trace_Tracepoint_doList
   (JNIEnv *jni, jclass klass)
 {
-    auto nr = tracepoint_base::tp_list.size();
-    auto a = jni->NewLongArray(nr);
-    size_t idx = 0;
-    for (auto& tp : tracepoint_base::tp_list) {
-        jlong handle = jlong(reinterpret_cast<uintptr_t>(&tp));
-        jni->SetLongArrayRegion(a, idx++, 1, &handle);
-    };
-    return a;
+    WITH_LOCK(tracepoint_base::tp_list_mutex) {
+        auto nr = tracepoint_base::tp_list.size();
+        auto a = jni->NewLongArray(nr);
+        size_t idx = 0;
+        for (auto& tp : tracepoint_base::tp_list) {
+            jlong handle = jlong(reinterpret_cast<uintptr_t>(&tp));
+            jni->SetLongArrayRegion(a, idx++, 1, &handle);
+        };
+        return a;
+    }
 }
 
 JNIEXPORT jlong JNICALL Java_com_cloudius_trace_Tracepoint_findByName
   (JNIEnv *jni, jclass klass, jstring name)
 {
     auto n = get_string(jni, name);
-    for (auto& tp : tracepoint_base::tp_list) {
-        if (n == tp.name) {
-            return reinterpret_cast<uintptr_t>(&tp);
+    WITH_LOCK(tracepoint_base::tp_list_mutex) {
+        for (auto& tp : tracepoint_base::tp_list) {
+            if (n == tp.name) {
+                return reinterpret_cast<uintptr_t>(&tp);
+            }
         }
     }
     auto re = jni->FindClass("java/lang/RuntimeException");
@@ -0,0 +1,706 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Asynchronous file I/O: POSIX aio_read() and friends, and the io_setup()
+// family of Linux system calls (see aio.hh).
+//
+// A read or write of a block device goes straight to the driver's strategy
+// routine as bios, and completes from their bio_done callback.  All the bios
+// of one submission are queued under a bio_plug, so the driver notifies the
+// host once per batch rather than once per request.
+//
+// Other files have no asynchronous read or write operation (ZFS reads and
+// writes through the DMU synchronously), so their requests are run by a
+// pool of worker threads with the ordinary pread() and pwrite().  With
+// several workers, several requests can wait for the disk at once.
+
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fs/fs.hh>
+#include <osv/bio.h>
+#include <osv/device.h>
+#include <osv/dentry.h>
+#include <osv/vnode.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <drivers/clock.hh>
+#include <libc/libc.hh>
+#include <libc/aio.hh>
+#include "mmu.hh"
+#include "sched.hh"
+
+namespace {
+
+enum class aio_cmd { read, write, readv, writev, fsync, fdatasync };
+
+// One read, write or sync, from either interface.  For readv and writev,
+// buf points to the iovec array and nbytes is the number of iovecs.
+class aio_request {
+public:
+    aio_request(int fd, aio_cmd cmd, void* buf, size_t nbytes, off_t offset)
+        : fd(fd), cmd(cmd), buf(buf), nbytes(nbytes), offset(offset) {}
+    virtual ~aio_request() {}
+    // Called once, with the result of the read() or write() (or fsync())
+    // the request stands for, and errno if it failed.  Deletes the request.
+    virtual void complete(ssize_t ret, int error) = 0;
+public:
+    int fd;
+    aio_cmd cmd;
+    void* buf;
+    size_t nbytes;
+    off_t offset;
+    // When sent as bios: how many are still in flight, and the first error
+    std::atomic<unsigned> bios_pending;
+    std::atomic<int> bio_error;
+};
+
+// Requests are split into bios of at most this size, which the block
+// drivers can take in one request
+constexpr size_t aio_max_bio = 64 * 1024;
+constexpr size_t aio_sector_size = 512;
+
+s64 timespec_ns(const timespec& ts)
+{
+    return s64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void aio_execute(aio_request* req)
+{
+    ssize_t ret = -1;
+    switch (req->cmd) {
+    case aio_cmd::read:
+        ret = pread(req->fd, req->buf, req->nbytes, req->offset);
+        break;
+    case aio_cmd::write:
+        ret = pwrite(req->fd, req->buf, req->nbytes, req->offset);
+        break;
+    case aio_cmd::readv:
+        ret = preadv(req->fd, static_cast<iovec*>(req->buf), req->nbytes,
+                     req->offset);
+        break;
+    case aio_cmd::writev:
+        ret = pwritev(req->fd, static_cast<iovec*>(req->buf), req->nbytes,
+                      req->offset);
+        break;
+    case aio_cmd::fsync:
+        ret = fsync(req->fd);
+        break;
+    case aio_cmd::fdatasync:
+        ret = fdatasync(req->fd);
+        break;
+    }
+    req->complete(ret, ret < 0 ? errno : 0);
+}
+
+class aio_workers {
+public:
+    aio_workers();
+    void queue(aio_request* req);
+private:
+    void run();
+private:
+    mutex _mtx;
+    condvar _cond;
+    std::deque<aio_request*> _queue;
+    std::vector<std::unique_ptr<sched::thread>> _threads;
+};
+
+aio_workers::aio_workers()
+{
+    for (unsigned i = 0; i < 2 * sched::cpus.size(); i++) {
+        _threads.emplace_back(new sched::thread([this] { run(); }));
+        _threads.back()->start();
+    }
+}
+
+void aio_workers::queue(aio_request* req)
+{
+    WITH_LOCK(_mtx) {
+        _queue.push_back(req);
+        _cond.wake_one();
+    }
+}
+
+void aio_workers::run()
+{
+    while (true) {
+        aio_request* req;
+        WITH_LOCK(_mtx) {
+            _cond.wait_until(_mtx, [&] { return !_queue.empty(); });
+            req = _queue.front();
+            _queue.pop_front();
+        }
+        aio_execute(req);
+    }
+}
+
+aio_workers* workers()
+{
+    static aio_workers* w = new aio_workers;
+    return w;
+}
+
+void aio_bio_done(struct bio* bio)
+{
+    auto req = static_cast<aio_request*>(bio->bio_caller1);
+    if (bio->bio_flags & BIO_ERROR) {
+        req->bio_error.store(bio->bio_error ? bio->bio_error : EIO);
+    }
+    destroy_bio(bio);
+    if (req->bios_pending.fetch_sub(1) == 1) {
+        int error = req->bio_error.load();
+        req->complete(error ? -1 : req->nbytes, error);
+    }
+}
+
+// Sends a read or write of a block device to its driver.  Returns false if
+// the request is not one the driver can take as it is (misaligned, out of
+// range, or in memory which is not mapped linearly), so it must be run by
+// a worker instead.  That is also how errors such as EBADF get reported.
+bool aio_start_bio(aio_request* req)
+{
+    if (req->cmd != aio_cmd::read && req->cmd != aio_cmd::write) {
+        return false;
+    }
+    if (req->offset < 0 || !req->nbytes ||
+        (req->offset | req->nbytes) % aio_sector_size ||
+        static_cast<char*>(req->buf) < mmu::phys_mem) {
+        return false;
+    }
+    fileref f(fileref_from_fd(req->fd));
+    if (!f || !f->f_dentry) {
+        return false;
+    }
+    auto vp = f->f_dentry->d_vnode;
+    if (vp->v_type != VBLK) {
+        return false;
+    }
+    auto dev = static_cast<struct device*>(vp->v_data);
+    auto fflag = req->cmd == aio_cmd::read ? FREAD : FWRITE;
+    if (!(f->f_flags & fflag) || req->offset + req->nbytes > (size_t)dev->size) {
+        return false;
+    }
+
+    auto chunk = std::min(aio_max_bio, dev->max_io_size);
+    std::vector<struct bio*> bios;
+    for (size_t done = 0; done < req->nbytes; done += chunk) {
+        auto bio = alloc_bio();
+        if (!bio) {
+            for (auto b : bios) {
+                destroy_bio(b);
+            }
+            return false;
+        }
+        bio->bio_cmd = req->cmd == aio_cmd::read ? BIO_READ : BIO_WRITE;
+        bio->bio_dev = dev;
+        bio->bio_data = static_cast<char*>(req->buf) + done;
+        bio->bio_offset = req->offset + done;
+        bio->bio_bcount = std::min(chunk, req->nbytes - done);
+        bio->bio_caller1 = req;
+        bio->bio_done = aio_bio_done;
+        bios.push_back(bio);
+    }
+    req->bio_error.store(0);
+    req->bios_pending.store(bios.size());
+    for (auto bio : bios) {
+        submit_bio(bio);
+    }
+    return true;
+}
+
+void aio_submit(aio_request* const* reqs, size_t n)
+{
+    struct bio_plug plug;
+    bio_start_plug(&plug);
+    for (size_t i = 0; i < n; i++) {
+        if (!aio_start_bio(reqs[i])) {
+            workers()->queue(reqs[i]);
+        }
+    }
+    bio_finish_plug(&plug);
+}
+
+struct aio_notify_thread {
+    void (*func)(sigval);
+    sigval value;
+};
+
+void* aio_notify_run(void* arg)
+{
+    std::unique_ptr<aio_notify_thread> n(static_cast<aio_notify_thread*>(arg));
+    n->func(n->value);
+    return nullptr;
+}
+
+// Like glibc, a SIGEV_THREAD notification runs in a new, detached, thread
+// created with the application's sigev_notify_attributes (so it gets the
+// stack it asked for), and a SIGEV_SIGNAL notification is queued with
+// sigev_value, for an SA_SIGINFO handler or a signalfd to see.
+void aio_notify(const sigevent& sev)
+{
+    switch (sev.sigev_notify) {
+    case SIGEV_SIGNAL:
+        sigqueue(getpid(), sev.sigev_signo, sev.sigev_value);
+        break;
+    case SIGEV_THREAD: {
+        pthread_attr_t attr;
+        if (sev.sigev_notify_attributes) {
+            attr = *sev.sigev_notify_attributes;
+        } else {
+            pthread_attr_init(&attr);
+        }
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        auto n = new aio_notify_thread{sev.sigev_notify_function, sev.sigev_value};
+        pthread_t t;
+        if (pthread_create(&t, &attr, aio_notify_run, n)) {
+            delete n;
+        }
+        break;
+    }
+    }
+}
+
+// POSIX requests.  aio_error() and aio_return() read the aiocb directly;
+// posix_mutex protects the counts of requests in flight, which aio_cancel()
+// needs, and completions wake aio_suspend() and lio_listio() on posix_cond.
+
+mutex posix_mutex;
+condvar posix_cond;
+std::unordered_map<int, unsigned> posix_inflight;
+
+// The requests of one lio_listio() call
+struct lio_group {
+    unsigned pending = 0;
+    bool failed = false;
+    // With LIO_WAIT the caller waits for the group, and frees it;
+    // otherwise the last request to complete does
+    bool wait = false;
+    sigevent sev;
+};
+
+class posix_request : public aio_request {
+public:
+    posix_request(aiocb* cb, aio_cmd cmd, lio_group* group)
+        : aio_request(cb->aio_fildes, cmd, const_cast<void*>(cb->aio_buf),
+                      cb->aio_nbytes, cb->aio_offset)
+        , _cb(cb), _sev(cb->aio_sigevent), _group(group)
+    {
+        cb->__ret = 0;
+        cb->__err = EINPROGRESS;
+    }
+    virtual void complete(ssize_t ret, int error) override;
+private:
+    aiocb* _cb;
+    sigevent _sev;
+    lio_group* _group;
+};
+
+void posix_request::complete(ssize_t ret, int error)
+{
+    lio_group* finished = nullptr;
+    _cb->__ret = ret;
+    WITH_LOCK(posix_mutex) {
+        // The application may reuse the aiocb once it sees this
+        __atomic_store_n(&_cb->__err, error, __ATOMIC_RELEASE);
+        if (!--posix_inflight[fd]) {
+            posix_inflight.erase(fd);
+        }
+        if (_group) {
+            _group->failed |= error != 0;
+            if (!--_group->pending && !_group->wait) {
+                finished = _group;
+            }
+        }
+        posix_cond.wake_all();
+    }
+    aio_notify(_sev);
+    if (finished) {
+        aio_notify(finished->sev);
+        delete finished;
+    }
+    delete this;
+}
+
+void posix_submit(aio_request* const* reqs, size_t n)
+{
+    WITH_LOCK(posix_mutex) {
+        for (size_t i = 0; i < n; i++) {
+            posix_inflight[reqs[i]->fd]++;
+        }
+    }
+    aio_submit(reqs, n);
+}
+
+int posix_queue(aiocb* cb, aio_cmd cmd)
+{
+    aio_request* req = new posix_request(cb, cmd, nullptr);
+    posix_submit(&req, 1);
+    return 0;
+}
+
+// Linux contexts.  A context's mutex protects its completed events and the
+// count of requests in flight, which together may not exceed the number of
+// events it was set up for.
+//
+// Each system call holds a reference to the context it works on, so that
+// io_destroy() in another thread does not free it under the call:
+// io_destroy() marks the context destroyed, which makes io_getevents()
+// return, and waits for the other references to be dropped.
+
+class aio_context {
+public:
+    explicit aio_context(unsigned max_events) : max_events(max_events) {}
+public:
+    const unsigned max_events;
+    unsigned inflight = 0;
+    std::deque<osv::io_event> events;
+    unsigned refs = 0;
+    bool destroyed = false;
+    mutex mtx;
+    condvar cond;
+};
+
+class context_ref {
+public:
+    explicit context_ref(aio_context* ctx = nullptr) : _ctx(ctx) {}
+    context_ref(const context_ref&) = delete;
+    context_ref& operator=(const context_ref&) = delete;
+    context_ref(context_ref&& other) : _ctx(other.release()) {}
+    ~context_ref();
+    aio_context* get() const { return _ctx; }
+    aio_context* operator->() const { return _ctx; }
+    explicit operator bool() const { return _ctx; }
+    aio_context* release()
+    {
+        auto ctx = _ctx;
+        _ctx = nullptr;
+        return ctx;
+    }
+private:
+    aio_context* _ctx;
+};
+
+context_ref::~context_ref()
+{
+    if (_ctx) {
+        WITH_LOCK(_ctx->mtx) {
+            if (!--_ctx->refs) {
+                _ctx->cond.wake_all();
+            }
+        }
+    }
+}
+
+mutex contexts_mutex;
+std::unordered_set<aio_context*> contexts;
+
+context_ref find_context(osv::aio_context_t id)
+{
+    auto ctx = reinterpret_cast<aio_context*>(id);
+    WITH_LOCK(contexts_mutex) {
+        if (!contexts.count(ctx)) {
+            return context_ref();
+        }
+        WITH_LOCK(ctx->mtx) {
+            ctx->refs++;
+        }
+        return context_ref(ctx);
+    }
+}
+
+class linux_request : public aio_request {
+public:
+    linux_request(aio_context* ctx, osv::iocb* cb, aio_cmd cmd)
+        : aio_request(cb->aio_fildes, cmd, reinterpret_cast<void*>(cb->aio_buf),
+                      cb->aio_nbytes, cb->aio_offset)
+        , _ctx(ctx), _data(cb->aio_data), _obj(reinterpret_cast<uint64_t>(cb))
+        , _resfd(cb->aio_flags & IOCB_FLAG_RESFD ? int(cb->aio_resfd) : -1) {}
+    virtual void complete(ssize_t ret, int error) override;
+private:
+    aio_context* _ctx;
+    uint64_t _data;
+    uint64_t _obj;
+    int _resfd;
+};
+
+void linux_request::complete(ssize_t ret, int error)
+{
+    osv::io_event ev = { _data, _obj, error ? -error : ret, 0 };
+    WITH_LOCK(_ctx->mtx) {
+        _ctx->events.push_back(ev);
+        _ctx->inflight--;
+        _ctx->cond.wake_all();
+    }
+    if (_resfd >= 0) {
+        eventfd_write(_resfd, 1);
+    }
+    delete this;
+}
+
+bool iocb_cmd(const osv::iocb* cb, aio_cmd& cmd)
+{
+    switch (cb->aio_lio_opcode) {
+    case osv::IOCB_CMD_PREAD:   cmd = aio_cmd::read;      return true;
+    case osv::IOCB_CMD_PWRITE:  cmd = aio_cmd::write;     return true;
+    case osv::IOCB_CMD_PREADV:  cmd = aio_cmd::readv;     return true;
+    case osv::IOCB_CMD_PWRITEV: cmd = aio_cmd::writev;    return true;
+    case osv::IOCB_CMD_FSYNC:   cmd = aio_cmd::fsync;     return true;
+    case osv::IOCB_CMD_FDSYNC:  cmd = aio_cmd::fdatasync; return true;
+    default:                    return false;
+    }
+}
+
+}
+
+int aio_read(struct aiocb* cb)
+{
+    return posix_queue(cb, aio_cmd::read);
+}
+
+int aio_write(struct aiocb* cb)
+{
+    return posix_queue(cb, aio_cmd::write);
+}
+
+int aio_fsync(int op, struct aiocb* cb)
+{
+    if (op != O_SYNC && op != O_DSYNC) {
+        return libc_error(EINVAL);
+    }
+    return posix_queue(cb, op == O_SYNC ? aio_cmd::fsync : aio_cmd::fdatasync);
+}
+
+int aio_error(const struct aiocb* cb)
+{
+    return __atomic_load_n(&cb->__err, __ATOMIC_ACQUIRE);
+}
+
+ssize_t aio_return(struct aiocb* cb)
+{
+    return cb->__ret;
+}
+
+// Requests are handed to the driver or to a worker as soon as they are
+// submitted, so there is never one left to cancel.
+int aio_cancel(int fd, struct aiocb* cb)
+{
+    if (cb && cb->aio_fildes != fd) {
+        return libc_error(EINVAL);
+    }
+    if (!fileref_from_fd(fd)) {
+        return libc_error(EBADF);
+    }
+    WITH_LOCK(posix_mutex) {
+        if (cb) {
+            return cb->__err == EINPROGRESS ? AIO_NOTCANCELED : AIO_ALLDONE;
+        }
+        return posix_inflight.count(fd) ? AIO_NOTCANCELED : AIO_ALLDONE;
+    }
+}
+
+int aio_suspend(const struct aiocb* const list[], int n,
+                const struct timespec* timeout)
+{
+    sched::timer tmr(*sched::thread::current());
+    if (timeout) {
+        tmr.set(clock::get()->time() + timespec_ns(*timeout));
+    }
+    WITH_LOCK(posix_mutex) {
+        while (true) {
+            for (int i = 0; i < n; i++) {
+                if (list[i] && list[i]->__err != EINPROGRESS) {
+                    return 0;
+                }
+            }
+            if (timeout && tmr.expired()) {
+                return libc_error(EAGAIN);
+            }
+            posix_cond.wait(&posix_mutex, timeout ? &tmr : nullptr);
+        }
+    }
+}
+
+int lio_listio(int mode, struct aiocb* const list[], int n,
+               struct sigevent* sev)
+{
+    if ((mode != LIO_WAIT && mode != LIO_NOWAIT) || n < 0) {
+        return libc_error(EINVAL);
+    }
+
+    std::unique_ptr<lio_group> group(new lio_group);
+    group->wait = mode == LIO_WAIT;
+    if (sev) {
+        group->sev = *sev;
+    } else {
+        group->sev.sigev_notify = SIGEV_NONE;
+    }
+
+    std::vector<aio_request*> reqs;
+    bool invalid = false;
+    for (int i = 0; i < n; i++) {
+        auto cb = list[i];
+        if (!cb || cb->aio_lio_opcode == LIO_NOP) {
+            continue;
+        }
+        if (cb->aio_lio_opcode != LIO_READ && cb->aio_lio_opcode != LIO_WRITE) {
+            cb->__ret = -1;
+            cb->__err = EINVAL;
+            invalid = true;
+            continue;
+        }
+        auto cmd = cb->aio_lio_opcode == LIO_READ ? aio_cmd::read : aio_cmd::write;
+        reqs.push_back(new posix_request(cb, cmd, group.get()));
+    }
+    group->pending = reqs.size();
+
+    if (reqs.empty()) {
+        if (!group->wait) {
+            aio_notify(group->sev);
+        }
+    } else if (group->wait) {
+        posix_submit(reqs.data(), reqs.size());
+        WITH_LOCK(posix_mutex) {
+            posix_cond.wait_until(posix_mutex, [&] { return !group->pending; });
+        }
+        invalid |= group->failed;
+    } else {
+        // From now on the group belongs to its requests
+        group.release();
+        posix_submit(reqs.data(), reqs.size());
+    }
+    return invalid ? libc_error(EIO) : 0;
+}
+
+namespace osv {
+
+long io_setup(unsigned nr_events, aio_context_t* ctxp)
+{
+    if (!nr_events || *ctxp) {
+        return libc_error(EINVAL);
+    }
+    auto ctx = new aio_context(nr_events);
+    WITH_LOCK(contexts_mutex) {
+        contexts.insert(ctx);
+    }
+    *ctxp = reinterpret_cast<aio_context_t>(ctx);
+    return 0;
+}
+
+long io_destroy(aio_context_t id)
+{
+    auto ctx = find_context(id);
+    if (!ctx) {
+        return libc_error(EINVAL);
+    }
+    WITH_LOCK(contexts_mutex) {
+        // two io_destroy() calls may race; only one erases the context
+        if (!contexts.erase(ctx.get())) {
+            return libc_error(EINVAL);
+        }
+    }
+    WITH_LOCK(ctx->mtx) {
+        ctx->destroyed = true;
+        ctx->cond.wake_all();
+        ctx->cond.wait_until(ctx->mtx, [&] {
+            return !ctx->inflight && ctx->refs == 1;
+        });
+        ctx->refs--;
+    }
+    delete ctx.release();
+    return 0;
+}
+
+long io_submit(aio_context_t id, long nr, iocb** iocbpp)
+{
+    auto ctx = find_context(id);
+    if (!ctx || nr < 0) {
+        return libc_error(EINVAL);
+    }
+
+    // Take room for the whole batch at once, and give back what's unused
+    long room;
+    WITH_LOCK(ctx->mtx) {
+        if (ctx->destroyed) {
+            return libc_error(EINVAL);
+        }
+        room = std::min<long>(nr, ctx->max_events - ctx->inflight -
+                                  ctx->events.size());
+        ctx->inflight += room;
+    }
+    std::vector<aio_request*> reqs;
+    int error = room < nr ? EAGAIN : 0;
+    for (long i = 0; i < room; i++) {
+        aio_cmd cmd;
+        if (!iocb_cmd(iocbpp[i], cmd)) {
+            error = EINVAL;
+            break;
+        }
+        reqs.push_back(new linux_request(ctx.get(), iocbpp[i], cmd));
+    }
+    if ((long)reqs.size() < room) {
+        WITH_LOCK(ctx->mtx) {
+            ctx->inflight -= room - reqs.size();
+        }
+    }
+
+    aio_submit(reqs.data(), reqs.size());
+    if (reqs.empty() && error) {
+        return libc_error(error);
+    }
+    return reqs.size();
+}
+
+long io_getevents(aio_context_t id, long min_nr, long nr, io_event* events,
+                  timespec* timeout)
+{
+    auto ctx = find_context(id);
+    if (!ctx || min_nr < 0 || nr < min_nr) {
+        return libc_error(EINVAL);
+    }
+
+    sched::timer tmr(*sched::thread::current());
+    if (timeout) {
+        tmr.set(clock::get()->time() + timespec_ns(*timeout));
+    }
+    long n = 0;
+    WITH_LOCK(ctx->mtx) {
+        while ((long)ctx->events.size() < min_nr && !ctx->destroyed &&
+               !(timeout && tmr.expired())) {
+            ctx->cond.wait(&ctx->mtx, timeout ? &tmr : nullptr);
+        }
+        if (ctx->destroyed) {
+            return libc_error(EINVAL);
+        }
+        for (; n < nr && !ctx->events.empty(); n++) {
+            events[n] = ctx->events.front();
+            ctx->events.pop_front();
+        }
+    }
+    return n;
+}
+
+// See aio_cancel()
+long io_cancel(aio_context_t id, iocb* iocb, io_event* result)
+{
+    auto ctx = find_context(id);
+    return libc_error(ctx ? EAGAIN : EINVAL);
+}
+
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#ifndef AIO_HH_
+#define AIO_HH_
+
+#include <stdint.h>
+#include <time.h>
+
+// Linux's native asynchronous I/O system calls, which libaio wraps, are
+// reached through syscall().  They keep C++ linkage, so they can't be
+// mistaken for libaio's own io_setup() and friends, which take different
+// arguments and return negative error numbers.
+//
+// The structures are those of <linux/aio_abi.h>, for x86_64.
+
+namespace osv {
+
+typedef unsigned long aio_context_t;
+
+enum {
+    IOCB_CMD_PREAD = 0,
+    IOCB_CMD_PWRITE = 1,
+    IOCB_CMD_FSYNC = 2,
+    IOCB_CMD_FDSYNC = 3,
+    IOCB_CMD_NOOP = 6,
+    IOCB_CMD_PREADV = 7,
+    IOCB_CMD_PWRITEV = 8,
+};
+
+// Signal completion by adding 1 to the eventfd in aio_resfd
+#define IOCB_FLAG_RESFD (1 << 0)
+
+struct io_event {
+    uint64_t data;
+    uint64_t obj;
+    int64_t res;
+    int64_t res2;
+};
+
+struct iocb {
+    uint64_t aio_data;
+    uint32_t aio_key;
+    uint32_t aio_rw_flags;
+    uint16_t aio_lio_opcode;
+    int16_t aio_reqprio;
+    uint32_t aio_fildes;
+    uint64_t aio_buf;
+    uint64_t aio_nbytes;
+    int64_t aio_offset;
+    uint64_t aio_reserved2;
+    uint32_t aio_flags;
+    uint32_t aio_resfd;
+};
+
+// These return -1 and set errno on failure, like syscall()
+long io_setup(unsigned nr_events, aio_context_t* ctxp);
+long io_destroy(aio_context_t ctx);
+long io_submit(aio_context_t ctx, long nr, iocb** iocbpp);
+long io_getevents(aio_context_t ctx, long min_nr, long nr, io_event* events,
+                  timespec* timeout);
+long io_cancel(aio_context_t ctx, iocb* iocb, io_event* result);
+
+}
+
+#endif /* AIO_HH_ */
@@ -634,6 +634,10 @@ libc += mman.o
 libc += sem.o
 libc += pipe_buffer.o
 libc += pipe.o
+libc += eventfd.o
+libc += timerfd.o
+libc += signalfd.o
+libc += aio.o
 libc += af_local.o
 libc += user.o
 libc += resource.o
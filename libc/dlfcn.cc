@@ -124,7 +124,7 @@ extern "C" int dladdr(void *addr, Dl_info *info)
     info->dli_fbase = ei.base;
     info->dli_sname = ei.sym;
     info->dli_saddr = ei.addr;
-    return 0;
+    return ei.fname != nullptr;
 }
 
 extern "C" char *dlerror(void)
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Implement Linux's eventfd(2): a file holding a 64-bit counter, which
+// write() adds to and read() consumes.  The counter is updated with atomic
+// operations, so a write() or read() which does not need to block never
+// takes a lock; the mutex and condvar are only used to sleep and wake.
+
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+
+#include <fs/fs.hh>
+#include <fs/unsupported.h>
+#include <osv/fcntl.h>
+#include <osv/poll.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <libc/libc.hh>
+
+class eventfd_obj {
+public:
+    eventfd_obj(unsigned int initval, bool semaphore)
+        : _counter(initval), _semaphore(semaphore) {}
+    int read(file* f, uio* data);
+    int write(file* f, uio* data);
+    int poll(int events);
+private:
+    bool try_take(u64& val);
+    bool try_add(u64 val);
+    void give_back(u64 val);
+    void wake(file* f, int events);
+    template <class Pred>
+    void wait_until(Pred pred);
+private:
+    static constexpr u64 max_counter = 0xfffffffffffffffe;
+    std::atomic<u64> _counter;
+    bool _semaphore;
+    std::atomic<unsigned> _waiters = { 0 };
+    mutex _mtx;
+    condvar _cond;
+};
+
+bool eventfd_obj::try_take(u64& val)
+{
+    auto old = _counter.load(std::memory_order_relaxed);
+    do {
+        if (!old) {
+            return false;
+        }
+        val = _semaphore ? 1 : old;
+    } while (!_counter.compare_exchange_weak(old, old - val));
+    return true;
+}
+
+bool eventfd_obj::try_add(u64 val)
+{
+    auto old = _counter.load(std::memory_order_relaxed);
+    do {
+        if (old > max_counter - val) {
+            return false;
+        }
+    } while (!_counter.compare_exchange_weak(old, old + val));
+    return true;
+}
+
+// Undo a try_take().  Writers may have added to the counter meanwhile, so
+// it may not have room for all of @val.
+void eventfd_obj::give_back(u64 val)
+{
+    auto old = _counter.load(std::memory_order_relaxed);
+    u64 sum;
+    do {
+        sum = old > max_counter - val ? max_counter : old + val;
+    } while (!_counter.compare_exchange_weak(old, sum));
+}
+
+// The waker checks _waiters after changing the counter, and the waiter
+// rechecks the counter after registering in _waiters (both sequentially
+// consistent), so at least one of them sees the other's update.
+void eventfd_obj::wake(file* f, int events)
+{
+    poll_wake(f, events);
+    if (_waiters.load()) {
+        WITH_LOCK(_mtx) {
+            _cond.wake_all();
+        }
+    }
+}
+
+template <class Pred>
+void eventfd_obj::wait_until(Pred pred)
+{
+    WITH_LOCK(_mtx) {
+        _waiters.fetch_add(1);
+        while (!pred()) {
+            _cond.wait(&_mtx);
+        }
+        _waiters.fetch_add(-1);
+    }
+}
+
+int eventfd_obj::read(file* f, uio* data)
+{
+    if (data->uio_resid < (ssize_t)sizeof(u64)) {
+        return EINVAL;
+    }
+    u64 val;
+    if (!try_take(val)) {
+        if (is_nonblock(f)) {
+            return EAGAIN;
+        }
+        wait_until([&] { return try_take(val); });
+    }
+    auto error = uiomove(&val, sizeof(val), data);
+    if (error) {
+        // The caller didn't get the value, so it stays in the counter
+        give_back(val);
+        wake(f, POLLIN | POLLRDNORM);
+        return error;
+    }
+    if (_counter.load(std::memory_order_relaxed) < max_counter) {
+        wake(f, POLLOUT | POLLWRNORM);
+    }
+    return 0;
+}
+
+int eventfd_obj::write(file* f, uio* data)
+{
+    if (data->uio_resid < (ssize_t)sizeof(u64)) {
+        return EINVAL;
+    }
+    u64 val;
+    auto error = uiomove(&val, sizeof(val), data);
+    if (error) {
+        return error;
+    }
+    if (val > max_counter) {
+        return EINVAL;
+    }
+    if (!try_add(val)) {
+        if (is_nonblock(f)) {
+            return EAGAIN;
+        }
+        wait_until([&] { return try_add(val); });
+    }
+    if (val) {
+        wake(f, POLLIN | POLLRDNORM);
+    }
+    return 0;
+}
+
+int eventfd_obj::poll(int events)
+{
+    auto counter = _counter.load(std::memory_order_relaxed);
+    int revents = 0;
+    if ((events & POLLIN) && counter > 0) {
+        revents |= POLLIN;
+    }
+    if ((events & POLLOUT) && counter < max_counter) {
+        revents |= POLLOUT;
+    }
+    return revents;
+}
+
+static int efd_init(file* f)
+{
+    return 0;
+}
+
+static int efd_read(file* f, uio* data, int flags)
+{
+    return static_cast<eventfd_obj*>(f->f_data)->read(f, data);
+}
+
+static int efd_write(file* f, uio* data, int flags)
+{
+    return static_cast<eventfd_obj*>(f->f_data)->write(f, data);
+}
+
+static int efd_poll(file* f, int events)
+{
+    return static_cast<eventfd_obj*>(f->f_data)->poll(events);
+}
+
+static int efd_close(file* f)
+{
+    delete static_cast<eventfd_obj*>(f->f_data);
+    f->f_data = nullptr;
+    return 0;
+}
+
+static fileops efd_ops = {
+    efd_init,
+    efd_read,
+    efd_write,
+    unsupported_truncate,
+    unsupported_ioctl,
+    efd_poll,
+    unsupported_stat,
+    efd_close,
+    unsupported_chmod,
+};
+
+int eventfd(unsigned int initval, int flags)
+{
+    if (flags & ~(EFD_SEMAPHORE | EFD_CLOEXEC | EFD_NONBLOCK)) {
+        return libc_error(EINVAL);
+    }
+    std::unique_ptr<eventfd_obj> efd{
+        new eventfd_obj(initval, flags & EFD_SEMAPHORE)};
+    unsigned fflags = FREAD | FWRITE;
+    if (flags & EFD_NONBLOCK) {
+        fflags |= FNONBLOCK;
+    }
+    try {
+        fileref f{falloc_noinstall()};
+        finit(f.get(), fflags, DTYPE_UNSPEC, efd.release(), &efd_ops);
+        fdesc fd(f);
+        return fd.release();
+    } catch (int error) {
+        return libc_error(error);
+    }
+}
+
+int eventfd_read(int fd, eventfd_t* value)
+{
+    return ::read(fd, value, sizeof(*value)) == sizeof(*value) ? 0 : -1;
+}
+
+int eventfd_write(int fd, eventfd_t value)
+{
+    return ::write(fd, &value, sizeof(value)) == sizeof(value) ? 0 : -1;
+}
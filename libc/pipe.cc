@@ -94,6 +94,25 @@ static fileops pipe_ops = {
     unsupported_chmod,
 };
 
+int pipe_fcntl_size(file* fp, int cmd, int arg, int* ret)
+{
+    if (fp->f_ops != &pipe_ops) {
+        return EBADF;
+    }
+    pipe_buffer *buf;
+    if (fp->f_flags & FWRITE) {
+        buf = static_cast<pipe_writer*>(fp->f_data)->buf.get();
+    } else {
+        buf = static_cast<pipe_reader*>(fp->f_data)->buf.get();
+    }
+    int error = 0;
+    if (cmd == F_SETPIPE_SZ) {
+        error = arg < 0 ? EINVAL : buf->set_capacity(arg);
+    }
+    *ret = buf->capacity();
+    return error;
+}
+
 int pipe(int pipefd[2]) {
     auto b = new pipe_buffer;
     std::unique_ptr<pipe_reader> s1{new pipe_reader(b)};
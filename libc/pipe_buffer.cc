@@ -10,7 +10,38 @@
 
 #include "pipe_buffer.hh"
 
+#include <string.h>
+#include <limits.h>
 #include <osv/poll.h>
+#include <osv/pagealloc.hh>
+#include "mempool.hh"
+
+pipe_buffer::~pipe_buffer()
+{
+    free_ring(pages);
+}
+
+bool pipe_buffer::alloc_ring(std::vector<char*>& ring, size_t size)
+{
+    ring.reserve(size / memory::page_size);
+    while (ring.size() < size / memory::page_size) {
+        auto page = static_cast<char*>(memory::alloc_page());
+        if (!page) {
+            free_ring(ring);
+            return false;
+        }
+        ring.push_back(page);
+    }
+    return true;
+}
+
+void pipe_buffer::free_ring(std::vector<char*>& ring)
+{
+    for (auto page : ring) {
+        memory::free_page(page);
+    }
+    ring.clear();
+}
 
 void pipe_buffer::detach_sender()
 {
@@ -46,50 +77,123 @@ void pipe_buffer::attach_receiver(struct file *f)
     receiver = f;
 }
 
-int pipe_buffer::read_events_unlocked()
+size_t pipe_buffer::used()
+{
+    auto b = begin.load(std::memory_order_acquire);
+    return end.load(std::memory_order_acquire) - b;
+}
+
+size_t pipe_buffer::room()
+{
+    return cap.load(std::memory_order_relaxed) - used();
+}
+
+size_t pipe_buffer::capacity()
 {
+    return cap.load(std::memory_order_relaxed);
+}
+
+// A poller first installs itself on the file and only then asks for the
+// events, so setting the polled flag here (sequentially consistent, as is
+// the other side's fence in wake_*()) guarantees that either we see the
+// new data or the other side sees the flag and calls poll_wake().
+int pipe_buffer::read_events()
+{
+    receiver_polled.store(true);
     int ret = 0;
-    ret |= !q.empty() ? POLLIN : 0;
+    ret |= used() ? POLLIN : 0;
     ret |= !sender ? POLLRDHUP : 0;
     return ret;
 }
 
-int pipe_buffer::write_events_unlocked()
+int pipe_buffer::write_events()
 {
+    sender_polled.store(true);
     if (!receiver) {
         return POLLHUP;
     }
     int ret = 0;
-    ret |= q.size() < max_buf ? POLLOUT : 0;
+    ret |= room() ? POLLOUT : 0;
     return ret;
 }
 
-int pipe_buffer::read_events()
+template <class Pred>
+void pipe_buffer::wait_until(condvar& cond, std::atomic<unsigned>& waiters,
+        Pred pred)
 {
     WITH_LOCK(mtx) {
-        return read_events_unlocked();
+        waiters.fetch_add(1);
+        while (!pred()) {
+            cond.wait(&mtx);
+        }
+        waiters.fetch_sub(1);
     }
 }
 
-int pipe_buffer::write_events()
+void pipe_buffer::wake_receiver()
 {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool polled = receiver_polled.load(std::memory_order_relaxed);
+    if (!polled && !read_waiters.load(std::memory_order_relaxed)) {
+        return;
+    }
     WITH_LOCK(mtx) {
-        return write_events_unlocked();
+        if (polled && receiver) {
+            poll_wake(receiver, (POLLIN | POLLRDNORM));
+        }
+        may_read.wake_all();
     }
 }
 
+void pipe_buffer::wake_sender()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool polled = sender_polled.load(std::memory_order_relaxed);
+    if (!polled && !write_waiters.load(std::memory_order_relaxed)) {
+        return;
+    }
+    WITH_LOCK(mtx) {
+        if (polled && sender) {
+            poll_wake(sender, (POLLOUT | POLLWRNORM));
+        }
+        may_write.wake_all();
+    }
+}
+
+// Where the free-running position pos is in a ring of the given size, and
+// how many bytes from there are in the same page
+static char* ring_at(const std::vector<char*>& ring, size_t size, size_t pos,
+                     size_t* contiguous)
+{
+    pos &= size - 1;
+    auto offset = pos % memory::page_size;
+    *contiguous = memory::page_size - offset;
+    return ring[pos / memory::page_size] + offset;
+}
+
 // Copy from the pipe into the given iovec array, until the array is full
-// or the queue is empty. Decrements uio->uio_resid.
-static void copy_to_uio(std::deque<char> &q, uio *uio)
+// or the ring is empty. Decrements uio->uio_resid. Call with read_mtx held.
+void pipe_buffer::copy_to_uio(uio *uio)
 {
-    for (int i = 0; i < uio->uio_iovcnt && !q.empty(); i++) {
+    auto size = cap.load(std::memory_order_relaxed);
+    auto b = begin.load(std::memory_order_relaxed);
+    auto e = end.load(std::memory_order_acquire);
+    for (int i = 0; i < uio->uio_iovcnt && b != e; i++) {
         auto &iov = uio->uio_iov[i];
-        auto n = std::min(q.size(), iov.iov_len);
+        auto n = std::min(e - b, iov.iov_len);
         char* p = static_cast<char*>(iov.iov_base);
-        std::copy(q.begin(), q.begin() + n, p);
-        q.erase(q.begin(), q.begin() + n);
         uio->uio_resid -= n;
+        while (n) {
+            size_t len;
+            auto src = ring_at(pages, size, b, &len);
+            len = std::min(len, n);
+            memcpy(p, src, len);
+            p += len;
+            b += len;
+            n -= len;
+        }
     }
+    begin.store(b, std::memory_order_release);
 }
 
 int pipe_buffer::read(uio* data, bool nonblock)
@@ -97,45 +201,61 @@ int pipe_buffer::read(uio* data, bool nonblock)
     if (!data->uio_resid) {
         return 0;
     }
-    std::unique_lock<mutex> lock(mtx);
-    if (nonblock && q.empty()) {
-        return sender ? EAGAIN : 0;
-    }
-    while (sender && q.empty()) {
-        may_read.wait(&mtx);
-    }
-    if (q.empty()) {
-        return 0;
+    while (true) {
+        WITH_LOCK(read_mtx) {
+            // Check for a detached sender before checking for data, as the
+            // sender's last data was published before it detached.
+            bool eof = !sender;
+            if (used()) {
+                copy_to_uio(data);
+                break;
+            }
+            if (eof) {
+                return 0;
+            }
+            if (nonblock) {
+                return EAGAIN;
+            }
+        }
+        wait_until(may_read, read_waiters, [&] { return used() || !sender; });
     }
-    copy_to_uio(q, data);
-    if (write_events_unlocked() & POLLOUT)
-        poll_wake(sender, (POLLOUT | POLLWRNORM));
-    lock.unlock();
-    may_write.wake_all();
+    wake_sender();
     return 0;
 }
 
-// Copy from a certain iovec array into a pipe, starting at a given index
-// and offset, until the buffer or the array ends. Decrements uio->uio_resid,
-// and modifies ind and offset to where the copy stopped.
-static void copy_from_uio(uio *uio, size_t *ind, size_t *offset,
-        std::deque<char> &buf, size_t bufsize)
+// Copy from a certain iovec array into the ring, starting at a given index
+// and offset, until the ring or the array ends. Decrements uio->uio_resid,
+// and modifies ind and offset to where the copy stopped. Call with write_mtx
+// held.
+void pipe_buffer::copy_from_uio(uio *uio, size_t *ind, size_t *offset)
 {
     int i = *ind;
     size_t off = *offset;
+    auto size = cap.load(std::memory_order_relaxed);
+    auto e = end.load(std::memory_order_relaxed);
+    auto b = begin.load(std::memory_order_acquire);
 
-    while (i < uio->uio_iovcnt && buf.size() < bufsize) {
+    while (i < uio->uio_iovcnt && e - b < size) {
         auto &iov = uio->uio_iov[i];
-        auto n = std::min(bufsize - buf.size(), iov.iov_len - off);
+        auto n = std::min(size - (e - b), iov.iov_len - off);
         char* p = static_cast<char*>(iov.iov_base) + off;
-        std::copy(p, p + n, std::back_inserter(buf));
         uio->uio_resid -= n;
         off += n;
+        while (n) {
+            size_t len;
+            auto dst = ring_at(pages, size, e, &len);
+            len = std::min(len, n);
+            memcpy(dst, p, len);
+            p += len;
+            e += len;
+            n -= len;
+        }
         if (off == iov.iov_len) {
             ++i;
             off = 0;
         }
     }
+    end.store(e, std::memory_order_release);
 
     *offset = off;
     *ind = i;
@@ -146,51 +266,90 @@ int pipe_buffer::write(uio* data, bool nonblock)
     if (!data->uio_resid) {
         return 0;
     }
-    WITH_LOCK(mtx) {
-        // A write() smaller than PIPE_BUF (=4096 in Linux) will not be split
-        // (i.e., will be "atomic"): For such a small write, we need to wait
-        // until there's enough room for all it in the buffer.
-        int needroom = data->uio_resid <= 4096 ? data->uio_resid : 1;
-        if (nonblock) {
+    // A write() smaller than PIPE_BUF (=4096 in Linux) will not be split
+    // (i.e., will be "atomic"): For such a small write, we need to wait
+    // until there's enough room for all it in the buffer.
+    size_t needroom = data->uio_resid <= PIPE_BUF ? data->uio_resid : 1;
+    size_t ind = 0, offset = 0;
+    bool wrote = false;
+
+    // A blocking write() to a pipe never returns with partial success -
+    // it waits, possibly writing its output in parts and waiting multiple
+    // times, until the whole given buffer is written. We don't hold
+    // write_mtx while waiting, so a large write may be interleaved with
+    // other writers' data, as Posix allows.
+    while (true) {
+        bool copied = false;
+        WITH_LOCK(write_mtx) {
             if (!receiver) {
                 // FIXME: If we don't generate a SIGPIPE here, at least assert
                 // that the user did not install a SIGPIPE handler.
-                return EPIPE;
-            } else if (q.size() + needroom > max_buf) {
-                return EAGAIN;
+                return wrote ? 0 : EPIPE;
             }
-        } else {
-            while (receiver && q.size() + needroom > max_buf) {
-                may_write.wait(&mtx);
-            }
-            if (!receiver) {
-                return EPIPE;
+            if (room() >= needroom) {
+                if (pages.empty() && !alloc_ring(pages, capacity())) {
+                    return wrote ? 0 : ENOMEM;
+                }
+                copy_from_uio(data, &ind, &offset);
+                copied = wrote = true;
+                needroom = 1;
             }
         }
+        if (copied) {
+            wake_receiver();
+        }
+        if (!data->uio_resid) {
+            return 0;
+        }
+        if (nonblock) {
+            return wrote ? 0 : EAGAIN;
+        }
+        wait_until(may_write, write_waiters,
+                [&] { return room() >= needroom || !receiver; });
+    }
+}
 
-        // A blocking write() to a pipe never returns with partial success -
-        // it waits, possibly writing its output in parts and waiting multiple
-        // times, until the whole given buffer is written.
-        size_t ind = 0, offset = 0;
-        while (data->uio_resid && receiver) {
-            copy_from_uio(data, &ind, &offset, q, max_buf);
-            if (data->uio_resid) {
-                // The buffer is full but we still have more to send. Wake up
-                // readers, and go to sleep ourselves.
-                assert(q.size() == max_buf);
-                poll_wake(receiver, (POLLIN | POLLRDNORM));
-                may_read.wake_all();
-                if (nonblock) {
-                    return 0;
+// Like Linux, round the capacity up to a power of two number of pages, and
+// refuse to shrink below the data currently in the pipe.
+int pipe_buffer::set_capacity(size_t size)
+{
+    if (size > max_capacity) {
+        return EPERM;
+    }
+    size_t newcap = memory::page_size;
+    while (newcap < size) {
+        newcap <<= 1;
+    }
+    WITH_LOCK(read_mtx) {
+        WITH_LOCK(write_mtx) {
+            auto b = begin.load(std::memory_order_relaxed);
+            auto e = end.load(std::memory_order_relaxed);
+            if (e - b > newcap) {
+                return EBUSY;
+            }
+            if (!pages.empty()) {
+                std::vector<char*> newpages;
+                if (!alloc_ring(newpages, newcap)) {
+                    return ENOMEM;
                 }
-                while (receiver && q.size() == max_buf) {
-                    may_write.wait(&mtx);
+                // Keep the free-running counters, moving each byte to where
+                // they point in the new ring.  Both rings are made of whole
+                // pages, so a byte has the same offset in its page in both.
+                auto oldcap = capacity();
+                for (auto i = b; i != e;) {
+                    size_t len;
+                    auto from = ring_at(pages, oldcap, i, &len);
+                    auto to = ring_at(newpages, newcap, i, &len);
+                    len = std::min(len, e - i);
+                    memcpy(to, from, len);
+                    i += len;
                 }
+                free_ring(pages);
+                pages.swap(newpages);
             }
+            cap.store(newcap, std::memory_order_relaxed);
         }
-        if (read_events_unlocked() & POLLIN)
-            poll_wake(receiver, (POLLIN | POLLRDNORM));
     }
-    may_read.wake_all();
+    wake_sender();
     return 0;
 }
@@ -8,36 +8,71 @@
 #ifndef PIPE_BUFFER_HH_
 #define PIPE_BUFFER_HH_
 
-#include <deque>
 #include <atomic>
+#include <vector>
 #include <boost/intrusive_ptr.hpp>
 
 #include <osv/mutex.h>
 #include <osv/condvar.h>
 #include <osv/file.h>
+#include <arch.hh>
 
+// A byte ring in the style of ring_spsc (lockfree/ring.hh): the reader only
+// advances begin and the writer only advances end, so a reader and a
+// writer copy data at the same time.  Readers (writers) are serialized
+// among themselves by read_mtx (write_mtx), which also keeps writes of up
+// to PIPE_BUF atomic; a reader and a writer never wait for each other's
+// lock.  mtx is only taken to sleep, to wake a sleeper or poller, and to
+// attach or detach the ends.
 struct pipe_buffer {
-private:
-    static constexpr size_t max_buf = 8192;
 public:
+    // Like Linux, a pipe holds 64K until resized with F_SETPIPE_SZ
+    static constexpr size_t default_capacity = 65536;
+    static constexpr size_t max_capacity = 1 << 20;
     pipe_buffer() = default;
+    ~pipe_buffer();
     pipe_buffer(const pipe_buffer&) = delete;
     int read(uio* data, bool nonblock);
     int write(uio* data, bool nonblock);
     int read_events();
     int write_events();
+    size_t capacity();
+    int set_capacity(size_t size);
     void detach_sender();
     void detach_receiver();
     void attach_sender(struct file *f);
     void attach_receiver(struct file *f);
 private:
-    int read_events_unlocked();
-    int write_events_unlocked();
+    size_t used();
+    size_t room();
+    static bool alloc_ring(std::vector<char*>& ring, size_t size);
+    static void free_ring(std::vector<char*>& ring);
+    void copy_to_uio(uio* uio);
+    void copy_from_uio(uio* uio, size_t* ind, size_t* offset);
+    void wake_receiver();
+    void wake_sender();
+    template <class Pred>
+    void wait_until(condvar& cond, std::atomic<unsigned>& waiters, Pred pred);
 private:
     mutex mtx;
-    std::deque<char> q;
-    struct file *receiver = nullptr;
-    struct file *sender = nullptr;
+    mutex read_mtx;
+    mutex write_mtx;
+    // The ring's pages, allocated on the first write, since many pipes
+    // never carry data.  A large ring need not be physically contiguous.
+    // Only replaced with both read_mtx and write_mtx held.
+    std::vector<char*> pages;
+    std::atomic<size_t> cap = { default_capacity };
+    // Free-running byte counts; the data is at [begin, end) modulo cap
+    std::atomic<size_t> begin CACHELINE_ALIGNED = { 0 };
+    std::atomic<size_t> end CACHELINE_ALIGNED = { 0 };
+    std::atomic<struct file*> receiver = { nullptr };
+    std::atomic<struct file*> sender = { nullptr };
+    // Set when a reader or writer sleeps, or when an end is first polled,
+    // so the other side knows it must take mtx to wake it.
+    std::atomic<unsigned> read_waiters = { 0 };
+    std::atomic<unsigned> write_waiters = { 0 };
+    std::atomic<bool> receiver_polled = { false };
+    std::atomic<bool> sender_polled = { false };
     std::atomic<unsigned> refs = {};
     condvar may_read;
     condvar may_write;
@@ -53,4 +88,8 @@ private:
 
 typedef boost::intrusive_ptr<pipe_buffer> pipe_buffer_ref;
 
+// fcntl()'s F_GETPIPE_SZ and F_SETPIPE_SZ.  Sets *ret to the pipe's
+// capacity; returns EBADF if fp is not a pipe.
+int pipe_fcntl_size(struct file* fp, int cmd, int arg, int* ret);
+
 #endif /* PIPE_BUFFER_HH */
@@ -7,6 +7,9 @@
 
 #include "signal.hh"
 #include <string.h>
+#include <unistd.h>
+#include "sched.hh"
+#include <libc/libc.hh>
 
 namespace osv {
 
@@ -160,3 +163,60 @@ int sigignore(int signum)
     act.sa_handler = SIG_IGN;
     return sigaction(signum, &act, nullptr);
 }
+
+// We only have one process, so kill() and sigqueue() can only send signals
+// to ourselves.  A signal is consumed by any signalfd waiting for it;
+// otherwise its handler is run, in a new thread, since there is no thread
+// we could safely interrupt to run it.
+static int send_signal(pid_t pid, const siginfo_t& si)
+{
+    auto sig = si.si_signo;
+    if (sig < 0 || sig >= (int)nsignals) {
+        return libc_error(EINVAL);
+    }
+    if (pid != 0 && pid != -1 && pid != getpid()) {
+        return libc_error(ESRCH);
+    }
+    if (sig == 0 || signalfd_deliver(si)) {
+        return 0;
+    }
+    auto sa = signal_actions[sig];
+    if (is_sig_ign(sa)) {
+        return 0;
+    }
+    if (is_sig_dfl(sa)) {
+        // Our default is to abort the process
+        abort();
+    }
+    sched::thread::attr attr;
+    attr.detached = true;
+    auto t = new sched::thread([=] {
+        if (sa.sa_flags & SA_SIGINFO) {
+            siginfo_t info = si;
+            sa.sa_sigaction(sig, &info, nullptr);
+        } else {
+            sa.sa_handler(sig);
+        }
+    }, attr);
+    t->start();
+    return 0;
+}
+
+int kill(pid_t pid, int sig)
+{
+    siginfo_t si = {};
+    si.si_signo = sig;
+    si.si_code = SI_USER;
+    si.si_pid = getpid();
+    return send_signal(pid, si);
+}
+
+int sigqueue(pid_t pid, int sig, const union sigval value)
+{
+    siginfo_t si = {};
+    si.si_signo = sig;
+    si.si_code = SI_QUEUE;
+    si.si_pid = getpid();
+    si.si_value = value;
+    return send_signal(pid, si);
+}
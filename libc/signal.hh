@@ -30,6 +30,10 @@ sigset* thread_signals();
 void generate_signal(siginfo_t &siginfo, exception_frame* ef);
 void handle_segmentation_fault(ulong addr, exception_frame* ef);
 
+// Queue the signal on any signalfd watching for it; returns false if
+// there is none
+bool signalfd_deliver(const siginfo_t& si);
+
 }
 
 namespace arch {
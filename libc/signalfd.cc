@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Implement Linux's signalfd(2): signals sent with kill() or sigqueue() are
+// queued on any signalfd whose mask contains them instead of running a
+// handler, and are read from it as signalfd_siginfo records.  Like standard
+// signals, several instances of the same signal pending on one signalfd are
+// merged, keeping the siginfo of the first.
+
+#include <sys/signalfd.h>
+#include <sys/poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <list>
+
+#include <fs/fs.hh>
+#include <fs/unsupported.h>
+#include <osv/fcntl.h>
+#include <osv/poll.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <libc/libc.hh>
+#include "signal.hh"
+
+class signalfd_obj {
+public:
+    explicit signalfd_obj(u64 mask) : _mask(mask) {}
+    void attach(file* f) { _file = f; }
+    void set_mask(u64 mask) { _mask.store(mask, std::memory_order_relaxed); }
+    bool deliver(const siginfo_t& si);
+    int read(file* f, uio* data);
+    int poll(int events);
+private:
+    bool take(siginfo_t& si);
+private:
+    file* _file = nullptr;
+    // bit n set for signal n
+    std::atomic<u64> _mask;
+    std::atomic<u64> _pending = { 0 };
+    // the siginfo of each pending signal; under _mtx
+    siginfo_t _info[osv::nsignals];
+    mutex _mtx;
+    condvar _readable;
+};
+
+static mutex signalfds_mutex;
+static std::list<signalfd_obj*> signalfds;
+
+static u64 to_mask(const sigset_t* set)
+{
+    auto s = osv::from_libc(set);
+    u64 mask = 0;
+    for (unsigned i = 1; i < osv::nsignals; ++i) {
+        if (s->mask.test(i)) {
+            mask |= u64(1) << i;
+        }
+    }
+    // Like Linux, silently ignore attempts to catch these
+    mask &= ~((u64(1) << SIGKILL) | (u64(1) << SIGSTOP));
+    return mask;
+}
+
+bool signalfd_obj::deliver(const siginfo_t& si)
+{
+    auto bit = u64(1) << si.si_signo;
+    if (!(_mask.load(std::memory_order_relaxed) & bit)) {
+        return false;
+    }
+    WITH_LOCK(_mtx) {
+        if (!(_pending.load(std::memory_order_relaxed) & bit)) {
+            _info[si.si_signo] = si;
+            _pending.fetch_or(bit);
+        }
+        _readable.wake_all();
+    }
+    poll_wake(_file, POLLIN | POLLRDNORM);
+    return true;
+}
+
+// Dequeue the lowest pending signal, or return false if none.  Called with
+// _mtx held.
+bool signalfd_obj::take(siginfo_t& si)
+{
+    auto pending = _pending.load(std::memory_order_relaxed);
+    if (!pending) {
+        return false;
+    }
+    auto signo = __builtin_ctzll(pending);
+    si = _info[signo];
+    _pending.fetch_and(~(u64(1) << signo));
+    return true;
+}
+
+int signalfd_obj::read(file* f, uio* data)
+{
+    if (data->uio_resid < (ssize_t)sizeof(signalfd_siginfo)) {
+        return EINVAL;
+    }
+    siginfo_t si;
+    bool more;
+    WITH_LOCK(_mtx) {
+        while (!take(si)) {
+            if (is_nonblock(f)) {
+                return EAGAIN;
+            }
+            _readable.wait(&_mtx);
+        }
+    }
+    do {
+        signalfd_siginfo ssi;
+        memset(&ssi, 0, sizeof(ssi));
+        ssi.ssi_signo = si.si_signo;
+        ssi.ssi_code = si.si_code;
+        ssi.ssi_pid = si.si_pid;
+        ssi.ssi_int = si.si_value.sival_int;
+        ssi.ssi_ptr = reinterpret_cast<uintptr_t>(si.si_value.sival_ptr);
+        auto error = uiomove(&ssi, sizeof(ssi), data);
+        if (error) {
+            return error;
+        }
+        more = false;
+        if (data->uio_resid >= (ssize_t)sizeof(signalfd_siginfo)) {
+            WITH_LOCK(_mtx) {
+                more = take(si);
+            }
+        }
+    } while (more);
+    return 0;
+}
+
+int signalfd_obj::poll(int events)
+{
+    if ((events & POLLIN) && _pending.load(std::memory_order_relaxed)) {
+        return POLLIN;
+    }
+    return 0;
+}
+
+static int sfd_init(file* f)
+{
+    auto sfd = static_cast<signalfd_obj*>(f->f_data);
+    sfd->attach(f);
+    WITH_LOCK(signalfds_mutex) {
+        signalfds.push_back(sfd);
+    }
+    return 0;
+}
+
+static int sfd_read(file* f, uio* data, int flags)
+{
+    return static_cast<signalfd_obj*>(f->f_data)->read(f, data);
+}
+
+static int sfd_poll(file* f, int events)
+{
+    return static_cast<signalfd_obj*>(f->f_data)->poll(events);
+}
+
+static int sfd_close(file* f)
+{
+    auto sfd = static_cast<signalfd_obj*>(f->f_data);
+    WITH_LOCK(signalfds_mutex) {
+        signalfds.remove(sfd);
+    }
+    delete sfd;
+    f->f_data = nullptr;
+    return 0;
+}
+
+static fileops signalfd_ops = {
+    sfd_init,
+    sfd_read,
+    unsupported_write,
+    unsupported_truncate,
+    unsupported_ioctl,
+    sfd_poll,
+    unsupported_stat,
+    sfd_close,
+    unsupported_chmod,
+};
+
+namespace osv {
+
+bool signalfd_deliver(const siginfo_t& si)
+{
+    bool delivered = false;
+    WITH_LOCK(signalfds_mutex) {
+        for (auto sfd : signalfds) {
+            delivered |= sfd->deliver(si);
+        }
+    }
+    return delivered;
+}
+
+}
+
+int signalfd(int fd, const sigset_t* mask, int flags)
+{
+    if (flags & ~(SFD_NONBLOCK | SFD_CLOEXEC)) {
+        return libc_error(EINVAL);
+    }
+    if (fd != -1) {
+        fileref f(fileref_from_fd(fd));
+        if (!f) {
+            return libc_error(EBADF);
+        }
+        if (f->f_ops != &signalfd_ops) {
+            return libc_error(EINVAL);
+        }
+        static_cast<signalfd_obj*>(f->f_data)->set_mask(to_mask(mask));
+        return fd;
+    }
+    std::unique_ptr<signalfd_obj> sfd{new signalfd_obj(to_mask(mask))};
+    unsigned fflags = FREAD;
+    if (flags & SFD_NONBLOCK) {
+        fflags |= FNONBLOCK;
+    }
+    try {
+        fileref f{falloc_noinstall()};
+        finit(f.get(), fflags, DTYPE_UNSPEC, sfd.release(), &signalfd_ops);
+        fdesc fd(f);
+        return fd.release();
+    } catch (int error) {
+        return libc_error(error);
+    }
+}
@@ -45,10 +45,27 @@ int usleep(useconds_t usec)
 
 int clock_gettime(clockid_t clk_id, struct timespec* ts)
 {
-    if (clk_id != CLOCK_REALTIME) {
+    u64 time;
+    switch (clk_id) {
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+        time = clock::get()->time();
+        break;
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_BOOTTIME:
+        time = clock::get()->uptime();
+        break;
+    case CLOCK_PROCESS_CPUTIME_ID:
+        time = sched::process_cputime();
+        break;
+    case CLOCK_THREAD_CPUTIME_ID:
+        time = sched::thread::current()->thread_clock();
+        break;
+    default:
         return libc_error(EINVAL);
     }
-    u64 time = clock::get()->time();
     auto sec = time / 1000000000;
     auto nsec = time % 1000000000;
     ts->tv_sec = sec;
@@ -61,7 +78,17 @@ int __clock_gettime(clockid_t clk_id, struct timespec* ts) __attribute__((alias(
 
 int clock_getres(clockid_t clk_id, struct timespec* ts)
 {
-    if (clk_id != CLOCK_REALTIME) {
+    switch (clk_id) {
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_BOOTTIME:
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+        break;
+    default:
         return libc_error(EINVAL);
     }
 
@@ -75,5 +102,9 @@ int clock_getres(clockid_t clk_id, struct timespec* ts)
 
 int clock_getcpuclockid(pid_t pid, clockid_t* clock_id)
 {
-    return libc_error(ENOSYS);
+    if (pid != 0 && pid != getpid()) {
+        return ESRCH;
+    }
+    *clock_id = CLOCK_PROCESS_CPUTIME_ID;
+    return 0;
 }
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Implement Linux's timerfd_create(2) family: a file which becomes readable
+// when a timer expires, and whose read() returns the number of expirations.
+//
+// All armed timerfds are kept in one set ordered by expiration time, served
+// by a single dispatcher thread sleeping until the earliest one, so an
+// application may have many timerfds without a thread (or a clock event)
+// for each.
+
+#include <sys/timerfd.h>
+#include <sys/poll.h>
+#include <time.h>
+#include <atomic>
+#include <memory>
+#include <set>
+
+#include <fs/fs.hh>
+#include <fs/unsupported.h>
+#include <osv/fcntl.h>
+#include <osv/poll.h>
+#include <osv/mutex.h>
+#include <osv/condvar.h>
+#include <drivers/clock.hh>
+#include <libc/libc.hh>
+#include "sched.hh"
+
+class timerfd_obj;
+
+struct timerfd_compare {
+    bool operator()(const timerfd_obj* a, const timerfd_obj* b) const;
+};
+
+// Protects the armed set and the expiration state of all timerfds
+static mutex timerfd_mutex;
+
+class timerfd_dispatcher {
+public:
+    timerfd_dispatcher();
+    void arm(timerfd_obj* t);
+    void disarm(timerfd_obj* t);
+private:
+    void run();
+private:
+    std::set<timerfd_obj*, timerfd_compare> _armed;
+    bool _changed = false;
+    sched::thread _thread;
+};
+
+static timerfd_dispatcher* dispatcher()
+{
+    static timerfd_dispatcher* d = new timerfd_dispatcher;
+    return d;
+}
+
+class timerfd_obj {
+public:
+    explicit timerfd_obj(clockid_t clockid) : _clockid(clockid) {}
+    ~timerfd_obj();
+    void attach(file* f) { _file = f; }
+    int read(file* f, uio* data);
+    int poll(int events);
+    void settime(int flags, const itimerspec* value, itimerspec* ovalue);
+    void gettime(itimerspec* value);
+    void expire(s64 now);
+private:
+    s64 to_clock_base(const timespec& ts, bool absolute);
+private:
+    clockid_t _clockid;
+    file* _file = nullptr;
+    // In clock::get()->time() units, which is what sched::timer uses;
+    // 0 when disarmed.
+    s64 _expiration = 0;
+    s64 _interval = 0;
+    std::atomic<u64> _expirations = { 0 };
+    condvar _readable;
+    friend struct timerfd_compare;
+    friend class timerfd_dispatcher;
+};
+
+bool timerfd_compare::operator()(const timerfd_obj* a, const timerfd_obj* b) const
+{
+    if (a->_expiration == b->_expiration) {
+        return a < b;
+    }
+    return a->_expiration < b->_expiration;
+}
+
+timerfd_dispatcher::timerfd_dispatcher()
+    : _thread([=] { run(); })
+{
+    _thread.start();
+}
+
+// call with timerfd_mutex held, after setting t's expiration
+void timerfd_dispatcher::arm(timerfd_obj* t)
+{
+    auto i = _armed.insert(t).first;
+    if (i == _armed.begin()) {
+        _changed = true;
+        _thread.wake();
+    }
+}
+
+// call with timerfd_mutex held, before changing t's expiration
+void timerfd_dispatcher::disarm(timerfd_obj* t)
+{
+    _armed.erase(t);
+}
+
+void timerfd_dispatcher::run()
+{
+    WITH_LOCK(timerfd_mutex) {
+        while (true) {
+            sched::thread::wait_until(timerfd_mutex, [&] {
+                return !_armed.empty();
+            });
+            auto t = *_armed.begin();
+            auto expiration = t->_expiration;
+            auto now = clock::get()->time();
+            if (now < expiration) {
+                sched::timer tmr(*sched::thread::current());
+                tmr.set(expiration);
+                _changed = false;
+                sched::thread::wait_until(timerfd_mutex, [&] {
+                    return tmr.expired() || _changed;
+                });
+                continue;
+            }
+            _armed.erase(_armed.begin());
+            t->expire(now);
+            if (t->_expiration) {
+                _armed.insert(t);
+            }
+        }
+    }
+}
+
+timerfd_obj::~timerfd_obj()
+{
+    WITH_LOCK(timerfd_mutex) {
+        if (_expiration) {
+            dispatcher()->disarm(this);
+        }
+    }
+}
+
+// call with timerfd_mutex held, after removing from the armed set
+void timerfd_obj::expire(s64 now)
+{
+    u64 count = 1;
+    if (_interval) {
+        auto missed = (now - _expiration) / _interval;
+        count += missed;
+        _expiration += (missed + 1) * _interval;
+    } else {
+        _expiration = 0;
+    }
+    _expirations.fetch_add(count, std::memory_order_relaxed);
+    _readable.wake_all();
+    poll_wake(_file, POLLIN | POLLRDNORM);
+}
+
+s64 timerfd_obj::to_clock_base(const timespec& ts, bool absolute)
+{
+    s64 t = ts.tv_sec * 1_s + ts.tv_nsec;
+    auto now = clock::get()->time();
+    if (!absolute) {
+        return now + t;
+    }
+    if (_clockid == CLOCK_MONOTONIC) {
+        return t + (now - clock::get()->uptime());
+    }
+    return t;
+}
+
+static timespec to_timespec(s64 ns)
+{
+    timespec ts;
+    ts.tv_sec = ns / 1_s;
+    ts.tv_nsec = ns % 1_s;
+    return ts;
+}
+
+// call with timerfd_mutex held
+void timerfd_obj::gettime(itimerspec* value)
+{
+    s64 remain = 0;
+    if (_expiration) {
+        remain = std::max(_expiration - clock::get()->time(), s64(1));
+    }
+    value->it_value = to_timespec(remain);
+    value->it_interval = to_timespec(_interval);
+}
+
+// call with timerfd_mutex held
+void timerfd_obj::settime(int flags, const itimerspec* value, itimerspec* ovalue)
+{
+    if (ovalue) {
+        gettime(ovalue);
+    }
+    if (_expiration) {
+        dispatcher()->disarm(this);
+    }
+    _expirations.store(0, std::memory_order_relaxed);
+    _interval = value->it_interval.tv_sec * 1_s + value->it_interval.tv_nsec;
+    if (value->it_value.tv_sec || value->it_value.tv_nsec) {
+        // an expiration time of 0 means disarmed, so don't land on it
+        _expiration = std::max(
+            to_clock_base(value->it_value, flags & TFD_TIMER_ABSTIME), s64(1));
+        dispatcher()->arm(this);
+    } else {
+        _expiration = 0;
+    }
+}
+
+int timerfd_obj::read(file* f, uio* data)
+{
+    if (data->uio_resid < (ssize_t)sizeof(u64)) {
+        return EINVAL;
+    }
+    u64 count;
+    WITH_LOCK(timerfd_mutex) {
+        if (!_expirations.load(std::memory_order_relaxed)) {
+            if (is_nonblock(f)) {
+                return EAGAIN;
+            }
+            while (!_expirations.load(std::memory_order_relaxed)) {
+                _readable.wait(&timerfd_mutex);
+            }
+        }
+        count = _expirations.exchange(0, std::memory_order_relaxed);
+    }
+    return uiomove(&count, sizeof(count), data);
+}
+
+// Doesn't take timerfd_mutex: poll_wake() is called with it held, and
+// pollers may call us with the file lock held.
+int timerfd_obj::poll(int events)
+{
+    if ((events & POLLIN) && _expirations.load(std::memory_order_relaxed)) {
+        return POLLIN;
+    }
+    return 0;
+}
+
+static int timerfd_init(file* f)
+{
+    static_cast<timerfd_obj*>(f->f_data)->attach(f);
+    return 0;
+}
+
+static int timerfd_read(file* f, uio* data, int flags)
+{
+    return static_cast<timerfd_obj*>(f->f_data)->read(f, data);
+}
+
+static int timerfd_poll(file* f, int events)
+{
+    return static_cast<timerfd_obj*>(f->f_data)->poll(events);
+}
+
+static int timerfd_close(file* f)
+{
+    delete static_cast<timerfd_obj*>(f->f_data);
+    f->f_data = nullptr;
+    return 0;
+}
+
+static fileops timerfd_ops = {
+    timerfd_init,
+    timerfd_read,
+    unsupported_write,
+    unsupported_truncate,
+    unsupported_ioctl,
+    timerfd_poll,
+    unsupported_stat,
+    timerfd_close,
+    unsupported_chmod,
+};
+
+int timerfd_create(int clockid, int flags)
+{
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC) {
+        return libc_error(EINVAL);
+    }
+    if (flags & ~(TFD_NONBLOCK | TFD_CLOEXEC)) {
+        return libc_error(EINVAL);
+    }
+    std::unique_ptr<timerfd_obj> tfd{new timerfd_obj(clockid)};
+    unsigned fflags = FREAD;
+    if (flags & TFD_NONBLOCK) {
+        fflags |= FNONBLOCK;
+    }
+    try {
+        fileref f{falloc_noinstall()};
+        finit(f.get(), fflags, DTYPE_UNSPEC, tfd.release(), &timerfd_ops);
+        fdesc fd(f);
+        return fd.release();
+    } catch (int error) {
+        return libc_error(error);
+    }
+}
+
+static bool valid_timespec(const timespec& ts)
+{
+    return ts.tv_sec >= 0 && ts.tv_nsec >= 0 && ts.tv_nsec < 1_s;
+}
+
+int timerfd_settime(int fd, int flags, const itimerspec* value,
+        itimerspec* ovalue)
+{
+    if (flags & ~TFD_TIMER_ABSTIME) {
+        return libc_error(EINVAL);
+    }
+    if (!value) {
+        return libc_error(EFAULT);
+    }
+    if (!valid_timespec(value->it_value) || !valid_timespec(value->it_interval)) {
+        return libc_error(EINVAL);
+    }
+    fileref f(fileref_from_fd(fd));
+    if (!f) {
+        return libc_error(EBADF);
+    }
+    if (f->f_ops != &timerfd_ops) {
+        return libc_error(EINVAL);
+    }
+    auto tfd = static_cast<timerfd_obj*>(f->f_data);
+    WITH_LOCK(timerfd_mutex) {
+        tfd->settime(flags, value, ovalue);
+    }
+    return 0;
+}
+
+int timerfd_gettime(int fd, itimerspec* value)
+{
+    fileref f(fileref_from_fd(fd));
+    if (!f) {
+        return libc_error(EBADF);
+    }
+    if (f->f_ops != &timerfd_ops) {
+        return libc_error(EINVAL);
+    }
+    auto tfd = static_cast<timerfd_obj*>(f->f_data);
+    WITH_LOCK(timerfd_mutex) {
+        tfd->gettime(value);
+    }
+    return 0;
+}
@@ -10,6 +10,7 @@
 #include "debug.hh"
 #include <boost/format.hpp>
 #include "sched.hh"
+#include "libc/aio.hh"
 
 #include <syscall.h>
 #include <stdarg.h>
@@ -34,6 +35,50 @@ long syscall(long number, ...)
         va_end(args);
         return clock_gettime(arg1, arg2);
         }
+    case __NR_io_setup: {
+        va_list args;
+        va_start(args, number);
+        auto nr_events = va_arg(args, unsigned);
+        auto ctxp = va_arg(args, osv::aio_context_t*);
+        va_end(args);
+        return osv::io_setup(nr_events, ctxp);
+        }
+    case __NR_io_destroy: {
+        va_list args;
+        va_start(args, number);
+        auto ctx = va_arg(args, osv::aio_context_t);
+        va_end(args);
+        return osv::io_destroy(ctx);
+        }
+    case __NR_io_submit: {
+        va_list args;
+        va_start(args, number);
+        auto ctx = va_arg(args, osv::aio_context_t);
+        auto nr = va_arg(args, long);
+        auto iocbpp = va_arg(args, osv::iocb**);
+        va_end(args);
+        return osv::io_submit(ctx, nr, iocbpp);
+        }
+    case __NR_io_getevents: {
+        va_list args;
+        va_start(args, number);
+        auto ctx = va_arg(args, osv::aio_context_t);
+        auto min_nr = va_arg(args, long);
+        auto nr = va_arg(args, long);
+        auto events = va_arg(args, osv::io_event*);
+        auto timeout = va_arg(args, struct timespec*);
+        va_end(args);
+        return osv::io_getevents(ctx, min_nr, nr, events, timeout);
+        }
+    case __NR_io_cancel: {
+        va_list args;
+        va_start(args, number);
+        auto ctx = va_arg(args, osv::aio_context_t);
+        auto iocb = va_arg(args, osv::iocb*);
+        auto result = va_arg(args, osv::io_event*);
+        va_end(args);
+        return osv::io_cancel(ctx, iocb, result);
+        }
     }
 
     debug("syscall(): unimplemented system call %d\n", number);
@@ -12,6 +12,8 @@
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include <cctype>
+#include <set>
+#include <string.h>
 #include "elf.hh"
 #include "tls.hh"
 #include "msr.hh"
@@ -36,7 +38,11 @@
 #include "osv/trace.hh"
 #include <osv/power.hh>
 #include <osv/rcu.hh>
+#include <osv/init-graph.hh>
+#include <osv/sampler.hh>
+#include <osv/lockstat.hh>
 #include "mempool.hh"
+#include "alloctracker.hh"
 #include <bsd/porting/networking.h>
 #include "dhcp.hh"
 
@@ -47,6 +53,8 @@ asm(".pushsection \".debug_gdb_scripts\", \"MS\",@progbits,1 \n"
     ".asciz \"scripts/loader.py\" \n"
     ".popsection \n");
 
+TRACEPOINT(trace_prelink_unused, "%s", const char*);
+
 namespace {
 
     void test_locale()
@@ -82,6 +90,8 @@ extern "C" {
     void premain();
     void vfs_init(void);
     void mount_usr(void);
+    void vfs_bootset_enable(void);
+    void vfs_bootset_print(void);
     void ramdisk_init(void);
 }
 
@@ -117,6 +127,11 @@ int main(int ac, char **av)
 static bool opt_leak = false;
 static bool opt_noshutdown = false;
 static bool opt_log_backtrace = false;
+static bool opt_bootset = false;
+static unsigned opt_sampler_hz = 0;
+static std::string opt_sampler_output = "/tmp/cpu.prof";
+static bool opt_lockstat = false;
+static size_t opt_heapprof_interval = 0;
 
 std::tuple<int, char**> parse_options(int ac, char** av)
 {
@@ -140,6 +155,12 @@ std::tuple<int, char**> parse_options(int ac, char** av)
         ("trace-backtrace", "log backtraces in the tracepoint log\n")
         ("leak", "start leak detector after boot\n")
         ("noshutdown", "continue running after main() returns\n")
+        ("bootset", "print the files opened until main() returns, for building a prewarmed image\n")
+        ("sampler", bpo::value<unsigned>(), "profile main() by sampling backtraces this many times a second on each cpu\n")
+        ("sampler-output", bpo::value<std::string>(), "write the profile here in pprof format, and a .folded copy for flamegraph.pl (default /tmp/cpu.prof)\n")
+        ("lockstat", "profile lock contention while main() runs, and print the most contended locks\n")
+        ("irqstat", "account the time spent in interrupt handlers in /dev/schedstat\n")
+        ("heapprof", bpo::value<size_t>(), "sample allocations about once every this many bytes from boot on, and print the sites owning the most memory when main() returns (see also /dev/heapprof)\n")
     ;
     bpo::variables_map vars;
     // don't allow --foo bar (require --foo=bar) so we can find the first non-option
@@ -160,6 +181,30 @@ std::tuple<int, char**> parse_options(int ac, char** av)
         opt_noshutdown = true;
     }
 
+    if (vars.count("bootset")) {
+        opt_bootset = true;
+    }
+
+    if (vars.count("sampler")) {
+        opt_sampler_hz = vars["sampler"].as<unsigned>();
+    }
+
+    if (vars.count("sampler-output")) {
+        opt_sampler_output = vars["sampler-output"].as<std::string>();
+    }
+
+    if (vars.count("lockstat")) {
+        opt_lockstat = true;
+    }
+
+    if (vars.count("irqstat")) {
+        sched::irq_accounting = true;
+    }
+
+    if (vars.count("heapprof")) {
+        opt_heapprof_interval = vars["heapprof"].as<size_t>();
+    }
+
     if (vars.count("trace-backtrace")) {
         opt_log_backtrace = true;
     }
@@ -213,30 +258,117 @@ void run_main(elf::program *prog, struct argblock *args)
 void* do_main_thread(void *_args)
 {
     auto args = static_cast<argblock*>(_args);
+    run_main(prog, args);
 
-    // Enumerate PCI devices
-    pci::pci_device_enumeration();
-
-    // Initialize all drivers
-    hw::driver_manager* drvman = hw::driver_manager::instance();
-    drvman->register_driver(virtio::virtio_blk::probe);
-    drvman->register_driver(virtio::virtio_net::probe);
-    drvman->register_driver(xenfront::xenbus::probe);
-    drvman->load_all();
-    drvman->list_drivers();
-
-
-    mount_usr();
+    return nullptr;
+}
 
-    // Start DHCP by default and wait for an IP
-    if (!osv_start_if("eth0", "0.0.0.0", "255.255.255.0") && !osv_ifup("eth0"))
-        dhcp_start(true);
-    else
-        debug("Could not initialize network interface");
+// The names in an object's DT_NEEDED entries, read from its file
+static std::vector<std::string> needed_objects(fileref f)
+{
+    using namespace elf;
+    std::vector<std::string> ret;
+    Elf64_Ehdr ehdr;
+    if (try_read(f, &ehdr, 0, sizeof(ehdr)) != 0 ||
+        memcmp(ehdr.e_ident, "\177ELF", 4) != 0 ||
+        ehdr.e_phentsize != sizeof(Elf64_Phdr)) {
+        return ret;
+    }
+    std::vector<Elf64_Phdr> phdrs(ehdr.e_phnum);
+    if (try_read(f, phdrs.data(), ehdr.e_phoff,
+                 phdrs.size() * sizeof(Elf64_Phdr)) != 0) {
+        return ret;
+    }
+    auto file_offset = [&] (uint64_t vaddr, uint64_t& offset) {
+        for (auto& phdr : phdrs) {
+            if (phdr.p_type == PT_LOAD && phdr.p_vaddr <= vaddr &&
+                vaddr < phdr.p_vaddr + phdr.p_filesz) {
+                offset = phdr.p_offset + vaddr - phdr.p_vaddr;
+                return true;
+            }
+        }
+        return false;
+    };
+    for (auto& phdr : phdrs) {
+        if (phdr.p_type != PT_DYNAMIC) {
+            continue;
+        }
+        std::vector<Elf64_Dyn> dynamic(phdr.p_filesz / sizeof(Elf64_Dyn));
+        if (try_read(f, dynamic.data(), phdr.p_offset,
+                     dynamic.size() * sizeof(Elf64_Dyn)) != 0) {
+            return ret;
+        }
+        uint64_t strtab = 0, strsz = 0, offset;
+        for (auto& d : dynamic) {
+            if (d.d_tag == DT_STRTAB) {
+                strtab = d.d_un.d_ptr;
+            } else if (d.d_tag == DT_STRSZ) {
+                strsz = d.d_un.d_val;
+            }
+        }
+        std::vector<char> strings(strsz);
+        if (!strsz || !file_offset(strtab, offset) ||
+            try_read(f, strings.data(), offset, strsz) != 0) {
+            return ret;
+        }
+        for (auto& d : dynamic) {
+            if (d.d_tag == DT_NEEDED && d.d_un.d_val < strsz) {
+                auto name = &strings[d.d_un.d_val];
+                ret.emplace_back(name, strnlen(name, strsz - d.d_un.d_val));
+            }
+        }
+    }
+    return ret;
+}
 
-    run_main(prog, args);
+// Read the application's object, and the objects it needs, ahead of
+// add_object(), so that mapping them later doesn't wait for the disk.
+// Objects the kernel provides, like libc.so.6, have no file and are skipped.
+static void prefetch_object(std::string name, std::set<std::string>& seen)
+{
+    if (!seen.insert(name).second) {
+        return;
+    }
+    fileref f;
+    if (name.find('/') == name.npos) {
+        for (auto dir : {"/", "/usr/lib/"}) {
+            if ((f = fileref_from_fname(dir + name))) {
+                break;
+            }
+        }
+    } else {
+        f = fileref_from_fname(name);
+    }
+    if (!f) {
+        return;
+    }
+    const uint64_t chunk = 1 << 20;
+    std::unique_ptr<char[]> buf(new char[chunk]);
+    auto len = size(f);
+    for (uint64_t off = 0; off < len; off += chunk) {
+        read(f, buf.get(), off, std::min(chunk, len - off));
+    }
+    for (auto& needed : needed_objects(f)) {
+        prefetch_object(needed, seen);
+    }
+}
 
-    return nullptr;
+static void write_profile(cpu_sampler& sampler)
+{
+    auto folded = opt_sampler_output + ".folded";
+    FILE* f = fopen(opt_sampler_output.c_str(), "w");
+    FILE* ff = fopen(folded.c_str(), "w");
+    if (!f || !ff) {
+        debug("cannot write the cpu profile to %s\n", opt_sampler_output.c_str());
+    }
+    if (f) {
+        sampler.write_pprof(f);
+        fclose(f);
+    }
+    if (ff) {
+        sampler.write_folded(ff);
+        fclose(ff);
+    }
 }
 
 namespace pthread_private {
@@ -251,6 +383,13 @@ void main_cont(int ac, char** av)
     smp_launch();
     sched::preempt_enable();
     console::console_init();
+    trace_device_init();
+    sched::schedstat_device_init();
+    lockstat::device_init();
+    memory::heap_profiler_device_init();
+    if (opt_heapprof_interval) {
+        memory::heap_profiler.start(opt_heapprof_interval);
+    }
     memory::enable_debug_allocator();
     enable_trace();
     if (opt_log_backtrace) {
@@ -263,6 +402,9 @@ void main_cont(int ac, char** av)
 
     vfs_init();
     ramdisk_init();
+    if (opt_bootset) {
+        vfs_bootset_enable();
+    }
 
     filesystem fs;
 
@@ -273,6 +415,43 @@ void main_cont(int ac, char** av)
     prog = new elf::program(fs);
     prog->set_search_path({"/", "/usr/lib"});
 
+    osv::init_graph boot;
+    boot.add("drivers", [] {
+        pci::pci_device_enumeration();
+        hw::driver_manager* drvman = hw::driver_manager::instance();
+        drvman->register_driver(virtio::virtio_blk::probe);
+        drvman->register_driver(virtio::virtio_net::probe);
+        drvman->register_driver(xenfront::xenbus::probe);
+        drvman->load_all();
+        drvman->list_drivers();
+    });
+    boot.add("usr", mount_usr, {"drivers"});
+    boot.add("dhcp", [] {
+        // Start DHCP by default and wait for an IP
+        if (!osv_start_if("eth0", "0.0.0.0", "255.255.255.0") && !osv_ifup("eth0"))
+            dhcp_start(true);
+        else
+            debug("Could not initialize network interface");
+    }, {"drivers"});
+    boot.add("preload", [=] {
+        // Objects relocated at build time, if the image was made with prelink=1
+        if (!prog->load_snapshot("/usr/.prelink")) {
+            trace_prelink_unused("/usr/.prelink");
+        }
+        std::set<std::string> seen;
+        prefetch_object(av[0], seen);
+    }, {"usr"});
+    boot.run();
+
+    std::unique_ptr<cpu_sampler> sampler;
+    if (opt_sampler_hz) {
+        sampler.reset(new cpu_sampler(opt_sampler_hz));
+        sampler->start();
+    }
+    if (opt_lockstat) {
+        lockstat::start();
+    }
+
     pthread_t pthread;
     // run the payload in a pthread, so pthread_self() etc. work
     argblock args{ ac, av };
@@ -280,6 +459,22 @@ void main_cont(int ac, char** av)
     void* retval;
     pthread_join(pthread, &retval);
 
+    if (sampler) {
+        sampler->stop();
+        write_profile(*sampler);
+    }
+    if (opt_lockstat) {
+        lockstat::stop();
+        debug("%s", lockstat::report().c_str());
+    }
+    if (opt_heapprof_interval) {
+        debug("%s", memory::heap_profiler.report().c_str());
+    }
+
+    if (opt_bootset) {
+        vfs_bootset_print();
+    }
+
     if (opt_noshutdown) {
         // If the --noshutdown option is given, continue running the system,
         // and whatever threads might be running, even after main returns
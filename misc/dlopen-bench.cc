@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measure how long it takes to load (map, relocate and initialize) a large
+// shared object, by default the JVM, and how long a global symbol lookup
+// takes once the object is in the program.
+//
+// Usage: /misc/dlopen-bench.so [object.so [symbol]]
+
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdint.h>
+
+static uint64_t nstime()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * uint64_t(1000000000) + tv.tv_usec * uint64_t(1000);
+}
+
+int main(int ac, char** av)
+{
+    const char* path = "/usr/lib/jvm/jre/lib/amd64/server/libjvm.so";
+    const char* sym = "JNI_CreateJavaVM";
+    if (ac > 1) {
+        path = av[1];
+        sym = ac > 2 ? av[2] : nullptr;
+    }
+
+    auto start = nstime();
+    void* handle = dlopen(path, RTLD_NOW);
+    auto end = nstime();
+    if (!handle) {
+        printf("%s\n", dlerror());
+        return 1;
+    }
+    printf("dlopen %s: %.3f ms\n", path, (end - start) / 1e6);
+
+    if (sym) {
+        const int loops = 100000;
+        start = nstime();
+        for (int i = 0; i < loops; i++) {
+            if (!dlsym(RTLD_DEFAULT, sym)) {
+                printf("%s\n", dlerror());
+                return 1;
+            }
+        }
+        end = nstime();
+        printf("dlsym %s: %.1f ns\n", sym, double(end - start) / loops);
+    }
+    return 0;
+}
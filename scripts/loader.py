@@ -377,6 +377,19 @@ class osv_info_threads(gdb.Command):
                            t['_vruntime'],
                            )
                           )
+                stats = t['_stats']
+                gdb.write('%s runtime %.3fms wait %.3fms (max %.3fms, %d waits) '
+                          'switches %d voluntary %d involuntary, %d migrations\n' %
+                          (' ' * 6,
+                           long(t['_total_cpu_time']) / 1e6,
+                           long(stats['wait_time']) / 1e6,
+                           long(stats['max_wait']) / 1e6,
+                           stats['waits'],
+                           stats['voluntary_switches'],
+                           stats['involuntary_switches'],
+                           stats['migrations'],
+                           )
+                          )
                 show_thread_timers(t)
 
 class osv_info_callouts(gdb.Command):
@@ -480,18 +493,30 @@ def align_down(v, pagesize):
 def align_up(v, pagesize):
     return align_down(v + pagesize - 1, pagesize)
 
+def read_trace_buffers():
+    '''Yield (cpu, bytes) for each cpu's trace ring, oldest record first'''
+    inf = gdb.selected_inferior()
+    trace_page_size = ulong(gdb.parse_and_eval('trace_page_size'))
+    trace_for_cpu = gdb.lookup_global_symbol('trace_for_cpu').value()
+    max_cpus = trace_for_cpu.type.sizeof // trace_for_cpu[0].type.sizeof
+    for cpu in range(max_cpus):
+        tb = trace_for_cpu[cpu]
+        log = ulong(tb['log'])
+        if log == 0:
+            continue
+        size = ulong(tb['size'])
+        last = ulong(tb['last']['_M_i'])
+        trace_log = inf.read_memory(log, size)
+        if last <= size:
+            yield cpu, trace_log[:last]
+            continue
+        last %= size
+        pivot = align_up(last, trace_page_size)
+        yield cpu, trace_log[pivot:] + trace_log[:last]
+
 def dump_trace(out_func):
     from collections import defaultdict       
-    inf = gdb.selected_inferior()
-    trace_log = gdb.lookup_global_symbol('trace_log').value()
-    max_trace = ulong(gdb.parse_and_eval('max_trace'))
-    trace_log = inf.read_memory(trace_log.address, max_trace)
     trace_page_size = ulong(gdb.parse_and_eval('trace_page_size'))
-    last = ulong(gdb.lookup_global_symbol('trace_record_last').value()['_M_i'])
-    last %= max_trace
-    pivot = align_up(last, trace_page_size)
-    trace_log = trace_log[pivot:] + trace_log[:pivot]
-    last += max_trace - pivot
     indents = defaultdict(int)
     backtrace_len = 10
     bt_format = '   [' + str.join(' ', ['0x%x'] * backtrace_len) + ']'
@@ -501,9 +526,33 @@ def dump_trace(out_func):
     tp_fn_entry = lookup_tp('gdb_trace_function_entry')
     tp_fn_exit = lookup_tp('gdb_trace_function_exit')
 
-    i = 0
-    while i < last:
-        tp_key, thread, time, cpu, flags = struct.unpack('QQQII', trace_log[i:i+32])
+    records = []
+    for _, trace_log in read_trace_buffers():
+        last = len(trace_log)
+        i = 0
+        while i < last:
+            tp_key, thread, time, cpu, flags = struct.unpack('QQQII', trace_log[i:i+32])
+            if tp_key == 0:
+                i = align_up(i + 8, trace_page_size)
+                continue
+            tp = gdb.Value(tp_key).cast(gdb.lookup_type('tracepoint_base').pointer())
+            sig = sig_to_string(ulong(tp['sig'])) # FIXME: cache
+            i += 32
+            backtrace = None
+            if flags & 1:
+                # backtrace
+                backtrace = struct.unpack('Q' * backtrace_len, trace_log[i:i+8*backtrace_len])
+                i += 8 * backtrace_len
+            size = struct.calcsize(sig)
+            buffer = trace_log[i:i+size]
+            i += size
+            i = align_up(i, 8)
+            data = struct.unpack(sig, buffer)
+            records.append((time, thread, cpu, tp, backtrace, data))
+    # each cpu's ring is in time order; merge them
+    records.sort(key=lambda r: r[0])
+
+    for time, thread, cpu, tp, backtrace, data in records:
         def trace_function(indent, annotation, data):
             fn, caller = data
             try:
@@ -520,22 +569,6 @@ def dump_trace(out_func):
                          annotation,
                          fn_name,
                          ))
-        if tp_key == 0:
-            i = align_up(i + 8, trace_page_size)
-            continue
-        tp = gdb.Value(tp_key).cast(gdb.lookup_type('tracepoint_base').pointer())
-        sig = sig_to_string(ulong(tp['sig'])) # FIXME: cache
-        i += 32
-        backtrace = None
-        if flags & 1:
-            # backtrace
-            backtrace = struct.unpack('Q' * backtrace_len, trace_log[i:i+8*backtrace_len])
-            i += 8 * backtrace_len
-        size = struct.calcsize(sig)
-        buffer = trace_log[i:i+size]
-        i += size
-        i = align_up(i, 8)
-        data = struct.unpack(sig, buffer)
         if tp == tp_fn_entry.address:
             indent = '  ' * indents[thread]
             indents[thread] += 1
@@ -0,0 +1,522 @@
+#!/usr/bin/python
+
+# Load and relocate shared objects offline, the way program::add_object()
+# does at boot, and write the relocated writable segments out as a
+# snapshot.  The kernel maps an object's segments from the snapshot instead
+# of relocating it when its validation hash still matches: the hash covers
+# the object, its base address, and every module symbols could be looked up
+# in, so a different kernel or library, or a different load order, falls
+# back to relocating from the file.  See object::relocate() in core/elf.cc.
+#
+# The objects are loaded in the order of the -r options, which should be
+# the order the application loads them in, starting with the command line.
+
+import os, sys, struct, optparse, StringIO, ConfigParser
+
+make_option = optparse.make_option
+
+defines = {}
+def add_var(option, opt, value, parser):
+    var, val = value.split('=')
+    defines[var] = val
+
+opt = optparse.OptionParser(option_list = [
+        make_option('-o',
+                    dest = 'output',
+                    help = 'write to FILE',
+                    metavar = 'FILE'),
+        make_option('-d',
+                    dest = 'depends',
+                    help = 'write dependencies to FILE',
+                    metavar = 'FILE',
+                    default = None),
+        make_option('-m',
+                    dest = 'manifests',
+                    help = 'read manifest from FILE (may be repeated)',
+                    metavar = 'FILE',
+                    action = 'append',
+                    default = []),
+        make_option('-k',
+                    dest = 'kernel',
+                    help = 'the kernel, loader.elf',
+                    metavar = 'FILE',
+                    default = 'loader.elf'),
+        make_option('-r',
+                    dest = 'roots',
+                    help = 'load OBJECT, as add_object() would (may be repeated)',
+                    metavar = 'OBJECT',
+                    action = 'append',
+                    default = []),
+        make_option('-D',
+                    type = 'string',
+                    help = 'define VAR=DATA',
+                    metavar = 'VAR=DATA',
+                    action = 'callback',
+                    callback = add_var),
+])
+
+(options, args) = opt.parse_args()
+
+# Must match program::program() and program::set_search_path() as called
+# from loader.cc
+program_base = 0x100000000000
+kernel_base = 0x200000
+kernel_names = ['libc.so.6', 'libm.so.6', 'ld-linux-x86-64.so.2',
+                'libpthread.so.0', 'libdl.so.2', 'librt.so.1',
+                'libstdc++.so.6', 'libgcc_s.so.1']
+search_path = ['/', '/usr/lib']
+
+page_size = 4096
+mask64 = (1 << 64) - 1
+
+PT_LOAD, PT_DYNAMIC, PT_NOTE = 1, 2, 4
+NT_GNU_BUILD_ID = 3
+PF_W = 2
+DT_NULL, DT_NEEDED, DT_PLTRELSZ, DT_PLTGOT, DT_HASH, DT_STRTAB, DT_SYMTAB, \
+    DT_RELA, DT_RELASZ, DT_RELAENT, DT_STRSZ = range(11)
+DT_SONAME, DT_RPATH, DT_JMPREL = 14, 15, 23
+DT_GNU_HASH = 0x6ffffef5
+SHN_UNDEF, SHN_ABS = 0, 0xfff1
+STT_NOTYPE, STT_OBJECT, STT_FUNC, STT_IFUNC = 0, 1, 2, 10
+STB_WEAK = 2
+R_X86_64_NONE, R_X86_64_64 = 0, 1
+R_X86_64_GLOB_DAT, R_X86_64_JUMP_SLOT, R_X86_64_RELATIVE = 6, 7, 8
+R_X86_64_DPTMOD64, R_X86_64_DTPOFF64, R_X86_64_TPOFF64 = 16, 17, 18
+
+def align_down(v, a):
+    return v & ~(a - 1)
+
+def align_up(v, a):
+    return align_down(v + a - 1, a)
+
+def fnv1a(h, data):
+    for c in data:
+        h = ((h ^ ord(c)) * 0x100000001b3) & mask64
+    return h
+
+fnv_basis = 0xcbf29ce484222325
+
+def dl_new_hash(name):
+    h = 5381
+    for c in name:
+        h = (h * 33 + ord(c)) & 0xffffffff
+    return h
+
+def elf64_hash(name):
+    h = 0
+    for c in name:
+        h = (h << 4) + ord(c)
+        g = h & 0xf0000000
+        if g:
+            h ^= g >> 24
+        h &= 0x0fffffff
+    return h
+
+class unsupported(Exception):
+    pass
+
+class phdr(object):
+    def __init__(self, data):
+        (self.type, self.flags, self.offset, self.vaddr, self.paddr,
+         self.filesz, self.memsz, self.align) = struct.unpack('<IIQQQQQQ', data)
+
+class elf(object):
+    def __init__(self, name, hostname):
+        self.name = name
+        self.hostname = hostname
+        self.data = file(hostname).read()
+        (phoff,) = struct.unpack_from('<Q', self.data, 32)
+        (phentsize, phnum) = struct.unpack_from('<HH', self.data, 54)
+        self.phdr_bytes = ''.join(self.data[phoff + i * phentsize:][:56]
+                                  for i in range(phnum))
+        self.phdrs = [phdr(self.phdr_bytes[i * 56:][:56]) for i in range(phnum)]
+        self.dynamic = []
+        for p in self.phdrs:
+            if p.type == PT_DYNAMIC:
+                off = p.offset
+                while True:
+                    tag, val = struct.unpack_from('<qQ', self.data, off)
+                    if tag == DT_NULL:
+                        break
+                    self.dynamic.append((tag, val))
+                    off += 16
+        self.segments = []
+        self.identity_cache = None
+        # the kernel is a memory_image, not a file
+        self.memory_image = False
+    def dyn(self, tag):
+        for t, v in self.dynamic:
+            if t == tag:
+                return v
+        return None
+    def dyn_all(self, tag):
+        return [v for t, v in self.dynamic if t == tag]
+    def offset(self, vaddr):
+        for p in self.phdrs:
+            if p.type == PT_LOAD and p.vaddr <= vaddr < p.vaddr + p.filesz:
+                return p.offset + vaddr - p.vaddr
+        raise unsupported('%s: address %x not in the file' % (self.name, vaddr))
+    def loaded(self, note):
+        return any(p.type == PT_LOAD and p.vaddr <= note.vaddr and
+                   note.vaddr + note.filesz <= p.vaddr + p.filesz
+                   for p in self.phdrs)
+    def words(self, fmt, vaddr, n):
+        return struct.unpack_from('<%d%s' % (n, fmt), self.data, self.offset(vaddr))
+    def string(self, off):
+        start = self.offset(self.dyn(DT_STRTAB) + off)
+        return self.data[start:self.data.index('\0', start)]
+    def sym(self, idx):
+        # (st_name, st_info, st_other, st_shndx, st_value, st_size)
+        return struct.unpack_from('<IBBHQQ', self.data,
+                                  self.offset(self.dyn(DT_SYMTAB) + idx * 24))
+    def soname(self):
+        v = self.dyn(DT_SONAME)
+        return self.string(v) if v is not None else ''
+    def set_base(self, base):
+        # object::set_base(), including its choice of min_element()
+        p = self.phdrs[0]
+        for x in self.phdrs[1:]:
+            if x.type == PT_LOAD and x.vaddr < p.vaddr:
+                p = x
+        off = p.vaddr & (p.align - 1)
+        self.base = align_up(base - off, p.align) + off - p.vaddr
+        q = self.phdrs[0]
+        for x in self.phdrs[1:]:
+            if x.type == PT_LOAD and x.vaddr > q.vaddr:
+                q = x
+        self.end = self.base + q.vaddr + q.memsz
+    def lookup_gnu(self, name, h):
+        tab = self.dyn(DT_GNU_HASH)
+        nbucket, symndx, maskwords, shift2 = self.words('I', tab, 4)
+        bword = self.words('Q', tab + 16 + (h // 64) % maskwords * 8, 1)[0]
+        if (bword >> (h % 64)) == 0 or (bword >> ((h >> shift2) % 64)) == 0:
+            return None
+        buckets = tab + 16 + maskwords * 8
+        chains = buckets + nbucket * 4
+        idx = self.words('I', buckets + h % nbucket * 4, 1)[0]
+        if idx == 0:
+            return None
+        while True:
+            c = self.words('I', chains + (idx - symndx) * 4, 1)[0]
+            if (c & ~1) == (h & ~1) and self.string(self.sym(idx)[0]) == name:
+                return idx
+            if c & 1:
+                return None
+            idx += 1
+    def lookup_old(self, name):
+        tab = self.dyn(DT_HASH)
+        nbucket = self.words('I', tab, 1)[0]
+        ent = self.words('I', tab + 8 + elf64_hash(name) % nbucket * 4, 1)[0]
+        while ent != 0:
+            if self.string(self.sym(ent)[0]) == name:
+                return ent
+            ent = self.words('I', tab + 8 + (nbucket + ent) * 4, 1)[0]
+        return None
+    def lookup_symbol(self, name, h):
+        if self.dyn(DT_GNU_HASH) is not None:
+            idx = self.lookup_gnu(name, h)
+        else:
+            idx = self.lookup_old(name)
+        if idx is not None and self.sym(idx)[3] == SHN_UNDEF:
+            idx = None
+        return idx
+    def nsyms(self):
+        if self.dyn(DT_HASH) is not None:
+            return self.words('I', self.dyn(DT_HASH) + 4, 1)[0]
+        tab = self.dyn(DT_GNU_HASH)
+        nbucket, symndx, maskwords = self.words('I', tab, 3)
+        buckets = tab + 16 + maskwords * 8
+        chains = buckets + nbucket * 4
+        n = symndx
+        for idx in self.words('I', buckets, nbucket):
+            if idx == 0:
+                continue
+            while True:
+                n += 1
+                c = self.words('I', chains + (idx - symndx) * 4, 1)[0]
+                idx += 1
+                if c & 1:
+                    break
+        return n
+    def identity(self):
+        # object::identity()
+        if self.identity_cache is None:
+            symtab = self.offset(self.dyn(DT_SYMTAB))
+            strtab = self.offset(self.dyn(DT_STRTAB))
+            h = fnv1a(fnv_basis, self.phdr_bytes)
+            h = fnv1a(h, self.data[symtab:symtab + self.nsyms() * 24])
+            h = fnv1a(h, self.data[strtab:strtab + self.dyn(DT_STRSZ)])
+            if not self.memory_image:
+                # file::hash_contents(): the build-id and the file size
+                for p in self.phdrs:
+                    if p.type != PT_NOTE or not self.loaded(p):
+                        continue
+                    off = 0
+                    while off + 12 <= p.filesz:
+                        namesz, descsz, ntype = struct.unpack_from(
+                            '<III', self.data, p.offset + off)
+                        name = off + 12
+                        desc = name + align_up(namesz, 4)
+                        end = desc + align_up(descsz, 4)
+                        if end > p.filesz:
+                            break
+                        start = p.offset + name
+                        if (ntype == NT_GNU_BUILD_ID and namesz == 4 and
+                            self.data[start:start + 4] == 'GNU\0'):
+                            start = p.offset + desc
+                            h = fnv1a(h, self.data[start:start + descsz])
+                        off = end
+                h = fnv1a(h, struct.pack('<Q', len(self.data)))
+            self.identity_cache = h
+        return self.identity_cache
+    def load_segments(self):
+        # The file-backed pages of each writable segment, as
+        # file::load_segment() maps them
+        for p in self.phdrs:
+            if p.type != PT_LOAD or not (p.flags & PF_W):
+                continue
+            vstart = align_down(p.vaddr, page_size)
+            filesz_unaligned = p.vaddr + p.filesz - vstart
+            filesz = align_up(filesz_unaligned, page_size)
+            off = align_down(p.offset, page_size)
+            data = bytearray(self.data[off:off + filesz_unaligned])
+            data += '\0' * (filesz - len(data))
+            self.segments.append((vstart, data))
+    def write(self, vaddr, value):
+        for vstart, data in self.segments:
+            if vstart <= vaddr and vaddr + 8 <= vstart + len(data):
+                struct.pack_into('<Q', data, vaddr - vstart, value & mask64)
+                return True
+        return False
+    def read(self, vaddr):
+        for vstart, data in self.segments:
+            if vstart <= vaddr and vaddr + 8 <= vstart + len(data):
+                return struct.unpack_from('<Q', data, vaddr - vstart)[0]
+        raise unsupported('%s: address %x not writable' % (self.name, vaddr))
+
+class program(object):
+    def __init__(self, files, kernel):
+        self.files = files
+        self.next_alloc = program_base
+        self.modules = [kernel]
+        self.loaded = dict((name, kernel) for name in kernel_names)
+        self.snapshots = []
+    def lookup(self, name):
+        h = dl_new_hash(name)
+        for m in self.modules:
+            idx = m.lookup_symbol(name, h)
+            if idx is not None:
+                return m, idx
+        return None, None
+    def add_object(self, name, extra_path = []):
+        if '/' not in name:
+            for m in self.modules:
+                if m.soname() == name:
+                    return m
+            for d in extra_path + search_path:
+                dname = canonicalize(d + '/' + name)
+                if dname in self.files:
+                    name = dname
+                    break
+        else:
+            name = canonicalize(name)
+        if name not in self.loaded and name in self.files:
+            obj = elf(name, self.files[name])
+            obj.set_base(self.next_alloc)
+            self.loaded[name] = obj
+            self.modules.insert(len(self.modules) - 1, obj)
+            obj.load_segments()
+            self.next_alloc = obj.end
+            rpath = []
+            if obj.dyn(DT_RPATH) is not None:
+                rpath = obj.string(obj.dyn(DT_RPATH)).replace(
+                    '$ORIGIN', dirname(name)).split(':')
+            for lib in obj.dyn_all(DT_NEEDED):
+                if not self.add_object(obj.string(lib), rpath):
+                    print >> sys.stderr, 'could not load %s' % obj.string(lib)
+            try:
+                self.snapshots.append(self.relocate(obj))
+            except unsupported, e:
+                print >> sys.stderr, 'not prelinking %s' % e
+            return obj
+        return self.loaded.get(name)
+    def relocate(self, obj):
+        h = fnv1a(fnv_basis, struct.pack('<QQ', obj.identity(), obj.base))
+        for m in self.modules:
+            h = fnv1a(h, struct.pack('<QQ', m.identity(), m.base))
+        resolved = {}
+        def symbol(idx):
+            # object::symbol(), and symbol_module::relocated_addr() as far
+            # as it can be done offline
+            if idx in resolved:
+                return resolved[idx]
+            sym = obj.sym(idx)
+            m, midx = self.lookup(obj.string(sym[0]))
+            if m is None:
+                if sym[1] >> 4 != STB_WEAK:
+                    raise unsupported('%s: symbol %s not found'
+                                      % (obj.name, obj.string(sym[0])))
+                m, midx = obj, idx
+            msym = m.sym(midx)
+            base = m.base
+            if msym[3] in (SHN_UNDEF, SHN_ABS):
+                base = 0
+            t = msym[1] & 15
+            if t == STT_NOTYPE:
+                addr = msym[4]
+            elif t in (STT_OBJECT, STT_FUNC):
+                addr = base + msym[4]
+            else:
+                addr = None
+            resolved[idx] = (addr, msym[4])
+            return resolved[idx]
+        deferred = []
+        if obj.dyn(DT_RELA) is not None:
+            if obj.dyn(DT_RELAENT) != 24:
+                raise unsupported('%s: bad DT_RELAENT' % obj.name)
+            rela = obj.dyn(DT_RELA)
+            for i in range(obj.dyn(DT_RELASZ) // 24):
+                offset, info, addend = struct.unpack_from(
+                    '<QQq', obj.data, obj.offset(rela + i * 24))
+                sym, type = info >> 32, info & 0xffffffff
+                if type == R_X86_64_NONE:
+                    continue
+                elif type == R_X86_64_RELATIVE:
+                    value = obj.base + addend
+                elif type == R_X86_64_DPTMOD64:
+                    value = 0
+                elif type in (R_X86_64_64, R_X86_64_GLOB_DAT,
+                              R_X86_64_JUMP_SLOT):
+                    value = symbol(sym)[0]
+                    if value is not None and type == R_X86_64_64:
+                        value += addend
+                elif type == R_X86_64_DTPOFF64 or type == R_X86_64_TPOFF64:
+                    value = symbol(sym)[1]
+                else:
+                    raise unsupported('%s: relocation type %d'
+                                      % (obj.name, type))
+                # ifuncs are called, and relocations outside the snapshot
+                # applied, by the kernel
+                if value is None or not obj.write(offset, value):
+                    deferred.append(i)
+        if obj.dyn(DT_JMPREL) is not None:
+            # object::relocate_pltgot(); the kernel fills in pltgot[1]
+            # and pltgot[2]
+            pltgot = obj.dyn(DT_PLTGOT)
+            original_plt = obj.read(pltgot + 8)
+            if original_plt:
+                original_plt += obj.base
+            jmprel = obj.dyn(DT_JMPREL)
+            for i in range(obj.dyn(DT_PLTRELSZ) // 24):
+                offset, = struct.unpack_from('<Q', obj.data,
+                                             obj.offset(jmprel + i * 24))
+                if original_plt:
+                    value = original_plt + i * 16
+                else:
+                    value = obj.read(offset) + obj.base
+                obj.write(offset, value)
+            obj.write(pltgot + 8, 0)
+            obj.write(pltgot + 16, 0)
+        return obj, h, deferred
+
+# These two behave like their namesakes in core/elf.cc, not like os.path's
+def dirname(path):
+    pos = path.rfind('/')
+    if pos < 0:
+        return '/'
+    return path[:pos]
+
+def canonicalize(path):
+    path = os.path.normpath(path)
+    if path.startswith('//'):
+        path = path[1:]
+    return path
+
+def expand(items):
+    for name, hostname in items:
+        if name.endswith('/**') and hostname.endswith('/**'):
+            name = name[:-2]
+            hostname = hostname[:-2]
+            for dirpath, dirnames, filenames in os.walk(hostname):
+                for filename in filenames:
+                    relpath = dirpath[len(hostname):]
+                    if relpath != "" :
+                        relpath += "/"
+                    yield (name + relpath + filename,
+                           hostname + relpath + filename)
+        elif '/&/' in name and hostname.endswith('/&'):
+            prefix, suffix = name.split('/&/', 1)
+            yield (prefix + '/' + suffix, hostname[:-1] + suffix)
+        else:
+            yield (name, hostname)
+
+def unsymlink(f):
+    try:
+        link = os.readlink(f)
+        if link.startswith('/'):
+            # try to find a match
+            base = os.path.dirname(f)
+            while not os.path.exists(base + link):
+                base = os.path.dirname(base)
+        else:
+            base = os.path.dirname(f) + '/'
+        return unsymlink(base + link)
+    except Exception:
+        return f
+
+files = {}
+for m in options.manifests:
+    manifest = ConfigParser.SafeConfigParser()
+    manifest.optionxform = str # avoid lowercasing
+    manifest.read(m)
+    items = [(f, manifest.get('manifest', f, vars = defines))
+             for f in manifest.options('manifest')]
+    for name, hostname in expand(items):
+        files[canonicalize(name)] = unsymlink(hostname)
+
+kernel = elf('', options.kernel)
+kernel.memory_image = True
+kernel.set_base(kernel_base)
+prog = program(files, kernel)
+for root in options.roots:
+    if not prog.add_object(root):
+        print >> sys.stderr, 'could not load %s' % root
+
+# Layout: a header (magic, object count, size of the metadata), then for
+# each object its path, base, validation hash, segment and deferred
+# relocation counts, its segments (address relative to the base, size,
+# offset in this file) and the indices of its deferred DT_RELA entries.
+# The page-aligned segment contents follow the metadata.
+meta = StringIO.StringIO()
+data = StringIO.StringIO()
+records = []
+for obj, h, deferred in prog.snapshots:
+    meta.write(struct.pack('<232sQQII', obj.name, obj.base, h,
+                           len(obj.segments), len(deferred)))
+    for vstart, seg in obj.segments:
+        records.append((meta.tell() + 16, seg))
+        meta.write(struct.pack('<QQQ', vstart, len(seg), 0))
+    meta.write(struct.pack('<%dI' % len(deferred), *deferred))
+    meta.write('\0' * (-meta.tell() % 8))
+meta = bytearray(meta.getvalue())
+pos = align_up(24 + len(meta), page_size)
+for off, seg in records:
+    struct.pack_into('<Q', meta, off, pos)
+    data.write(str(seg))
+    pos += len(seg)
+
+out = file(options.output, 'w')
+out.write(struct.pack('<8sQQ', 'OSVPRLK1', len(prog.snapshots), len(meta)))
+out.write(meta)
+out.write('\0' * (-out.tell() % page_size))
+out.write(data.getvalue())
+out.close()
+
+if options.depends:
+    depends = file(options.depends, 'w')
+    depends.write('%s: \\\n' % (options.output,))
+    depends.write('\t%s \\\n' % (options.kernel,))
+    for obj, h, deferred in prog.snapshots:
+        depends.write('\t%s \\\n' % (obj.hostname,))
+    depends.write('\n\n')
+    depends.close()
@@ -34,6 +34,27 @@ opt = optparse.OptionParser(option_list = [
                     help = 'offset to write the data to',
                     metavar = 'OFFSET',
                     default = 0),
+        make_option('-b',
+                    dest = 'bootset',
+                    help = 'lay out and prefetch the files listed in FILE '
+                           '(the output of running with --bootset) first',
+                    metavar = 'FILE',
+                    default = None),
+        make_option('-p',
+                    dest = 'prelink',
+                    help = 'install FILE, made by mkprelink.py, as /usr/.prelink',
+                    metavar = 'FILE',
+                    default = None),
+        make_option('-l',
+                    dest = 'slog',
+                    help = 'also create a separate intent log device in FILE',
+                    metavar = 'FILE',
+                    default = None),
+        make_option('-c',
+                    dest = 'compression',
+                    help = 'compress the usr filesystem with ALGORITHM',
+                    metavar = 'ALGORITHM',
+                    default = None),
 
 ])
 
@@ -55,6 +76,8 @@ loop_dev='/dev/loop7'
 dev='/dev/vblk0.1'
 zfs_pool='osv'
 zfs_fs='usr'
+slog_loop_dev='/dev/loop6'
+slog_dev='/dev/vblk1'
 
 if os.path.exists(zfs_root) and os.listdir(zfs_root): 
     print 'Please make sure %s does not exist or is an empty directory' % zfs_root
@@ -68,8 +91,25 @@ os.system('sudo losetup -o %s %s %s' % (options.offset, loop_dev, options.output
 
 os.system('sudo ln %s %s' % (loop_dev, dev))
 
-os.system('sudo zpool create -f %s -R %s %s' % (zfs_pool, zfs_root, dev))
-os.system('sudo zfs create %s/%s' % (zfs_pool, zfs_fs))
+# The slog is the whole of the second disk, which OSv calls vblk1.
+vdevs = dev
+if options.slog:
+    os.system('sudo rm -f %s' % options.slog)
+    os.system('sudo truncate --size 1g %s' % options.slog)
+    os.system('sudo losetup %s %s' % (slog_loop_dev, options.slog))
+    os.system('sudo ln %s %s' % (slog_loop_dev, slog_dev))
+    vdevs += ' log %s' % slog_dev
+
+# Only enable the pool features OSv supports, so the pool can be imported
+# read-write whatever the host's zpool version.
+zfs_features = ['async_destroy', 'empty_bpobj', 'lz4_compress']
+os.system('sudo zpool create -f -d %s %s -R %s %s' % (
+    ' '.join('-o feature@%s=enabled' % f for f in zfs_features),
+    zfs_pool, zfs_root, vdevs))
+fs_opts = ''
+if options.compression:
+    fs_opts = '-o compression=%s' % options.compression
+os.system('sudo zfs create %s %s/%s' % (fs_opts, zfs_pool, zfs_fs))
 
 files = dict([(f, manifest.get('manifest', f, vars = defines))
               for f in manifest.options('manifest')])
@@ -109,19 +149,67 @@ def unsymlink(f):
 files = list(expand(files.items()))
 files = [(x, unsymlink(y)) for (x, y) in files]
 
+# The boot set is the files the application opened while booting, in the
+# order it first opened them, printed as "bootset: <path>" lines.  Copying
+# those files first, in that order, gives them neighbouring object numbers
+# and disk blocks, and .bootset tells the kernel which objects to prefetch
+# at mount; see zfs_prewarm().
+bootset = []
+if options.bootset:
+    names = set(name for name, hostname in files)
+    for line in file(options.bootset):
+        if line.startswith('bootset: '):
+            name = line[len('bootset: '):].strip()
+            if name in names and name not in bootset:
+                bootset.append(name)
+    rank = dict((name, i) for i, name in enumerate(bootset))
+    files.sort(key = lambda (name, hostname): rank.get(name, len(rank)))
+
 for name, hostname in files:
     depends.write('\t%s \\\n' % (hostname,))
     if name[:4] in [ '/usr' ]:
         os.system('sudo mkdir -p %s/`dirname %s`' % ('/zfs/', name))
         os.system('sudo cp -L %s %s/%s' % (hostname, '/zfs/', name))
 
+if bootset:
+    listed = set()
+    entries = []
+    for name in bootset:
+        if name[:5] != '/usr/':
+            continue
+        # the directories on the way are looked up too
+        path = '/usr'
+        for part in name[5:].split('/')[:-1]:
+            path += '/' + part
+            if path not in listed:
+                listed.add(path)
+                entries.append((path, 'd'))
+        entries.append((name, 'f'))
+    out = StringIO.StringIO()
+    for name, kind in entries:
+        # the inode number of a ZFS file is its object number
+        out.write('%d %s %s\n' % (os.stat('/zfs/' + name).st_ino, kind, name))
+    tmp = options.output + '.bootset'
+    file(tmp, 'w').write(out.getvalue())
+    os.system('sudo cp %s /zfs/usr/.bootset' % tmp)
+    os.remove(tmp)
+
+if options.prelink:
+    depends.write('\t%s \\\n' % (options.prelink,))
+    os.system('sudo cp %s /zfs/usr/.prelink' % options.prelink)
+
 os.system('sudo zpool export %s' % zfs_pool)
 os.system('sleep 2')
 os.system('sudo losetup -d %s' % loop_dev)
 os.system('sudo rm %s' % dev)
+if options.slog:
+    os.system('sudo losetup -d %s' % slog_loop_dev)
+    os.system('sudo rm %s' % slog_dev)
 
 os.system('sudo chmod g+w %s' % options.output)
 os.system('sudo chmod o+w %s' % options.output)
+if options.slog:
+    os.system('sudo chmod g+w,o+w %s' % options.slog)
 
 depends.write('\n\n')
 depends.close()
@@ -40,6 +40,9 @@ def start_osv_qemu():
         "-mon", "chardev=stdio,mode=readline,default",
         "-device", "isa-serial,chardev=stdio",
         "-drive", ("file=build/%s/usr.img,if=virtio,cache=unsafe" % opt_path)]
+
+    if (cmdargs.slog):
+        args += ["-drive", ("file=build/%s/slog.img,if=virtio,cache=none" % opt_path)]
     
     if (cmdargs.no_shutdown):
         args += ["-no-reboot", "-no-shutdown"]
@@ -176,6 +179,8 @@ if (__name__ == "__main__"):
                         help="run in background, do not connect the console (Xen only)")
     parser.add_argument("-H", "--no-shutdown", action="store_true",
                         help="don't restart qemu automatially (allow debugger to connect on early errors)")
+    parser.add_argument("-L", "--slog", action="store_true",
+                        help="attach the ZFS intent log device (build with 'make slog=1')")
     cmdargs = parser.parse_args()
     opt_path = "debug" if cmdargs.debug else "release"
     
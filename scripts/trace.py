@@ -0,0 +1,135 @@
+#!/usr/bin/python
+
+# Decode a binary trace, as read from /dev/trace (see trace_export() in
+# core/trace.cc), and print it in the format of gdb's 'osv trace'.
+#
+# usage: trace.py [--cpu N] [--tracepoint NAME] trace-file
+
+import sys
+import struct
+import argparse
+from collections import defaultdict
+
+def align_up(v, pagesize):
+    return (v + pagesize - 1) & ~(pagesize - 1)
+
+def sig_to_string(sig):
+    '''Convert a tracepoint signature encoded in a u64 to a struct format'''
+    ret = ''
+    while sig != 0:
+        ret += chr(sig & 255)
+        sig >>= 8
+    return ret.replace('p', '50p')
+
+class tracepoint(object):
+    def __init__(self, key, sig, name, format):
+        self.key = key
+        self.sig = sig_to_string(sig)
+        self.size = struct.calcsize(self.sig)
+        self.name = name
+        self.format = format.replace('%p', '0x%016x')
+
+class record(object):
+    def __init__(self, tp, thread, time, cpu, backtrace, data):
+        self.tp = tp
+        self.thread = thread
+        self.time = time
+        self.cpu = cpu
+        self.backtrace = backtrace
+        self.data = data
+
+class reader(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+    def u64(self):
+        v, = struct.unpack_from('<Q', self.data, self.pos)
+        self.pos += 8
+        return v
+    def bytes(self, n):
+        v = self.data[self.pos:self.pos + n]
+        self.pos = align_up(self.pos + n, 8)
+        return v
+
+def decode(data):
+    '''Return the tracepoints and the records, merged in time order'''
+    r = reader(data)
+    if r.bytes(8) != 'OSVTRACE':
+        raise Exception('not an OSv trace')
+    version = r.u64()
+    if version != 1:
+        raise Exception('unsupported trace version %d' % version)
+    backtrace_len = r.u64()
+    page_size = r.u64()
+    tracepoints = {}
+    for i in range(r.u64()):
+        key, sig, name_len, format_len = [r.u64() for j in range(4)]
+        name = r.bytes(name_len)
+        format = r.bytes(format_len)
+        tracepoints[key] = tracepoint(key, sig, name, format)
+    records = []
+    for i in range(r.u64()):
+        cpu = r.u64()
+        log = r.bytes(r.u64())
+        pos = 0
+        while pos + 32 <= len(log):
+            key, thread, time, rcpu, flags = struct.unpack_from('<QQQII', log, pos)
+            if key == 0:
+                # padding up to the end of the page
+                pos = align_up(pos + 8, page_size)
+                continue
+            tp = tracepoints.get(key)
+            if not tp:
+                # a record still being written when the trace was taken
+                break
+            pos += 32
+            backtrace = None
+            if flags & 1:
+                backtrace = struct.unpack_from('<' + 'Q' * backtrace_len, log, pos)
+                pos += 8 * backtrace_len
+            if pos + tp.size > len(log):
+                break
+            args = struct.unpack_from(tp.sig, log, pos)
+            pos = align_up(pos + tp.size, 8)
+            records.append(record(tp, thread, time, rcpu, backtrace, args))
+    records.sort(key=lambda rec: rec.time)
+    return tracepoints, records
+
+def format_record(rec, indents):
+    prefix = '0x%016x %2d %12d.%06d' % (rec.thread, rec.cpu,
+                                        rec.time / 1000000000,
+                                        (rec.time % 1000000000) / 1000)
+    if rec.tp.name in ('function entry', 'function exit'):
+        fn, caller = rec.data
+        if rec.tp.name == 'function entry':
+            indent = '  ' * indents[rec.thread]
+            indents[rec.thread] += 1
+            annotation = '->'
+        else:
+            indents[rec.thread] = max(indents[rec.thread] - 1, 0)
+            indent = '  ' * indents[rec.thread]
+            annotation = '<-'
+        return '%s %s %s 0x%x' % (prefix, indent, annotation, fn)
+    bt = ''
+    if rec.backtrace:
+        bt = '   [' + ' '.join('0x%x' % a for a in rec.backtrace) + ']'
+    return '%s %-20s %s%s' % (prefix, rec.tp.name, rec.tp.format % rec.data, bt)
+
+def main():
+    parser = argparse.ArgumentParser(description='decode an OSv binary trace')
+    parser.add_argument('--cpu', type=int, help='only show records of this cpu')
+    parser.add_argument('--tracepoint', action='append', default=[],
+                        help='only show this tracepoint (may be repeated)')
+    parser.add_argument('file', help='trace file, as read from /dev/trace')
+    args = parser.parse_args()
+    tracepoints, records = decode(open(args.file, 'rb').read())
+    indents = defaultdict(int)
+    for rec in records:
+        if args.cpu is not None and rec.cpu != args.cpu:
+            continue
+        if args.tracepoint and rec.tp.name not in args.tracepoint:
+            continue
+        sys.stdout.write(format_record(rec, indents) + '\n')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// POSIX aio on a regular file (run by the worker threads) and on a block
+// device (sent to the driver as bios), its signal notification, and Linux's
+// io_submit() with an eventfd for completion.
+
+#include <aio.h>
+#include <sys/eventfd.h>
+#include <sys/poll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <atomic>
+#include "sched.hh"
+#include "debug.hh"
+#include "libc/aio.hh"
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static bool wait_for(struct aiocb* cb)
+{
+    const struct aiocb* list[] = { cb };
+    struct timespec ts = { 5, 0 };
+    while (aio_error(cb) == EINPROGRESS) {
+        if (aio_suspend(list, 1, &ts) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::atomic<int> notified(0);
+
+static void notify(union sigval v)
+{
+    notified += v.sival_int;
+}
+
+static void test_file()
+{
+    static char wbuf[8192], rbuf[8192];
+    for (unsigned i = 0; i < sizeof(wbuf); i++) {
+        wbuf[i] = i * 7;
+    }
+    int fd = open("/tmp/tst-aio", O_CREAT|O_TRUNC|O_RDWR, 0666);
+    report(fd >= 0, "open file");
+
+    struct aiocb w = {};
+    w.aio_fildes = fd;
+    w.aio_buf = wbuf;
+    w.aio_nbytes = sizeof(wbuf);
+    w.aio_sigevent.sigev_notify = SIGEV_NONE;
+    report(aio_write(&w) == 0, "aio_write");
+    report(wait_for(&w) && aio_error(&w) == 0 &&
+           aio_return(&w) == sizeof(wbuf), "aio_write completes");
+
+    struct aiocb r[2] = {};
+    struct aiocb* list[2];
+    for (int i = 0; i < 2; i++) {
+        r[i].aio_fildes = fd;
+        r[i].aio_lio_opcode = LIO_READ;
+        r[i].aio_buf = rbuf + i * 4096;
+        r[i].aio_nbytes = 4096;
+        r[i].aio_offset = i * 4096;
+        r[i].aio_sigevent.sigev_notify = SIGEV_THREAD;
+        r[i].aio_sigevent.sigev_notify_function = notify;
+        r[i].aio_sigevent.sigev_value.sival_int = 1;
+        list[i] = &r[i];
+    }
+    report(lio_listio(LIO_WAIT, list, 2, nullptr) == 0, "lio_listio");
+    report(aio_return(&r[0]) == 4096 && aio_return(&r[1]) == 4096 &&
+           memcmp(rbuf, wbuf, sizeof(wbuf)) == 0, "lio_listio reads data");
+    for (int i = 0; i < 50 && notified != 2; i++) {
+        usleep(10000);
+    }
+    report(notified == 2, "SIGEV_THREAD notifications");
+
+    struct aiocb s = {};
+    s.aio_fildes = fd;
+    s.aio_sigevent.sigev_notify = SIGEV_NONE;
+    report(aio_fsync(O_SYNC, &s) == 0 && wait_for(&s) && aio_error(&s) == 0,
+           "aio_fsync");
+
+    struct aiocb bad = {};
+    bad.aio_fildes = 12345;
+    bad.aio_buf = rbuf;
+    bad.aio_nbytes = 1;
+    bad.aio_sigevent.sigev_notify = SIGEV_NONE;
+    report(aio_read(&bad) == 0 && wait_for(&bad) && aio_error(&bad) == EBADF &&
+           aio_return(&bad) == -1, "bad descriptor reported by aio_error");
+
+    close(fd);
+    unlink("/tmp/tst-aio");
+}
+
+static void test_signal()
+{
+    static char buf[512];
+    int fd = open("/tmp/tst-aio", O_CREAT|O_TRUNC|O_RDWR, 0666);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    int sfd = signalfd(-1, &mask, 0);
+    report(sfd >= 0, "signalfd");
+
+    struct aiocb w = {};
+    w.aio_fildes = fd;
+    w.aio_buf = buf;
+    w.aio_nbytes = sizeof(buf);
+    w.aio_sigevent.sigev_notify = SIGEV_SIGNAL;
+    w.aio_sigevent.sigev_signo = SIGUSR1;
+    w.aio_sigevent.sigev_value.sival_ptr = &w;
+    report(aio_write(&w) == 0 && wait_for(&w), "aio_write with SIGEV_SIGNAL");
+    struct pollfd p = { sfd, POLLIN, 0 };
+    signalfd_siginfo ssi = {};
+    report(poll(&p, 1, 5000) == 1 && read(sfd, &ssi, sizeof(ssi)) == sizeof(ssi) &&
+           ssi.ssi_signo == SIGUSR1 && ssi.ssi_code == SI_QUEUE &&
+           ssi.ssi_ptr == reinterpret_cast<uintptr_t>(&w),
+           "SIGEV_SIGNAL queued with sigev_value");
+
+    close(sfd);
+    close(fd);
+    unlink("/tmp/tst-aio");
+}
+
+static void test_bdev()
+{
+    int fd = open("/dev/vblk0", O_RDONLY);
+    if (fd < 0) {
+        debug("no /dev/vblk0, skipping block device test\n");
+        return;
+    }
+    const size_t len = 256 * 1024;
+    char* buf = static_cast<char*>(malloc(len));
+    char* expect = static_cast<char*>(malloc(len));
+    report(pread(fd, expect, len, 0) == (ssize_t)len, "pread device");
+
+    struct aiocb r = {};
+    r.aio_fildes = fd;
+    r.aio_buf = buf;
+    r.aio_nbytes = len;
+    r.aio_sigevent.sigev_notify = SIGEV_NONE;
+    report(aio_read(&r) == 0 && wait_for(&r) && aio_return(&r) == (ssize_t)len &&
+           memcmp(buf, expect, len) == 0, "aio_read device");
+
+    free(buf);
+    free(expect);
+    close(fd);
+}
+
+static void test_linux()
+{
+    static char wbuf[4096], rbuf[4096];
+    memset(wbuf, 'a', sizeof(wbuf));
+    int fd = open("/tmp/tst-aio", O_CREAT|O_TRUNC|O_RDWR, 0666);
+    int efd = eventfd(0, 0);
+
+    osv::aio_context_t ctx = 0;
+    report(syscall(__NR_io_setup, 2, &ctx) == 0, "io_setup");
+
+    osv::iocb cbs[3] = {};
+    osv::iocb* cbp[3] = { &cbs[0], &cbs[1], &cbs[2] };
+    cbs[0].aio_lio_opcode = osv::IOCB_CMD_PWRITE;
+    cbs[0].aio_fildes = fd;
+    cbs[0].aio_buf = reinterpret_cast<uint64_t>(wbuf);
+    cbs[0].aio_nbytes = sizeof(wbuf);
+    cbs[0].aio_data = 42;
+    cbs[0].aio_flags = IOCB_FLAG_RESFD;
+    cbs[0].aio_resfd = efd;
+    cbs[1] = cbs[0];
+    cbs[1].aio_offset = sizeof(wbuf);
+    cbs[1].aio_data = 43;
+    cbs[2] = cbs[0];
+    report(syscall(__NR_io_submit, ctx, 3, cbp) == 2,
+           "io_submit stops at the context size");
+
+    struct pollfd p = { efd, POLLIN, 0 };
+    report(poll(&p, 1, 5000) == 1, "eventfd becomes readable");
+    osv::io_event ev[2];
+    struct timespec ts = { 5, 0 };
+    report(syscall(__NR_io_getevents, ctx, 2, 2, ev, &ts) == 2 &&
+           ev[0].res == sizeof(wbuf) && ev[1].res == sizeof(wbuf) &&
+           ev[0].data + ev[1].data == 85, "io_getevents");
+
+    cbs[0].aio_lio_opcode = osv::IOCB_CMD_PREAD;
+    cbs[0].aio_buf = reinterpret_cast<uint64_t>(rbuf);
+    cbs[0].aio_offset = sizeof(wbuf);
+    cbs[0].aio_flags = 0;
+    report(syscall(__NR_io_submit, ctx, 1, cbp) == 1 &&
+           syscall(__NR_io_getevents, ctx, 1, 1, ev, &ts) == 1 &&
+           ev[0].res == sizeof(rbuf) && memcmp(rbuf, wbuf, sizeof(rbuf)) == 0,
+           "read back with io_submit");
+
+    ts = { 0, 10000000 };
+    report(syscall(__NR_io_getevents, ctx, 1, 1, ev, &ts) == 0,
+           "io_getevents times out");
+    report(syscall(__NR_io_destroy, ctx) == 0, "io_destroy");
+    report(syscall(__NR_io_destroy, ctx) == -1 && errno == EINVAL,
+           "io_destroy of a destroyed context");
+
+    // io_destroy() wakes an io_getevents() blocked on the context, and
+    // waits for it to let go of the context before freeing it
+    ctx = 0;
+    syscall(__NR_io_setup, 1, &ctx);
+    long ret = 0;
+    sched::thread waiter([&] {
+        ret = syscall(__NR_io_getevents, ctx, 1, 1, ev, nullptr);
+    });
+    waiter.start();
+    usleep(100000);
+    report(syscall(__NR_io_destroy, ctx) == 0, "io_destroy with a waiter");
+    waiter.join();
+    report(ret == -1, "io_getevents fails on a destroyed context");
+
+    close(efd);
+    close(fd);
+    unlink("/tmp/tst-aio");
+}
+
+int main(int ac, char** av)
+{
+    test_file();
+    test_signal();
+    test_bdev();
+    test_linux();
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Reads the start of /dev/vblk0 in small bios, with and without a plug,
+// and checks both against a copy read in large bios.  Only reads, so it is safe to
+// run on the boot disk.
+
+#include <osv/bio.h>
+#include <osv/device.h>
+#include <osv/prex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    printf("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static constexpr size_t bsize = 4096;
+static constexpr int nblocks = 256;
+
+static struct bio* make_bio(struct device* dev, void* data, size_t size, off_t offset)
+{
+    auto bio = alloc_bio();
+    bio->bio_cmd = BIO_READ;
+    bio->bio_dev = dev;
+    bio->bio_data = data;
+    bio->bio_offset = offset;
+    bio->bio_bcount = size;
+    return bio;
+}
+
+// Reads nblocks blocks, in the given order, one bio each
+static bool read_blocks(struct device* dev, char* buf, bool plugged,
+        const std::vector<int>& order)
+{
+    std::vector<struct bio*> bios;
+    struct bio_plug plug;
+    if (plugged) {
+        bio_start_plug(&plug);
+    }
+    for (auto i : order) {
+        auto bio = make_bio(dev, buf + i * bsize, bsize, i * bsize);
+        bios.push_back(bio);
+        submit_bio(bio);
+    }
+    if (plugged) {
+        bio_finish_plug(&plug);
+    }
+    bool ok = true;
+    for (auto bio : bios) {
+        ok &= bio_wait(bio) == 0;
+        destroy_bio(bio);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    struct device* dev;
+    if (device_open("vblk0", DO_RDWR, &dev)) {
+        printf("no /dev/vblk0, skipping\n");
+        return 0;
+    }
+
+    // malloc'ed, since virtio needs virt_to_phys() to work on the buffers
+    auto size = nblocks * bsize;
+    auto expected = static_cast<char*>(malloc(size));
+    auto buf = static_cast<char*>(malloc(size));
+
+    // The reference copy, read in 64K bios, which any driver can take
+    bool ok = true;
+    for (size_t off = 0; off < size; off += 65536) {
+        auto bio = make_bio(dev, expected + off, 65536, off);
+        dev->driver->devops->strategy(bio);
+        ok &= bio_wait(bio) == 0;
+        destroy_bio(bio);
+    }
+    report(ok, "reference read");
+
+    std::vector<int> order;
+    for (int i = 0; i < nblocks; i++) {
+        order.push_back(i);
+    }
+    std::vector<int> shuffled(order);
+    for (int i = nblocks - 1; i > 0; i--) {
+        std::swap(shuffled[i], shuffled[rand() % (i + 1)]);
+    }
+
+    typedef std::chrono::high_resolution_clock clock;
+    for (auto plugged : { false, true }) {
+        memset(buf, 0, size);
+        auto start = clock::now();
+        bool ok = read_blocks(dev, buf, plugged, order);
+        auto t = clock::now() - start;
+        report(ok && memcmp(buf, expected, size) == 0,
+               plugged ? "plugged reads" : "unplugged reads");
+        printf("  %d reads in %lld us\n", nblocks, (long long)
+               std::chrono::duration_cast<std::chrono::microseconds>(t).count());
+    }
+
+    // Out of order submission must still be sorted and merged correctly
+    memset(buf, 0, size);
+    report(read_blocks(dev, buf, true, shuffled) && memcmp(buf, expected, size) == 0,
+           "plugged reads out of order");
+
+    // Nested plugs: only the outer one holds bios back
+    struct bio_plug outer, inner;
+    bio_start_plug(&outer);
+    bio_start_plug(&inner);
+    memset(buf, 0, bsize);
+    auto bio = make_bio(dev, buf, bsize, 0);
+    submit_bio(bio);
+    bio_finish_plug(&inner);
+    // bio_wait() must submit what the plug still holds
+    report(bio_wait(bio) == 0 && memcmp(buf, expected, bsize) == 0,
+           "wait on a plugged bio");
+    destroy_bio(bio);
+    bio_finish_plug(&outer);
+
+    free(buf);
+    free(expected);
+    device_close(dev);
+    printf("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails != 0;
+}
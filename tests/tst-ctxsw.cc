@@ -14,6 +14,7 @@
 #include <cinttypes>
 #include <stdio.h>
 #include <stdint.h>
+#include <cpuid.h>
 
 uint64_t target_time = 10; // seconds
 
@@ -115,11 +116,32 @@ unsigned remain;
 
 bool exiting;
 unsigned nr_running;
+bool use_avx;
+
+bool have_avx()
+{
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return false;
+    }
+    // avx and osxsave
+    return (c & (1u << 28)) && (c & (1u << 27));
+}
+
+// Leave the upper halves of the ymm registers in a non-initial state, so
+// every switch away from this thread has live AVX state to preserve.
+void dirty_avx_state()
+{
+    asm volatile ("vpcmpeqd %%ymm8, %%ymm8, %%ymm8" : : : "xmm8");
+}
 
 void run_once(unsigned me)
 {
     bool done = false;
     while (!done) {
+        if (use_avx) {
+            dirty_avx_state();
+        }
         pthread_mutex_lock(&mtx);
         while (owner != me) {
             pthread_cond_wait(&cond, &mtx);
@@ -214,6 +236,12 @@ int main(int ac, char** av)
     test("colocated", pin0, pin0);
     test("apart", pin0, pin1);
     test("nopin", nopin, nopin);
+    if (have_avx()) {
+        use_avx = true;
+        test("colocated-avx", pin0, pin0);
+        test("apart-avx", pin0, pin1);
+        use_avx = false;
+    }
 }
 
 
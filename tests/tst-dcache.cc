@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// The dentry cache: lookups after creating, removing and renaming names
+// must not see what the cache remembered from before, whether it was a
+// negative entry or a path below a renamed directory.
+
+#include "debug.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static bool exists(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static bool missing(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == -1 && errno == ENOENT;
+}
+
+static bool create(const char* path)
+{
+    int fd = open(path, O_CREAT|O_WRONLY, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+int main(int ac, char** av)
+{
+    mkdir("/tmp/tst-dcache", 0777);
+
+    // a negative entry, then a create of the same name
+    report(missing("/tmp/tst-dcache/a") && missing("/tmp/tst-dcache/a"),
+           "lookup of a missing file");
+    report(create("/tmp/tst-dcache/a") && exists("/tmp/tst-dcache/a"),
+           "create after a failed lookup");
+
+    // unlink, then lookup again
+    report(unlink("/tmp/tst-dcache/a") == 0 && missing("/tmp/tst-dcache/a"),
+           "lookup after unlink");
+
+    // rename of a file over another
+    create("/tmp/tst-dcache/x");
+    create("/tmp/tst-dcache/y");
+    report(rename("/tmp/tst-dcache/x", "/tmp/tst-dcache/y") == 0 &&
+           missing("/tmp/tst-dcache/x") && exists("/tmp/tst-dcache/y"),
+           "lookup after renaming a file");
+    unlink("/tmp/tst-dcache/y");
+
+    // rename of a directory, with paths below it in the cache
+    mkdir("/tmp/tst-dcache/d", 0777);
+    create("/tmp/tst-dcache/d/f");
+    report(exists("/tmp/tst-dcache/d/f") && missing("/tmp/tst-dcache/e/f"),
+           "lookup below a directory");
+    report(rename("/tmp/tst-dcache/d", "/tmp/tst-dcache/e") == 0,
+           "rename directory");
+    report(missing("/tmp/tst-dcache/d") && missing("/tmp/tst-dcache/d/f"),
+           "old paths gone after renaming a directory");
+    report(exists("/tmp/tst-dcache/e") && exists("/tmp/tst-dcache/e/f"),
+           "new paths found after renaming a directory");
+
+    // rmdir, then create a file of the same name
+    unlink("/tmp/tst-dcache/e/f");
+    report(rmdir("/tmp/tst-dcache/e") == 0 && missing("/tmp/tst-dcache/e"),
+           "lookup after rmdir");
+    struct stat st;
+    report(create("/tmp/tst-dcache/e") && stat("/tmp/tst-dcache/e", &st) == 0 &&
+           S_ISREG(st.st_mode), "create after rmdir");
+    unlink("/tmp/tst-dcache/e");
+    rmdir("/tmp/tst-dcache");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
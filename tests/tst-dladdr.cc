@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// dladdr() on exported and local symbols of this object and of the kernel,
+// and the cost of a lookup once the address index is built.
+
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "debug.hh"
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static uint64_t nstime()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * uint64_t(1000000000) + tv.tv_usec * uint64_t(1000);
+}
+
+extern "C" int tst_dladdr_global(int x)
+{
+    return x * 3 + 1;
+}
+
+static int __attribute__((noinline)) tst_dladdr_local(int x)
+{
+    return x * 5 + 2;
+}
+
+static bool names(void* addr, const char* sym, void* saddr)
+{
+    Dl_info info;
+    if (!dladdr(addr, &info)) {
+        return false;
+    }
+    return info.dli_fname && info.dli_sname && !strcmp(info.dli_sname, sym)
+        && info.dli_saddr == saddr;
+}
+
+int main(int ac, char** av)
+{
+    auto global = reinterpret_cast<char*>(tst_dladdr_global);
+    auto local = reinterpret_cast<char*>(tst_dladdr_local);
+    auto kernel = reinterpret_cast<char*>(malloc);
+
+    report(names(global, "tst_dladdr_global", global),
+           "exported function, start");
+    report(names(global + 1, "tst_dladdr_global", global),
+           "exported function, inside");
+    report(names(local + 1, "tst_dladdr_local", local),
+           "local function (.symtab)");
+    report(names(kernel + 1, "malloc", kernel), "kernel function");
+
+    Dl_info info;
+    report(dladdr(reinterpret_cast<void*>(16), &info) == 0,
+           "unmapped address");
+
+    const int loops = 1000000;
+    auto start = nstime();
+    for (int i = 0; i < loops; i++) {
+        dladdr(kernel + (i & 15), &info);
+    }
+    auto end = nstime();
+    debug("dladdr: %.1f ns\n", double(end - start) / loops);
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <sys/poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include "sched.hh"
+#include "debug.hh"
+#include "drivers/clock.hh"
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static bool readable(int fd, int timeout_ms)
+{
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    return poll(&p, 1, timeout_ms) == 1 && (p.revents & POLLIN);
+}
+
+static void test_eventfd()
+{
+    int fd = eventfd(0, EFD_NONBLOCK);
+    report(fd >= 0, "eventfd");
+
+    eventfd_t v;
+    report(eventfd_read(fd, &v) == -1 && errno == EAGAIN,
+            "eventfd read of zero counter returns EAGAIN");
+    report(!readable(fd, 0), "eventfd with zero counter is not readable");
+
+    report(eventfd_write(fd, 3) == 0 && eventfd_write(fd, 4) == 0,
+            "eventfd write");
+    report(readable(fd, 0), "eventfd with nonzero counter is readable");
+    report(eventfd_read(fd, &v) == 0 && v == 7, "eventfd read sums writes");
+    report(!readable(fd, 0), "eventfd read clears counter");
+
+    report(eventfd_write(fd, 0xfffffffffffffffe) == 0, "eventfd write max");
+    report(eventfd_write(fd, 1) == -1 && errno == EAGAIN,
+            "eventfd write past max returns EAGAIN");
+    close(fd);
+
+    fd = eventfd(2, EFD_SEMAPHORE | EFD_NONBLOCK);
+    report(eventfd_read(fd, &v) == 0 && v == 1
+            && eventfd_read(fd, &v) == 0 && v == 1
+            && eventfd_read(fd, &v) == -1 && errno == EAGAIN,
+            "eventfd semaphore mode");
+    close(fd);
+
+    // wake up a blocked reader, via epoll
+    fd = eventfd(0, 0);
+    int ep = epoll_create(1);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = 123;
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &event);
+    sched::thread writer([&] {
+        sched::thread::sleep_until(clock::get()->time() + 100_ms);
+        eventfd_write(fd, 5);
+    });
+    writer.start();
+    int r = epoll_wait(ep, &event, 1, 5000);
+    report(r == 1 && event.data.u32 == 123, "epoll wakes on eventfd write");
+    report(eventfd_read(fd, &v) == 0 && v == 5, "eventfd read after epoll");
+    writer.join();
+    close(ep);
+    close(fd);
+}
+
+static void test_timerfd()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    report(fd >= 0, "timerfd_create");
+
+    u64 count;
+    report(read(fd, &count, sizeof(count)) == -1 && errno == EAGAIN,
+            "disarmed timerfd read returns EAGAIN");
+
+    report(timerfd_settime(fd, 0, nullptr, nullptr) == -1 && errno == EFAULT,
+            "timerfd_settime with no value returns EFAULT");
+
+    struct itimerspec its = {};
+    its.it_value.tv_nsec = 50000000;
+    report(timerfd_settime(fd, 0, &its, nullptr) == 0, "timerfd one-shot");
+    struct itimerspec cur;
+    report(timerfd_gettime(fd, &cur) == 0 && cur.it_value.tv_sec == 0
+            && cur.it_value.tv_nsec > 0, "timerfd_gettime while armed");
+    report(!readable(fd, 0), "timerfd not readable before expiration");
+    report(readable(fd, 5000), "timerfd readable after expiration");
+    report(read(fd, &count, sizeof(count)) == sizeof(count) && count == 1,
+            "one-shot timerfd expires once");
+
+    its.it_value.tv_nsec = 10000000;
+    its.it_interval.tv_nsec = 10000000;
+    timerfd_settime(fd, 0, &its, nullptr);
+    sched::thread::sleep_until(clock::get()->time() + 100_ms);
+    report(read(fd, &count, sizeof(count)) == sizeof(count) && count >= 5,
+            "interval timerfd accumulates expirations");
+
+    its = {};
+    timerfd_settime(fd, 0, &its, nullptr);
+    report(timerfd_gettime(fd, &cur) == 0 && cur.it_value.tv_sec == 0
+            && cur.it_value.tv_nsec == 0, "timerfd disarm");
+    close(fd);
+}
+
+static void test_signalfd()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK);
+    report(fd >= 0, "signalfd");
+    report(!readable(fd, 0), "signalfd with no pending signal");
+
+    report(kill(getpid(), SIGUSR1) == 0, "kill");
+    report(readable(fd, 0), "signalfd readable after kill");
+    struct signalfd_siginfo ssi;
+    report(read(fd, &ssi, sizeof(ssi)) == sizeof(ssi)
+            && ssi.ssi_signo == SIGUSR1, "signalfd read");
+    report(read(fd, &ssi, sizeof(ssi)) == -1 && errno == EAGAIN,
+            "signalfd read consumes signal");
+    close(fd);
+}
+
+int main(int ac, char** av)
+{
+    test_eventfd();
+    test_timerfd();
+    test_signalfd();
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Descriptor allocation across file table growth, and lookups of a
+// descriptor by other threads while the table is being replaced.
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <atomic>
+#include <vector>
+#include "sched.hh"
+#include "debug.hh"
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+int main(int ac, char** av)
+{
+    int s[2];
+    report(pipe(s) == 0, "pipe call");
+
+    std::atomic<bool> done(false);
+    std::atomic<int> lookup_errors(0);
+    std::vector<sched::thread*> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.push_back(new sched::thread([&] {
+            struct stat st;
+            while (!done.load(std::memory_order_relaxed)) {
+                if (fstat(s[0], &st) != 0) {
+                    lookup_errors++;
+                }
+            }
+        }));
+        readers.back()->start();
+    }
+
+    std::vector<int> fds;
+    bool lowest = true;
+    for (int i = 0; i < 2000; i++) {
+        int fd = dup(s[1]);
+        if (fd < 0) {
+            break;
+        }
+        lowest &= fds.empty() || fd == fds.back() + 1;
+        fds.push_back(fd);
+    }
+    report(fds.size() == 2000, "dup 2000 descriptors");
+    report(lowest, "descriptors are allocated in order");
+
+    done = true;
+    for (auto t : readers) {
+        t->join();
+        delete t;
+    }
+    report(lookup_errors == 0, "lookups while the table grows");
+
+    char c = 'x';
+    report(write(fds.back(), &c, 1) == 1 && read(s[0], &c, 1) == 1,
+           "write through the last descriptor");
+
+    report(close(fds[10]) == 0 && close(fds[1500]) == 0, "close two");
+    int fd = dup(s[1]);
+    report(fd == fds[10], "lowest free descriptor is reused");
+    fds[10] = fd;
+    fd = fcntl(s[1], F_DUPFD, fds[1000]);
+    report(fd == fds[1500], "F_DUPFD honours the minimum");
+    fds[1500] = fd;
+    report(write(fds[1500], &c, 0) == 0, "reused descriptor works");
+
+    for (auto fd : fds) {
+        close(fd);
+    }
+    report(write(fds.back(), &c, 1) == -1 && errno == EBADF,
+           "closed descriptor is invalid");
+    report(dup2(s[1], 3000) == 3000 && close(3000) == 0,
+           "dup2 beyond the table");
+
+    close(s[0]);
+    close(s[1]);
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
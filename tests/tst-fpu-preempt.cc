@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// The full ymm state of threads preempted in the middle of using it (not
+// only at voluntary switches, like tst-ctxsw's avx variant) survives the
+// switch.  Two threads share a cpu, each loading its own pattern into all
+// the ymm registers and spinning long enough to be preempted, then
+// comparing the registers with what it loaded.
+
+#include "sched.hh"
+#include "debug.hh"
+#include <cpuid.h>
+#include <stdint.h>
+#include <string.h>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static bool have_avx()
+{
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) {
+        return false;
+    }
+    // avx and osxsave
+    return (c & (1u << 28)) && (c & (1u << 27));
+}
+
+struct ymm_regs {
+    uint8_t b[16 * 32];
+};
+
+// Load @in into ymm0-15, spin for @loops iterations without touching them,
+// and store them into @out
+static void load_spin_store(const ymm_regs& in, ymm_regs& out, uint64_t loops)
+{
+    asm volatile(
+        "vmovdqu 0(%[in]), %%ymm0\n\t"
+        "vmovdqu 32(%[in]), %%ymm1\n\t"
+        "vmovdqu 64(%[in]), %%ymm2\n\t"
+        "vmovdqu 96(%[in]), %%ymm3\n\t"
+        "vmovdqu 128(%[in]), %%ymm4\n\t"
+        "vmovdqu 160(%[in]), %%ymm5\n\t"
+        "vmovdqu 192(%[in]), %%ymm6\n\t"
+        "vmovdqu 224(%[in]), %%ymm7\n\t"
+        "vmovdqu 256(%[in]), %%ymm8\n\t"
+        "vmovdqu 288(%[in]), %%ymm9\n\t"
+        "vmovdqu 320(%[in]), %%ymm10\n\t"
+        "vmovdqu 352(%[in]), %%ymm11\n\t"
+        "vmovdqu 384(%[in]), %%ymm12\n\t"
+        "vmovdqu 416(%[in]), %%ymm13\n\t"
+        "vmovdqu 448(%[in]), %%ymm14\n\t"
+        "vmovdqu 480(%[in]), %%ymm15\n\t"
+        "1: dec %[loops]\n\t"
+        "jnz 1b\n\t"
+        "vmovdqu %%ymm0, 0(%[out])\n\t"
+        "vmovdqu %%ymm1, 32(%[out])\n\t"
+        "vmovdqu %%ymm2, 64(%[out])\n\t"
+        "vmovdqu %%ymm3, 96(%[out])\n\t"
+        "vmovdqu %%ymm4, 128(%[out])\n\t"
+        "vmovdqu %%ymm5, 160(%[out])\n\t"
+        "vmovdqu %%ymm6, 192(%[out])\n\t"
+        "vmovdqu %%ymm7, 224(%[out])\n\t"
+        "vmovdqu %%ymm8, 256(%[out])\n\t"
+        "vmovdqu %%ymm9, 288(%[out])\n\t"
+        "vmovdqu %%ymm10, 320(%[out])\n\t"
+        "vmovdqu %%ymm11, 352(%[out])\n\t"
+        "vmovdqu %%ymm12, 384(%[out])\n\t"
+        "vmovdqu %%ymm13, 416(%[out])\n\t"
+        "vmovdqu %%ymm14, 448(%[out])\n\t"
+        "vmovdqu %%ymm15, 480(%[out])\n\t"
+        "vzeroupper\n\t"
+        : [loops]"+r"(loops)
+        : [in]"r"(&in), [out]"r"(&out)
+        : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15", "memory", "cc");
+}
+
+int main(int ac, char** av)
+{
+    if (!have_avx()) {
+        debug("no avx, skipping\n");
+        return 0;
+    }
+    auto c = sched::cpus[0];
+    const int rounds = 10;
+    bool ok[2] = { true, true };
+    auto worker = [&] (int id) {
+        ymm_regs in, out;
+        for (int r = 0; r < rounds; r++) {
+            for (unsigned i = 0; i < sizeof(in.b); i++) {
+                in.b[i] = id * 101 + r * 7 + i;
+            }
+            memset(out.b, 0, sizeof(out.b));
+            load_spin_store(in, out, 200000000);
+            ok[id] &= !memcmp(in.b, out.b, sizeof(in.b));
+        }
+    };
+    sched::thread t0([&] { worker(0); }, sched::thread::attr(c));
+    sched::thread t1([&] { worker(1); }, sched::thread::attr(c));
+    t0.start();
+    t1.start();
+    t0.join();
+    t1.join();
+    report(t0.get_stats().involuntary_switches
+           + t1.get_stats().involuntary_switches > 0,
+           "threads were preempted while using ymm registers");
+    report(ok[0] && ok[1], "ymm registers survive preemption");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
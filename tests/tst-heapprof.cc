@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// The sampling heap profiler: live and total bytes of known allocation
+// sites, for small objects, large objects and pages, and /dev/heapprof.
+
+#include "alloctracker.hh"
+#include "debug.hh"
+#include "elf.hh"
+#include <osv/pagealloc.hh>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+extern "C" __attribute__((noinline))
+void heapprof_test_malloc(std::vector<void*>& v, size_t size)
+{
+    for (auto& p : v) {
+        p = malloc(size);
+    }
+}
+
+extern "C" __attribute__((noinline))
+void heapprof_test_alloc_page(std::vector<void*>& v)
+{
+    for (auto& p : v) {
+        p = memory::alloc_page();
+    }
+}
+
+// The merged statistics of the sites whose backtraces go through @fn
+static memory::heap_sampler::site site_of(const char* fn)
+{
+    memory::heap_sampler::site ret = {};
+    for (auto& s : memory::heap_profiler.sites()) {
+        for (unsigned i = 0; i < s.len; ++i) {
+            auto ei = elf::get_program()->lookup_addr(s.pc[i] - 1);
+            if (ei.sym && !strcmp(ei.sym, fn)) {
+                ret.live_bytes += s.live_bytes;
+                ret.live_objects += s.live_objects;
+                ret.total_bytes += s.total_bytes;
+                ret.total_objects += s.total_objects;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+// @estimate is within a third of @expected
+static bool close_to(s64 estimate, s64 expected)
+{
+    return estimate > expected * 2 / 3 && estimate < expected * 4 / 3;
+}
+
+static void test_malloc(size_t size, int n)
+{
+    std::vector<void*> v(n);
+    heapprof_test_malloc(v, size);
+    auto s = site_of("heapprof_test_malloc");
+    auto msg = "malloc(" + std::to_string(size) + ") ";
+    report(close_to(s.live_bytes, size * n), (msg + "live bytes estimated").c_str());
+    report(close_to(s.live_objects, n), (msg + "live objects estimated").c_str());
+    for (auto p : v) {
+        free(p);
+    }
+    s = site_of("heapprof_test_malloc");
+    report(s.live_bytes == 0 && s.live_objects == 0,
+           (msg + "frees accounted").c_str());
+    report(close_to(s.total_bytes, size * n), (msg + "total bytes kept").c_str());
+}
+
+int main(int ac, char** av)
+{
+    auto& prof = memory::heap_profiler;
+    prof.start(4096);
+    test_malloc(100, 20000);
+    prof.start(4096);
+    test_malloc(20000, 200);
+
+    prof.start(4096);
+    std::vector<void*> pages(1000);
+    heapprof_test_alloc_page(pages);
+    auto s = site_of("heapprof_test_alloc_page");
+    report(close_to(s.live_bytes, 1000 * 4096), "pages' live bytes estimated");
+    for (auto p : pages) {
+        memory::free_page(p);
+    }
+    s = site_of("heapprof_test_alloc_page");
+    report(s.live_bytes == 0, "pages' frees accounted");
+
+    prof.stop();
+    std::vector<void*> v(1000);
+    heapprof_test_malloc(v, 1000);
+    s = site_of("heapprof_test_malloc");
+    report(s.total_bytes == 0, "nothing sampled after stop()");
+    for (auto p : v) {
+        free(p);
+    }
+
+    int fd = open("/dev/heapprof", O_RDONLY);
+    report(fd >= 0, "open /dev/heapprof");
+    std::string text;
+    char buf[1024];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        text.append(buf, n);
+    }
+    close(fd);
+    report(text.find("heapprof_test_alloc_page") != std::string::npos,
+           "report names the allocation sites");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
@@ -16,6 +16,7 @@
 #include <debug.hh>
 #include <lockfree/ring.hh>
 #include <lockfree/queue-mpsc.hh>
+#include <lockfree/deque-ws.hh>
 
 //
 // Create 2 threads on different CPUs which perform concurrent push/pop
@@ -269,6 +270,314 @@ private:
     }
 };
 
+//
+// Create 4 threads on different CPUs, 2 pushing and 2 popping concurrently
+// Testing mpmc ring
+//
+class test_mpmc_ring {
+public:
+
+    static const int max_random = 25;
+    static const u64 elements_to_process = 50000000;
+
+    bool run()
+    {
+        assert (sched::cpus.size() >= 4);
+
+        sched::thread * thread1 = new sched::thread([&] { thread_push(0); },
+            sched::thread::attr(sched::cpus[0]));
+        sched::thread * thread2 = new sched::thread([&] { thread_push(1); },
+            sched::thread::attr(sched::cpus[1]));
+        sched::thread * thread3 = new sched::thread([&] { thread_pop(2); },
+            sched::thread::attr(sched::cpus[2]));
+        sched::thread * thread4 = new sched::thread([&] { thread_pop(3); },
+            sched::thread::attr(sched::cpus[3]));
+
+        thread1->start();
+        thread2->start();
+        thread3->start();
+        thread4->start();
+
+        thread1->join();
+        thread2->join();
+        thread3->join();
+        thread4->join();
+
+        delete thread1;
+        delete thread2;
+        delete thread3;
+        delete thread4;
+
+        bool success = true;
+        debug("Results:\n");
+        for (int i=0; i < max_random; i++) {
+            unsigned pushed = _stats[0][i] + _stats[1][i];
+            unsigned popped = _stats[2][i] + _stats[3][i];
+
+            debug("    value=%-08d pushed=%-08d popped=%-08d\n", i,
+                pushed, popped);
+
+            if (pushed != popped) {
+                success = false;
+            }
+        }
+
+        return success;
+    }
+
+private:
+
+    ring_mpmc<int, 4096> _ring;
+
+    int _stats[4][max_random] = {};
+
+    void thread_push(int cpu_id)
+    {
+        std::srand(std::time(0));
+        for (u64 ctr=0; ctr < elements_to_process; ctr++)
+        {
+            int element = std::rand() % max_random;
+            while (!_ring.push(element));
+            _stats[cpu_id][element]++;
+        }
+    }
+
+    void thread_pop(int cpu_id)
+    {
+        for (u64 ctr=0; ctr < elements_to_process; ctr++)
+        {
+            int element = 0;
+            while (!_ring.pop(element));
+            _stats[cpu_id][element]++;
+        }
+    }
+};
+
+//
+// Create 4 threads on different CPUs: the owner of a work-stealing deque,
+// which pushes and pops, and 3 thieves
+// Testing the work-stealing deque
+//
+class test_deque_ws {
+public:
+
+    static const int max_random = 25;
+    static const u64 elements_to_process = 50000000;
+
+    bool run()
+    {
+        assert (sched::cpus.size() >= 4);
+
+        sched::thread * thread1 = new sched::thread([&] { thread_owner(0); },
+            sched::thread::attr(sched::cpus[0]));
+        sched::thread * thread2 = new sched::thread([&] { thread_steal(1); },
+            sched::thread::attr(sched::cpus[1]));
+        sched::thread * thread3 = new sched::thread([&] { thread_steal(2); },
+            sched::thread::attr(sched::cpus[2]));
+        sched::thread * thread4 = new sched::thread([&] { thread_steal(3); },
+            sched::thread::attr(sched::cpus[3]));
+
+        thread1->start();
+        thread2->start();
+        thread3->start();
+        thread4->start();
+
+        thread1->join();
+        thread2->join();
+        thread3->join();
+        thread4->join();
+
+        delete thread1;
+        delete thread2;
+        delete thread3;
+        delete thread4;
+
+        bool success = true;
+        debug("Results:\n");
+        for (int i=0; i < max_random; i++) {
+            unsigned pushed = _pushed[i];
+            unsigned popped = _stats[0][i];
+            unsigned stolen = _stats[1][i] + _stats[2][i] + _stats[3][i];
+
+            debug("    value=%-08d pushed=%-08d popped=%-08d stolen=%-08d\n",
+                i, pushed, popped, stolen);
+
+            if (pushed != popped + stolen) {
+                success = false;
+            }
+        }
+
+        return success;
+    }
+
+private:
+
+    lockfree::deque_ws<int, 4096> _deque;
+
+    std::atomic<bool> _done { false };
+
+    int _pushed[max_random] = {};
+    int _stats[4][max_random] = {};
+
+    // push in bursts, and pop (newest first) part of each, racing the
+    // thieves on the last elements whenever they catch up
+    void thread_owner(int cpu_id)
+    {
+        std::srand(std::time(0));
+        u64 ctr = 0;
+        while (ctr < elements_to_process) {
+            int burst = std::rand() % 64;
+            for (int i = 0; i < burst && ctr < elements_to_process; i++) {
+                int element = std::rand() % max_random;
+                if (!_deque.push(element)) {
+                    break;
+                }
+                _pushed[element]++;
+                ctr++;
+            }
+            int pops = std::rand() % 64;
+            for (int i = 0; i < pops; i++) {
+                int element = 0;
+                if (_deque.pop(element)) {
+                    _stats[cpu_id][element]++;
+                }
+            }
+        }
+        int element = 0;
+        while (_deque.pop(element)) {
+            _stats[cpu_id][element]++;
+        }
+        _done.store(true);
+    }
+
+    void thread_steal(int cpu_id)
+    {
+        for (;;) {
+            int element = 0;
+            if (_deque.steal(element)) {
+                _stats[cpu_id][element]++;
+            } else if (_done.load()) {
+                break;
+            }
+        }
+    }
+};
+
+//
+// Create 4 threads on different CPUs, 3 pushing and one popping batches
+// Testing mpsc batch queue
+//
+class test_mpsc_batch_queue {
+public:
+
+    static const int max_random = 25;
+    static const u64 elements_to_process = 1000000;
+
+    struct item {
+        int value;
+        unsigned seq;
+        item* next;
+    };
+
+    void init()
+    {
+        std::srand(std::time(0));
+        for (int pusher = 0; pusher < 3; pusher++) {
+            for (unsigned i=0; i < elements_to_process; i++) {
+                _items[pusher][i].value = std::rand() % max_random;
+                _items[pusher][i].seq = i;
+            }
+        }
+    }
+
+    bool run()
+    {
+        assert (sched::cpus.size() >= 4);
+
+        sched::thread * thread1 = new sched::thread([&] { thread_push(0); },
+            sched::thread::attr(sched::cpus[0]));
+        sched::thread * thread2 = new sched::thread([&] { thread_push(1); },
+            sched::thread::attr(sched::cpus[1]));
+        sched::thread * thread3 = new sched::thread([&] { thread_push(2); },
+            sched::thread::attr(sched::cpus[2]));
+        sched::thread * thread4 = new sched::thread([&] { thread_pop(3); },
+            sched::thread::attr(sched::cpus[3]));
+
+        thread1->start();
+        thread2->start();
+        thread3->start();
+        thread4->start();
+
+        thread1->join();
+        thread2->join();
+        thread3->join();
+        thread4->join();
+
+        delete thread1;
+        delete thread2;
+        delete thread3;
+        delete thread4;
+
+        bool success = _in_order;
+        debug("Results: %d batches, %s\n", _batches,
+            _in_order ? "in order" : "OUT OF ORDER");
+        for (int i=0; i < max_random; i++) {
+            unsigned pushed = _stats[0][i] + _stats[1][i] + _stats[2][i];
+            unsigned popped = _stats[3][i];
+
+            debug("    value=%-08d pushed=%-08d popped=%-08d\n", i,
+                pushed, popped);
+
+            if (pushed != popped) {
+                success = false;
+            }
+        }
+
+        return success;
+    }
+
+private:
+
+    lockfree::queue_mpsc_batch<item> _queue;
+
+    // items for pusher1, pusher2, pusher3
+    item _items[3][elements_to_process];
+
+    int _stats[4][max_random] = {};
+    int _batches = 0;
+    bool _in_order = true;
+
+    void thread_push(int cpu_id)
+    {
+        for (u64 ctr=0; ctr < elements_to_process; ctr++)
+        {
+            auto it = &_items[cpu_id][ctr];
+            _stats[cpu_id][it->value]++;
+            _queue.push(it);
+        }
+    }
+
+    void thread_pop(int cpu_id)
+    {
+        // the next sequence number expected from each pusher
+        unsigned next[3] = {};
+        u64 ctr = 0;
+        while (ctr < elements_to_process*3) {
+            item* it = _queue.pop_all();
+            if (it) {
+                _batches++;
+            }
+            for (; it; it = it->next, ctr++) {
+                unsigned pusher = (it - &_items[0][0]) / elements_to_process;
+                if (it->seq != next[pusher]++) {
+                    _in_order = false;
+                }
+                _stats[cpu_id][it->value]++;
+            }
+        }
+    }
+};
+
 int main(int argc, char **argv)
 {
     // Test
@@ -320,6 +629,54 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    debug("[~] Testing mpmc ringbuffer:\n");
+    test_mpmc_ring t4;
+    beg = nanotime();
+    rc = t4.run();
+    end = nanotime();
+    if (rc) {
+        double dT = (double)(end-beg)/1000000000.0;
+        debug("[+] mpmc test passed:\n");
+        debug("[+] duration: %.6fs\n", dT);
+        debug("[+] throughput: %.0f ops/s\n", (double)(test_mpmc_ring::elements_to_process*4)/dT);
+    } else {
+        debug("[-] mpmc test failed\n");
+        return 1;
+    }
+
+    debug("[~] Testing work-stealing deque:\n");
+    test_deque_ws *t5 = new test_deque_ws();
+    beg = nanotime();
+    rc = t5->run();
+    end = nanotime();
+    delete t5;
+    if (rc) {
+        double dT = (double)(end-beg)/1000000000.0;
+        debug("[+] work-stealing deque test passed:\n");
+        debug("[+] duration: %.6fs\n", dT);
+        debug("[+] throughput: %.0f ops/s\n", (double)(test_deque_ws::elements_to_process*2)/dT);
+    } else {
+        debug("[-] work-stealing deque test failed\n");
+        return 1;
+    }
+
+    debug("[~] Testing mpsc-batch-queue:\n");
+    test_mpsc_batch_queue *t6 = new test_mpsc_batch_queue();
+    t6->init();
+    beg = nanotime();
+    rc = t6->run();
+    end = nanotime();
+    delete t6;
+    if (rc) {
+        double dT = (double)(end-beg)/1000000000.0;
+        debug("[+] mpsc-batch-queue test passed:\n");
+        debug("[+] duration: %.6fs\n", dT);
+        debug("[+] throughput: %.0f ops/s\n", (double)(test_mpsc_batch_queue::elements_to_process*6)/dT);
+    } else {
+        debug("[-] mpsc-batch-queue test failed\n");
+        return 1;
+    }
+
     debug("[+] finished.\n");
     return 0;
 }
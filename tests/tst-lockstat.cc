@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Lock contention profiling: acquisitions, waits and hold times of a
+// contended mutex, the /dev/lockstat report, and restarting.
+
+#include <osv/lockstat.hh>
+#include <osv/mutex.h>
+#include "sched.hh"
+#include "debug.hh"
+#include "drivers/clock.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static mutex test_mutex;
+
+int main(int ac, char** av)
+{
+    const int loops = 1000;
+    // two threads on different cpus (if there are two), each holding the
+    // lock for a while, so the other has to wait for it
+    auto locker = [] {
+        for (int i = 0; i < loops; i++) {
+            WITH_LOCK(test_mutex) {
+                auto end = nanotime() + 10000;
+                while (nanotime() < end) {
+                }
+            }
+        }
+    };
+    auto c2 = sched::cpus[sched::cpus.size() > 1 ? 1 : 0];
+    sched::thread t1(locker, sched::thread::attr(sched::cpus[0]));
+    sched::thread t2(locker, sched::thread::attr(c2));
+    lockstat::start();
+    t1.start();
+    t2.start();
+    t1.join();
+    t2.join();
+    lockstat::stop();
+
+    lockstat::lock_stats s = {};
+    for (auto& e : lockstat::collect()) {
+        if (e.lock == &test_mutex) {
+            s.acquisitions += e.acquisitions;
+            s.contended += e.contended;
+            s.wait_time += e.wait_time;
+            s.hold_time += e.hold_time;
+        }
+    }
+    report(s.acquisitions == 2 * loops, "acquisitions counted");
+    report(s.contended > 0 && s.wait_time > 0, "contention timed");
+    report(s.hold_time >= 2 * loops * 10000LL, "hold time accounted");
+
+    WITH_LOCK(test_mutex) {
+    }
+    bool counted = false;
+    for (auto& e : lockstat::collect()) {
+        counted |= e.lock == &test_mutex && e.acquisitions > 2 * loops;
+    }
+    report(!counted, "nothing counted after stop()");
+
+    int fd = open("/dev/lockstat", O_RDONLY);
+    report(fd >= 0, "open /dev/lockstat");
+    std::string text;
+    char buf[1024];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        text.append(buf, n);
+    }
+    close(fd);
+    report(text.find("test_mutex") != std::string::npos, "report names the lock");
+
+    // A lock taken in one run and released in the next is not charged
+    // with the time in between
+    lockstat::start();
+    test_mutex.lock();
+    lockstat::stop();
+    usleep(10000);
+    lockstat::start();
+    test_mutex.unlock();
+    lockstat::stop();
+    s64 hold = 0;
+    for (auto& e : lockstat::collect()) {
+        if (e.lock == &test_mutex) {
+            hold += e.hold_time;
+        }
+    }
+    report(hold == 0, "hold from before start() not recorded");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
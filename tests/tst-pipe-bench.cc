@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Measure pipe and unix-domain socketpair throughput between two threads,
+// for several write sizes.  Also builds on Linux, for comparison.
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+
+static const uint64_t total_bytes = uint64_t(1) << 30;
+
+struct writer_args {
+    int fd;
+    size_t chunk;
+};
+
+static void* writer(void* arg)
+{
+    auto args = static_cast<writer_args*>(arg);
+    std::vector<char> buf(args->chunk, 'x');
+    for (uint64_t sent = 0; sent < total_bytes; sent += args->chunk) {
+        if (write(args->fd, buf.data(), args->chunk) != (ssize_t)args->chunk) {
+            perror("write");
+            break;
+        }
+    }
+    return nullptr;
+}
+
+static uint64_t nstime()
+{
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * uint64_t(1000000000) + tv.tv_usec * uint64_t(1000);
+}
+
+static void test(std::string name, int rfd, int wfd, size_t chunk)
+{
+    writer_args args = { wfd, chunk };
+    std::vector<char> buf(std::max(chunk, size_t(65536)));
+    pthread_t t;
+    auto start = nstime();
+    pthread_create(&t, nullptr, writer, &args);
+    uint64_t received = 0;
+    while (received < total_bytes) {
+        auto r = read(rfd, buf.data(), buf.size());
+        if (r <= 0) {
+            perror("read");
+            break;
+        }
+        received += r;
+    }
+    pthread_join(t, nullptr);
+    auto end = nstime();
+    printf("%-12s %6zu byte writes: %8.1f MB/s\n", name.c_str(), chunk,
+            received * 1000.0 / (end - start));
+}
+
+int main(int ac, char** av)
+{
+    for (size_t chunk : { 64, 512, 4096, 65536 }) {
+        int s[2];
+        pipe(s);
+        test("pipe", s[0], s[1], chunk);
+        close(s[0]);
+        close(s[1]);
+    }
+    for (size_t chunk : { 4096, 65536 }) {
+        int s[2];
+        pipe(s);
+        fcntl(s[1], F_SETPIPE_SZ, 1 << 20);
+        test("pipe 1M", s[0], s[1], chunk);
+        close(s[0]);
+        close(s[1]);
+    }
+    for (size_t chunk : { 64, 4096, 65536 }) {
+        int s[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, s);
+        test("socketpair", s[0], s[1], chunk);
+        close(s[0]);
+        close(s[1]);
+    }
+    return 0;
+}
@@ -92,8 +92,17 @@ int main(int ac, char** av)
     report(r == 0, "poll() (no input on write end)");
 
 
-    // test atomic writes. Assumes our af_local_buffer size is 8192 bytes -
-    // if this changes we need to change this test!
+    r = fcntl(s[1], F_GETPIPE_SZ);
+    report(r == 65536, "default pipe size");
+    r = fcntl(s[1], F_SETPIPE_SZ, 5000);
+    report(r == 8192 && fcntl(s[0], F_GETPIPE_SZ) == 8192,
+            "set pipe size rounds up to power of two pages");
+    int notpipe = open("/", O_RDONLY);
+    r = fcntl(notpipe, F_SETPIPE_SZ, 8192);
+    report(r == -1 && errno == EBADF, "F_SETPIPE_SZ on a non-pipe");
+    close(notpipe);
+
+    // test atomic writes. Assumes our pipe size is 8192 bytes, as set above.
 #define TSTBUFSIZE 8192*3
     char *buf1 = (char *)calloc(1,TSTBUFSIZE);
     char *buf2 = (char *)calloc(1,TSTBUFSIZE);
@@ -213,6 +222,8 @@ int main(int ac, char** av)
     // test nonblocking
     r = pipe(s);
     report(r == 0, "pipe call");
+    r = fcntl(s[0], F_SETPIPE_SZ, 8192);
+    report(r == 8192, "set pipe size");
     r = fcntl(s[0], F_SETFL, O_NONBLOCK);
     report(r == 0, "set read side to nonblocking");
     memcpy(msg, "yoyoy", 5);
@@ -234,6 +245,10 @@ int main(int ac, char** av)
     report(r == (8192 - 10), "partial write to nonblocking pipe");
     r = write(s[1], buf1, TSTBUFSIZE);
     report(r == -1 && errno == EAGAIN, "write to full nonblocking pipe");
+    r = fcntl(s[0], F_SETPIPE_SZ, 4096);
+    report(r == -1 && errno == EBUSY, "can't shrink pipe below its contents");
+    r = fcntl(s[0], F_SETPIPE_SZ, 16384);
+    report(r == 16384, "grow a full pipe");
     r = read(s[0], buf1, TSTBUFSIZE);
     report(r == 8192, "read entire nonblocking pipe");
     free(buf1);
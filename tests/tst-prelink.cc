@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Prelink snapshots: malformed snapshot files are rejected as a whole, and
+// an object whose snapshot does not match is relocated from its file.
+
+#include "elf.hh"
+#include "align.hh"
+#include "debug.hh"
+#include <fs/fs.hh>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+// In this object's writable data, so a second copy of it shows whether its
+// data came from the file or from a snapshot
+extern "C" int prelink_test_marker = 0x12345678;
+
+struct snapshot_header {
+    char magic[8];
+    u64 nobjs;
+    u64 meta_size;
+};
+
+struct object_header {
+    char path[232];
+    u64 base;
+    u64 hash;
+    u32 nsegs;
+    u32 ndeferred;
+};
+
+static void write_file(const char* path, const void* data, size_t len)
+{
+    int fd = open(path, O_CREAT|O_TRUNC|O_WRONLY, 0666);
+    write(fd, data, len);
+    close(fd);
+}
+
+// A snapshot of one object with one segment, padded to @file_size
+static std::vector<char> make_snapshot(u64 nobjs, u64 meta_size,
+                                       elf::snapshot_segment seg,
+                                       size_t file_size)
+{
+    std::vector<char> buf(file_size);
+    snapshot_header hdr = { {'O','S','V','P','R','L','K','1'}, nobjs, meta_size };
+    object_header oh = {};
+    strcpy(oh.path, "/no/such/object.so");
+    oh.nsegs = 1;
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+    memcpy(buf.data() + sizeof(hdr), &oh, sizeof(oh));
+    memcpy(buf.data() + sizeof(hdr) + sizeof(oh), &seg, sizeof(seg));
+    return buf;
+}
+
+static void test_malformed()
+{
+    auto prog = elf::get_program();
+    const char* path = "/tmp/tst-prelink.snap";
+    const size_t meta = sizeof(object_header) + sizeof(elf::snapshot_segment);
+    elf::snapshot_segment seg = { 0, 4096, 4096 };
+
+    auto good = make_snapshot(1, meta, seg, 8192);
+    write_file(path, good.data(), good.size());
+    report(prog->load_snapshot(path), "well-formed snapshot accepted");
+
+    write_file(path, "OSVPRLK1", 8);
+    report(!prog->load_snapshot(path), "truncated header rejected");
+
+    auto bad = make_snapshot(1, 1 << 20, seg, 8192);
+    write_file(path, bad.data(), bad.size());
+    report(!prog->load_snapshot(path), "metadata beyond the file rejected");
+
+    bad = make_snapshot(1000, meta, seg, 8192);
+    write_file(path, bad.data(), bad.size());
+    report(!prog->load_snapshot(path), "object count beyond the metadata rejected");
+
+    bad = make_snapshot(1, meta, { 0, 4096, 1 << 20 }, 8192);
+    write_file(path, bad.data(), bad.size());
+    report(!prog->load_snapshot(path), "segment beyond the file rejected");
+
+    bad = make_snapshot(1, meta, { 0, 4096, 100 }, 8192);
+    write_file(path, bad.data(), bad.size());
+    report(!prog->load_snapshot(path), "misaligned segment rejected");
+
+    unlink(path);
+}
+
+static void test_mismatch()
+{
+    auto prog = elf::get_program();
+    const char* self = "/tests/tst-prelink.so";
+    const char* path = "/tmp/tst-prelink.snap";
+
+    // A copy of this object, at an address of its own, with a snapshot
+    // whose segments are all 0xff and whose hash matches nothing
+    auto obj = new elf::file(*prog, fileref_from_fname(self), self);
+    obj->set_base(reinterpret_cast<void*>(0x180000000000UL));
+    elf::snapshot_object snap;
+    snap.base = obj->base();
+    snap.hash = 0;
+    size_t len = 0;
+    for (auto& phdr : *obj->phdrs()) {
+        // writable (PF_W) segments
+        if (phdr.p_type == elf::PT_LOAD && (phdr.p_flags & 2)) {
+            auto vstart = align_down(phdr.p_vaddr, 4096UL);
+            auto size = align_up(phdr.p_vaddr + phdr.p_filesz, 4096UL) - vstart;
+            snap.segments.push_back({ vstart, size, 0 });
+            len = std::max<size_t>(len, size);
+        }
+    }
+    std::vector<char> junk(len, 0xff);
+    write_file(path, junk.data(), junk.size());
+    snap.file = fileref_from_fname(path);
+    obj->set_snapshot(&snap);
+
+    obj->load_segments();
+    report(*obj->lookup<int>("prelink_test_marker") == -1,
+           "snapshot segments mapped");
+    obj->relocate();
+    report(*obj->lookup<int>("prelink_test_marker") == 0x12345678,
+           "mismatched snapshot rejected, data read from the file");
+
+    obj->unload_segments();
+    delete obj;
+    unlink(path);
+}
+
+int main(int ac, char** av)
+{
+    test_malformed();
+    test_mismatch();
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
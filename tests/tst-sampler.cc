@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Profile a busy loop with the sampling cpu profiler, and check that it
+// dominates both output formats.
+
+#include <osv/sampler.hh>
+#include "drivers/clock.hh"
+#include "debug.hh"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+volatile unsigned long counter;
+
+extern "C" void __attribute__((noinline)) tst_sampler_spin(s64 ns)
+{
+    auto end = nanotime() + ns;
+    while (nanotime() < end) {
+        ++counter;
+    }
+}
+
+int main(int ac, char** av)
+{
+    const unsigned frequency = 1000;
+    cpu_sampler sampler(frequency);
+    auto start = nanotime();
+    sampler.start();
+    tst_sampler_spin(500000000);
+    sampler.stop();
+    auto elapsed = nanotime() - start;
+
+    FILE* f = fopen("/tmp/tst-sampler.folded", "w+");
+    sampler.write_folded(f);
+    rewind(f);
+    char line[4096];
+    unsigned total = 0, spin = 0;
+    while (fgets(line, sizeof(line), f)) {
+        auto count = strrchr(line, ' ');
+        if (!count) {
+            continue;
+        }
+        unsigned n = atoi(count + 1);
+        total += n;
+        *count = '\0';
+        if (strstr(line, "tst_sampler_spin")) {
+            spin += n;
+        }
+    }
+    fclose(f);
+    unlink("/tmp/tst-sampler.folded");
+    debug("%u samples in %d ms, %u in the loop\n", total, int(elapsed / 1000000), spin);
+    // at least one cpu ran the loop the whole time
+    report(spin >= elapsed / (1000000000 / frequency) / 2, "loop sampled");
+    report(spin * 2 > total / sched::cpus.size(), "loop dominates its cpu");
+
+    f = fopen("/tmp/tst-sampler.prof", "w+");
+    sampler.write_pprof(f);
+    rewind(f);
+    uintptr_t header[5];
+    report(fread(header, sizeof(header), 1, f) == 1 && header[0] == 0
+           && header[1] == 3 && header[3] == 1000000 / frequency,
+           "pprof header");
+    fclose(f);
+    unlink("/tmp/tst-sampler.prof");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Scheduler statistics: switch and wait accounting of threads sharing a
+// cpu, and the /dev/schedstat report.
+
+#include "sched.hh"
+#include "debug.hh"
+#include "drivers/clock.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+
+int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    debug("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+int main(int ac, char** av)
+{
+    auto c = sched::cpus[0];
+    const int yields = 1000;
+    // two threads yielding to each other on the same cpu
+    auto yielder = [] {
+        for (int i = 0; i < yields; i++) {
+            sched::thread::yield();
+        }
+    };
+    sched::thread t1(yielder, sched::thread::attr(c));
+    sched::thread t2(yielder, sched::thread::attr(c));
+    t1.start();
+    t2.start();
+    t1.join();
+    t2.join();
+    auto& s1 = t1.get_stats();
+    auto& s2 = t2.get_stats();
+    report(s1.involuntary_switches + s2.involuntary_switches >= yields,
+           "yields count as involuntary switches");
+    report(s1.waits > 0 && s1.wait_time > 0 && s1.max_wait > 0
+           && s1.max_wait <= s1.wait_time, "runqueue waits accounted");
+
+    sched::thread sleeper([] {
+        for (int i = 0; i < 10; i++) {
+            sched::thread::sleep_until(nanotime() + 1000000);
+        }
+    }, sched::thread::attr(c));
+    sleeper.start();
+    sleeper.join();
+    report(sleeper.get_stats().voluntary_switches >= 10,
+           "sleeps count as voluntary switches");
+
+    int fd = open("/dev/schedstat", O_RDONLY);
+    report(fd >= 0, "open /dev/schedstat");
+    std::string text;
+    char buf[1024];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        text.append(buf, n);
+    }
+    close(fd);
+    auto line = "thread" + std::to_string(t1.id()) + " ";
+    report(text.find("cpu0 ") != std::string::npos, "report lists cpus");
+    report(text.find(line) != std::string::npos, "report lists threads");
+
+    debug("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails == 0 ? 0 : 1;
+}
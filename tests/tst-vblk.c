@@ -7,12 +7,61 @@
 
 
 #include <fcntl.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #define BUF_SIZE	4096
+#define DIRECT_SIZE	(256 * 1024)
+
+/* Not in the linear map, so O_DIRECT has to bounce it */
+static char static_buf[DIRECT_SIZE];
+
+static int test_direct(int fd)
+{
+    char *buf = malloc(DIRECT_SIZE), *expect = malloc(DIRECT_SIZE);
+    int dfd = open("/dev/vblk0", O_RDWR | O_DIRECT);
+
+    if (dfd < 0) {
+        perror("open O_DIRECT");
+        return 1;
+    }
+    if (pread(fd, expect, DIRECT_SIZE, 0) != DIRECT_SIZE ||
+        pread(dfd, buf, DIRECT_SIZE, 0) != DIRECT_SIZE ||
+        memcmp(buf, expect, DIRECT_SIZE) != 0) {
+        fprintf(stderr, "O_DIRECT read differs\n");
+        return 1;
+    }
+    if (pread(dfd, static_buf, DIRECT_SIZE, 0) != DIRECT_SIZE ||
+        memcmp(static_buf, expect, DIRECT_SIZE) != 0) {
+        fprintf(stderr, "O_DIRECT bounced read differs\n");
+        return 1;
+    }
+    if (pread(dfd, buf, 100, 0) != -1 || errno != EINVAL) {
+        fprintf(stderr, "misaligned O_DIRECT read accepted\n");
+        return 1;
+    }
+
+    /* A direct write must not leave stale blocks in the buffer cache */
+    memset(buf, 0x5a, BUF_SIZE);
+    if (pwrite(dfd, buf, BUF_SIZE, 0) != BUF_SIZE ||
+        pread(fd, buf + BUF_SIZE, BUF_SIZE, 0) != BUF_SIZE ||
+        memcmp(buf, buf + BUF_SIZE, BUF_SIZE) != 0) {
+        fprintf(stderr, "O_DIRECT write not seen by buffered read\n");
+        return 1;
+    }
+    if (pwrite(dfd, expect, BUF_SIZE, 0) != BUF_SIZE) {
+        perror("pwrite origin");
+        return 1;
+    }
+
+    close(dfd);
+    free(buf);
+    free(expect);
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -65,6 +114,9 @@ int main(int argc, char **argv)
 
     }
 
+    if (test_direct(fd))
+        return 1;
+
     fprintf(stdout, "vblk test passed\n");
 
     close(fd);
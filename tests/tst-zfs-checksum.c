@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Cross-check the vectorized fletcher4 and SHA-256 checksums against the
+ * scalar reference implementations, for aligned and unaligned buffers of
+ * many sizes, and measure the single-core throughput of each.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <zfs_fletcher.h>
+#include <osv/debug.h>
+
+#define	BLOCKSIZE	SPA_MAXBLOCKSIZE
+#define	RUNTIME_NS	(500 * 1000 * 1000LL)
+
+static int fails;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return (rnd_state);
+}
+
+static void
+compare(const char *name, zio_checksum_t *ref, zio_checksum_t *func,
+    const char *buf, uint64_t size)
+{
+	zio_cksum_t a, b;
+
+	ref(buf, size, &a);
+	func(buf, size, &b);
+	if (!ZIO_CHECKSUM_EQUAL(a, b)) {
+		kprintf("FAIL: %s size %llu offset %d\n", name,
+		    (u_longlong_t)size, (int)((uintptr_t)buf & 63));
+		fails++;
+	}
+}
+
+static void
+bench(const char *name, zio_checksum_t *func, const char *buf)
+{
+	zio_cksum_t zc;
+	hrtime_t start, t;
+	uint64_t rounds = 0;
+
+	start = gethrtime();
+	do {
+		func(buf, BLOCKSIZE, &zc);
+		rounds++;
+	} while ((t = gethrtime() - start) < RUNTIME_NS);
+
+	kprintf("%-20s %8.1f MB/s\n", name,
+	    (double)BLOCKSIZE * rounds * 1000 / t);
+}
+
+int
+main(int argc, char **argv)
+{
+	/* SHA-256("abc"), as zio_checksum_SHA256() lays it out */
+	static const zio_cksum_t abc = {{
+		0xba7816bf8f01cfeaULL, 0x414140de5dae2223ULL,
+		0xb00361a396177a9cULL, 0xb410ff61f20015adULL,
+	}};
+	static const uint64_t sizes[] = { 0, 4, 8, 12, 16, 20, 28, 32, 36,
+	    52, 55, 56, 63, 64, 65, 100, 512, 4096, 4100, 8192, BLOCKSIZE };
+	zio_cksum_t zc;
+	char *buf;
+	int i, off;
+
+	buf = kmem_alloc(BLOCKSIZE + 64, KM_SLEEP);
+	for (i = 0; i < BLOCKSIZE + 64; i++)
+		buf[i] = rnd();
+
+	zio_checksum_SHA256("abc", 3, &zc);
+	if (!ZIO_CHECKSUM_EQUAL(zc, abc)) {
+		kprintf("FAIL: SHA-256 of \"abc\"\n");
+		fails++;
+	}
+
+	for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		for (off = 0; off < 64; off += 4) {
+			const char *p = buf + off;
+			uint64_t size = sizes[i];
+
+			compare("fletcher4", fletcher_4_scalar_native,
+			    fletcher_4_native, p, size);
+			compare("fletcher4 bswap", fletcher_4_scalar_byteswap,
+			    fletcher_4_byteswap, p, size);
+			compare("fletcher4 sse", fletcher_4_scalar_native,
+			    fletcher_4_sse_native, p, size);
+			compare("fletcher4 sse bswap",
+			    fletcher_4_scalar_byteswap,
+			    fletcher_4_sse_byteswap, p, size);
+			compare("sha256", zio_checksum_SHA256_scalar,
+			    zio_checksum_SHA256, p, size);
+		}
+	}
+
+	bench("fletcher4 scalar", fletcher_4_scalar_native, buf);
+	bench("fletcher4 sse", fletcher_4_sse_native, buf);
+	bench("fletcher4", fletcher_4_native, buf);
+	bench("fletcher4 bswap", fletcher_4_byteswap, buf);
+	bench("sha256 scalar", zio_checksum_SHA256_scalar, buf);
+	bench("sha256", zio_checksum_SHA256, buf);
+
+	kmem_free(buf, BLOCKSIZE + 64);
+
+	kprintf("SUMMARY: %d failures\n", fails);
+	return (fails != 0);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+/*
+ * Measure the single-core throughput and ratio of the ZFS compression
+ * algorithms on full-size blocks of log-like and JSON-like data, and check
+ * that every block decompresses back to its original contents.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/zio.h>
+#include <sys/zio_compress.h>
+#include <osv/debug.h>
+
+#define	NBLOCKS		64
+#define	BLOCKSIZE	SPA_MAXBLOCKSIZE
+#define	RUNTIME_NS	(1000 * 1000 * 1000LL)
+
+static int fails;
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return (rnd_state);
+}
+
+static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG" };
+static const char *paths[] = { "/api/v1/users", "/api/v1/orders",
+    "/static/app.js", "/healthz", "/api/v1/search" };
+
+static void
+fill_log(char *buf, size_t len)
+{
+	size_t off = 0;
+	uint64_t ts = 1380000000000ULL;
+
+	while (off < len) {
+		char line[256];
+		int n;
+
+		ts += rnd() % 1000;
+		n = snprintf(line, sizeof (line),
+		    "%llu.%03llu %s [worker-%d] GET %s?id=%llu 200 %llums\n",
+		    (u_longlong_t)(ts / 1000), (u_longlong_t)(ts % 1000),
+		    levels[rnd() % 5], (int)(rnd() % 16), paths[rnd() % 5],
+		    (u_longlong_t)(rnd() % 100000), (u_longlong_t)(rnd() % 500));
+		n = MIN(n, len - off);
+		bcopy(line, buf + off, n);
+		off += n;
+	}
+}
+
+static void
+fill_json(char *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (off < len) {
+		char rec[256];
+		int n;
+
+		n = snprintf(rec, sizeof (rec),
+		    "{\"id\":%llu,\"name\":\"user%llu\",\"active\":%s,"
+		    "\"score\":%llu.%02llu,\"tags\":[\"t%d\",\"t%d\"]},\n",
+		    (u_longlong_t)(rnd() % 1000000),
+		    (u_longlong_t)(rnd() % 10000),
+		    (rnd() & 1) ? "true" : "false",
+		    (u_longlong_t)(rnd() % 100), (u_longlong_t)(rnd() % 100),
+		    (int)(rnd() % 20), (int)(rnd() % 20));
+		n = MIN(n, len - off);
+		bcopy(rec, buf + off, n);
+		off += n;
+	}
+}
+
+static void
+bench(const char *dataname, char **src, enum zio_compress c)
+{
+	char *dst[NBLOCKS], *out;
+	size_t clen[NBLOCKS], total_in = 0, total_out = 0;
+	hrtime_t start, ctime, dtime;
+	uint64_t rounds = 0, i;
+	int b;
+
+	out = kmem_alloc(BLOCKSIZE, KM_SLEEP);
+	for (b = 0; b < NBLOCKS; b++)
+		dst[b] = kmem_alloc(BLOCKSIZE, KM_SLEEP);
+
+	start = gethrtime();
+	do {
+		for (b = 0; b < NBLOCKS; b++)
+			clen[b] = zio_compress_data(c, src[b], dst[b],
+			    BLOCKSIZE);
+		rounds++;
+	} while (gethrtime() - start < RUNTIME_NS);
+	ctime = gethrtime() - start;
+
+	for (b = 0; b < NBLOCKS; b++) {
+		total_in += BLOCKSIZE;
+		total_out += clen[b];
+		if (clen[b] == BLOCKSIZE)
+			continue;
+		if (zio_decompress_data(c, dst[b], out, clen[b],
+		    BLOCKSIZE) != 0 || bcmp(out, src[b], BLOCKSIZE) != 0) {
+			kprintf("FAIL: %s %s block %d\n", dataname,
+			    zio_compress_table[c].ci_name, b);
+			fails++;
+		}
+	}
+
+	start = gethrtime();
+	i = 0;
+	do {
+		for (b = 0; b < NBLOCKS; b++) {
+			if (clen[b] < BLOCKSIZE)
+				(void) zio_decompress_data(c, dst[b], out,
+				    clen[b], BLOCKSIZE);
+		}
+		i++;
+	} while (gethrtime() - start < RUNTIME_NS);
+	dtime = gethrtime() - start;
+
+	kprintf("%-5s %-7s ratio %5.2f  compress %7.1f MB/s  "
+	    "decompress %7.1f MB/s\n", dataname, zio_compress_table[c].ci_name,
+	    (double)total_in / total_out,
+	    (double)total_in * rounds * 1000 / ctime,
+	    (double)total_in * i * 1000 / dtime);
+
+	for (b = 0; b < NBLOCKS; b++)
+		kmem_free(dst[b], BLOCKSIZE);
+	kmem_free(out, BLOCKSIZE);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const enum zio_compress algs[] = {
+		ZIO_COMPRESS_LZJB, ZIO_COMPRESS_GZIP_1, ZIO_COMPRESS_GZIP_6,
+		ZIO_COMPRESS_ZLE, ZIO_COMPRESS_LZ4,
+	};
+	char *log[NBLOCKS], *json[NBLOCKS];
+	int a, b;
+
+	for (b = 0; b < NBLOCKS; b++) {
+		log[b] = kmem_alloc(BLOCKSIZE, KM_SLEEP);
+		fill_log(log[b], BLOCKSIZE);
+		json[b] = kmem_alloc(BLOCKSIZE, KM_SLEEP);
+		fill_json(json[b], BLOCKSIZE);
+	}
+
+	for (a = 0; a < sizeof (algs) / sizeof (algs[0]); a++)
+		bench("log", log, algs[a]);
+	for (a = 0; a < sizeof (algs) / sizeof (algs[0]); a++)
+		bench("json", json, algs[a]);
+
+	for (b = 0; b < NBLOCKS; b++) {
+		kmem_free(log[b], BLOCKSIZE);
+		kmem_free(json[b], BLOCKSIZE);
+	}
+
+	kprintf("SUMMARY: %d failures\n", fails);
+	return (fails != 0);
+}
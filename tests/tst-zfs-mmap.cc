@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2013 Cloudius Systems, Ltd.
+ *
+ * This work is open source software, licensed under the terms of the
+ * BSD license as described in the LICENSE file in the top-level directory.
+ */
+
+// Read-only mappings of ZFS files and sendfile() use the ARC buffers
+// directly instead of copying them; check that what they see matches
+// read(), and that writing to a private mapping does not reach the file.
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <vector>
+#include <chrono>
+
+static int tests = 0, fails = 0;
+
+static void report(bool ok, const char* msg)
+{
+    ++tests;
+    fails += !ok;
+    printf("%s: %s\n", (ok ? "PASS" : "FAIL"), msg);
+}
+
+static const char* path = "/usr/tst-zfs-mmap.dat";
+static constexpr size_t size = 4 << 20;
+
+static unsigned char pattern(size_t off)
+{
+    return (off / 4096) * 7 + off % 251;
+}
+
+static bool create_file()
+{
+    auto fd = open(path, O_CREAT|O_TRUNC|O_RDWR, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<unsigned char> buf(size);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = pattern(i);
+    }
+    bool ok = write(fd, buf.data(), size) == ssize_t(size) && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+static bool verify(const unsigned char* p, size_t off, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != pattern(off + i)) {
+            printf("mismatch at offset %zu\n", off + i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_mmap(int flags, size_t offset, size_t len)
+{
+    auto fd = open(path, O_RDONLY);
+    auto* p = static_cast<unsigned char*>(mmap(NULL, len, PROT_READ, flags, fd, offset));
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    bool ok = verify(p, offset, len);
+    return munmap(p, len) == 0 && ok;
+}
+
+static bool test_mprotect()
+{
+    auto fd = open(path, O_RDONLY);
+    auto* p = static_cast<unsigned char*>(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    if (mprotect(p, size, PROT_READ|PROT_WRITE) != 0) {
+        perror("mprotect");
+        return false;
+    }
+    bool ok = verify(p, 0, size);
+    memset(p + 8192, 0xaa, 65536);
+    ok = ok && p[8192] == 0xaa && p[8192 + 65535] == 0xaa && p[8191] == pattern(8191);
+    return munmap(p, size) == 0 && ok && test_mmap(MAP_PRIVATE, 0, size);
+}
+
+static bool test_sendfile(off_t start, size_t len, bool use_offset)
+{
+    int s[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s) != 0) {
+        perror("socketpair");
+        return false;
+    }
+    auto fd = open(path, O_RDONLY);
+    off_t off = start;
+    if (!use_offset) {
+        lseek(fd, start, SEEK_SET);
+    }
+    std::vector<unsigned char> buf(len);
+    size_t sent = 0, received = 0;
+    bool ok = true;
+    while (received < len && ok) {
+        if (sent < len) {
+            auto n = sendfile(s[0], fd, use_offset ? &off : nullptr,
+                              std::min(len - sent, size_t(32768)));
+            ok = n > 0;
+            sent += n;
+        }
+        auto n = read(s[1], buf.data() + received, len - received);
+        ok = ok && n > 0;
+        received += n;
+    }
+    ok = ok && verify(buf.data(), start, len);
+    if (use_offset) {
+        ok = ok && off == off_t(start + len) && lseek(fd, 0, SEEK_CUR) == 0;
+    } else {
+        ok = ok && lseek(fd, 0, SEEK_CUR) == off_t(start + len);
+    }
+    close(fd);
+    close(s[0]);
+    close(s[1]);
+    return ok;
+}
+
+static void bench()
+{
+    typedef std::chrono::high_resolution_clock clock;
+    auto fd = open(path, O_RDONLY);
+    std::vector<unsigned char> buf(size);
+    unsigned sum = 0;
+
+    auto start = clock::now();
+    for (int i = 0; i < 20; i++) {
+        pread(fd, buf.data(), size, 0);
+        sum += buf[i];
+    }
+    auto mid = clock::now();
+    for (int i = 0; i < 20; i++) {
+        auto* p = static_cast<unsigned char*>(mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        sum += p[i];
+        munmap(p, size);
+    }
+    auto end = clock::now();
+    close(fd);
+
+    auto us = [] (clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 20;
+    };
+    printf("read %lld us, mmap %lld us per %zu MB (%u)\n",
+           (long long)us(mid - start), (long long)us(end - mid), size >> 20, sum);
+}
+
+int main(int argc, char *argv[])
+{
+    report(create_file(), "create file");
+    report(test_mmap(MAP_PRIVATE, 0, size), "MAP_PRIVATE read-only mapping");
+    report(test_mmap(MAP_SHARED, 0, size), "MAP_SHARED read-only mapping");
+    report(test_mmap(MAP_PRIVATE, 1 << 20, 12288), "mapping at an offset");
+    report(test_mmap(MAP_PRIVATE, size - 4096, 4096), "mapping of the last page");
+    report(test_mprotect(), "write to private mapping after mprotect");
+    report(test_sendfile(0, size, true), "sendfile with offset");
+    report(test_sendfile(4096 * 3 + 100, 200000, true), "sendfile at unaligned offset");
+    report(test_sendfile(65536, 300000, false), "sendfile from file position");
+    bench();
+    report(unlink(path) == 0, "unlink");
+    printf("SUMMARY: %d tests, %d failures\n", tests, fails);
+    return fails != 0;
+}